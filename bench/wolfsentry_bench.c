@@ -0,0 +1,840 @@
+/*
+ * wolfsentry_bench.c
+ *
+ * Copyright (C) 2021-2023 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* microbenchmarks for the route engine.  each result is written to stdout as
+ * one JSON object per line, so that runs can be diffed across releases and
+ * build options.  see usage() for the knobs.
+ */
+
+#define _GNU_SOURCE
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_USER_BASE
+
+#include "wolfsentry/wolfsentry.h"
+#ifndef WOLFSENTRY_NO_JSON
+#include "wolfsentry/wolfsentry_json.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef WOLFSENTRY_THREADSAFE
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_EXIT_ON_FAILURE(...) do { wolfsentry_errcode_t _retval = (__VA_ARGS__); if (_retval < 0) { fprintf(stderr, "%s: " WOLFSENTRY_ERROR_FMT "\n", #__VA_ARGS__, WOLFSENTRY_ERROR_FMT_ARGS(_retval)); exit(1); }} while(0)
+#define BENCH_EXIT_ON_FALSE(...) do { if (! (__VA_ARGS__)) { fprintf(stderr, "%s should have been true, but was false.\n", #__VA_ARGS__); exit(1); }} while(0)
+
+struct bench_params {
+    unsigned int n_routes;
+    unsigned int prefix_min, prefix_max; /* remote address prefix lengths, uniformly distributed. */
+    unsigned int wildcard_pct; /* chance of each of proto, local address, and local port being wildcarded. */
+    unsigned int n_ports; /* size of the pool of local ports that routes and lookups draw from. */
+    unsigned int hit_pct; /* share of lookups aimed inside a generated route. */
+    unsigned int n_lookups;
+    unsigned int max_threads;
+    unsigned int n_churn;
+    unsigned int n_purge;
+    unsigned int json_reps;
+    uint64_t seed;
+    const char *label;
+};
+
+static struct bench_params params = {
+    10000, /* n_routes */
+    8, 32, /* prefix_min, prefix_max */
+    20, /* wildcard_pct */
+    16, /* n_ports */
+    80, /* hit_pct */
+    200000, /* n_lookups */
+    0, /* max_threads -- 0 means the number of online CPUs. */
+    100000, /* n_churn */
+    10000, /* n_purge */
+    5, /* json_reps */
+    1, /* seed */
+    "" /* label */
+};
+
+/* one generated rule or probe, IPv4 only. */
+struct bench_route {
+    byte remote_addr[4];
+    byte local_addr[4];
+    wolfsentry_addr_bits_t remote_bits;
+    wolfsentry_port_t local_port;
+    wolfsentry_route_flags_t flags;
+};
+
+struct bench_sockaddr {
+    struct wolfsentry_sockaddr sa;
+    byte addr_buf[4];
+};
+
+static uint64_t bench_rng_state;
+
+/* xorshift64* -- deterministic for a given --seed, so rulesets are
+ * reproducible across builds being compared.
+ */
+static uint64_t bench_rand(void) {
+    bench_rng_state ^= bench_rng_state >> 12;
+    bench_rng_state ^= bench_rng_state << 25;
+    bench_rng_state ^= bench_rng_state >> 27;
+    return bench_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned int bench_rand_below(unsigned int n) {
+    return (unsigned int)((bench_rand() >> 32) % n);
+}
+
+static int bench_rand_pct(unsigned int pct) {
+    return bench_rand_below(100) < pct;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double bench_seconds_since(uint64_t start_ns) {
+    return (double)(bench_now_ns() - start_ns) / 1e9;
+}
+
+static void bench_emit_start(const char *bench) {
+    printf("{\"bench\":\"%s\",\"label\":\"%s\",\"version\":\"%d.%d.%d\",\"seed\":%llu",
+           bench,
+           params.label,
+           WOLFSENTRY_VERSION_MAJOR, WOLFSENTRY_VERSION_MINOR, WOLFSENTRY_VERSION_TINY,
+           (unsigned long long)params.seed);
+}
+
+static void bench_emit_end(void) {
+    printf("}\n");
+    fflush(stdout);
+}
+
+static const wolfsentry_port_t bench_port_pool[] = {
+    22, 25, 53, 80, 110, 123, 143, 389, 443, 465, 587, 636, 993, 995, 1194, 1433,
+    1521, 1883, 2049, 3306, 3389, 5060, 5222, 5432, 5671, 5900, 6379, 8080, 8443, 8883, 9000, 9200
+};
+
+static wolfsentry_port_t bench_pick_port(void) {
+    unsigned int n = params.n_ports;
+    if ((n == 0) || (n > sizeof bench_port_pool / sizeof bench_port_pool[0]))
+        n = sizeof bench_port_pool / sizeof bench_port_pool[0];
+    return bench_port_pool[bench_rand_below(n)];
+}
+
+static void bench_random_addr(byte addr[4]) {
+    uint32_t a = (uint32_t)(bench_rand() >> 32);
+    addr[0] = (byte)(a >> 24);
+    addr[1] = (byte)(a >> 16);
+    addr[2] = (byte)(a >> 8);
+    addr[3] = (byte)a;
+}
+
+/* the ruleset generator.  remote addresses are random prefixes with lengths
+ * uniform over [prefix_min, prefix_max], local addresses come from a /24, and
+ * each of proto, local address, and local port is independently wildcarded
+ * with probability wildcard_pct.  remote ports are always wildcarded, as they
+ * would be for a server-side ruleset.
+ */
+static void bench_generate_ruleset(struct bench_route *routes, unsigned int n_routes) {
+    unsigned int i;
+    for (i = 0; i < n_routes; ++i) {
+        struct bench_route *r = &routes[i];
+        unsigned int bits = params.prefix_min + bench_rand_below(params.prefix_max - params.prefix_min + 1);
+        unsigned int j;
+
+        bench_random_addr(r->remote_addr);
+        for (j = bits; j < 32; ++j)
+            r->remote_addr[j >> 3] &= (byte)~(0x80U >> (j & 7));
+        r->remote_bits = (wolfsentry_addr_bits_t)bits;
+        r->local_addr[0] = 192;
+        r->local_addr[1] = 0;
+        r->local_addr[2] = 2;
+        r->local_addr[3] = (byte)bench_rand_below(256);
+        r->local_port = bench_pick_port();
+
+        r->flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+            WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS;
+        if (bench_rand_pct(params.wildcard_pct))
+            r->flags |= WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD;
+        else if (bench_rand_pct(params.wildcard_pct))
+            r->flags |= WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD;
+        if (bench_rand_pct(params.wildcard_pct))
+            r->flags |= WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD;
+        r->flags |= bench_rand_pct(50) ? WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED : WOLFSENTRY_ROUTE_FLAG_GREENLISTED;
+    }
+}
+
+/* probes are full /32 addresses -- hit_pct of them fall inside a generated
+ * route, the rest are random and mostly end up on the fallthrough.
+ */
+static void bench_generate_probes(const struct bench_route *routes, unsigned int n_routes, struct bench_route *probes, unsigned int n_probes) {
+    unsigned int i;
+    for (i = 0; i < n_probes; ++i) {
+        struct bench_route *p = &probes[i];
+        if ((n_routes > 0) && bench_rand_pct(params.hit_pct)) {
+            const struct bench_route *r = &routes[bench_rand_below(n_routes)];
+            byte host[4];
+            unsigned int j;
+            bench_random_addr(host);
+            for (j = 0; j < 4; ++j) {
+                unsigned int keep = r->remote_bits >= (j + 1) * 8 ? 8 : (r->remote_bits > j * 8 ? r->remote_bits - j * 8 : 0);
+                byte mask = (byte)(0xffU << (8 - keep));
+                p->remote_addr[j] = (byte)((r->remote_addr[j] & mask) | (host[j] & (byte)~mask));
+            }
+            memcpy(p->local_addr, r->local_addr, sizeof p->local_addr);
+            p->local_port = (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD) ? bench_pick_port() : r->local_port;
+        } else {
+            bench_random_addr(p->remote_addr);
+            p->local_addr[0] = 192;
+            p->local_addr[1] = 0;
+            p->local_addr[2] = 2;
+            p->local_addr[3] = (byte)bench_rand_below(256);
+            p->local_port = bench_pick_port();
+        }
+        p->remote_bits = 32;
+        p->flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS;
+    }
+}
+
+static void bench_route_to_sockaddrs(const struct bench_route *r, struct bench_sockaddr *remote, struct bench_sockaddr *local, wolfsentry_port_t remote_port) {
+    memset(remote, 0, sizeof *remote);
+    memset(local, 0, sizeof *local);
+    remote->sa.sa_family = local->sa.sa_family = AF_INET;
+    remote->sa.sa_proto = local->sa.sa_proto = IPPROTO_TCP;
+    remote->sa.sa_port = remote_port;
+    local->sa.sa_port = r->local_port;
+    remote->sa.addr_len = r->remote_bits;
+    local->sa.addr_len = (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD) ? 0 : 32;
+    memcpy(remote->sa.addr, r->remote_addr, sizeof r->remote_addr);
+    memcpy(local->sa.addr, r->local_addr, sizeof r->local_addr);
+}
+
+static void bench_context_new(
+#ifdef WOLFSENTRY_THREADSAFE
+    struct wolfsentry_thread_context *thread,
+#endif
+    struct wolfsentry_context **wolfsentry)
+{
+    struct wolfsentry_eventconfig config;
+    memset(&config, 0, sizeof config);
+    config.max_connection_count = 10;
+    config.penaltybox_duration = 1;
+    BENCH_EXIT_ON_FAILURE(
+        wolfsentry_init(
+            wolfsentry_build_settings,
+            WOLFSENTRY_CONTEXT_ARGS_OUT_EX(NULL /* hpi */),
+            &config,
+            wolfsentry));
+}
+
+/* inserts the ruleset, compacting out generated duplicates so that routes[0 ..
+ * return value) is exactly what the table holds.
+ */
+static unsigned int bench_load_ruleset(WOLFSENTRY_CONTEXT_ARGS_IN, struct bench_route *routes, unsigned int n_routes) {
+    unsigned int i, n_inserted = 0;
+    for (i = 0; i < n_routes; ++i) {
+        struct bench_sockaddr remote, local;
+        wolfsentry_ent_id_t id;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_errcode_t ret;
+
+        bench_route_to_sockaddrs(&routes[i], &remote, &local, 0);
+        ret = wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, routes[i].flags, NULL /* event_label */, 0 /* event_label_len */, &id, &action_results);
+        if (WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT))
+            continue;
+        BENCH_EXIT_ON_FAILURE(ret);
+        if (n_inserted != i)
+            routes[n_inserted] = routes[i];
+        ++n_inserted;
+    }
+    return n_inserted;
+}
+
+static int bench_uint64_cmp(const void *a, const void *b) {
+    uint64_t a_i = *(const uint64_t *)a, b_i = *(const uint64_t *)b;
+    return (a_i > b_i) - (a_i < b_i);
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, size_t n, unsigned int per_mille) {
+    size_t i = (n * per_mille) / 1000;
+    if (i >= n)
+        i = n - 1;
+    return sorted[i];
+}
+
+static void bench_dispatch_latency(WOLFSENTRY_CONTEXT_ARGS_IN, const struct bench_route *probes, unsigned int n_probes, unsigned int n_routes) {
+    uint64_t *samples = (uint64_t *)malloc(sizeof *samples * n_probes);
+    uint64_t total = 0;
+    unsigned int i, n_hits = 0;
+
+    BENCH_EXIT_ON_FALSE(samples != NULL);
+
+    /* warm the caches and any lazily built structures before sampling. */
+    for (i = 0; i < n_probes && i < 1000; ++i) {
+        struct bench_sockaddr remote, local;
+        wolfsentry_ent_id_t id;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_action_res_t action_results;
+        bench_route_to_sockaddrs(&probes[i], &remote, &local, 40000);
+        (void)wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, probes[i].flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &id, &inexact_matches, &action_results);
+    }
+
+    for (i = 0; i < n_probes; ++i) {
+        struct bench_sockaddr remote, local;
+        wolfsentry_ent_id_t id;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_errcode_t ret;
+        uint64_t t0;
+
+        bench_route_to_sockaddrs(&probes[i], &remote, &local, (wolfsentry_port_t)(32768U + (i & 0x7fffU)));
+        t0 = bench_now_ns();
+        ret = wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, probes[i].flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &id, &inexact_matches, &action_results);
+        samples[i] = bench_now_ns() - t0;
+        BENCH_EXIT_ON_FAILURE(ret);
+        if (! WOLFSENTRY_SUCCESS_CODE_IS(ret, USED_FALLBACK))
+            ++n_hits;
+        total += samples[i];
+    }
+
+    qsort(samples, n_probes, sizeof *samples, bench_uint64_cmp);
+
+    bench_emit_start("dispatch_latency");
+    printf(",\"routes\":%u,\"lookups\":%u,\"matched\":%u,\"mean_ns\":%.1f,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+           n_routes,
+           n_probes,
+           n_hits,
+           (double)total / (double)n_probes,
+           (unsigned long long)bench_percentile(samples, n_probes, 500),
+           (unsigned long long)bench_percentile(samples, n_probes, 900),
+           (unsigned long long)bench_percentile(samples, n_probes, 990),
+           (unsigned long long)bench_percentile(samples, n_probes, 999),
+           (unsigned long long)samples[n_probes - 1]);
+    bench_emit_end();
+
+    free(samples);
+}
+
+#ifdef WOLFSENTRY_THREADSAFE
+
+struct bench_thread_args {
+    struct wolfsentry_context *wolfsentry;
+    const struct bench_route *probes;
+    unsigned int n_probes;
+    unsigned int offset;
+    pthread_barrier_t *start_barrier;
+    wolfsentry_errcode_t ret;
+};
+
+static void *bench_dispatch_thread(void *arg) {
+    struct bench_thread_args *args = (struct bench_thread_args *)arg;
+    struct wolfsentry_context *wolfsentry = args->wolfsentry;
+    unsigned int i;
+    WOLFSENTRY_THREAD_HEADER_DECLS
+
+    if (WOLFSENTRY_THREAD_HEADER_INIT(WOLFSENTRY_THREAD_FLAG_NONE) < 0) {
+        args->ret = _thread_context_ret;
+        return NULL;
+    }
+
+    (void)pthread_barrier_wait(args->start_barrier);
+
+    for (i = 0; i < args->n_probes; ++i) {
+        const struct bench_route *p = &args->probes[(i + args->offset) % args->n_probes];
+        struct bench_sockaddr remote, local;
+        wolfsentry_ent_id_t id;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_errcode_t ret;
+
+        bench_route_to_sockaddrs(p, &remote, &local, (wolfsentry_port_t)(32768U + (i & 0x7fffU)));
+        ret = wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, p->flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &id, &inexact_matches, &action_results);
+        if (ret < 0) {
+            args->ret = ret;
+            break;
+        }
+    }
+
+    if (WOLFSENTRY_THREAD_TAILER(WOLFSENTRY_THREAD_FLAG_NONE) < 0)
+        args->ret = _thread_context_ret;
+    return NULL;
+}
+
+/* each thread runs the full probe set, starting at its own offset, so the
+ * work per thread is constant and ideal scaling is a linear rise in ops/s.
+ */
+static void bench_dispatch_throughput(struct wolfsentry_context *wolfsentry, const struct bench_route *probes, unsigned int n_probes, unsigned int n_routes) {
+    unsigned int max_threads = params.max_threads, n_threads;
+
+    if (max_threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = n_cpus > 0 ? (unsigned int)n_cpus : 1U;
+    }
+
+    for (n_threads = 1; ; n_threads = (n_threads * 2 > max_threads && n_threads < max_threads) ? max_threads : n_threads * 2) {
+        pthread_t *threads = (pthread_t *)malloc(sizeof *threads * n_threads);
+        struct bench_thread_args *args = (struct bench_thread_args *)malloc(sizeof *args * n_threads);
+        pthread_barrier_t start_barrier;
+        uint64_t t0;
+        double elapsed;
+        unsigned int i;
+
+        BENCH_EXIT_ON_FALSE((threads != NULL) && (args != NULL));
+        BENCH_EXIT_ON_FALSE(pthread_barrier_init(&start_barrier, NULL, n_threads + 1) == 0);
+
+        for (i = 0; i < n_threads; ++i) {
+            args[i].wolfsentry = wolfsentry;
+            args[i].probes = probes;
+            args[i].n_probes = n_probes;
+            args[i].offset = (n_probes / n_threads) * i;
+            args[i].start_barrier = &start_barrier;
+            args[i].ret = 0;
+            BENCH_EXIT_ON_FALSE(pthread_create(&threads[i], NULL, bench_dispatch_thread, &args[i]) == 0);
+        }
+
+        (void)pthread_barrier_wait(&start_barrier);
+        t0 = bench_now_ns();
+        for (i = 0; i < n_threads; ++i)
+            BENCH_EXIT_ON_FALSE(pthread_join(threads[i], NULL) == 0);
+        elapsed = bench_seconds_since(t0);
+
+        for (i = 0; i < n_threads; ++i)
+            BENCH_EXIT_ON_FAILURE(args[i].ret);
+
+        bench_emit_start("dispatch_throughput");
+        printf(",\"routes\":%u,\"threads\":%u,\"ops\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+               n_routes,
+               n_threads,
+               (unsigned long long)n_probes * n_threads,
+               elapsed,
+               (double)n_probes * (double)n_threads / elapsed);
+        bench_emit_end();
+
+        (void)pthread_barrier_destroy(&start_barrier);
+        free(threads);
+        free(args);
+
+        if (n_threads >= max_threads)
+            break;
+    }
+}
+
+#endif /* WOLFSENTRY_THREADSAFE */
+
+/* insert/delete churn against a populated table -- each op inserts a fresh
+ * /32 and deletes the one inserted 64 ops earlier, so the table size stays
+ * constant while the indexes are continually reshaped.
+ */
+static void bench_churn(WOLFSENTRY_CONTEXT_ARGS_IN, unsigned int n_routes) {
+#define BENCH_CHURN_WINDOW 64U
+    struct bench_route window[BENCH_CHURN_WINDOW];
+    int live[BENCH_CHURN_WINDOW];
+    unsigned int i, n_ops = params.n_churn;
+    uint64_t t0;
+    double elapsed;
+
+    memset(window, 0, sizeof window);
+    memset(live, 0, sizeof live);
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n_ops + BENCH_CHURN_WINDOW; ++i) {
+        struct bench_route *r = &window[i % BENCH_CHURN_WINDOW];
+        struct bench_sockaddr remote, local;
+        wolfsentry_action_res_t action_results;
+
+        if (live[i % BENCH_CHURN_WINDOW]) {
+            int n_deleted = 0;
+            bench_route_to_sockaddrs(r, &remote, &local, 0);
+            BENCH_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, r->flags, NULL /* trigger_label */, 0 /* trigger_label_len */, &action_results, &n_deleted));
+            live[i % BENCH_CHURN_WINDOW] = 0;
+        }
+        if (i < n_ops) {
+            wolfsentry_ent_id_t id;
+            wolfsentry_errcode_t ret;
+            /* the counter makes each churned route unique. */
+            r->remote_addr[0] = 10;
+            r->remote_addr[1] = (byte)(i >> 16);
+            r->remote_addr[2] = (byte)(i >> 8);
+            r->remote_addr[3] = (byte)i;
+            r->remote_bits = 32;
+            r->local_addr[0] = 192;
+            r->local_addr[1] = 0;
+            r->local_addr[2] = 2;
+            r->local_addr[3] = 1;
+            r->local_port = 443;
+            r->flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+                WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS |
+                WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+            bench_route_to_sockaddrs(r, &remote, &local, 0);
+            ret = wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, r->flags, NULL /* event_label */, 0 /* event_label_len */, &id, &action_results);
+            if (WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT))
+                continue; /* collided with the generated ruleset -- leave it be. */
+            BENCH_EXIT_ON_FAILURE(ret);
+            live[i % BENCH_CHURN_WINDOW] = 1;
+        }
+    }
+    elapsed = bench_seconds_since(t0);
+
+    bench_emit_start("churn");
+    printf(",\"routes\":%u,\"ops\":%u,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+           n_routes,
+           n_ops,
+           elapsed,
+           (double)n_ops / elapsed);
+    bench_emit_end();
+#undef BENCH_CHURN_WINDOW
+}
+
+/* stale_purge throughput -- routes are inserted with strictly increasing
+ * purge_after times a second out (so the purge list insertions stay cheap and
+ * the measurement isolates the purge itself), then once they've all expired,
+ * purged in one call.
+ */
+static void bench_stale_purge(WOLFSENTRY_CONTEXT_ARGS_IN) {
+    struct wolfsentry_route_table *main_routes;
+    wolfsentry_action_res_t action_results;
+    unsigned int i, n_routes = params.n_purge;
+    wolfsentry_time_t idle, now, last_purge_after = 0;
+    uint64_t t0;
+    double elapsed;
+
+    BENCH_EXIT_ON_FAILURE(wolfsentry_interval_from_seconds(wolfsentry, 1, 0, &idle));
+
+    BENCH_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+    BENCH_EXIT_ON_FAILURE(wolfsentry_route_get_main_table(WOLFSENTRY_CONTEXT_ARGS_OUT, &main_routes));
+    BENCH_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+    for (i = 0; i < n_routes; ++i) {
+        struct wolfsentry_route_exports route_exports;
+        byte remote_addr[4], local_addr[4];
+        wolfsentry_ent_id_t id;
+
+        remote_addr[0] = 172;
+        remote_addr[1] = (byte)(16U + ((i >> 16) & 0xfU));
+        remote_addr[2] = (byte)(i >> 8);
+        remote_addr[3] = (byte)i;
+        local_addr[0] = 192;
+        local_addr[1] = 0;
+        local_addr[2] = 2;
+        local_addr[3] = 1;
+
+        memset(&route_exports, 0, sizeof route_exports);
+        route_exports.flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+            WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS |
+            WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+        route_exports.sa_family = AF_INET;
+        route_exports.sa_proto = IPPROTO_TCP;
+        route_exports.remote.addr_len = 32;
+        route_exports.local.addr_len = 32;
+        route_exports.remote_address = remote_addr;
+        route_exports.local_address = local_addr;
+        BENCH_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &now));
+        route_exports.meta.purge_after = now + idle + (wolfsentry_time_t)i;
+        last_purge_after = route_exports.meta.purge_after;
+
+        BENCH_EXIT_ON_FAILURE(wolfsentry_route_insert_by_exports_into_table(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, NULL /* caller_arg */, &route_exports, &id, &action_results));
+    }
+
+    for (;;) {
+        struct timespec ts = { 0, 10000000 };
+        BENCH_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &now));
+        if (now > last_purge_after)
+            break;
+        (void)nanosleep(&ts, NULL);
+    }
+
+    t0 = bench_now_ns();
+    BENCH_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &action_results));
+    elapsed = bench_seconds_since(t0);
+
+    bench_emit_start("stale_purge");
+    printf(",\"routes\":%u,\"seconds\":%.6f,\"routes_per_sec\":%.0f",
+           n_routes,
+           elapsed,
+           (double)n_routes / elapsed);
+    bench_emit_end();
+}
+
+#ifndef WOLFSENTRY_NO_JSON
+
+static size_t bench_format_ruleset_json(const struct bench_route *routes, unsigned int n_routes, char **json) {
+    size_t json_size = 128 + (size_t)n_routes * 384, json_len = 0;
+    unsigned int i;
+
+    *json = (char *)malloc(json_size);
+    BENCH_EXIT_ON_FALSE(*json != NULL);
+
+    json_len += (size_t)snprintf(*json + json_len, json_size - json_len, "{\"wolfsentry-config-version\":1,\n\"static-routes-insert\":[\n");
+    for (i = 0; i < n_routes; ++i) {
+        const struct bench_route *r = &routes[i];
+        int len = snprintf(*json + json_len, json_size - json_len,
+                           "%s{\"direction-in\":true,\"tcplike-port-numbers\":true,\"%s\":true,\"family\":\"inet\",%s"
+                           "\"remote\":{\"address\":\"%u.%u.%u.%u\",\"prefix-bits\":%u},"
+                           "\"local\":{",
+                           i > 0 ? ",\n" : "",
+                           (r->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) ? "penalty-boxed" : "green-listed",
+                           (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) ? "" : "\"protocol\":6,",
+                           r->remote_addr[0], r->remote_addr[1], r->remote_addr[2], r->remote_addr[3],
+                           (unsigned int)r->remote_bits);
+        BENCH_EXIT_ON_FALSE((len > 0) && ((size_t)len < json_size - json_len));
+        json_len += (size_t)len;
+        if (! (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) {
+            len = snprintf(*json + json_len, json_size - json_len, "\"address\":\"%u.%u.%u.%u\"%s",
+                           r->local_addr[0], r->local_addr[1], r->local_addr[2], r->local_addr[3],
+                           (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD) ? "" : ",");
+            BENCH_EXIT_ON_FALSE((len > 0) && ((size_t)len < json_size - json_len));
+            json_len += (size_t)len;
+        }
+        if (! (r->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)) {
+            len = snprintf(*json + json_len, json_size - json_len, "\"port\":%u", (unsigned int)r->local_port);
+            BENCH_EXIT_ON_FALSE((len > 0) && ((size_t)len < json_size - json_len));
+            json_len += (size_t)len;
+        }
+        len = snprintf(*json + json_len, json_size - json_len, "}}");
+        BENCH_EXIT_ON_FALSE((len > 0) && ((size_t)len < json_size - json_len));
+        json_len += (size_t)len;
+    }
+    BENCH_EXIT_ON_FALSE(json_size - json_len > 8);
+    json_len += (size_t)snprintf(*json + json_len, json_size - json_len, "\n]}\n");
+
+    return json_len;
+}
+
+/* JSON load time for the generated ruleset, best of json_reps fresh loads. */
+static void bench_json_load(
+#ifdef WOLFSENTRY_THREADSAFE
+    struct wolfsentry_thread_context *thread,
+#endif
+    const struct bench_route *routes,
+    unsigned int n_routes)
+{
+    char *json;
+    size_t json_len = bench_format_ruleset_json(routes, n_routes, &json);
+    double best = 0.0;
+    unsigned int rep;
+
+    for (rep = 0; rep < (params.json_reps ? params.json_reps : 1); ++rep) {
+        struct wolfsentry_context *wolfsentry;
+        char err_buf[512];
+        wolfsentry_errcode_t ret;
+        uint64_t t0;
+        double elapsed;
+
+        bench_context_new(
+#ifdef WOLFSENTRY_THREADSAFE
+            thread,
+#endif
+            &wolfsentry);
+
+        t0 = bench_now_ns();
+        ret = wolfsentry_config_json_oneshot(WOLFSENTRY_CONTEXT_ARGS_OUT, (const unsigned char *)json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf);
+        elapsed = bench_seconds_since(t0);
+        if (ret < 0) {
+            fprintf(stderr, "json load failed: %s\n", err_buf);
+            exit(1);
+        }
+        if ((rep == 0) || (elapsed < best))
+            best = elapsed;
+
+        BENCH_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&wolfsentry)));
+    }
+
+    bench_emit_start("json_load");
+    printf(",\"routes\":%u,\"bytes\":%zu,\"seconds\":%.6f,\"routes_per_sec\":%.0f",
+           n_routes,
+           json_len,
+           best,
+           (double)n_routes / best);
+    bench_emit_end();
+
+    free(json);
+}
+
+#endif /* !WOLFSENTRY_NO_JSON */
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "usage: %s [options] [bench ...]\n"
+            "benches: dispatch_latency dispatch_throughput churn json_load stale_purge (default: all)\n"
+            "options:\n"
+            "  --routes N          generated ruleset size (%u)\n"
+            "  --prefix-min B      shortest remote prefix (%u)\n"
+            "  --prefix-max B      longest remote prefix (%u)\n"
+            "  --wildcard-pct P    chance of each wildcarded field (%u)\n"
+            "  --ports N           local port pool size, max 32 (%u)\n"
+            "  --hit-pct P         lookups aimed inside a route (%u)\n"
+            "  --lookups N         dispatches per latency/throughput run (%u)\n"
+            "  --threads N         max threads for dispatch_throughput, 0 for all CPUs (%u)\n"
+            "  --churn N           insert/delete pairs (%u)\n"
+            "  --purge N           routes for stale_purge (%u)\n"
+            "  --json-reps N       JSON load repetitions, best is reported (%u)\n"
+            "  --seed S            generator seed (%llu)\n"
+            "  --label L           free-form tag copied into every record\n",
+            progname,
+            params.n_routes, params.prefix_min, params.prefix_max, params.wildcard_pct, params.n_ports,
+            params.hit_pct, params.n_lookups, params.max_threads, params.n_churn, params.n_purge,
+            params.json_reps, (unsigned long long)params.seed);
+    exit(1);
+}
+
+static int bench_selected(char **benches, int n_benches, const char *name) {
+    int i;
+    if (n_benches == 0)
+        return 1;
+    for (i = 0; i < n_benches; ++i) {
+        if (! strcmp(benches[i], name))
+            return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct wolfsentry_context *wolfsentry;
+    struct bench_route *routes, *probes;
+    unsigned int n_inserted;
+    char **benches = NULL;
+    int n_benches = 0;
+    int i;
+    WOLFSENTRY_THREAD_HEADER_CHECKED(WOLFSENTRY_THREAD_FLAG_NONE);
+
+    for (i = 1; i < argc; ++i) {
+        unsigned int *uint_param = NULL;
+        if (! strcmp(argv[i], "--routes"))
+            uint_param = &params.n_routes;
+        else if (! strcmp(argv[i], "--prefix-min"))
+            uint_param = &params.prefix_min;
+        else if (! strcmp(argv[i], "--prefix-max"))
+            uint_param = &params.prefix_max;
+        else if (! strcmp(argv[i], "--wildcard-pct"))
+            uint_param = &params.wildcard_pct;
+        else if (! strcmp(argv[i], "--ports"))
+            uint_param = &params.n_ports;
+        else if (! strcmp(argv[i], "--hit-pct"))
+            uint_param = &params.hit_pct;
+        else if (! strcmp(argv[i], "--lookups"))
+            uint_param = &params.n_lookups;
+        else if (! strcmp(argv[i], "--threads"))
+            uint_param = &params.max_threads;
+        else if (! strcmp(argv[i], "--churn"))
+            uint_param = &params.n_churn;
+        else if (! strcmp(argv[i], "--purge"))
+            uint_param = &params.n_purge;
+        else if (! strcmp(argv[i], "--json-reps"))
+            uint_param = &params.json_reps;
+        else if (! strcmp(argv[i], "--seed")) {
+            if (++i == argc)
+                usage(argv[0]);
+            params.seed = strtoull(argv[i], NULL, 0);
+            continue;
+        } else if (! strcmp(argv[i], "--label")) {
+            if (++i == argc)
+                usage(argv[0]);
+            params.label = argv[i];
+            continue;
+        } else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else {
+            if (benches == NULL)
+                benches = &argv[i];
+            ++n_benches;
+            continue;
+        }
+        if (++i == argc)
+            usage(argv[0]);
+        *uint_param = (unsigned int)strtoul(argv[i], NULL, 0);
+    }
+
+    /* benches must be the trailing arguments. */
+    if ((benches != NULL) && (benches + n_benches != argv + argc))
+        usage(argv[0]);
+
+    if ((params.prefix_min > params.prefix_max) || (params.prefix_max > 32) || (params.n_lookups == 0))
+        usage(argv[0]);
+
+    bench_rng_state = params.seed ? params.seed : 1;
+
+    routes = (struct bench_route *)malloc(sizeof *routes * (params.n_routes ? params.n_routes : 1));
+    probes = (struct bench_route *)malloc(sizeof *probes * params.n_lookups);
+    BENCH_EXIT_ON_FALSE((routes != NULL) && (probes != NULL));
+
+    bench_generate_ruleset(routes, params.n_routes);
+    bench_generate_probes(routes, params.n_routes, probes, params.n_lookups);
+
+    bench_context_new(
+#ifdef WOLFSENTRY_THREADSAFE
+        thread,
+#endif
+        &wolfsentry);
+    n_inserted = bench_load_ruleset(WOLFSENTRY_CONTEXT_ARGS_OUT, routes, params.n_routes);
+
+    if (bench_selected(benches, n_benches, "dispatch_latency"))
+        bench_dispatch_latency(WOLFSENTRY_CONTEXT_ARGS_OUT, probes, params.n_lookups, n_inserted);
+
+#ifdef WOLFSENTRY_THREADSAFE
+    if (bench_selected(benches, n_benches, "dispatch_throughput"))
+        bench_dispatch_throughput(wolfsentry, probes, params.n_lookups, n_inserted);
+#endif
+
+    if (bench_selected(benches, n_benches, "churn"))
+        bench_churn(WOLFSENTRY_CONTEXT_ARGS_OUT, n_inserted);
+
+    if (bench_selected(benches, n_benches, "stale_purge"))
+        bench_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT);
+
+    BENCH_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&wolfsentry)));
+
+#ifndef WOLFSENTRY_NO_JSON
+    if (bench_selected(benches, n_benches, "json_load"))
+        bench_json_load(
+#ifdef WOLFSENTRY_THREADSAFE
+            thread,
+#endif
+            routes,
+            n_inserted);
+#endif
+
+    BENCH_EXIT_ON_FAILURE(WOLFSENTRY_THREAD_TAILER(WOLFSENTRY_THREAD_FLAG_NONE));
+
+    free(routes);
+    free(probes);
+
+    return 0;
+}
@@ -48,6 +48,11 @@ static int wolfsentry_action_key_cmp(const struct wolfsentry_table_ent_header *l
         ((const struct wolfsentry_action *)right)->label_len);
 }
 
+static void wolfsentry_action_label(const struct wolfsentry_table_ent_header *action, const char **label, unsigned int *label_len) {
+    *label = ((const struct wolfsentry_action *)action)->label;
+    *label_len = ((const struct wolfsentry_action *)action)->label_len;
+}
+
 static wolfsentry_errcode_t wolfsentry_action_init_1(const char *label, int label_len, wolfsentry_action_flags_t flags, wolfsentry_action_callback_t handler, void *handler_arg, struct wolfsentry_action *action, size_t action_size) {
     if (label_len <= 0)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
@@ -56,6 +61,12 @@ static wolfsentry_errcode_t wolfsentry_action_init_1(const char *label, int labe
         WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
 
     memset(&action->header, 0, sizeof action->header);
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    memset(action->hit_shards, 0, sizeof action->hit_shards);
+#endif
+#ifdef WOLFSENTRY_INSTRUMENT
+    memset(&action->handler_time, 0, sizeof action->handler_time);
+#endif
 
     action->handler = handler;
     action->handler_arg = handler_arg;
@@ -220,34 +231,22 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_flush_all(WOLFSENTRY_CONTE
     WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
-static wolfsentry_errcode_t wolfsentry_action_get_reference_1(WOLFSENTRY_CONTEXT_ARGS_IN, const struct wolfsentry_action *action_template, struct wolfsentry_action **action) {
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_action *ret_action = (struct wolfsentry_action *)action_template;
-    ret = wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->actions->header, (struct wolfsentry_table_ent_header **)&ret_action);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
-    WOLFSENTRY_REFCOUNT_INCREMENT(ret_action->header.refcount, ret);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
-    *action = ret_action;
-    WOLFSENTRY_RETURN_OK;
-}
-
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_get_reference(WOLFSENTRY_CONTEXT_ARGS_IN, const char *label, int label_len, struct wolfsentry_action **action) {
-    struct wolfsentry_action *action_template;
     wolfsentry_errcode_t ret;
+    struct wolfsentry_action *ret_action;
     if (label_len == 0)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
     if (label_len < 0)
         label_len = (int)strlen(label);
     if (label_len > WOLFSENTRY_MAX_LABEL_BYTES)
         WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-    if ((action_template = (struct wolfsentry_action *)WOLFSENTRY_MALLOC(sizeof *action_template + (size_t)label_len)) == NULL)
-        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    action_template->label_len = (byte)label_len;
-    memcpy(action_template->label, label, (size_t)label_len);
     WOLFSENTRY_SHARED_OR_RETURN();
-    ret = wolfsentry_action_get_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, action_template, action);
-    WOLFSENTRY_FREE(action_template);
-    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    ret = wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->actions->header, label, (unsigned int)label_len, (struct wolfsentry_table_ent_header **)&ret_action);
+    WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
+    WOLFSENTRY_REFCOUNT_INCREMENT(ret_action->header.refcount, ret);
+    WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
+    *action = ret_action;
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_drop_reference(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_action *action, wolfsentry_action_res_t *action_results) {
@@ -270,6 +269,60 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_get_flags(
     WOLFSENTRY_RETURN_OK;
 }
 
+WOLFSENTRY_LOCAL void wolfsentry_action_list_compile(
+    struct wolfsentry_action_list *action_list)
+{
+    struct wolfsentry_list_ent_header *i;
+    unsigned int n = 0;
+
+    for (wolfsentry_list_ent_get_first(&action_list->header, &i);
+         i;
+         wolfsentry_list_ent_get_next(&action_list->header, &i))
+    {
+        struct wolfsentry_action *action = ((struct wolfsentry_action_list_ent *)i)->action;
+        action_list->vector[n].handler = action->handler;
+        action_list->vector[n].handler_arg = action->handler_arg;
+        action_list->vector[n].action = action;
+        ++n;
+    }
+    action_list->vector_len = n;
+}
+
+/* make room in the vector for n_ents actions, ahead of adding to the list, so
+ * that a failed allocation leaves both the list and its vector unchanged.
+ */
+static wolfsentry_errcode_t wolfsentry_action_list_reserve(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_action_list *action_list,
+    unsigned int n_ents)
+{
+    struct wolfsentry_action_vector_ent *new_vector;
+
+    if (n_ents <= action_list->vector_cap)
+        WOLFSENTRY_RETURN_OK;
+    if (n_ents < action_list->vector_cap * 2U)
+        n_ents = action_list->vector_cap * 2U;
+    if ((new_vector = (struct wolfsentry_action_vector_ent *)WOLFSENTRY_MALLOC(sizeof *new_vector * n_ents)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    if (action_list->vector != NULL) {
+        memcpy(new_vector, action_list->vector, sizeof *new_vector * action_list->vector_len);
+        WOLFSENTRY_FREE(action_list->vector);
+    }
+    action_list->vector = new_vector;
+    action_list->vector_cap = n_ents;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_action_list_release_vector(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_action_list *action_list)
+{
+    if (action_list->vector != NULL)
+        WOLFSENTRY_FREE(action_list->vector);
+    action_list->vector = NULL;
+    action_list->vector_len = action_list->vector_cap = 0;
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_update_flags(
     struct wolfsentry_action *action,
     wolfsentry_action_flags_t flags_to_set,
@@ -277,6 +330,10 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_update_flags(
     wolfsentry_action_flags_t *flags_before,
     wolfsentry_action_flags_t *flags_after)
 {
+    /* builtins act on the route table, which deferred handlers don't get. */
+    if (WOLFSENTRY_CHECK_BITS(flags_to_set, WOLFSENTRY_ACTION_FLAG_DEFERRABLE) &&
+        WOLFSENTRY_SUCCESS_CODE_IS(wolfsentry_label_is_builtin(action->label, action->label_len), YES))
+        WOLFSENTRY_ERROR_RETURN(NOT_PERMITTED);
     WOLFSENTRY_ATOMIC_UPDATE_FLAGS(action->flags, flags_to_set, flags_to_clear, flags_before, flags_after);
     WOLFSENTRY_RETURN_OK;
 }
@@ -311,10 +368,13 @@ static inline int wolfsentry_action_list_append_1(
     struct wolfsentry_action_list_ent *new;
     if (wolfsentry_action_list_find_1(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, action, NULL /* action_list_ent */) >= 0)
         WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+    if (wolfsentry_action_list_reserve(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, (unsigned int)wolfsentry_list_ent_get_len(&action_list->header) + 1U) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     if ((new  = (struct wolfsentry_action_list_ent *)WOLFSENTRY_MALLOC(sizeof *new)) == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     new->action = action;
     wolfsentry_list_ent_append(&action_list->header, &new->header);
+    wolfsentry_action_list_compile(action_list);
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -348,10 +408,13 @@ static inline int wolfsentry_action_list_prepend_1(
     struct wolfsentry_action_list_ent *new;
     if (wolfsentry_action_list_find_1(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, action, NULL /* action_list_ent */) >= 0)
         WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+    if (wolfsentry_action_list_reserve(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, (unsigned int)wolfsentry_list_ent_get_len(&action_list->header) + 1U) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     if ((new  = (struct wolfsentry_action_list_ent *)WOLFSENTRY_MALLOC(sizeof *new)) == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     new->action = action;
     wolfsentry_list_ent_prepend(&action_list->header, &new->header);
+    wolfsentry_action_list_compile(action_list);
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -388,10 +451,13 @@ static inline wolfsentry_errcode_t wolfsentry_action_list_insert_after_1(
         WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
     if ((ret = wolfsentry_action_list_find_1(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, point_action, &point)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
+    if (wolfsentry_action_list_reserve(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list, (unsigned int)wolfsentry_list_ent_get_len(&action_list->header) + 1U) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     if ((new  = (struct wolfsentry_action_list_ent *)WOLFSENTRY_MALLOC(sizeof *new)) == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     new->action = action;
     wolfsentry_list_ent_insert_after(&action_list->header, &point->header, &new->header);
+    wolfsentry_action_list_compile(action_list);
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -443,6 +509,9 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_clone(
 
     (void)flags;
 
+    if ((ret = wolfsentry_action_list_reserve(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), dest_action_list, (unsigned int)wolfsentry_list_ent_get_len(&src_action_list->header))) < 0)
+        goto out;
+
     for (wolfsentry_list_ent_get_first(&src_action_list->header, &i);
          i && ((struct wolfsentry_action_list_ent *)i)->action;
          wolfsentry_list_ent_get_next(&src_action_list->header, &i))
@@ -464,6 +533,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_clone(
         WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
         wolfsentry_list_ent_append(&dest_action_list->header, &new_ale->header);
     }
+    wolfsentry_action_list_compile(dest_action_list);
     ret = WOLFSENTRY_ERROR_ENCODE(OK);
 
   out:
@@ -504,6 +574,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_delete(
         WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(ITEM_NOT_FOUND);
 
     wolfsentry_list_ent_delete(&action_list->header, i);
+    wolfsentry_action_list_compile(action_list);
     WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_action_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, ((struct wolfsentry_action_list_ent *)i)->action, NULL /* action_results */));
     WOLFSENTRY_FREE(i);
 
@@ -530,9 +601,287 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_delete_all(
         WOLFSENTRY_FREE(i);
     }
 
+    wolfsentry_action_list_release_vector(WOLFSENTRY_CONTEXT_ARGS_OUT, action_list);
+
     WOLFSENTRY_UNLOCK_AND_RETURN_OK;
 }
 
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_action_get_hitcount(
+    const struct wolfsentry_action *action)
+{
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    return wolfsentry_counter_shards_sum(action->hit_shards);
+#else
+    return WOLFSENTRY_ATOMIC_LOAD(action->header.hitcount);
+#endif
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_init(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int capacity,
+    wolfsentry_deferred_overflow_policy_t overflow_policy)
+{
+    struct wolfsentry_deferred_action_ring *ring;
+    unsigned int i;
+
+    if ((capacity == 0) ||
+        (capacity > (1U << 30U)) ||
+        ((capacity & (capacity - 1U)) != 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    switch (overflow_policy) {
+    case WOLFSENTRY_DEFERRED_OVERFLOW_DROP:
+    case WOLFSENTRY_DEFERRED_OVERFLOW_RUN_INLINE:
+    case WOLFSENTRY_DEFERRED_OVERFLOW_YIELD_THEN_RUN_INLINE:
+        break;
+    default:
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    }
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (wolfsentry->deferred_actions != NULL)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(ITEM_ALREADY_PRESENT);
+
+    if ((ring = (struct wolfsentry_deferred_action_ring *)WOLFSENTRY_MALLOC(sizeof *ring + sizeof ring->slots[0] * capacity)) == NULL)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(SYS_RESOURCE_FAILED);
+    memset(ring, 0, sizeof *ring);
+    ring->mask = capacity - 1U;
+    ring->overflow_policy = overflow_policy;
+    for (i = 0; i < capacity; ++i)
+        ring->slots[i].seq = i;
+
+    WOLFSENTRY_ATOMIC_STORE(wolfsentry->deferred_actions, ring);
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+/* called with the mutex held.  records still queued are discarded. */
+WOLFSENTRY_LOCAL void wolfsentry_deferred_actions_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN)
+{
+    struct wolfsentry_deferred_action_ring *ring = wolfsentry->deferred_actions;
+    if (ring == NULL)
+        WOLFSENTRY_RETURN_VOID;
+    for (;;) {
+        struct wolfsentry_deferred_action_slot *slot = &ring->slots[ring->head & ring->mask];
+        if (WOLFSENTRY_ATOMIC_LOAD(slot->seq) != ring->head + 1U)
+            break;
+        if (slot->record.action != NULL)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, (struct wolfsentry_table_ent_header *)slot->record.action, NULL /* action_results */));
+        ++ring->head;
+    }
+    WOLFSENTRY_FREE(ring);
+    wolfsentry->deferred_actions = NULL;
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static void wolfsentry_deferred_action_copy_endpoints(
+    struct wolfsentry_deferred_action *record,
+    const struct wolfsentry_route *route)
+{
+    if (route == NULL) {
+        memset(&record->remote, 0, sizeof record->remote);
+        memset(&record->local, 0, sizeof record->local);
+        return;
+    }
+    record->remote.sa_family = record->local.sa_family = route->sa_family;
+    record->remote.sa_proto = record->local.sa_proto = route->sa_proto;
+    record->remote.sa_port = route->remote.sa_port;
+    record->remote.interface = route->remote.interface;
+    record->remote.addr_len = route->remote.addr_len <= WOLFSENTRY_MAX_ADDR_BITS ? route->remote.addr_len : (wolfsentry_addr_bits_t)0;
+    memcpy(record->remote.addr, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), WOLFSENTRY_BITS_TO_BYTES(record->remote.addr_len));
+    record->local.sa_port = route->local.sa_port;
+    record->local.interface = route->local.interface;
+    record->local.addr_len = route->local.addr_len <= WOLFSENTRY_MAX_ADDR_BITS ? route->local.addr_len : (wolfsentry_addr_bits_t)0;
+    memcpy(record->local.addr, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), WOLFSENTRY_BITS_TO_BYTES(record->local.addr_len));
+}
+
+/* returns nonzero if the action was queued or dropped, or zero if the caller
+ * must call the handler inline.  called with the context lock held shared.
+ */
+static int wolfsentry_deferred_action_enqueue(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_deferred_action_ring *ring,
+    struct wolfsentry_action *action,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    const struct wolfsentry_route *target_route,
+    const struct wolfsentry_route *rule_route,
+    wolfsentry_action_res_t action_results)
+{
+    struct wolfsentry_deferred_action_slot *slot;
+    uint32_t pos;
+    wolfsentry_errcode_t ret;
+#ifdef WOLFSENTRY_THREADSAFE
+    unsigned int n_yields = 0;
+#endif
+
+    for (;;) {
+        int32_t dif;
+        pos = WOLFSENTRY_ATOMIC_LOAD_RELAXED(ring->tail);
+        slot = &ring->slots[pos & ring->mask];
+        dif = (int32_t)(WOLFSENTRY_ATOMIC_LOAD(slot->seq) - pos);
+        if (dif == 0) {
+#ifdef WOLFSENTRY_THREADSAFE
+            uint32_t expected = pos;
+            int claimed;
+            claimed = WOLFSENTRY_ATOMIC_TEST_AND_SET(ring->tail, expected, pos + 1U);
+            if (claimed)
+                break;
+#else
+            ring->tail = pos + 1U;
+            break;
+#endif
+        } else if (dif < 0) {
+            /* the ring is full. */
+            switch (ring->overflow_policy) {
+            case WOLFSENTRY_DEFERRED_OVERFLOW_DROP:
+                WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_dropped);
+                return 1;
+            case WOLFSENTRY_DEFERRED_OVERFLOW_YIELD_THEN_RUN_INLINE:
+#ifdef WOLFSENTRY_THREADSAFE
+                /* the drainer runs without the context lock, so it can make
+                 * room while the caller holds it.  but the wait is bounded,
+                 * so that a stalled or absent drainer can't wedge dispatch.
+                 */
+                if (n_yields < WOLFSENTRY_DEFERRED_OVERFLOW_MAX_YIELDS) {
+                    ++n_yields;
+                    wolfsentry_thread_yield();
+                    continue;
+                }
+#endif
+                break;
+            case WOLFSENTRY_DEFERRED_OVERFLOW_RUN_INLINE:
+                break;
+            }
+            WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_run_inline);
+            return 0;
+        }
+    }
+
+    WOLFSENTRY_REFCOUNT_INCREMENT(action->header.refcount, ret);
+    if (ret < 0) {
+        /* the slot is claimed, so it has to be published -- as a record with
+         * no action, skipped by the drainer.
+         */
+        slot->record.action = NULL;
+        WOLFSENTRY_ATOMIC_STORE(slot->seq, pos + 1U);
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_run_inline);
+        return 0;
+    }
+
+    slot->record.action = action;
+    slot->record.action_type = action_type;
+    slot->record.trigger_event_id = trigger_event ? trigger_event->header.id : WOLFSENTRY_ENT_ID_NONE;
+    slot->record.rule_route_id = rule_route ? rule_route->header.id : WOLFSENTRY_ENT_ID_NONE;
+    slot->record.rule_route_flags = rule_route ? rule_route->flags : WOLFSENTRY_ROUTE_FLAG_NONE;
+    slot->record.action_results = action_results;
+    if (WOLFSENTRY_GET_TIME_CACHED(&slot->record.when) < 0)
+        slot->record.when = 0;
+    wolfsentry_deferred_action_copy_endpoints(&slot->record, target_route ? target_route : rule_route);
+
+    WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_enqueued);
+    WOLFSENTRY_ATOMIC_STORE(slot->seq, pos + 1U);
+    return 1;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_drain(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int max_records,
+    unsigned int *n_drained)
+{
+    struct wolfsentry_deferred_action_ring *ring = WOLFSENTRY_ATOMIC_LOAD(wolfsentry->deferred_actions);
+    unsigned int n = 0;
+
+    if (n_drained)
+        *n_drained = 0;
+    if (ring == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+
+#ifdef WOLFSENTRY_THREADSAFE
+    {
+        uint32_t expected = 0;
+        int locked;
+        locked = WOLFSENTRY_ATOMIC_TEST_AND_SET(ring->drainer_lock, expected, 1U);
+        if (! locked)
+            WOLFSENTRY_ERROR_RETURN(BUSY);
+    }
+#endif
+
+    while ((max_records == 0) || (n < max_records)) {
+        struct wolfsentry_deferred_action_slot *slot = &ring->slots[ring->head & ring->mask];
+        struct wolfsentry_deferred_action record;
+        struct wolfsentry_action *action;
+        wolfsentry_action_res_t action_results;
+        /* the stand-in route passed to the handler, built on the stack like
+         * the dispatch stand-ins.
+         */
+        struct {
+            struct wolfsentry_route route;
+            byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+        } route;
+        wolfsentry_errcode_t ret;
+#ifdef WOLFSENTRY_INSTRUMENT
+        uint64_t handler_start;
+#endif
+
+        if (WOLFSENTRY_ATOMIC_LOAD(slot->seq) != ring->head + 1U)
+            break;
+        record = slot->record;
+        /* release the slot before calling the handler, so that dispatchers
+         * aren't held up by it.
+         */
+        WOLFSENTRY_ATOMIC_STORE(slot->seq, ring->head + ring->mask + 1U);
+        ++ring->head;
+
+        if (record.action == NULL)
+            continue;
+        action = (struct wolfsentry_action *)record.action;
+        action_results = record.action_results;
+        if ((ret = wolfsentry_route_init_deferred(&record, &route.route, sizeof route.buf)) >= 0) {
+#ifdef WOLFSENTRY_INSTRUMENT
+            handler_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+            ret = action->handler(WOLFSENTRY_CONTEXT_ARGS_OUT, action, action->handler_arg, &record /* caller_arg */, NULL /* trigger_event */, record.action_type, &route.route /* trigger_route */, NULL /* route_table */, &route.route /* rule_route */, &action_results);
+#ifdef WOLFSENTRY_INSTRUMENT
+            wolfsentry_histogram_record(&action->handler_time, WOLFSENTRY_INSTRUMENT_NOW() - handler_start);
+#endif
+        }
+        if (ret < 0)
+            WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_handler_errors);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, &action->header, NULL /* action_results */));
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(ring->stats.n_drained);
+        ++n;
+    }
+
+#ifdef WOLFSENTRY_THREADSAFE
+    WOLFSENTRY_ATOMIC_STORE(ring->drainer_lock, 0U);
+#endif
+
+    if (n_drained)
+        *n_drained = n;
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_get_stats(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_deferred_action_stats *stats)
+{
+    struct wolfsentry_deferred_action_ring *ring = WOLFSENTRY_ATOMIC_LOAD(wolfsentry->deferred_actions);
+    WOLFSENTRY_CONTEXT_ARGS_THREAD_NOT_USED;
+    if (stats == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (ring == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    stats->n_enqueued = WOLFSENTRY_ATOMIC_LOAD(ring->stats.n_enqueued);
+    stats->n_drained = WOLFSENTRY_ATOMIC_LOAD(ring->stats.n_drained);
+    stats->n_dropped = WOLFSENTRY_ATOMIC_LOAD(ring->stats.n_dropped);
+    stats->n_run_inline = WOLFSENTRY_ATOMIC_LOAD(ring->stats.n_run_inline);
+    stats->n_handler_errors = WOLFSENTRY_ATOMIC_LOAD(ring->stats.n_handler_errors);
+    WOLFSENTRY_RETURN_OK;
+}
+
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_dispatch(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     void *caller_arg,
@@ -545,8 +894,11 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_dispatch(
     wolfsentry_action_res_t *action_results)
 {
     wolfsentry_errcode_t ret;
-    struct wolfsentry_action_list_ent *i;
+    const struct wolfsentry_action_vector_ent *i, *end;
     struct wolfsentry_action_list *w_a_l = NULL;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t handler_start;
+#endif
 
     if (action_results == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
@@ -614,17 +966,37 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_dispatch(
     if (w_a_l == NULL)
         WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(INVALID_ARG);
 
-    for (i = (struct wolfsentry_action_list_ent *)w_a_l->header.head;
-         i;
-         i = (struct wolfsentry_action_list_ent *)i->header.next) {
-        if (WOLFSENTRY_CHECK_BITS(i->action->flags, WOLFSENTRY_ACTION_FLAG_DISABLED))
+    for (i = w_a_l->vector, end = i + w_a_l->vector_len; i < end; ++i) {
+        /* the flags are read live, not as of compilation, so that
+         * wolfsentry_action_update_flags() takes effect on the next dispatch.
+         */
+        wolfsentry_action_flags_t action_flags = WOLFSENTRY_ATOMIC_LOAD(i->action->flags);
+        if (WOLFSENTRY_CHECK_BITS(action_flags, WOLFSENTRY_ACTION_FLAG_DISABLED))
             continue;
-        if (! (rule_route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS))
+        if (! (rule_route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS)) {
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+            WOLFSENTRY_ATOMIC_INCREMENT(i->action->hit_shards[WOLFSENTRY_COUNTER_SHARD_INDEX(thread)].hitcount, 1);
+#else
             WOLFSENTRY_ATOMIC_INCREMENT(i->action->header.hitcount, 1);
+#endif
+        }
+        if (WOLFSENTRY_CHECK_BITS(action_flags, WOLFSENTRY_ACTION_FLAG_DEFERRABLE) &&
+            (wolfsentry->deferred_actions != NULL) &&
+            wolfsentry_deferred_action_enqueue(wolfsentry, wolfsentry->deferred_actions, i->action, trigger_event, action_type, target_route, rule_route, *action_results))
+        {
+            continue;
+        }
 #ifdef WOLFSENTRY_DEBUG_ACTIONS
         fprintf(stderr,"calling action %s for event %s and action type %u\n", wolfsentry_action_get_label(i->action), wolfsentry_event_get_label(trigger_event), action_type);
 #endif
-        if ((ret = i->action->handler(WOLFSENTRY_CONTEXT_ARGS_OUT, i->action, i->action->handler_arg, caller_arg, trigger_event, action_type, target_route, route_table, rule_route, action_results)) < 0)
+#ifdef WOLFSENTRY_INSTRUMENT
+        handler_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+        ret = i->handler(WOLFSENTRY_CONTEXT_ARGS_OUT, i->action, i->handler_arg, caller_arg, trigger_event, action_type, target_route, route_table, rule_route, action_results);
+#ifdef WOLFSENTRY_INSTRUMENT
+        wolfsentry_histogram_record(&i->action->handler_time, WOLFSENTRY_INSTRUMENT_NOW() - handler_start);
+#endif
+        if (ret < 0)
             WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
         if (WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP))
             WOLFSENTRY_UNLOCK_AND_RETURN_OK;
@@ -642,6 +1014,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_table_init(
     WOLFSENTRY_TABLE_HEADER_RESET(action_table->header);
     action_table->header.cmp_fn = wolfsentry_action_key_cmp;
     action_table->header.free_fn = wolfsentry_action_drop_reference_generic;
+    action_table->header.label_fn = wolfsentry_action_label;
     action_table->header.ent_type = WOLFSENTRY_OBJECT_TYPE_ACTION;
     WOLFSENTRY_RETURN_OK;
 }
@@ -52,6 +52,11 @@ static int wolfsentry_event_key_cmp_generic(const struct wolfsentry_table_ent_he
         ((const struct wolfsentry_event *)right)->label_len);
 }
 
+static void wolfsentry_event_label(const struct wolfsentry_table_ent_header *event, const char **label, unsigned int *label_len) {
+    *label = ((const struct wolfsentry_event *)event)->label;
+    *label_len = ((const struct wolfsentry_event *)event)->label_len;
+}
+
 static wolfsentry_errcode_t wolfsentry_event_init_1(const char *label, int label_len, wolfsentry_priority_t priority, const struct wolfsentry_eventconfig *config, struct wolfsentry_event *event, size_t event_size) {
     if (label_len <= 0)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
@@ -155,6 +160,19 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_event_clone_bare(
     WOLFSENTRY_LIST_HEADER_RESET((*new_event)->update_action_list.header);
     WOLFSENTRY_LIST_HEADER_RESET((*new_event)->delete_action_list.header);
     WOLFSENTRY_LIST_HEADER_RESET((*new_event)->decision_action_list.header);
+    (*new_event)->post_action_list.vector = NULL;
+    (*new_event)->post_action_list.vector_len = (*new_event)->post_action_list.vector_cap = 0;
+    (*new_event)->insert_action_list.vector = NULL;
+    (*new_event)->insert_action_list.vector_len = (*new_event)->insert_action_list.vector_cap = 0;
+    (*new_event)->match_action_list.vector = NULL;
+    (*new_event)->match_action_list.vector_len = (*new_event)->match_action_list.vector_cap = 0;
+    (*new_event)->update_action_list.vector = NULL;
+    (*new_event)->update_action_list.vector_len = (*new_event)->update_action_list.vector_cap = 0;
+    (*new_event)->delete_action_list.vector = NULL;
+    (*new_event)->delete_action_list.vector_len = (*new_event)->delete_action_list.vector_cap = 0;
+    (*new_event)->decision_action_list.vector = NULL;
+    (*new_event)->decision_action_list.vector_len = (*new_event)->decision_action_list.vector_cap = 0;
+    (*new_event)->action_type_mask = 0;
 
     (*new_event)->aux_event = NULL;
 
@@ -249,6 +267,8 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_event_clone_resolve(
         flags);
     WOLFSENTRY_RERETURN_IF_ERROR(ret);
 
+    wolfsentry_event_update_action_type_mask(new_event);
+
     if (src_event->aux_event) {
         new_event->aux_event = src_event->aux_event;
         if ((ret = wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), &dest_context->events->header, (struct wolfsentry_table_ent_header **)&new_event->aux_event)) < 0) {
@@ -316,13 +336,6 @@ WOLFSENTRY_API const struct wolfsentry_event *wolfsentry_event_get_aux_event(con
 }
 
 static wolfsentry_errcode_t wolfsentry_event_get_1(WOLFSENTRY_CONTEXT_ARGS_IN, const char *label, int label_len, struct wolfsentry_event **event) {
-    wolfsentry_errcode_t ret;
-    struct {
-        struct wolfsentry_event event;
-        byte buf[WOLFSENTRY_MAX_LABEL_BYTES];
-    } target;
-    struct wolfsentry_event *event_1 = &target.event;
-
     if (label_len == 0)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
     if (label_len < 0)
@@ -330,15 +343,7 @@ static wolfsentry_errcode_t wolfsentry_event_get_1(WOLFSENTRY_CONTEXT_ARGS_IN, c
     if (label_len > WOLFSENTRY_MAX_LABEL_BYTES)
         WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
 
-    ret = wolfsentry_event_init_1(label, label_len, 0, NULL, &target.event, sizeof target);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
-
-    ret = wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->events->header, (struct wolfsentry_table_ent_header **)&event_1);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
-
-    *event = event_1;
-
-    WOLFSENTRY_RETURN_OK;
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->events->header, label, (unsigned int)label_len, (struct wolfsentry_table_ent_header **)event));
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_event_get_config(WOLFSENTRY_CONTEXT_ARGS_IN, const char *label, int label_len, struct wolfsentry_eventconfig *config) {
@@ -372,11 +377,13 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_event_update_config(WOLFSENTRY_CO
             WOLFSENTRY_FREE(event->config);
             event->config = NULL;
         }
-        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
-    } else {
+    } else
         ret = wolfsentry_eventconfig_load(config, event->config);
-        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
-    }
+
+    /* the config filters route matches, so cached lookup results are stale. */
+    wolfsentry_route_table_generation_bump(wolfsentry->routes);
+
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_IN, const char *label, int label_len, struct wolfsentry_event **event) {
@@ -447,8 +454,37 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_event_flush_all(WOLFSENTRY_CONTEX
     WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_event_get_hitcount(
+    const struct wolfsentry_event *event)
+{
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    return wolfsentry_counter_shards_sum(event->hit_shards);
+#else
+    return WOLFSENTRY_ATOMIC_LOAD(event->header.hitcount);
+#endif
+}
+
 typedef enum { W_E_A_A_PREPEND, W_E_A_A_APPEND, W_E_A_A_INSERT, W_E_A_A_DELETE } w_e_a_a_how_t;
 
+WOLFSENTRY_LOCAL void wolfsentry_event_update_action_type_mask(
+    struct wolfsentry_event *event)
+{
+    byte mask = 0;
+    if (event->post_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_POST);
+    if (event->insert_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_INSERT);
+    if (event->match_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_MATCH);
+    if (event->update_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_UPDATE);
+    if (event->delete_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_DELETE);
+    if (event->decision_action_list.vector_len > 0)
+        mask |= (byte)(1U << WOLFSENTRY_ACTION_TYPE_DECISION);
+    event->action_type_mask = mask;
+}
+
 static inline wolfsentry_errcode_t wolfsentry_event_action_change_1(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     const char *event_label,
@@ -509,6 +545,8 @@ static inline wolfsentry_errcode_t wolfsentry_event_action_change_1(
         ret = wolfsentry_action_list_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, w_a_l, action_label, action_label_len);
         break;
     };
+    if (ret >= 0)
+        wolfsentry_event_update_action_type_mask(event);
     WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
@@ -733,6 +771,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_event_table_init(
     WOLFSENTRY_TABLE_HEADER_RESET(event_table->header);
     event_table->header.cmp_fn = wolfsentry_event_key_cmp_generic;
     event_table->header.free_fn = wolfsentry_event_drop_reference_generic;
+    event_table->header.label_fn = wolfsentry_event_label;
     event_table->header.ent_type = WOLFSENTRY_OBJECT_TYPE_EVENT;
     WOLFSENTRY_RETURN_OK;
 }
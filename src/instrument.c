@@ -0,0 +1,245 @@
+/*
+ * instrument.c
+ *
+ * Copyright (C) 2021-2023 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_INSTRUMENT_C
+
+#ifdef WOLFSENTRY_INSTRUMENT
+
+#if (WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS < 1) || (WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS > 63) || (WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS <= WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS)
+#error WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS and WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS are out of range.
+#endif
+
+#define WOLFSENTRY_HISTOGRAM_SUB_BUCKETS (1U << WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS)
+
+#ifdef WOLFSENTRY_INSTRUMENT_BUILTIN_NOW
+
+#include <time.h>
+
+WOLFSENTRY_LOCAL uint64_t wolfsentry_instrument_now(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ((uint64_t)ts.tv_sec * (uint64_t)1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+#endif
+
+static unsigned int wolfsentry_histogram_msb(uint64_t value) {
+#ifdef LOG2_64
+    return (unsigned int)LOG2_64(value);
+#else
+    unsigned int msb = 0;
+    while (value >>= 1U)
+        ++msb;
+    return msb;
+#endif
+}
+
+static unsigned int wolfsentry_histogram_bucket_of(uint64_t value) {
+    unsigned int shift;
+    if (value < WOLFSENTRY_HISTOGRAM_SUB_BUCKETS)
+        return (unsigned int)value;
+    if ((value >> WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS) != 0)
+        return WOLFSENTRY_HISTOGRAM_BUCKETS - 1U;
+    shift = wolfsentry_histogram_msb(value) - WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS;
+    /* the top SUB_BUCKET_BITS + 1 bits of value, less the leading one, pick
+     * the sub-bucket within the power of 2.
+     */
+    return ((shift + 1U) << WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS) +
+        (unsigned int)((value >> shift) & (WOLFSENTRY_HISTOGRAM_SUB_BUCKETS - 1U));
+}
+
+WOLFSENTRY_API uint64_t wolfsentry_histogram_bucket_value(unsigned int bucket) {
+    unsigned int shift;
+    uint64_t lowest;
+    if (bucket < WOLFSENTRY_HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    if (bucket >= WOLFSENTRY_HISTOGRAM_BUCKETS)
+        bucket = WOLFSENTRY_HISTOGRAM_BUCKETS - 1U;
+    shift = (bucket >> WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS) - 1U;
+    lowest = (uint64_t)(WOLFSENTRY_HISTOGRAM_SUB_BUCKETS + (bucket & (WOLFSENTRY_HISTOGRAM_SUB_BUCKETS - 1U))) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1U;
+}
+
+WOLFSENTRY_LOCAL void wolfsentry_histogram_record(struct wolfsentry_histogram *histogram, uint64_t value) {
+#ifdef WOLFSENTRY_THREADSAFE
+    uint64_t max;
+    int max_updated;
+#endif
+
+    WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(histogram->buckets[wolfsentry_histogram_bucket_of(value)]);
+    WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(histogram->count);
+    WOLFSENTRY_ATOMIC_INCREMENT(histogram->sum, value);
+
+#ifdef WOLFSENTRY_THREADSAFE
+    max = WOLFSENTRY_ATOMIC_LOAD_RELAXED(histogram->max);
+    while (value > max) {
+        /* on failure, max is reloaded with the current value. */
+        max_updated = WOLFSENTRY_ATOMIC_TEST_AND_SET(histogram->max, max, value);
+        if (max_updated)
+            break;
+    }
+#else
+    if (value > histogram->max)
+        histogram->max = value;
+#endif
+}
+
+/* folds src into dst, zeroing src as it goes if reset_p. */
+static void wolfsentry_histogram_fold(struct wolfsentry_histogram *dst, struct wolfsentry_histogram *src, int reset_p) {
+    unsigned int i;
+    wolfsentry_hitcount_t hits;
+    uint64_t value;
+
+    if (reset_p) {
+        WOLFSENTRY_ATOMIC_RESET(src->count, &hits);
+        dst->count += hits;
+        WOLFSENTRY_ATOMIC_RESET(src->sum, &value);
+        dst->sum += value;
+        WOLFSENTRY_ATOMIC_RESET(src->max, &value);
+        if (value > dst->max)
+            dst->max = value;
+        for (i = 0; i < WOLFSENTRY_HISTOGRAM_BUCKETS; ++i) {
+            WOLFSENTRY_ATOMIC_RESET(src->buckets[i], &hits);
+            dst->buckets[i] += hits;
+        }
+    } else {
+        dst->count += WOLFSENTRY_ATOMIC_LOAD(src->count);
+        dst->sum += WOLFSENTRY_ATOMIC_LOAD(src->sum);
+        value = WOLFSENTRY_ATOMIC_LOAD(src->max);
+        if (value > dst->max)
+            dst->max = value;
+        for (i = 0; i < WOLFSENTRY_HISTOGRAM_BUCKETS; ++i)
+            dst->buckets[i] += WOLFSENTRY_ATOMIC_LOAD(src->buckets[i]);
+    }
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_get_histogram(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    wolfsentry_instrument_histogram_t which,
+    struct wolfsentry_histogram *histogram,
+    int reset_p)
+{
+    unsigned int i;
+
+    WOLFSENTRY_CONTEXT_ARGS_THREAD_NOT_USED;
+
+    if ((histogram == NULL) ||
+        ((unsigned int)which >= (unsigned int)WOLFSENTRY_INSTRUMENT_HISTOGRAM_COUNT))
+    {
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    }
+
+    memset(histogram, 0, sizeof *histogram);
+    for (i = 0; i < WOLFSENTRY_INSTRUMENT_SHARDS; ++i)
+        wolfsentry_histogram_fold(histogram, &wolfsentry->instrument->shards[i].hists[which], reset_p);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_get_action_histogram(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const char *label,
+    int label_len,
+    struct wolfsentry_histogram *histogram,
+    int reset_p)
+{
+    struct wolfsentry_action *action;
+    wolfsentry_errcode_t ret;
+
+    if (histogram == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (label_len == 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (label_len < 0)
+        label_len = (int)strlen(label);
+    if (label_len > WOLFSENTRY_MAX_LABEL_BYTES)
+        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    ret = wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->actions->header, label, (unsigned int)label_len, (struct wolfsentry_table_ent_header **)&action);
+    WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
+
+    memset(histogram, 0, sizeof *histogram);
+    wolfsentry_histogram_fold(histogram, &action->handler_time, reset_p);
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_reset(
+    WOLFSENTRY_CONTEXT_ARGS_IN)
+{
+    struct wolfsentry_histogram scratch;
+    struct wolfsentry_table_ent_header *i;
+    unsigned int shard, which;
+
+    memset(&scratch, 0, sizeof scratch);
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    for (shard = 0; shard < WOLFSENTRY_INSTRUMENT_SHARDS; ++shard) {
+        for (which = 0; which < (unsigned int)WOLFSENTRY_INSTRUMENT_HISTOGRAM_COUNT; ++which)
+            wolfsentry_histogram_fold(&scratch, &wolfsentry->instrument->shards[shard].hists[which], 1 /* reset_p */);
+    }
+
+    for (i = wolfsentry->actions->header.head; i; i = i->next)
+        wolfsentry_histogram_fold(&scratch, &((struct wolfsentry_action *)i)->handler_time, 1 /* reset_p */);
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API uint64_t wolfsentry_histogram_percentile(
+    const struct wolfsentry_histogram *histogram,
+    unsigned int parts_per_million)
+{
+    uint64_t total = 0, target, seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < WOLFSENTRY_HISTOGRAM_BUCKETS; ++i)
+        total += histogram->buckets[i];
+    if (total == 0)
+        return 0;
+
+    if (parts_per_million > 1000000U)
+        parts_per_million = 1000000U;
+    target = ((total * parts_per_million) + 999999U) / 1000000U;
+    if (target == 0)
+        target = 1;
+
+    for (i = 0; i < WOLFSENTRY_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint64_t value = wolfsentry_histogram_bucket_value(i);
+            /* the top bucket is open-ended, and the max is exact. */
+            if ((histogram->max != 0) && ((value > histogram->max) || (i == WOLFSENTRY_HISTOGRAM_BUCKETS - 1U)))
+                value = histogram->max;
+            return value;
+        }
+    }
+
+    return histogram->max;
+}
+
+#endif /* WOLFSENTRY_INSTRUMENT */
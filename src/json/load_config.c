@@ -86,24 +86,28 @@ struct wolfsentry_json_process_state {
     struct wolfsentry_thread_context *thread;
     int got_reservation;
 #define JPS_WOLFSENTRY_CONTEXT_ARGS_OUT jps->wolfsentry, jps->thread
+#define JPS_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT jps->wolfsentry_actual, jps->thread
 #define JPSP_WOLFSENTRY_CONTEXT_ARGS_OUT (*jps)->wolfsentry, (*jps)->thread
 #define JPSP_P_WOLFSENTRY_CONTEXT_ARGS_OUT &(*jps)->wolfsentry, (*jps)->thread
 #define JPSP_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT (*jps)->wolfsentry_actual, (*jps)->thread
 #else
 #define JPS_WOLFSENTRY_CONTEXT_ARGS_OUT jps->wolfsentry
+#define JPS_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT jps->wolfsentry_actual
 #define JPSP_WOLFSENTRY_CONTEXT_ARGS_OUT (*jps)->wolfsentry
 #define JPSP_P_WOLFSENTRY_CONTEXT_ARGS_OUT &(*jps)->wolfsentry
 #define JPSP_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT (*jps)->wolfsentry_actual
 #endif
 
     union {
-        struct {
+        struct wolfsentry_json_route {
             char event_label[WOLFSENTRY_MAX_LABEL_BYTES];
             int event_label_len;
             void *caller_arg; /* xxx */
             WOLFSENTRY_SOCKADDR(WOLFSENTRY_MAX_ADDR_BITS) remote;
             WOLFSENTRY_SOCKADDR(WOLFSENTRY_MAX_ADDR_BITS) local;
             wolfsentry_route_flags_t flags;
+            size_t index; /* ordinal in the static route array */
+            JSON_INPUT_POS pos; /* end of the route object */
         } route;
         struct {
             char label[WOLFSENTRY_MAX_LABEL_BYTES];
@@ -124,6 +128,18 @@ struct wolfsentry_json_process_state {
             int label_len;
         } user_value;
     } o_u_c;
+
+    /* completed static routes, inserted a batch at a time by
+     * flush_route_buf().
+     */
+    struct wolfsentry_json_route *route_buf;
+    size_t route_buf_len, route_buf_size;
+    size_t route_count;
+
+    /* the static route that failed to insert, reported in err_buf. */
+    int route_failed;
+    size_t failed_route_index;
+    JSON_INPUT_POS failed_route_pos;
 };
 
 static wolfsentry_errcode_t reset_o_u_c(struct wolfsentry_json_process_state *jps) {
@@ -807,24 +823,133 @@ static wolfsentry_errcode_t handle_route_protocol_clause(struct wolfsentry_json_
     WOLFSENTRY_RETURN_OK;
 }
 
+/* static routes are inserted with wolfsentry_route_bulk_insert_by_exports(), in
+ * batches of up to WOLFSENTRY_CONFIG_LOAD_ROUTE_BATCH_SIZE, the last at the end
+ * of the route array.
+ *
+ * if a batch fails as a whole, it is retried a route at a time, so that the
+ * routes ahead of the bad one are left inserted, as when each route was
+ * inserted on its own.  either way, the bad route is recorded in the jps, for
+ * err_buf.
+ */
+#ifndef WOLFSENTRY_CONFIG_LOAD_ROUTE_BATCH_SIZE
+#define WOLFSENTRY_CONFIG_LOAD_ROUTE_BATCH_SIZE 4096
+#endif
+
+static wolfsentry_errcode_t flush_route_buf(struct wolfsentry_json_process_state *jps) {
+    struct wolfsentry_route_exports *exports;
+    wolfsentry_ent_id_t *ids;
+    wolfsentry_action_res_t action_results;
+    size_t i;
+    wolfsentry_errcode_t ret;
+
+    if (jps->route_buf_len == 0)
+        WOLFSENTRY_RETURN_OK;
+
+    exports = (struct wolfsentry_route_exports *)wolfsentry_malloc(JPS_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT, jps->route_buf_len * (sizeof *exports + sizeof *ids));
+    if (exports == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(exports, 0, jps->route_buf_len * (sizeof *exports + sizeof *ids));
+    ids = (wolfsentry_ent_id_t *)(exports + jps->route_buf_len);
+
+    for (i = 0; i < jps->route_buf_len; ++i) {
+        const struct wolfsentry_json_route *route = &jps->route_buf[i];
+        struct wolfsentry_route_exports *e = &exports[i];
+        e->parent_event_label = (route->event_label_len > 0) ? route->event_label : NULL;
+        e->parent_event_label_len = route->event_label_len;
+        e->flags = route->flags;
+        e->sa_family = route->remote.sa_family;
+        e->sa_proto = route->remote.sa_proto;
+        e->remote.sa_port = route->remote.sa_port;
+        e->remote.addr_len = route->remote.addr_len;
+        e->remote.interface = route->remote.interface;
+        e->remote_address = route->remote.addr;
+        e->local.sa_port = route->local.sa_port;
+        e->local.addr_len = route->local.addr_len;
+        e->local.interface = route->local.interface;
+        e->local_address = route->local.addr;
+    }
+
+    ret = wolfsentry_route_bulk_insert_by_exports(
+        JPS_WOLFSENTRY_CONTEXT_ARGS_OUT,
+        NULL /* caller_arg */,
+        exports,
+        jps->route_buf_len,
+        ids,
+        &action_results);
+
+    if (ret < 0) {
+        /* a route whose insert actions failed is backed out alone, leaving
+         * the rest of the batch in place with their IDs set.
+         */
+        for (i = 0; i < jps->route_buf_len; ++i) {
+            if (ids[i] != WOLFSENTRY_ENT_ID_NONE)
+                break;
+        }
+        if (i < jps->route_buf_len) {
+            for (i = 0; i < jps->route_buf_len; ++i) {
+                if (ids[i] == WOLFSENTRY_ENT_ID_NONE)
+                    break;
+            }
+        } else {
+            for (i = 0; i < jps->route_buf_len; ++i) {
+                const struct wolfsentry_json_route *route = &jps->route_buf[i];
+                ret = wolfsentry_route_insert(
+                    JPS_WOLFSENTRY_CONTEXT_ARGS_OUT,
+                    NULL /* caller_arg */,
+                    (const struct wolfsentry_sockaddr *)&route->remote,
+                    (const struct wolfsentry_sockaddr *)&route->local,
+                    route->flags,
+                    (route->event_label_len > 0) ? route->event_label : NULL,
+                    route->event_label_len,
+                    &ids[i],
+                    &action_results);
+                if (ret < 0)
+                    break;
+            }
+        }
+        if ((ret < 0) && (i < jps->route_buf_len)) {
+            jps->route_failed = 1;
+            jps->failed_route_index = jps->route_buf[i].index;
+            jps->failed_route_pos = jps->route_buf[i].pos;
+        }
+    }
+
+    wolfsentry_free(JPS_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT, exports);
+    jps->route_buf_len = 0;
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+static wolfsentry_errcode_t buffer_route(struct wolfsentry_json_process_state *jps) {
+    if (jps->route_buf_len == jps->route_buf_size) {
+        size_t new_size = jps->route_buf_size ? jps->route_buf_size * 2 : 16;
+        struct wolfsentry_json_route *new_buf;
+        if (new_size > WOLFSENTRY_CONFIG_LOAD_ROUTE_BATCH_SIZE)
+            new_size = WOLFSENTRY_CONFIG_LOAD_ROUTE_BATCH_SIZE;
+        if (new_size <= jps->route_buf_size)
+            WOLFSENTRY_RERETURN_IF_ERROR(flush_route_buf(jps));
+        else {
+            new_buf = (struct wolfsentry_json_route *)wolfsentry_realloc(JPS_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT, jps->route_buf, new_size * sizeof *new_buf);
+            if (new_buf == NULL)
+                WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+            jps->route_buf = new_buf;
+            jps->route_buf_size = new_size;
+        }
+    }
+    jps->o_u_c.route.index = jps->route_count++;
+    jps->o_u_c.route.pos = jps->parser.pos;
+    jps->route_buf[jps->route_buf_len++] = jps->o_u_c.route;
+    WOLFSENTRY_RETURN_OK;
+}
+
 static wolfsentry_errcode_t handle_route_clause(struct wolfsentry_json_process_state *jps, JSON_TYPE type, const unsigned char *data, size_t data_size) {
     wolfsentry_errcode_t ret;
     if ((jps->cur_depth == 2) && (type == JSON_OBJECT_END)) {
-        wolfsentry_ent_id_t id;
-        wolfsentry_action_res_t action_results;
         if (WOLFSENTRY_CHECK_BITS(jps->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_ROUTES_OR_EVENTS))
             ret = WOLFSENTRY_ERROR_ENCODE(OK);
         else
-            ret = wolfsentry_route_insert(
-                JPS_WOLFSENTRY_CONTEXT_ARGS_OUT,
-                jps->o_u_c.route.caller_arg,
-                (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote,
-                (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.local,
-                jps->o_u_c.route.flags,
-                (jps->o_u_c.route.event_label_len > 0) ? jps->o_u_c.route.event_label : NULL,
-                jps->o_u_c.route.event_label_len,
-                &id,
-                &action_results);
+            ret = buffer_route(jps);
         reset_o_u_c(jps);
         WOLFSENTRY_ERROR_RERETURN(ret);
     }
@@ -1474,7 +1599,8 @@ static wolfsentry_errcode_t json_process(
     if (jps->table_under_construction == T_U_C_STATIC_ROUTES) {
         if ((jps->cur_depth == 1) && (type == JSON_ARRAY_END)) {
             jps->table_under_construction = T_U_C_NONE;
-            WOLFSENTRY_RETURN_OK;
+            ret = flush_route_buf(jps);
+            goto out;
         }
         ret = handle_route_clause(jps, type, data, data_size);
         goto out;
@@ -1515,7 +1641,9 @@ static wolfsentry_errcode_t json_process(
 
     if (ret < 0) {
         reset_o_u_c(jps);
-        if (WOLFSENTRY_ERROR_CODE_IS(ret, CONFIG_INVALID_KEY))
+        if (jps->route_failed)
+            memcpy(&jps->parser.err_pos, &jps->failed_route_pos, sizeof(JSON_INPUT_POS));
+        else if (WOLFSENTRY_ERROR_CODE_IS(ret, CONFIG_INVALID_KEY))
             memcpy(&jps->parser.err_pos, &jps->key_pos, sizeof(JSON_INPUT_POS));
         else if (WOLFSENTRY_ERROR_CODE_IS(ret, CONFIG_INVALID_VALUE))
             memcpy(&jps->parser.err_pos, &jps->parser.value_pos, sizeof(JSON_INPUT_POS));
@@ -1734,6 +1862,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_feed(
         if (err_buf) {
             if (WOLFSENTRY_ERROR_DECODE_SOURCE_ID(jps->fini_ret) == WOLFSENTRY_SOURCE_ID_UNSET)
                 snprintf(err_buf, err_buf_size, "json_feed failed at offset %d, line %u, col %u, with centijson code " WOLFSENTRY_ERRCODE_FMT ": %s", (int)json_pos.offset, json_pos.line_number, json_pos.column_number, (int)jps->fini_ret, json_error_str(jps->fini_ret));
+            else if (jps->route_failed)
+                snprintf(err_buf, err_buf_size, "json_feed failed at offset %d, line %u, col %u, static route #%lu, with " WOLFSENTRY_ERROR_FMT, (int)json_pos.offset, json_pos.line_number, json_pos.column_number, (unsigned long)jps->failed_route_index, WOLFSENTRY_ERROR_FMT_ARGS(jps->fini_ret));
             else
                 snprintf(err_buf, err_buf_size, "json_feed failed at offset %d, line %u, col %u, with " WOLFSENTRY_ERROR_FMT, (int)json_pos.offset, json_pos.line_number, json_pos.column_number, WOLFSENTRY_ERROR_FMT_ARGS(jps->fini_ret));
         }
@@ -1844,6 +1974,9 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_fini(
     }
 #endif
 
+    if ((*jps)->route_buf != NULL)
+        wolfsentry_free(JPSP_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT, (*jps)->route_buf);
+
     wolfsentry_free(JPSP_WOLFSENTRY_ACTUAL_CONTEXT_ARGS_OUT, *jps);
 
     *jps = NULL;
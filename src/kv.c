@@ -52,6 +52,11 @@ static int wolfsentry_kv_key_cmp(const struct wolfsentry_table_ent_header *left,
         (unsigned int)WOLFSENTRY_KV_KEY_LEN(&((const struct wolfsentry_kv_pair_internal *)right)->kv));
 }
 
+static void wolfsentry_kv_label(const struct wolfsentry_table_ent_header *kv, const char **label, unsigned int *label_len) {
+    *label = WOLFSENTRY_KV_KEY(&((const struct wolfsentry_kv_pair_internal *)kv)->kv);
+    *label_len = (unsigned int)WOLFSENTRY_KV_KEY_LEN(&((const struct wolfsentry_kv_pair_internal *)kv)->kv);
+}
+
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_kv_new(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     const char *key,
@@ -1179,6 +1184,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_kv_table_init(
     WOLFSENTRY_TABLE_HEADER_RESET(kv_table->header);
     kv_table->header.cmp_fn = wolfsentry_kv_key_cmp;
     kv_table->header.free_fn = wolfsentry_kv_drop_reference_generic;
+    kv_table->header.label_fn = wolfsentry_kv_label;
     kv_table->header.ent_type = WOLFSENTRY_OBJECT_TYPE_KV;
     WOLFSENTRY_RETURN_OK;
 }
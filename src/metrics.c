@@ -0,0 +1,415 @@
+/*
+ * metrics.c
+ *
+ * Copyright (C) 2021-2023 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_METRICS_C
+
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+#define WOLFSENTRY_DISPATCH_COUNTER_GET(counters, which) wolfsentry_counter_shards_sum((counters).which)
+#else
+#define WOLFSENTRY_DISPATCH_COUNTER_GET(counters, which) WOLFSENTRY_ATOMIC_LOAD((counters).which)
+#endif
+
+struct wolfsentry_metrics_route_rank {
+    const struct wolfsentry_route *route;
+    wolfsentry_hitcount_t hits;
+};
+
+/* restores the min-heap property below heap[i]. */
+static void wolfsentry_metrics_rank_sift_down(struct wolfsentry_metrics_route_rank *heap, unsigned int n, unsigned int i) {
+    for (;;) {
+        unsigned int least = i, child = (2U * i) + 1U;
+        struct wolfsentry_metrics_route_rank swap;
+        if ((child < n) && (heap[child].hits < heap[least].hits))
+            least = child;
+        ++child;
+        if ((child < n) && (heap[child].hits < heap[least].hits))
+            least = child;
+        if (least == i)
+            break;
+        swap = heap[i];
+        heap[i] = heap[least];
+        heap[least] = swap;
+        i = least;
+    }
+}
+
+static void wolfsentry_metrics_rank_sift_up(struct wolfsentry_metrics_route_rank *heap, unsigned int i) {
+    while (i > 0) {
+        unsigned int parent = (i - 1U) / 2U;
+        struct wolfsentry_metrics_route_rank swap;
+        if (heap[parent].hits <= heap[i].hits)
+            break;
+        swap = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = swap;
+        i = parent;
+    }
+}
+
+static void wolfsentry_metrics_copy_ent(struct wolfsentry_metrics_ent *out, const struct wolfsentry_table_ent_header *header, wolfsentry_hitcount_t hits, const char *label, byte label_len) {
+    out->id = header->id;
+    out->hits = hits;
+    out->label_len = label_len;
+    memcpy(out->label, label, label_len);
+    out->label[label_len] = 0;
+}
+
+static void wolfsentry_metrics_format_address(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    wolfsentry_addr_family_t sa_family,
+    const byte *addr,
+    wolfsentry_addr_bits_t addr_len,
+    char *out)
+{
+    int out_len = WOLFSENTRY_METRICS_ADDR_TEXT_SIZE;
+    if (wolfsentry_route_format_address(WOLFSENTRY_CONTEXT_ARGS_OUT, sa_family, addr, addr_len, out, &out_len) < 0)
+        out_len = 0;
+    out[out_len < WOLFSENTRY_METRICS_ADDR_TEXT_SIZE ? out_len : WOLFSENTRY_METRICS_ADDR_TEXT_SIZE - 1] = 0;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_snapshot(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int max_top_routes,
+    struct wolfsentry_metrics **metrics)
+{
+    struct wolfsentry_metrics *m = NULL;
+    struct wolfsentry_metrics_route_rank *ranks = NULL;
+    struct wolfsentry_route_table *routes;
+    struct wolfsentry_table_ent_header *i;
+    unsigned int n_ranked = 0, j;
+    size_t n_events, n_actions, n_top_routes;
+    wolfsentry_errcode_t ret;
+
+    if (metrics == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    routes = wolfsentry->routes;
+    n_events = (size_t)wolfsentry->events->header.n_ents;
+    n_actions = (size_t)wolfsentry->actions->header.n_ents;
+    n_top_routes = (size_t)routes->header.n_ents < (size_t)max_top_routes ? (size_t)routes->header.n_ents : (size_t)max_top_routes;
+
+    if ((m = (struct wolfsentry_metrics *)WOLFSENTRY_MALLOC(
+             sizeof *m +
+             (sizeof m->events[0] * n_events) +
+             (sizeof m->actions[0] * n_actions) +
+             (sizeof m->top_routes[0] * n_top_routes))) == NULL)
+    {
+        WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(SYS_RESOURCE_FAILED);
+    }
+    memset(m, 0, sizeof *m);
+    m->events = (struct wolfsentry_metrics_ent *)(m + 1);
+    m->actions = m->events + n_events;
+    m->top_routes = (struct wolfsentry_metrics_route *)(m->actions + n_actions);
+
+    if ((ret = WOLFSENTRY_GET_TIME(&m->when)) < 0)
+        goto out;
+
+    m->n_dispatches = WOLFSENTRY_DISPATCH_COUNTER_GET(routes->dispatch_counters, n_dispatches);
+    m->n_accepts = WOLFSENTRY_DISPATCH_COUNTER_GET(routes->dispatch_counters, n_accepts);
+    m->n_rejects = WOLFSENTRY_DISPATCH_COUNTER_GET(routes->dispatch_counters, n_rejects);
+    m->n_fallthroughs = WOLFSENTRY_DISPATCH_COUNTER_GET(routes->dispatch_counters, n_fallthroughs);
+    m->n_routes = routes->header.n_ents;
+    m->n_route_inserts = routes->header.n_inserts;
+    m->n_route_deletes = routes->header.n_deletes;
+    m->n_route_purges = WOLFSENTRY_ATOMIC_LOAD(routes->n_purges);
+#ifdef WOLFSENTRY_THREADSAFE
+    m->n_lock_waits = WOLFSENTRY_ATOMIC_LOAD(wolfsentry->lock.wait_count);
+#endif
+    if (routes->flow_cache != NULL) {
+        m->n_flow_cache_hits = WOLFSENTRY_ATOMIC_LOAD(routes->flow_cache->hits);
+        m->n_flow_cache_misses = WOLFSENTRY_ATOMIC_LOAD(routes->flow_cache->misses);
+    }
+
+    for (i = wolfsentry->events->header.head; i && (m->n_events < n_events); i = i->next) {
+        const struct wolfsentry_event *event = (const struct wolfsentry_event *)i;
+        wolfsentry_metrics_copy_ent(&m->events[m->n_events++], i, wolfsentry_event_get_hitcount(event), event->label, event->label_len);
+    }
+
+    for (i = wolfsentry->actions->header.head; i && (m->n_actions < n_actions); i = i->next) {
+        const struct wolfsentry_action *action = (const struct wolfsentry_action *)i;
+        wolfsentry_metrics_copy_ent(&m->actions[m->n_actions++], i, wolfsentry_action_get_hitcount(action), action->label, action->label_len);
+    }
+
+    if (n_top_routes > 0) {
+        /* a min-heap of the busiest routes seen so far, so that the walk is
+         * O(n log max_top_routes) and needs no copy of the table.
+         */
+        if ((ranks = (struct wolfsentry_metrics_route_rank *)WOLFSENTRY_MALLOC(sizeof *ranks * n_top_routes)) == NULL) {
+            ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+            goto out;
+        }
+        for (i = routes->header.head; i; i = i->next) {
+            const struct wolfsentry_route *route = (const struct wolfsentry_route *)i;
+            wolfsentry_hitcount_t hits = wolfsentry_route_get_hitcount(route);
+            if (n_ranked < n_top_routes) {
+                ranks[n_ranked].route = route;
+                ranks[n_ranked].hits = hits;
+                wolfsentry_metrics_rank_sift_up(ranks, n_ranked++);
+            } else if (hits > ranks[0].hits) {
+                ranks[0].route = route;
+                ranks[0].hits = hits;
+                wolfsentry_metrics_rank_sift_down(ranks, n_ranked, 0);
+            }
+        }
+
+        /* pop the heap from the least hit, filling from the end. */
+        m->n_top_routes = n_ranked;
+        for (j = n_ranked; j > 0; --j) {
+            struct wolfsentry_metrics_route *out = &m->top_routes[j - 1U];
+            const struct wolfsentry_route *route = ranks[0].route;
+
+            out->id = route->header.id;
+            out->hits = ranks[0].hits;
+            out->flags = WOLFSENTRY_ATOMIC_LOAD(route->flags);
+            out->sa_family = route->sa_family;
+            out->sa_proto = route->sa_proto;
+            out->remote_port = route->remote.sa_port;
+            out->local_port = route->local.sa_port;
+            out->remote_prefix_len = route->remote.addr_len;
+            out->local_prefix_len = route->local.addr_len;
+            wolfsentry_metrics_format_address(WOLFSENTRY_CONTEXT_ARGS_OUT, route->sa_family, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), route->remote.addr_len, out->remote_addr);
+            wolfsentry_metrics_format_address(WOLFSENTRY_CONTEXT_ARGS_OUT, route->sa_family, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), route->local.addr_len, out->local_addr);
+
+            ranks[0] = ranks[j - 1U];
+            wolfsentry_metrics_rank_sift_down(ranks, j - 1U, 0);
+        }
+    }
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (ranks != NULL)
+        WOLFSENTRY_FREE(ranks);
+    if (ret < 0) {
+        WOLFSENTRY_FREE(m);
+        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    }
+    *metrics = m;
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_metrics *metrics)
+{
+    if (metrics == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_FREE(metrics);
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the renderer keeps counting after the buffer fills, so that a failed render
+ * reports the size needed.
+ */
+struct wolfsentry_metrics_render_state {
+    char *out;
+    size_t out_space;
+    size_t len;
+    int overflowed;
+};
+
+static void wolfsentry_metrics_emit_n(struct wolfsentry_metrics_render_state *st, const char *s, size_t n) {
+    if ((! st->overflowed) && (st->len + n < st->out_space))
+        memcpy(st->out + st->len, s, n);
+    else
+        st->overflowed = 1;
+    st->len += n;
+}
+
+static void wolfsentry_metrics_emit(struct wolfsentry_metrics_render_state *st, const char *s) {
+    wolfsentry_metrics_emit_n(st, s, strlen(s));
+}
+
+static void wolfsentry_metrics_emit_uint(struct wolfsentry_metrics_render_state *st, uint64_t n) {
+    char digits[20];
+    size_t i = sizeof digits;
+    do {
+        digits[--i] = (char)('0' + (n % 10U));
+        n /= 10U;
+    } while (n > 0);
+    wolfsentry_metrics_emit_n(st, digits + i, sizeof digits - i);
+}
+
+static void wolfsentry_metrics_emit_family(struct wolfsentry_metrics_render_state *st, const char *name, const char *type, const char *help) {
+    wolfsentry_metrics_emit(st, "# TYPE ");
+    wolfsentry_metrics_emit(st, name);
+    wolfsentry_metrics_emit(st, " ");
+    wolfsentry_metrics_emit(st, type);
+    wolfsentry_metrics_emit(st, "\n# HELP ");
+    wolfsentry_metrics_emit(st, name);
+    wolfsentry_metrics_emit(st, " ");
+    wolfsentry_metrics_emit(st, help);
+    wolfsentry_metrics_emit(st, "\n");
+}
+
+/* label values are escaped as the exposition format requires. */
+static void wolfsentry_metrics_emit_label(struct wolfsentry_metrics_render_state *st, const char *key, const char *value, size_t value_len, int first) {
+    size_t i;
+    wolfsentry_metrics_emit(st, first ? "{" : ",");
+    wolfsentry_metrics_emit(st, key);
+    wolfsentry_metrics_emit(st, "=\"");
+    for (i = 0; i < value_len; ++i) {
+        switch (value[i]) {
+        case '\\':
+            wolfsentry_metrics_emit(st, "\\\\");
+            break;
+        case '"':
+            wolfsentry_metrics_emit(st, "\\\"");
+            break;
+        case '\n':
+            wolfsentry_metrics_emit(st, "\\n");
+            break;
+        default:
+            wolfsentry_metrics_emit_n(st, &value[i], 1);
+        }
+    }
+    wolfsentry_metrics_emit(st, "\"");
+}
+
+static void wolfsentry_metrics_emit_uint_label(struct wolfsentry_metrics_render_state *st, const char *key, uint64_t value, int first) {
+    wolfsentry_metrics_emit(st, first ? "{" : ",");
+    wolfsentry_metrics_emit(st, key);
+    wolfsentry_metrics_emit(st, "=\"");
+    wolfsentry_metrics_emit_uint(st, value);
+    wolfsentry_metrics_emit(st, "\"");
+}
+
+static void wolfsentry_metrics_emit_value(struct wolfsentry_metrics_render_state *st, wolfsentry_hitcount_t value) {
+    wolfsentry_metrics_emit(st, " ");
+    wolfsentry_metrics_emit_uint(st, (uint64_t)value);
+    wolfsentry_metrics_emit(st, "\n");
+}
+
+static void wolfsentry_metrics_emit_scalar(struct wolfsentry_metrics_render_state *st, const char *name, const char *type, const char *help, wolfsentry_hitcount_t value) {
+    wolfsentry_metrics_emit_family(st, name, type, help);
+    wolfsentry_metrics_emit(st, name);
+    if (strcmp(type, "counter") == 0)
+        wolfsentry_metrics_emit(st, "_total");
+    wolfsentry_metrics_emit_value(st, value);
+}
+
+static void wolfsentry_metrics_emit_address(struct wolfsentry_metrics_render_state *st, const char *key, const char *addr, wolfsentry_addr_bits_t prefix_len) {
+    char text[WOLFSENTRY_METRICS_ADDR_TEXT_SIZE + 8];
+    char digits[6];
+    size_t text_len = strlen(addr), i = sizeof digits;
+    memcpy(text, addr, text_len);
+    text[text_len++] = '/';
+    do {
+        digits[--i] = (char)('0' + (prefix_len % 10U));
+        prefix_len = (wolfsentry_addr_bits_t)(prefix_len / 10U);
+    } while (prefix_len > 0);
+    memcpy(text + text_len, digits + i, sizeof digits - i);
+    text_len += sizeof digits - i;
+    wolfsentry_metrics_emit_label(st, key, text, text_len, 0);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_render_openmetrics(
+    const struct wolfsentry_metrics *metrics,
+    char *buf,
+    size_t *buf_len)
+{
+    struct wolfsentry_metrics_render_state st;
+    unsigned int i;
+
+    if ((metrics == NULL) || (buf_len == NULL) || ((buf == NULL) && (*buf_len > 0)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    st.out = buf;
+    st.out_space = *buf_len;
+    st.len = 0;
+    st.overflowed = 0;
+
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_dispatches", "counter", "Route event dispatches.", metrics->n_dispatches);
+
+    wolfsentry_metrics_emit_family(&st, "wolfsentry_decisions", "counter", "Dispatches by final decision.");
+    wolfsentry_metrics_emit(&st, "wolfsentry_decisions_total");
+    wolfsentry_metrics_emit_label(&st, "decision", "accept", strlen("accept"), 1);
+    wolfsentry_metrics_emit(&st, "}");
+    wolfsentry_metrics_emit_value(&st, metrics->n_accepts);
+    wolfsentry_metrics_emit(&st, "wolfsentry_decisions_total");
+    wolfsentry_metrics_emit_label(&st, "decision", "reject", strlen("reject"), 1);
+    wolfsentry_metrics_emit(&st, "}");
+    wolfsentry_metrics_emit_value(&st, metrics->n_rejects);
+
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_fallthroughs", "counter", "Dispatches decided by the default policy.", metrics->n_fallthroughs);
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_routes", "gauge", "Routes in the route table.", metrics->n_routes);
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_route_inserts", "counter", "Routes inserted.", metrics->n_route_inserts);
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_route_deletes", "counter", "Routes deleted, including by purge.", metrics->n_route_deletes);
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_route_purges", "counter", "Routes deleted by the stale purge.", metrics->n_route_purges);
+    wolfsentry_metrics_emit_scalar(&st, "wolfsentry_lock_waits", "counter", "Context lock acquisitions that had to block.", metrics->n_lock_waits);
+
+    wolfsentry_metrics_emit_family(&st, "wolfsentry_flow_cache_lookups", "counter", "Route flow cache lookups.");
+    wolfsentry_metrics_emit(&st, "wolfsentry_flow_cache_lookups_total");
+    wolfsentry_metrics_emit_label(&st, "result", "hit", strlen("hit"), 1);
+    wolfsentry_metrics_emit(&st, "}");
+    wolfsentry_metrics_emit_value(&st, metrics->n_flow_cache_hits);
+    wolfsentry_metrics_emit(&st, "wolfsentry_flow_cache_lookups_total");
+    wolfsentry_metrics_emit_label(&st, "result", "miss", strlen("miss"), 1);
+    wolfsentry_metrics_emit(&st, "}");
+    wolfsentry_metrics_emit_value(&st, metrics->n_flow_cache_misses);
+
+    wolfsentry_metrics_emit_family(&st, "wolfsentry_event_hits", "counter", "Dispatches triggered by each event.");
+    for (i = 0; i < metrics->n_events; ++i) {
+        wolfsentry_metrics_emit(&st, "wolfsentry_event_hits_total");
+        wolfsentry_metrics_emit_label(&st, "event", metrics->events[i].label, metrics->events[i].label_len, 1);
+        wolfsentry_metrics_emit(&st, "}");
+        wolfsentry_metrics_emit_value(&st, metrics->events[i].hits);
+    }
+
+    wolfsentry_metrics_emit_family(&st, "wolfsentry_action_hits", "counter", "Calls of each action.");
+    for (i = 0; i < metrics->n_actions; ++i) {
+        wolfsentry_metrics_emit(&st, "wolfsentry_action_hits_total");
+        wolfsentry_metrics_emit_label(&st, "action", metrics->actions[i].label, metrics->actions[i].label_len, 1);
+        wolfsentry_metrics_emit(&st, "}");
+        wolfsentry_metrics_emit_value(&st, metrics->actions[i].hits);
+    }
+
+    wolfsentry_metrics_emit_family(&st, "wolfsentry_route_hits", "counter", "Hits on the busiest routes.");
+    for (i = 0; i < metrics->n_top_routes; ++i) {
+        const struct wolfsentry_metrics_route *route = &metrics->top_routes[i];
+        wolfsentry_metrics_emit(&st, "wolfsentry_route_hits_total");
+        wolfsentry_metrics_emit_uint_label(&st, "route_id", route->id, 1);
+        wolfsentry_metrics_emit_uint_label(&st, "family", route->sa_family, 0);
+        wolfsentry_metrics_emit_uint_label(&st, "proto", route->sa_proto, 0);
+        wolfsentry_metrics_emit_address(&st, "remote", route->remote_addr, route->remote_prefix_len);
+        wolfsentry_metrics_emit_uint_label(&st, "remote_port", route->remote_port, 0);
+        wolfsentry_metrics_emit_address(&st, "local", route->local_addr, route->local_prefix_len);
+        wolfsentry_metrics_emit_uint_label(&st, "local_port", route->local_port, 0);
+        wolfsentry_metrics_emit(&st, "}");
+        wolfsentry_metrics_emit_value(&st, route->hits);
+    }
+
+    wolfsentry_metrics_emit(&st, "# EOF\n");
+
+    if (st.overflowed) {
+        *buf_len = st.len + 1;
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    }
+    st.out[st.len] = 0;
+    *buf_len = st.len;
+    WOLFSENTRY_RETURN_OK;
+}
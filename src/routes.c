@@ -78,8 +78,11 @@ static inline int cmp_addrs(
                     if ((cmp = memcmp(left_addr, right_addr, min_bytes - 1)))
                         return cmp;
                 }
-                if ((left_addr[min_bytes - 1] >> (min_addr_len & 0x7)) ==
-                    (right_addr[min_bytes - 1] >> (min_addr_len & 0x7)))
+                /* addresses are big endian, so the prefix occupies the most
+                 * significant bits of the last byte.
+                 */
+                if ((left_addr[min_bytes - 1] >> (BITS_PER_BYTE - (min_addr_len & 0x7))) ==
+                    (right_addr[min_bytes - 1] >> (BITS_PER_BYTE - (min_addr_len & 0x7))))
                     *inexact_p = 1;
                 else if (left_addr[min_bytes - 1] < right_addr[min_bytes - 1])
                     return -1;
@@ -105,7 +108,7 @@ static inline int cmp_addrs(
     return 0;
 }
 
-static inline int addr_prefix_match_size(
+static int addr_prefix_match_size(
     const byte *a,
     int a_len,
     const byte *b,
@@ -126,9 +129,7 @@ static inline int addr_prefix_match_size(
     ret <<= 3;
 
     for (; ret < min_len; ++ret) {
-        int byte_number = ret / 8;
-        int bit_number = ret % 8;
-        if ((a[byte_number] & (1U << bit_number)) != (b[byte_number] & (1U << bit_number)))
+        if ((a[ret >> 3] ^ b[ret >> 3]) & (0x80U >> (ret & 0x7)))
             break;
     }
 
@@ -308,427 +309,910 @@ static int wolfsentry_route_key_cmp(const struct wolfsentry_table_ent_header *le
     return wolfsentry_route_key_cmp_1((struct wolfsentry_route *)left, (struct wolfsentry_route *)right, 0 /* match_wildcards_p */, NULL /* inexact_matches */);
 }
 
-static void wolfsentry_route_update_flags_1(
-    struct wolfsentry_route *route,
-    wolfsentry_route_flags_t flags_to_set,
-    wolfsentry_route_flags_t flags_to_clear,
-    wolfsentry_route_flags_t *flags_before,
-    wolfsentry_route_flags_t *flags_after);
+/* the route LPM index.  each route table keeps one pair of path-compressed
+ * binary tries (remote and local address) per sa_family and direction, so that
+ * an inexact lookup visits only the routes whose indexed address prefix
+ * covers, or is covered by, the target address, rather than scanning the whole
+ * table.
+ */
 
-static void wolfsentry_route_free_1(
-    WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_eventconfig_internal *config,
-    struct wolfsentry_route *route)
-{
-    if (config->config.route_private_data_alignment == 0)
-        WOLFSENTRY_FREE(route);
-    else
-        WOLFSENTRY_FREE_ALIGNED(route);
-    WOLFSENTRY_RETURN_VOID;
+#define WOLFSENTRY_ROUTE_LPM_LINK_TO_ROUTE(link, d) ((struct wolfsentry_route *)(void *)((byte *)((link) - (d)) - offsetof(struct wolfsentry_route, lpm_links)))
+
+static inline int wolfsentry_route_lpm_addr_bit(const byte *addr, int bit) {
+    return (addr[bit >> 3] >> (7 - (bit & 0x7))) & 1;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_drop_reference_1(
-    WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route *route,
-    wolfsentry_action_res_t *action_results)
-{
-    struct wolfsentry_eventconfig_internal *config = (route->parent_event && route->parent_event->config) ? route->parent_event->config : &wolfsentry->config;
-    wolfsentry_errcode_t ret;
-    wolfsentry_refcount_t refs_left;
-    if (route->header.refcount <= 0)
-        WOLFSENTRY_ERROR_RETURN(INTERNAL_CHECK_FATAL);
-    if ((route->header.parent_table != NULL) &&
-        (route->header.parent_table->ent_type != WOLFSENTRY_OBJECT_TYPE_ROUTE))
-        WOLFSENTRY_ERROR_RETURN(WRONG_OBJECT);
-    WOLFSENTRY_REFCOUNT_DECREMENT(route->header.refcount, refs_left, ret);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
-    if (refs_left > 0)
-        WOLFSENTRY_RETURN_OK;
-    if (route->parent_event)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route->parent_event, NULL /* action_results */));
-    wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, route);
-    if (action_results)
-        WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED);
-    WOLFSENTRY_RETURN_OK;
+/* wildcard addresses are indexed as zero-length prefixes. */
+static inline int wolfsentry_route_lpm_remote_len(const struct wolfsentry_route *route) {
+    return (route->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) ? 0 : (int)route->remote.addr_len;
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_drop_reference(
-    WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route *route,
-    wolfsentry_action_res_t *action_results)
-{
-    if (action_results)
-        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route, action_results));
+static inline int wolfsentry_route_lpm_local_len(const struct wolfsentry_route *route) {
+    return (route->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD) ? 0 : (int)route->local.addr_len;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_drop_reference_generic(
+static wolfsentry_errcode_t wolfsentry_route_lpm_node_new(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_table_ent_header *route,
-    wolfsentry_action_res_t *action_results)
+    const byte *prefix,
+    int prefix_len,
+    struct wolfsentry_route_lpm_node **node)
 {
-    if (action_results)
-        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, (struct wolfsentry_route *)route, action_results));
+    size_t prefix_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)prefix_len);
+
+    if ((*node = (struct wolfsentry_route_lpm_node *)WOLFSENTRY_MALLOC(sizeof **node)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*node, 0, sizeof **node);
+    (*node)->prefix_len = (wolfsentry_addr_bits_t)prefix_len;
+    if (prefix_bytes > 0) {
+        memcpy((*node)->prefix, prefix, prefix_bytes);
+        if (prefix_len & 0x7)
+            (*node)->prefix[prefix_bytes - 1] = (byte)((*node)->prefix[prefix_bytes - 1] & (0xffU << (BITS_PER_BYTE - (prefix_len & 0x7))));
+    }
+
+    WOLFSENTRY_RETURN_OK;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_init(
-    struct wolfsentry_event *parent_event,
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    int data_addr_offset,
-    size_t data_addr_size,
-    struct wolfsentry_route *new)
+/* find or create the node for addr/addr_len, splitting a compressed edge if
+ * the new prefix diverges from it or ends partway along it.
+ */
+static wolfsentry_errcode_t wolfsentry_route_lpm_node_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_lpm_node **root,
+    const byte *addr,
+    int addr_len,
+    struct wolfsentry_route_lpm_node **node)
 {
-    if (data_addr_size < WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len))
-        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
-    if (data_addr_size > MAX_UINT_OF(uint16_t))
-        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
-    if ((unsigned)data_addr_offset > MAX_UINT_OF(uint16_t))
-        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
-    if (! (flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    struct wolfsentry_route_lpm_node *i, *child, *split, *leaf;
+    int bit, common;
+    wolfsentry_errcode_t ret;
 
-    /* make sure wildcards are sensical. */
-    if (((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
-         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
-          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
-          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
-        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) &&
-         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
-          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (*root == NULL) {
+        if ((ret = wolfsentry_route_lpm_node_new(WOLFSENTRY_CONTEXT_ARGS_OUT, addr, 0, root)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+    }
 
-    memset(new, 0, offsetof(struct wolfsentry_route, data));
+    for (i = *root; ; i = child) {
+        if (i->prefix_len == addr_len) {
+            *node = i;
+            WOLFSENTRY_RETURN_OK;
+        }
 
-    new->parent_event = parent_event;
-    new->flags = flags;
-    new->sa_family = remote->sa_family;
-    new->sa_proto = remote->sa_proto;
-    new->remote.sa_port = remote->sa_port;
-    new->remote.addr_len = remote->addr_len;
-    new->remote.interface = remote->interface;
-    new->local.sa_port = local->sa_port;
-    new->local.addr_len = local->addr_len;
-    new->local.interface = local->interface;
-    new->data_addr_offset = (uint16_t)data_addr_offset;
-    new->data_addr_size = (uint16_t)data_addr_size;
+        bit = wolfsentry_route_lpm_addr_bit(addr, i->prefix_len);
+        child = i->child[bit];
 
-    if (data_addr_offset > 0)
-        memset(new->data, 0, (size_t)data_addr_offset); /* zero private data. */
+        if (child == NULL) {
+            if ((ret = wolfsentry_route_lpm_node_new(WOLFSENTRY_CONTEXT_ARGS_OUT, addr, addr_len, &leaf)) < 0)
+                WOLFSENTRY_ERROR_RERETURN(ret);
+            leaf->parent = i;
+            i->child[bit] = leaf;
+            *node = leaf;
+            WOLFSENTRY_RETURN_OK;
+        }
 
-    if (remote->addr_len > 0)
-        memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(new), remote->addr, WOLFSENTRY_BITS_TO_BYTES(remote->addr_len));
-    if (local->addr_len > 0)
-        memcpy(WOLFSENTRY_ROUTE_LOCAL_ADDR(new), local->addr, WOLFSENTRY_BITS_TO_BYTES(local->addr_len));
+        common = addr_prefix_match_size(child->prefix, child->prefix_len, addr, addr_len);
+        if (common == child->prefix_len)
+            continue;
 
-    /* make sure the pad bits in the addresses are zero. */
-    {
-        int left_over_bits = remote->addr_len % BITS_PER_BYTE;
-        if (left_over_bits) {
-            byte *remote_lsb = WOLFSENTRY_ROUTE_REMOTE_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) - 1;
-            if (*remote_lsb & (0xffU >> (BITS_PER_BYTE - left_over_bits)))
-                *remote_lsb = (byte)(*remote_lsb & (0xffU << left_over_bits));
+        if ((ret = wolfsentry_route_lpm_node_new(WOLFSENTRY_CONTEXT_ARGS_OUT, addr, common, &split)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        if (common == addr_len)
+            leaf = split;
+        else {
+            if ((ret = wolfsentry_route_lpm_node_new(WOLFSENTRY_CONTEXT_ARGS_OUT, addr, addr_len, &leaf)) < 0) {
+                WOLFSENTRY_FREE(split);
+                WOLFSENTRY_ERROR_RERETURN(ret);
+            }
+            leaf->parent = split;
+            split->child[wolfsentry_route_lpm_addr_bit(addr, common)] = leaf;
         }
+        split->parent = i;
+        split->child[wolfsentry_route_lpm_addr_bit(child->prefix, common)] = child;
+        child->parent = split;
+        i->child[bit] = split;
+        *node = leaf;
+        WOLFSENTRY_RETURN_OK;
     }
+}
+
+/* free nodes left with no routes and at most one child, splicing out the
+ * interior ones.  the root is left in place.
+ */
+static void wolfsentry_route_lpm_node_prune(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_lpm_node *node)
+{
+    while ((node->parent != NULL) &&
+           (node->routes.len == 0) &&
+           ((node->child[0] == NULL) || (node->child[1] == NULL)))
     {
-        int left_over_bits = local->addr_len % BITS_PER_BYTE;
-        if (left_over_bits) {
-            byte *local_lsb = WOLFSENTRY_ROUTE_LOCAL_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len) - 1;
-            if (*local_lsb & (0xffU >> (BITS_PER_BYTE - left_over_bits)))
-                *local_lsb = (byte)(*local_lsb & (0xffU << left_over_bits));
+        struct wolfsentry_route_lpm_node *parent = node->parent;
+        struct wolfsentry_route_lpm_node *only_child = node->child[0] ? node->child[0] : node->child[1];
+        parent->child[parent->child[1] == node] = only_child;
+        if (only_child)
+            only_child->parent = parent;
+        WOLFSENTRY_FREE(node);
+        node = parent;
+    }
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static void wolfsentry_route_lpm_node_free_all(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_lpm_node *node)
+{
+    while (node) {
+        struct wolfsentry_route_lpm_node *parent;
+        if (node->child[0]) {
+            node = node->child[0];
+            continue;
+        }
+        if (node->child[1]) {
+            node = node->child[1];
+            continue;
         }
+        parent = node->parent;
+        if (parent)
+            parent->child[parent->child[1] == node] = NULL;
+        WOLFSENTRY_FREE(node);
+        node = parent;
+    }
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_lpm_index_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    wolfsentry_addr_family_t sa_family,
+    wolfsentry_route_flags_t direction,
+    struct wolfsentry_route_lpm_index **index)
+{
+    for (*index = route_table->lpm_indexes; *index; *index = (*index)->next) {
+        if (((*index)->sa_family == sa_family) && ((*index)->direction == direction))
+            WOLFSENTRY_RETURN_OK;
     }
 
-    new->header.refcount = 1;
-    new->header.id = WOLFSENTRY_ENT_ID_NONE;
+    if ((*index = (struct wolfsentry_route_lpm_index *)WOLFSENTRY_MALLOC(sizeof **index)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*index, 0, sizeof **index);
+    (*index)->sa_family = sa_family;
+    (*index)->direction = direction;
+    (*index)->next = route_table->lpm_indexes;
+    route_table->lpm_indexes = *index;
 
     WOLFSENTRY_RETURN_OK;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_init_by_exports(
-    struct wolfsentry_event *parent_event,
-    const struct wolfsentry_route_exports *route_exports,
-    size_t data_addr_offset,
-    size_t data_addr_size,
-    struct wolfsentry_route *new)
+static void wolfsentry_route_lpm_unlink(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route *route,
+    int d)
 {
-    if (route_exports->private_data_size > data_addr_offset)
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
-    if (data_addr_size < WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len))
-        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
-    if (data_addr_size > MAX_UINT_OF(uint16_t))
-        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
-    if ((unsigned)data_addr_offset > MAX_UINT_OF(uint16_t))
-        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
-    if (! (route_exports->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
-
-    /* make sure wildcards are sensical. */
-    if (((route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
-         ((! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
-          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
-          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
-        ((route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) &&
-         ((! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
-          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    wolfsentry_list_ent_delete(&route->lpm_nodes[d]->routes, &route->lpm_links[d]);
+    wolfsentry_route_lpm_node_prune(WOLFSENTRY_CONTEXT_ARGS_OUT, route->lpm_nodes[d]);
+    route->lpm_nodes[d] = NULL;
+    WOLFSENTRY_RETURN_VOID;
+}
 
-    memset(new, 0, offsetof(struct wolfsentry_route, data));
+static wolfsentry_errcode_t wolfsentry_route_lpm_insert(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
+{
+    int remote_len = wolfsentry_route_lpm_remote_len(route);
+    int local_len = wolfsentry_route_lpm_local_len(route);
+    int d;
+    wolfsentry_errcode_t ret;
 
-    new->parent_event = parent_event;
-    new->flags = route_exports->flags;
-    new->sa_family = route_exports->sa_family;
-    new->sa_proto = route_exports->sa_proto;
-    new->remote.sa_port = route_exports->remote.sa_port;
-    new->remote.addr_len = route_exports->remote.addr_len;
-    new->remote.interface = route_exports->remote.interface;
-    new->local.sa_port = route_exports->local.sa_port;
-    new->local.addr_len = route_exports->local.addr_len;
-    new->local.interface = route_exports->local.interface;
-    new->data_addr_offset = (uint16_t)data_addr_offset;
-    new->data_addr_size = (uint16_t)data_addr_size;
+    route->lpm_nodes[0] = route->lpm_nodes[1] = NULL;
 
-    if (data_addr_offset > 0) {
-        if (route_exports->private_data != NULL) {
-            memcpy(new->data, route_exports->private_data, route_exports->private_data_size); /* copy private data. */
-            if ((size_t)data_addr_offset > route_exports->private_data_size)
-                memset(new->data + route_exports->private_data_size, 0, (size_t)data_addr_offset - route_exports->private_data_size); /* zero leftovers. */
-        } else
-            memset(new->data, 0, (size_t)data_addr_offset); /* zero private data. */
+    if ((route->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) ||
+        (! (route->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT))) ||
+        (remote_len > WOLFSENTRY_MAX_ADDR_BITS) ||
+        (local_len > WOLFSENTRY_MAX_ADDR_BITS))
+    {
+        wolfsentry_list_ent_append(&route_table->lpm_unindexed, &route->lpm_links[0]);
+        WOLFSENTRY_RETURN_OK;
     }
 
-    new->meta.purge_after = route_exports->meta.purge_after;
-    new->meta.connection_count = route_exports->meta.connection_count;
-    new->meta.derogatory_count = route_exports->meta.derogatory_count;
-    new->meta.commendable_count = route_exports->meta.commendable_count;
+    for (d = 0; d < 2; ++d) {
+        struct wolfsentry_route_lpm_index *index;
+        wolfsentry_route_flags_t direction = d ? WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT : WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
 
-    if (route_exports->remote.addr_len > 0) {
-        memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(new),
-               route_exports->remote_address,
-               WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len));
-    }
-    if (route_exports->local.addr_len > 0) {
-        memcpy(WOLFSENTRY_ROUTE_LOCAL_ADDR(new),
-               route_exports->local_address,
-               WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len));
+        if (! (route->flags & direction))
+            continue;
+        if ((ret = wolfsentry_route_lpm_index_get(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route->sa_family, direction, &index)) < 0)
+            goto out;
+        /* index by the longer prefix, to keep candidate sets small. */
+        if (remote_len >= local_len)
+            ret = wolfsentry_route_lpm_node_get(WOLFSENTRY_CONTEXT_ARGS_OUT, &index->remote_root, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), remote_len, &route->lpm_nodes[d]);
+        else
+            ret = wolfsentry_route_lpm_node_get(WOLFSENTRY_CONTEXT_ARGS_OUT, &index->local_root, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), local_len, &route->lpm_nodes[d]);
+        if (ret < 0)
+            goto out;
+        wolfsentry_list_ent_append(&route->lpm_nodes[d]->routes, &route->lpm_links[d]);
     }
 
-    /* make sure the pad bits in the addresses are zero. */
-    {
-        int left_over_bits = route_exports->remote.addr_len % BITS_PER_BYTE;
-        if (left_over_bits) {
-            byte *remote_lsb = WOLFSENTRY_ROUTE_REMOTE_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) - 1;
-            if (*remote_lsb & (0xffU >> (BITS_PER_BYTE - left_over_bits)))
-                *remote_lsb = (byte)(*remote_lsb & (0xffU << left_over_bits));
-        }
-    }
-    {
-        int left_over_bits = route_exports->local.addr_len % BITS_PER_BYTE;
-        if (left_over_bits) {
-            byte *local_lsb = WOLFSENTRY_ROUTE_LOCAL_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len) - 1;
-            if (*local_lsb & (0xffU >> (BITS_PER_BYTE - left_over_bits)))
-                *local_lsb = (byte)(*local_lsb & (0xffU << left_over_bits));
-        }
-    }
+    WOLFSENTRY_RETURN_OK;
 
-    new->header.refcount = 1;
-    new->header.id = WOLFSENTRY_ENT_ID_NONE;
+  out:
 
-    WOLFSENTRY_RETURN_OK;
+    for (d = 0; d < 2; ++d) {
+        if (route->lpm_nodes[d])
+            wolfsentry_route_lpm_unlink(WOLFSENTRY_CONTEXT_ARGS_OUT, route, d);
+    }
+    WOLFSENTRY_ERROR_RERETURN(ret);
 }
 
-static wolfsentry_errcode_t wolfsentry_route_new(
+static void wolfsentry_route_lpm_delete(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_event *parent_event,
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    struct wolfsentry_route **new)
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
 {
-    size_t new_size;
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
-
-    new_size = WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len);
-    if (new_size > (size_t)(uint16_t)~0UL)
-        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-    new_size += offsetof(struct wolfsentry_route, data);
-    new_size += config->config.route_private_data_size;
-    if (new_size & 1)
-        ++new_size;
-    /* extra_ports storage will go here. */
+    int d;
 
-    if (config->config.route_private_data_alignment == 0)
-        *new = (struct wolfsentry_route *)WOLFSENTRY_MALLOC(new_size);
-    else
-        *new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
-    if (*new == NULL)
-        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    ret = wolfsentry_route_init(parent_event, remote, local, flags, (int)config->config.route_private_data_size, new_size - offsetof(struct wolfsentry_route, data), *new);
-    if (ret < 0) {
-        wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, *new);
-        *new = NULL;
-    } else {
-        if (parent_event != NULL) {
-            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount, ret);
-        }
+    if ((route->lpm_nodes[0] == NULL) && (route->lpm_nodes[1] == NULL)) {
+        if ((route->lpm_links[0].prev != NULL) || (route_table->lpm_unindexed.head == &route->lpm_links[0]))
+            wolfsentry_list_ent_delete(&route_table->lpm_unindexed, &route->lpm_links[0]);
+        route->lpm_links[0].prev = route->lpm_links[0].next = NULL;
+        WOLFSENTRY_RETURN_VOID;
     }
 
-    WOLFSENTRY_ERROR_RERETURN(ret);
+    for (d = 0; d < 2; ++d) {
+        if (route->lpm_nodes[d])
+            wolfsentry_route_lpm_unlink(WOLFSENTRY_CONTEXT_ARGS_OUT, route, d);
+    }
+    WOLFSENTRY_RETURN_VOID;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_new_by_exports(
+static void wolfsentry_route_lpm_free(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_event *parent_event,
-    const struct wolfsentry_route_exports *route_exports,
-    struct wolfsentry_route **new)
+    struct wolfsentry_route_table *route_table)
 {
-    size_t new_size;
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
+    while (route_table->lpm_indexes) {
+        struct wolfsentry_route_lpm_index *index = route_table->lpm_indexes;
+        route_table->lpm_indexes = index->next;
+        wolfsentry_route_lpm_node_free_all(WOLFSENTRY_CONTEXT_ARGS_OUT, index->remote_root);
+        wolfsentry_route_lpm_node_free_all(WOLFSENTRY_CONTEXT_ARGS_OUT, index->local_root);
+        WOLFSENTRY_FREE(index);
+    }
+    WOLFSENTRY_LIST_HEADER_RESET(route_table->lpm_unindexed);
+    WOLFSENTRY_RETURN_VOID;
+}
 
-    if ((route_exports->private_data_size != 0) && (route_exports->private_data_size != config->config.route_private_data_size))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+/* the tuple classifier.  FNV-1a is used for hashing, folding in only the
+ * fields that the tuple's wildcard mask leaves significant, and only the
+ * prefix bits of the addresses.
+ */
 
-    new_size = WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len);
-    if (new_size > (size_t)(uint16_t)~0UL)
-        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-    new_size += offsetof(struct wolfsentry_route, data);
-    new_size += config->config.route_private_data_size;
-    if (new_size & 1)
-        ++new_size;
-    /* extra_ports storage will go here. */
+static inline uint32_t wolfsentry_route_tuple_hash_bytes(uint32_t h, const byte *p, size_t n) {
+    for (; n > 0; --n, ++p) {
+        h ^= *p;
+        h *= 16777619U;
+    }
+    return h;
+}
 
-    if (config->config.route_private_data_alignment == 0)
-        *new = (struct wolfsentry_route *)WOLFSENTRY_MALLOC(new_size);
-    else
-        *new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
-    if (*new == NULL)
+static inline uint32_t wolfsentry_route_tuple_hash_uint(uint32_t h, uint32_t v) {
+    byte buf[4];
+    buf[0] = (byte)(v >> 24);
+    buf[1] = (byte)(v >> 16);
+    buf[2] = (byte)(v >> 8);
+    buf[3] = (byte)v;
+    return wolfsentry_route_tuple_hash_bytes(h, buf, sizeof buf);
+}
+
+static inline uint32_t wolfsentry_route_tuple_hash_prefix(uint32_t h, const byte *addr, int prefix_len) {
+    h = wolfsentry_route_tuple_hash_bytes(h, addr, (size_t)prefix_len >> 3);
+    if (prefix_len & 0x7)
+        h = wolfsentry_route_tuple_hash_uint(h, (uint32_t)(addr[prefix_len >> 3] & (0xffU << (BITS_PER_BYTE - (prefix_len & 0x7)))));
+    return h;
+}
+
+static uint32_t wolfsentry_route_tuple_hash(
+    const struct wolfsentry_route *route,
+    const struct wolfsentry_route_tuple *tuple)
+{
+    uint32_t h = 2166136261U;
+    wolfsentry_route_flags_t wildcard_flags = tuple->wildcard_flags;
+
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->sa_family);
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->sa_proto);
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->remote.sa_port);
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->local.sa_port);
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->remote.interface);
+    if (! (wildcard_flags & WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD))
+        h = wolfsentry_route_tuple_hash_uint(h, route->local.interface);
+    h = wolfsentry_route_tuple_hash_prefix(h, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), tuple->remote_prefix_len);
+    h = wolfsentry_route_tuple_hash_prefix(h, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), tuple->local_prefix_len);
+
+    return h;
+}
+
+#define WOLFSENTRY_ROUTE_TUPLE_INITIAL_BUCKETS 16U
+
+static wolfsentry_errcode_t wolfsentry_route_tuple_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    struct wolfsentry_route_tuple **tuple)
+{
+    wolfsentry_route_flags_t wildcard_flags = route->flags & WOLFSENTRY_ROUTE_WILDCARD_FLAGS;
+    int remote_len = wolfsentry_route_lpm_remote_len(route);
+    int local_len = wolfsentry_route_lpm_local_len(route);
+
+    for (*tuple = route_table->tuples; *tuple; *tuple = (*tuple)->next) {
+        if (((*tuple)->wildcard_flags == wildcard_flags) &&
+            ((*tuple)->remote_prefix_len == remote_len) &&
+            ((*tuple)->local_prefix_len == local_len))
+        {
+            WOLFSENTRY_RETURN_OK;
+        }
+    }
+
+    if ((*tuple = (struct wolfsentry_route_tuple *)WOLFSENTRY_MALLOC(sizeof **tuple)) == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    ret = wolfsentry_route_init_by_exports(parent_event, route_exports, config->config.route_private_data_size, new_size - offsetof(struct wolfsentry_route, data), *new);
-    if (ret < 0) {
-        wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, *new);
-        *new = NULL;
-    } else {
-        if (parent_event != NULL) {
-            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount, ret);
+    memset(*tuple, 0, sizeof **tuple);
+    if (((*tuple)->buckets = (struct wolfsentry_route **)WOLFSENTRY_MALLOC(sizeof *(*tuple)->buckets * WOLFSENTRY_ROUTE_TUPLE_INITIAL_BUCKETS)) == NULL) {
+        WOLFSENTRY_FREE(*tuple);
+        *tuple = NULL;
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    }
+    memset((*tuple)->buckets, 0, sizeof *(*tuple)->buckets * WOLFSENTRY_ROUTE_TUPLE_INITIAL_BUCKETS);
+    (*tuple)->n_buckets = WOLFSENTRY_ROUTE_TUPLE_INITIAL_BUCKETS;
+    (*tuple)->wildcard_flags = wildcard_flags;
+    (*tuple)->remote_prefix_len = (wolfsentry_addr_bits_t)remote_len;
+    (*tuple)->local_prefix_len = (wolfsentry_addr_bits_t)local_len;
+    (*tuple)->next = route_table->tuples;
+    route_table->tuples = *tuple;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_route_tuple_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_tuple *tuple)
+{
+    struct wolfsentry_route_tuple **i;
+    for (i = &route_table->tuples; *i; i = &(*i)->next) {
+        if (*i == tuple) {
+            *i = tuple->next;
+            break;
         }
     }
+    WOLFSENTRY_FREE(tuple->buckets);
+    WOLFSENTRY_FREE(tuple);
+    WOLFSENTRY_RETURN_VOID;
+}
 
-    WOLFSENTRY_ERROR_RERETURN(ret);
+/* double the bucket count once the load factor passes 2.  failure to grow
+ * isn't an error -- the chains just get longer.
+ */
+static void wolfsentry_route_tuple_grow(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_tuple *tuple)
+{
+    uint32_t new_n_buckets = tuple->n_buckets << 1U;
+    struct wolfsentry_route **new_buckets;
+    uint32_t b;
+
+    if (new_n_buckets == 0)
+        WOLFSENTRY_RETURN_VOID;
+    if ((new_buckets = (struct wolfsentry_route **)WOLFSENTRY_MALLOC(sizeof *new_buckets * new_n_buckets)) == NULL)
+        WOLFSENTRY_RETURN_VOID;
+    memset(new_buckets, 0, sizeof *new_buckets * new_n_buckets);
+
+    for (b = 0; b < tuple->n_buckets; ++b) {
+        struct wolfsentry_route *i, *i_next;
+        for (i = tuple->buckets[b]; i; i = i_next) {
+            i_next = i->tuple_next;
+            i->tuple_next = new_buckets[i->tuple_hash & (new_n_buckets - 1U)];
+            new_buckets[i->tuple_hash & (new_n_buckets - 1U)] = i;
+        }
+    }
+
+    WOLFSENTRY_FREE(tuple->buckets);
+    tuple->buckets = new_buckets;
+    tuple->n_buckets = new_n_buckets;
+
+    WOLFSENTRY_RETURN_VOID;
 }
 
-WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_fallthrough_route_alloc(
+static wolfsentry_errcode_t wolfsentry_route_tuple_insert(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *route_table)
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
 {
-    static const struct wolfsentry_sockaddr fallthrough_sockaddr = { 0 };
+    struct wolfsentry_route_tuple *tuple;
+    struct wolfsentry_route **bucket;
     wolfsentry_errcode_t ret;
 
-    if (route_table->fallthrough_route != NULL)
-        WOLFSENTRY_ERROR_RETURN(ALREADY);
-    if ((ret = wolfsentry_route_new(
-             WOLFSENTRY_CONTEXT_ARGS_OUT,
-             NULL /* parent_event */,
-             &fallthrough_sockaddr,
-             &fallthrough_sockaddr,
-             (WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
-              WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
-              WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT |
-              WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS),
-             &route_table->fallthrough_route)) < 0)
+    if ((ret = wolfsentry_route_tuple_get(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route, &tuple)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if (tuple->n_routes >= (wolfsentry_hitcount_t)tuple->n_buckets * 2U)
+        wolfsentry_route_tuple_grow(WOLFSENTRY_CONTEXT_ARGS_OUT, tuple);
+
+    route->tuple = tuple;
+    route->tuple_hash = wolfsentry_route_tuple_hash(route, tuple);
+    bucket = &tuple->buckets[route->tuple_hash & (tuple->n_buckets - 1U)];
+    route->tuple_next = *bucket;
+    *bucket = route;
+    ++tuple->n_routes;
+
     WOLFSENTRY_RETURN_OK;
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_fallthrough_route_get(
+static void wolfsentry_route_tuple_delete(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *route_table,
-    const struct wolfsentry_route **fallthrough_route)
+    struct wolfsentry_route *route)
 {
-    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+    struct wolfsentry_route_tuple *tuple = route->tuple;
+    struct wolfsentry_route **i;
 
-    if (route_table->fallthrough_route == NULL)
-        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
-    else {
-        wolfsentry_errcode_t ret;
-        *fallthrough_route = route_table->fallthrough_route;
-        WOLFSENTRY_REFCOUNT_INCREMENT(route_table->fallthrough_route->header.refcount, ret);
-        WOLFSENTRY_ERROR_RERETURN(ret);
+    if (tuple == NULL)
+        WOLFSENTRY_RETURN_VOID;
+
+    for (i = &tuple->buckets[route->tuple_hash & (tuple->n_buckets - 1U)]; *i; i = &(*i)->tuple_next) {
+        if (*i == route) {
+            *i = route->tuple_next;
+            break;
+        }
     }
+    route->tuple = NULL;
+    route->tuple_next = NULL;
+
+    if (--tuple->n_routes == 0)
+        wolfsentry_route_tuple_free(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, tuple);
+
+    WOLFSENTRY_RETURN_VOID;
 }
 
-WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_clone(
-    struct wolfsentry_context *src_context,
-#ifdef WOLFSENTRY_THREADSAFE
-    struct wolfsentry_thread_context *thread,
-#endif
-    struct wolfsentry_table_ent_header * const src_ent,
-    struct wolfsentry_context *dest_context,
-    struct wolfsentry_table_ent_header ** const new_ent,
-    wolfsentry_clone_flags_t flags)
+static void wolfsentry_route_tuples_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table)
 {
-    struct wolfsentry_route * const src_route = (struct wolfsentry_route * const)src_ent;
-    struct wolfsentry_route ** const new_route = (struct wolfsentry_route ** const)new_ent;
-    struct wolfsentry_eventconfig_internal *config = (src_route->parent_event && src_route->parent_event->config) ? src_route->parent_event->config : &src_context->config;
-    size_t new_size;
-    wolfsentry_errcode_t ret;
+    struct wolfsentry_table_ent_header *i;
 
-    (void)flags;
+    for (i = route_table->header.head; i; i = i->next) {
+        ((struct wolfsentry_route *)i)->tuple = NULL;
+        ((struct wolfsentry_route *)i)->tuple_next = NULL;
+    }
+    while (route_table->tuples)
+        wolfsentry_route_tuple_free(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route_table->tuples);
 
-    new_size = WOLFSENTRY_BITS_TO_BYTES((size_t)src_route->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)src_route->local.addr_len);
-    if (new_size > (size_t)(uint16_t)~0UL)
-        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-    new_size += offsetof(struct wolfsentry_route, data);
-    new_size += config->config.route_private_data_size;
-    if (new_size & 1)
-        ++new_size;
-    /* extra_ports storage will go here. */
+    WOLFSENTRY_RETURN_VOID;
+}
 
-    if ((*new_route = WOLFSENTRY_MALLOC_1(dest_context->hpi.allocator, new_size)) == NULL)
-        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    memcpy(*new_route, src_route, new_size);
-    WOLFSENTRY_TABLE_ENT_HEADER_RESET(**new_ent);
 
-    if (src_route->parent_event) {
-        (*new_route)->parent_event = src_route->parent_event;
-        if ((ret = wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), &dest_context->events->header, (struct wolfsentry_table_ent_header **)&(*new_route)->parent_event)) < 0) {
-            wolfsentry_route_free_1(dest_context,
+WOLFSENTRY_LOCAL_VOID wolfsentry_route_table_generation_bump(
+    struct wolfsentry_route_table *route_table)
+{
+    wolfsentry_hitcount_t generation;
+    generation = WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(route_table->generation);
+    /* zero marks empty flow cache slots. */
+    if (generation == 0)
+        (void)WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(route_table->generation);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* the flow cache.  a set-associative cache of lookup results, consulted by
+ * wolfsentry_route_event_dispatch_1() ahead of wolfsentry_route_lookup_0().
+ * dispatch runs under a shared lock, so each set is claimed with a try-lock,
+ * and a dispatcher that loses the race just bypasses the cache.
+ */
+
 #ifdef WOLFSENTRY_THREADSAFE
-                                    thread,
+static inline int wolfsentry_route_flow_cache_set_trylock(struct wolfsentry_route_flow_cache_set *set) {
+    uint32_t expected = 0;
+    return WOLFSENTRY_ATOMIC_TEST_AND_SET(set->lock, expected, 1U);
+}
+static inline void wolfsentry_route_flow_cache_set_unlock(struct wolfsentry_route_flow_cache_set *set) {
+    WOLFSENTRY_ATOMIC_STORE(set->lock, 0U);
+}
+#else
+#define wolfsentry_route_flow_cache_set_trylock(set) ((void)(set), 1)
+#define wolfsentry_route_flow_cache_set_unlock(set) ((void)(set))
 #endif
-                                    config, *new_route);
-            WOLFSENTRY_ERROR_RERETURN(ret);
+
+static inline int wolfsentry_route_flow_cache_eligible(const struct wolfsentry_route *target_route) {
+    return (target_route->remote.addr_len <= WOLFSENTRY_MAX_ADDR_BITS) && (target_route->local.addr_len <= WOLFSENTRY_MAX_ADDR_BITS);
+}
+
+/* the trigger event is keyed by ID rather than pointer, because IDs aren't
+ * reused, so a freed event can't alias a later one at the same address.
+ */
+static inline wolfsentry_ent_id_t wolfsentry_route_flow_cache_event_id(const struct wolfsentry_route *target_route) {
+    return target_route->parent_event ? target_route->parent_event->header.id : WOLFSENTRY_ENT_ID_NONE;
+}
+
+static uint32_t wolfsentry_route_flow_cache_hash(
+    const struct wolfsentry_route *target_route,
+    wolfsentry_action_res_t action_results)
+{
+    uint32_t h = 2166136261U;
+    h = wolfsentry_route_tuple_hash_uint(h, target_route->sa_family);
+    h = wolfsentry_route_tuple_hash_uint(h, target_route->sa_proto);
+    h = wolfsentry_route_tuple_hash_uint(h, ((uint32_t)target_route->remote.sa_port << 16U) | target_route->local.sa_port);
+    h = wolfsentry_route_tuple_hash_uint(h, ((uint32_t)target_route->remote.interface << 8U) | target_route->local.interface);
+    h = wolfsentry_route_tuple_hash_uint(h, target_route->flags);
+    h = wolfsentry_route_tuple_hash_uint(h, action_results);
+    h = wolfsentry_route_tuple_hash_uint(h, (uint32_t)wolfsentry_route_flow_cache_event_id(target_route));
+    h = wolfsentry_route_tuple_hash_prefix(h, WOLFSENTRY_ROUTE_REMOTE_ADDR(target_route), target_route->remote.addr_len);
+    h = wolfsentry_route_tuple_hash_prefix(h, WOLFSENTRY_ROUTE_LOCAL_ADDR(target_route), target_route->local.addr_len);
+    return h;
+}
+
+static inline int wolfsentry_route_flow_cache_ent_matches(
+    const struct wolfsentry_route_flow_cache_ent *ent,
+    const struct wolfsentry_route *target_route,
+    wolfsentry_action_res_t action_results,
+    uint32_t hash)
+{
+    return (ent->hash == hash) &&
+        (ent->flags == target_route->flags) &&
+        (ent->action_results == action_results) &&
+        (ent->parent_event_id == wolfsentry_route_flow_cache_event_id(target_route)) &&
+        (ent->sa_family == target_route->sa_family) &&
+        (ent->sa_proto == target_route->sa_proto) &&
+        (ent->remote_port == target_route->remote.sa_port) &&
+        (ent->local_port == target_route->local.sa_port) &&
+        (ent->remote_interface == target_route->remote.interface) &&
+        (ent->local_interface == target_route->local.interface) &&
+        (ent->remote_addr_len == target_route->remote.addr_len) &&
+        (ent->local_addr_len == target_route->local.addr_len) &&
+        (memcmp(ent->remote_addr, WOLFSENTRY_ROUTE_REMOTE_ADDR(target_route), WOLFSENTRY_BITS_TO_BYTES((size_t)ent->remote_addr_len)) == 0) &&
+        (memcmp(ent->local_addr, WOLFSENTRY_ROUTE_LOCAL_ADDR(target_route), WOLFSENTRY_BITS_TO_BYTES((size_t)ent->local_addr_len)) == 0);
+}
+
+/* returns nonzero on a hit, with the cached result in *route (or for a match
+ * in the route image, *image_route) and *inexact_matches.
+ */
+static int wolfsentry_route_flow_cache_get(
+    struct wolfsentry_route_flow_cache *cache,
+    const struct wolfsentry_route *target_route,
+    wolfsentry_action_res_t action_results,
+    uint32_t hash,
+    wolfsentry_hitcount_t generation,
+    struct wolfsentry_route **route,
+    const struct wolfsentry_route_image_route **image_route,
+    wolfsentry_route_flags_t *inexact_matches)
+{
+    struct wolfsentry_route_flow_cache_set *set = &cache->sets[hash & (cache->n_sets - 1U)];
+    int hit = 0;
+    int w;
+
+    if (! wolfsentry_route_flow_cache_set_trylock(set))
+        return 0;
+    for (w = 0; w < WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS; ++w) {
+        const struct wolfsentry_route_flow_cache_ent *ent = &set->ways[w];
+        if ((ent->generation == generation) && wolfsentry_route_flow_cache_ent_matches(ent, target_route, action_results, hash)) {
+            *route = ent->route;
+            *image_route = ent->image_route;
+            *inexact_matches = ent->inexact_matches;
+            hit = 1;
+            break;
         }
-        WOLFSENTRY_REFCOUNT_INCREMENT((*new_route)->parent_event->header.refcount, ret);
-        WOLFSENTRY_RERETURN_IF_ERROR(ret);
     }
+    wolfsentry_route_flow_cache_set_unlock(set);
 
-    WOLFSENTRY_RETURN_OK;
+    return hit;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_stale_purge_one_opportunistically(
+static void wolfsentry_route_flow_cache_put(
+    struct wolfsentry_route_flow_cache *cache,
+    const struct wolfsentry_route *target_route,
+    wolfsentry_action_res_t action_results,
+    uint32_t hash,
+    wolfsentry_hitcount_t generation,
+    struct wolfsentry_route *route,
+    const struct wolfsentry_route_image_route *image_route,
+    wolfsentry_route_flags_t inexact_matches)
+{
+    struct wolfsentry_route_flow_cache_set *set = &cache->sets[hash & (cache->n_sets - 1U)];
+    struct wolfsentry_route_flow_cache_ent *ent = NULL;
+    int w;
+
+    if (! wolfsentry_route_flow_cache_set_trylock(set))
+        return;
+
+    /* prefer a stale slot, else evict round-robin. */
+    for (w = 0; w < WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS; ++w) {
+        if (set->ways[w].generation != generation) {
+            ent = &set->ways[w];
+            break;
+        }
+    }
+    if (ent == NULL) {
+        ent = &set->ways[set->next_victim];
+        set->next_victim = (set->next_victim + 1U) % WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS;
+    }
+
+    ent->generation = generation;
+    ent->route = route;
+    ent->image_route = image_route;
+    ent->hash = hash;
+    ent->flags = target_route->flags;
+    ent->inexact_matches = inexact_matches;
+    ent->action_results = action_results;
+    ent->parent_event_id = wolfsentry_route_flow_cache_event_id(target_route);
+    ent->sa_family = target_route->sa_family;
+    ent->sa_proto = target_route->sa_proto;
+    ent->remote_port = target_route->remote.sa_port;
+    ent->local_port = target_route->local.sa_port;
+    ent->remote_interface = target_route->remote.interface;
+    ent->local_interface = target_route->local.interface;
+    ent->remote_addr_len = target_route->remote.addr_len;
+    ent->local_addr_len = target_route->local.addr_len;
+    memcpy(ent->remote_addr, WOLFSENTRY_ROUTE_REMOTE_ADDR(target_route), WOLFSENTRY_BITS_TO_BYTES((size_t)ent->remote_addr_len));
+    memcpy(ent->local_addr, WOLFSENTRY_ROUTE_LOCAL_ADDR(target_route), WOLFSENTRY_BITS_TO_BYTES((size_t)ent->local_addr_len));
+
+    wolfsentry_route_flow_cache_set_unlock(set);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_flow_cache_new(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *table,
-    wolfsentry_action_res_t *action_results);
+    size_t n_entries,
+    struct wolfsentry_route_flow_cache **cache)
+{
+    uint32_t n_sets = 1;
+    size_t cache_size;
 
-static wolfsentry_errcode_t wolfsentry_route_stale_purge_one_unconditionally(
+    while ((size_t)n_sets * WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS < n_entries) {
+        if (n_sets >= (1U << 24U))
+            WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+        n_sets <<= 1U;
+    }
+
+    cache_size = offsetof(struct wolfsentry_route_flow_cache, sets) + (sizeof (*cache)->sets[0] * n_sets);
+    if ((*cache = (struct wolfsentry_route_flow_cache *)WOLFSENTRY_MALLOC(cache_size)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*cache, 0, cache_size);
+    (*cache)->n_sets = n_sets;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* add a route newly in route_table to the LPM index, and to the tuple
+ * classifier if it's enabled.
+ */
+static wolfsentry_errcode_t wolfsentry_route_table_index_insert(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *table,
-    wolfsentry_action_res_t *action_results);
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
+{
+    wolfsentry_errcode_t ret;
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_check_flags_sensical(wolfsentry_route_flags_t flags) {
-    if (((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
+    route->tuple = NULL;
+    route->tuple_next = NULL;
+
+    if ((ret = wolfsentry_route_lpm_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if (route_table->tuple_classifier_enabled) {
+        if ((ret = wolfsentry_route_tuple_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route)) < 0) {
+            wolfsentry_route_lpm_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+    }
+
+    wolfsentry_route_table_generation_bump(route_table);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_route_table_index_delete(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
+{
+    wolfsentry_route_lpm_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+    wolfsentry_route_tuple_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+    wolfsentry_route_table_generation_bump(route_table);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* copy the trie at src_root node for node, in preorder, linking each node's
+ * routes to their copies in the (destination) context, which have the same
+ * IDs.
+ */
+static wolfsentry_errcode_t wolfsentry_route_lpm_trie_clone(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_route_lpm_node *src_root,
+    struct wolfsentry_route_lpm_node **dest_root,
+    int d)
+{
+    const struct wolfsentry_route_lpm_node *src = src_root;
+    struct wolfsentry_route_lpm_node *dest_parent = NULL, **dest_slot = dest_root, *dest;
+    const struct wolfsentry_list_ent_header *link;
+    struct wolfsentry_table_ent_header *route;
+
+    while (src != NULL) {
+        if ((dest = (struct wolfsentry_route_lpm_node *)WOLFSENTRY_MALLOC(sizeof *dest)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        memcpy(dest, src, sizeof *dest);
+        dest->parent = dest_parent;
+        dest->child[0] = dest->child[1] = NULL;
+        WOLFSENTRY_LIST_HEADER_RESET(dest->routes);
+        *dest_slot = dest;
+
+        for (link = src->routes.head; link; link = link->next) {
+            WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_table_ent_get_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_ROUTE_LPM_LINK_TO_ROUTE(link, d)->header.id, &route));
+            ((struct wolfsentry_route *)route)->lpm_nodes[d] = dest;
+            wolfsentry_list_ent_append(&dest->routes, &((struct wolfsentry_route *)route)->lpm_links[d]);
+        }
+
+        if (src->child[0] || src->child[1]) {
+            int bit = (src->child[0] == NULL);
+            dest_parent = dest;
+            dest_slot = &dest->child[bit];
+            src = src->child[bit];
+            continue;
+        }
+
+        /* back up to the nearest right sibling not yet visited. */
+        for (;;) {
+            if (src == src_root) {
+                src = NULL;
+                break;
+            }
+            if ((src->parent->child[0] == src) && (src->parent->child[1] != NULL)) {
+                dest_parent = dest->parent;
+                dest_slot = &dest->parent->child[1];
+                src = src->parent->child[1];
+                break;
+            }
+            src = src->parent;
+            dest = dest->parent;
+        }
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* index the routes just copied from src_table into dest_table.  rather than
+ * descending the LPM tries once per route, the source tries are copied whole,
+ * so the cost is linear in the size of the tries.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_clone_indexes(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_route_table *src_table,
+    struct wolfsentry_context *dest_context,
+    struct wolfsentry_route_table *dest_table)
+{
+    const struct wolfsentry_route_lpm_index *src_index;
+    struct wolfsentry_route_lpm_index **dest_index = &dest_table->lpm_indexes;
+    const struct wolfsentry_list_ent_header *link;
+    struct wolfsentry_table_ent_header *i;
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
+
+    if ((dest_table->lpm_indexes != NULL) || (dest_table->lpm_unindexed.head != NULL))
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+
+    for (src_index = src_table->lpm_indexes; src_index; src_index = src_index->next) {
+        int d = (src_index->direction == WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
+        if ((*dest_index = (struct wolfsentry_route_lpm_index *)WOLFSENTRY_MALLOC_1(dest_context->hpi.allocator, sizeof **dest_index)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        memset(*dest_index, 0, sizeof **dest_index);
+        (*dest_index)->sa_family = src_index->sa_family;
+        (*dest_index)->direction = src_index->direction;
+        if ((ret = wolfsentry_route_lpm_trie_clone(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), src_index->remote_root, &(*dest_index)->remote_root, d)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        if ((ret = wolfsentry_route_lpm_trie_clone(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), src_index->local_root, &(*dest_index)->local_root, d)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        dest_index = &(*dest_index)->next;
+    }
+
+    for (link = src_table->lpm_unindexed.head; link; link = link->next) {
+        if ((ret = wolfsentry_table_ent_get_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), WOLFSENTRY_ROUTE_LPM_LINK_TO_ROUTE(link, 0)->header.id, &i)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        wolfsentry_list_ent_append(&dest_table->lpm_unindexed, &((struct wolfsentry_route *)i)->lpm_links[0]);
+    }
+
+    if (dest_table->tuple_classifier_enabled) {
+        for (i = dest_table->header.head; i; i = i->next) {
+            if ((ret = wolfsentry_route_tuple_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), dest_table, (struct wolfsentry_route *)i)) < 0)
+                WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+    }
+
+    wolfsentry_route_table_generation_bump(dest_table);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_route_update_flags_1(
+    struct wolfsentry_route *route,
+    wolfsentry_route_flags_t flags_to_set,
+    wolfsentry_route_flags_t flags_to_clear,
+    wolfsentry_route_flags_t *flags_before,
+    wolfsentry_route_flags_t *flags_after);
+
+static void wolfsentry_route_free_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_eventconfig_internal *config,
+    struct wolfsentry_route *route)
+{
+    if (config->config.route_private_data_alignment == 0)
+        WOLFSENTRY_FREE(route);
+    else
+        WOLFSENTRY_FREE_ALIGNED(route);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_drop_reference_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_eventconfig_internal *config = (route->parent_event && route->parent_event->config) ? route->parent_event->config : &wolfsentry->config;
+    wolfsentry_errcode_t ret;
+    wolfsentry_refcount_t refs_left;
+    if (route->header.refcount <= 0)
+        WOLFSENTRY_ERROR_RETURN(INTERNAL_CHECK_FATAL);
+    if ((route->header.parent_table != NULL) &&
+        (route->header.parent_table->ent_type != WOLFSENTRY_OBJECT_TYPE_ROUTE))
+        WOLFSENTRY_ERROR_RETURN(WRONG_OBJECT);
+    WOLFSENTRY_REFCOUNT_DECREMENT(route->header.refcount, refs_left, ret);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    if (refs_left > 0)
+        WOLFSENTRY_RETURN_OK;
+    if (route->parent_event)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route->parent_event, NULL /* action_results */));
+    wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, route);
+    if (action_results)
+        WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED);
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_drop_reference(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    if (action_results)
+        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route, action_results));
+}
+
+static wolfsentry_errcode_t wolfsentry_route_drop_reference_generic(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_table_ent_header *route,
+    wolfsentry_action_res_t *action_results)
+{
+    if (action_results)
+        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, (struct wolfsentry_route *)route, action_results));
+}
+
+static wolfsentry_errcode_t wolfsentry_route_init(
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    int data_addr_offset,
+    size_t data_addr_size,
+    struct wolfsentry_route *new)
+{
+    if (data_addr_size < WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len))
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    if (data_addr_size > MAX_UINT_OF(uint16_t))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if ((unsigned)data_addr_offset > MAX_UINT_OF(uint16_t))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if (! (flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    /* make sure wildcards are sensical. */
+    if (((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
          ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
           (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
           (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
@@ -736,363 +1220,1842 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_check_flags_sensical(wolfse
          ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
           (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    memset(new, 0, offsetof(struct wolfsentry_route, data));
+
+    new->parent_event = parent_event;
+    new->flags = flags;
+    new->sa_family = remote->sa_family;
+    new->sa_proto = remote->sa_proto;
+    new->remote.sa_port = remote->sa_port;
+    new->remote.addr_len = remote->addr_len;
+    new->remote.interface = remote->interface;
+    new->local.sa_port = local->sa_port;
+    new->local.addr_len = local->addr_len;
+    new->local.interface = local->interface;
+    new->data_addr_offset = (uint16_t)data_addr_offset;
+    new->data_addr_size = (uint16_t)data_addr_size;
+
+    if (data_addr_offset > 0)
+        memset(new->data, 0, (size_t)data_addr_offset); /* zero private data. */
+
+    if (remote->addr_len > 0)
+        memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(new), remote->addr, WOLFSENTRY_BITS_TO_BYTES(remote->addr_len));
+    if (local->addr_len > 0)
+        memcpy(WOLFSENTRY_ROUTE_LOCAL_ADDR(new), local->addr, WOLFSENTRY_BITS_TO_BYTES(local->addr_len));
+
+    /* make sure the pad bits in the addresses (the least significant bits of
+     * the last byte) are zero.
+     */
+    {
+        int left_over_bits = remote->addr_len % BITS_PER_BYTE;
+        if (left_over_bits) {
+            byte *remote_lsb = WOLFSENTRY_ROUTE_REMOTE_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) - 1;
+            if (*remote_lsb & (0xffU >> left_over_bits))
+                *remote_lsb = (byte)(*remote_lsb & (0xffU << (BITS_PER_BYTE - left_over_bits)));
+        }
+    }
+    {
+        int left_over_bits = local->addr_len % BITS_PER_BYTE;
+        if (left_over_bits) {
+            byte *local_lsb = WOLFSENTRY_ROUTE_LOCAL_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len) - 1;
+            if (*local_lsb & (0xffU >> left_over_bits))
+                *local_lsb = (byte)(*local_lsb & (0xffU << (BITS_PER_BYTE - left_over_bits)));
+        }
+    }
+
+    new->header.refcount = 1;
+    new->header.id = WOLFSENTRY_ENT_ID_NONE;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_init_by_exports(
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_route_exports *route_exports,
+    size_t data_addr_offset,
+    size_t data_addr_size,
+    struct wolfsentry_route *new)
+{
+    if (route_exports->private_data_size > data_addr_offset)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (data_addr_size < WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len))
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    if (data_addr_size > MAX_UINT_OF(uint16_t))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if ((unsigned)data_addr_offset > MAX_UINT_OF(uint16_t))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if (! (route_exports->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    /* make sure wildcards are sensical. */
+    if (((route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
+         ((! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
+          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
+          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
+        ((route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) &&
+         ((! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
+          (! (route_exports->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    memset(new, 0, offsetof(struct wolfsentry_route, data));
+
+    new->parent_event = parent_event;
+    new->flags = route_exports->flags;
+    new->sa_family = route_exports->sa_family;
+    new->sa_proto = route_exports->sa_proto;
+    new->remote.sa_port = route_exports->remote.sa_port;
+    new->remote.addr_len = route_exports->remote.addr_len;
+    new->remote.interface = route_exports->remote.interface;
+    new->local.sa_port = route_exports->local.sa_port;
+    new->local.addr_len = route_exports->local.addr_len;
+    new->local.interface = route_exports->local.interface;
+    new->data_addr_offset = (uint16_t)data_addr_offset;
+    new->data_addr_size = (uint16_t)data_addr_size;
+
+    if (data_addr_offset > 0) {
+        if (route_exports->private_data != NULL) {
+            memcpy(new->data, route_exports->private_data, route_exports->private_data_size); /* copy private data. */
+            if ((size_t)data_addr_offset > route_exports->private_data_size)
+                memset(new->data + route_exports->private_data_size, 0, (size_t)data_addr_offset - route_exports->private_data_size); /* zero leftovers. */
+        } else
+            memset(new->data, 0, (size_t)data_addr_offset); /* zero private data. */
+    }
+
+    new->meta.purge_after = route_exports->meta.purge_after;
+    new->meta.connection_count = route_exports->meta.connection_count;
+    new->meta.derogatory_count = route_exports->meta.derogatory_count;
+    new->meta.commendable_count = route_exports->meta.commendable_count;
+
+    if (route_exports->remote.addr_len > 0) {
+        memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(new),
+               route_exports->remote_address,
+               WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len));
+    }
+    if (route_exports->local.addr_len > 0) {
+        memcpy(WOLFSENTRY_ROUTE_LOCAL_ADDR(new),
+               route_exports->local_address,
+               WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len));
+    }
+
+    /* make sure the pad bits in the addresses are zero. */
+    {
+        int left_over_bits = route_exports->remote.addr_len % BITS_PER_BYTE;
+        if (left_over_bits) {
+            byte *remote_lsb = WOLFSENTRY_ROUTE_REMOTE_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) - 1;
+            if (*remote_lsb & (0xffU >> left_over_bits))
+                *remote_lsb = (byte)(*remote_lsb & (0xffU << (BITS_PER_BYTE - left_over_bits)));
+        }
+    }
+    {
+        int left_over_bits = route_exports->local.addr_len % BITS_PER_BYTE;
+        if (left_over_bits) {
+            byte *local_lsb = WOLFSENTRY_ROUTE_LOCAL_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len) - 1;
+            if (*local_lsb & (0xffU >> left_over_bits))
+                *local_lsb = (byte)(*local_lsb & (0xffU << (BITS_PER_BYTE - left_over_bits)));
+        }
+    }
+
+    new->header.refcount = 1;
+    new->header.id = WOLFSENTRY_ENT_ID_NONE;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_new(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_route **new)
+{
+    size_t new_size;
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
+
+    new_size = WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len);
+    if (new_size > (size_t)(uint16_t)~0UL)
+        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+    new_size += offsetof(struct wolfsentry_route, data);
+    new_size += config->config.route_private_data_size;
+    if (new_size & 1)
+        ++new_size;
+    /* extra_ports storage will go here. */
+
+    if (config->config.route_private_data_alignment == 0)
+        *new = (struct wolfsentry_route *)WOLFSENTRY_MALLOC(new_size);
+    else
+        *new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
+    if (*new == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    ret = wolfsentry_route_init(parent_event, remote, local, flags, (int)config->config.route_private_data_size, new_size - offsetof(struct wolfsentry_route, data), *new);
+    if (ret < 0) {
+        wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, *new);
+        *new = NULL;
+    } else {
+        if (parent_event != NULL) {
+            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount, ret);
+        }
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_new_by_exports(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_route_exports *route_exports,
+    struct wolfsentry_route **new)
+{
+    size_t new_size;
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
+
+    if ((route_exports->private_data_size != 0) && (route_exports->private_data_size != config->config.route_private_data_size))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    new_size = WOLFSENTRY_BITS_TO_BYTES(route_exports->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES(route_exports->local.addr_len);
+    if (new_size > (size_t)(uint16_t)~0UL)
+        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+    new_size += offsetof(struct wolfsentry_route, data);
+    new_size += config->config.route_private_data_size;
+    if (new_size & 1)
+        ++new_size;
+    /* extra_ports storage will go here. */
+
+    if (config->config.route_private_data_alignment == 0)
+        *new = (struct wolfsentry_route *)WOLFSENTRY_MALLOC(new_size);
+    else
+        *new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
+    if (*new == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    ret = wolfsentry_route_init_by_exports(parent_event, route_exports, config->config.route_private_data_size, new_size - offsetof(struct wolfsentry_route, data), *new);
+    if (ret < 0) {
+        wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, *new);
+        *new = NULL;
+    } else {
+        if (parent_event != NULL) {
+            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount, ret);
+        }
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_fallthrough_route_alloc(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table)
+{
+    static const struct wolfsentry_sockaddr fallthrough_sockaddr = { 0 };
+    wolfsentry_errcode_t ret;
+
+    if (route_table->fallthrough_route != NULL)
+        WOLFSENTRY_ERROR_RETURN(ALREADY);
+    if ((ret = wolfsentry_route_new(
+             WOLFSENTRY_CONTEXT_ARGS_OUT,
+             NULL /* parent_event */,
+             &fallthrough_sockaddr,
+             &fallthrough_sockaddr,
+             (WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
+              WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+              WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT |
+              WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS),
+             &route_table->fallthrough_route)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_fallthrough_route_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route **fallthrough_route)
+{
+    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+
+    if (route_table->fallthrough_route == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    else {
+        wolfsentry_errcode_t ret;
+        *fallthrough_route = route_table->fallthrough_route;
+        WOLFSENTRY_REFCOUNT_INCREMENT(route_table->fallthrough_route->header.refcount, ret);
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+}
+
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_clone(
+    struct wolfsentry_context *src_context,
+#ifdef WOLFSENTRY_THREADSAFE
+    struct wolfsentry_thread_context *thread,
+#endif
+    struct wolfsentry_table_ent_header * const src_ent,
+    struct wolfsentry_context *dest_context,
+    struct wolfsentry_table_ent_header ** const new_ent,
+    wolfsentry_clone_flags_t flags)
+{
+    struct wolfsentry_route * const src_route = (struct wolfsentry_route * const)src_ent;
+    struct wolfsentry_route ** const new_route = (struct wolfsentry_route ** const)new_ent;
+    struct wolfsentry_eventconfig_internal *config = (src_route->parent_event && src_route->parent_event->config) ? src_route->parent_event->config : &src_context->config;
+    size_t new_size;
+    wolfsentry_errcode_t ret;
+
+    (void)flags;
+
+    new_size = WOLFSENTRY_BITS_TO_BYTES((size_t)src_route->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)src_route->local.addr_len);
+    if (new_size > (size_t)(uint16_t)~0UL)
+        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+    new_size += offsetof(struct wolfsentry_route, data);
+    new_size += config->config.route_private_data_size;
+    if (new_size & 1)
+        ++new_size;
+    /* extra_ports storage will go here. */
+
+    if ((*new_route = WOLFSENTRY_MALLOC_1(dest_context->hpi.allocator, new_size)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memcpy(*new_route, src_route, new_size);
+    WOLFSENTRY_TABLE_ENT_HEADER_RESET(**new_ent);
+    /* the clone is indexed afresh when it's added to the destination table. */
+    (*new_route)->purge_bucket = NULL;
+    (*new_route)->lpm_links[0].prev = (*new_route)->lpm_links[0].next = NULL;
+    (*new_route)->lpm_nodes[0] = (*new_route)->lpm_nodes[1] = NULL;
+    (*new_route)->tuple = NULL;
+    (*new_route)->tuple_next = NULL;
+
+    if (src_route->parent_event) {
+        (*new_route)->parent_event = src_route->parent_event;
+        if ((ret = wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), &dest_context->events->header, (struct wolfsentry_table_ent_header **)&(*new_route)->parent_event)) < 0) {
+            wolfsentry_route_free_1(dest_context,
+#ifdef WOLFSENTRY_THREADSAFE
+                                    thread,
+#endif
+                                    config, *new_route);
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+        WOLFSENTRY_REFCOUNT_INCREMENT((*new_route)->parent_event->header.refcount, ret);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the purge wheel.  a route is filed in the lowest level whose span covers the
+ * distance from cur_tick to its purge_after, so scheduling and cancelling are
+ * O(1).  advancing the wheel processes only the slots whose periods it
+ * crosses, highest level first, refiling each route there into a lower level,
+ * or onto the due list if its purge_after has passed.  purge_after is compared
+ * exactly at that point, so the tick granularity never purges a route early,
+ * and a route whose purge_after moved later since it was filed is simply
+ * refiled when its old slot comes up.
+ */
+
+static inline uint64_t wolfsentry_route_purge_wheel_tick(wolfsentry_time_t when) {
+    if (when <= 0)
+        return 0;
+    return (uint64_t)when >> WOLFSENTRY_ROUTE_PURGE_WHEEL_TICK_SHIFT;
+}
+
+static void wolfsentry_route_purge_wheel_file(struct wolfsentry_route_purge_wheel *wheel, struct wolfsentry_route *route) {
+    uint64_t tick = wolfsentry_route_purge_wheel_tick(route->meta.purge_after);
+    unsigned int level = 0;
+
+    if (tick <= wheel->cur_tick) {
+        tick = wheel->cur_tick;
+        if (route->meta.purge_after < wheel->cur_slot_earliest)
+            wheel->cur_slot_earliest = route->meta.purge_after;
+    } else {
+        uint64_t delta = tick - wheel->cur_tick;
+        while ((level < WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS - 1) &&
+               (delta >= ((uint64_t)1 << ((level + 1) * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS))))
+            ++level;
+        if (delta >= ((uint64_t)1 << (WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)))
+            tick = wheel->cur_tick + ((uint64_t)1 << (WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)) - 1;
+    }
+    route->purge_bucket = &wheel->slots[level][(tick >> (level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)) & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)];
+    wolfsentry_list_ent_append(route->purge_bucket, &route->purge_links);
+}
+
+static inline void wolfsentry_route_purge_wheel_unfile(struct wolfsentry_route *route) {
+    wolfsentry_list_ent_delete(route->purge_bucket, &route->purge_links);
+    route->purge_bucket = NULL;
+}
+
+WOLFSENTRY_LOCAL_VOID wolfsentry_route_purge_wheel_schedule(struct wolfsentry_route_table *route_table, struct wolfsentry_route *route) {
+    wolfsentry_route_purge_wheel_file(&route_table->purge_wheel, route);
+    ++route_table->purge_wheel.len;
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static inline void wolfsentry_route_purge_wheel_reschedule(struct wolfsentry_route_table *route_table, struct wolfsentry_route *route) {
+    if (route->purge_bucket == NULL)
+        return;
+    wolfsentry_route_purge_wheel_unfile(route);
+    wolfsentry_route_purge_wheel_file(&route_table->purge_wheel, route);
+}
+
+/* the purge deadline as refreshed by hits since the route was filed. */
+static wolfsentry_time_t wolfsentry_route_purge_deadline(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route)
+{
+    const struct wolfsentry_event *parent_event = route->parent_event ? route->parent_event : route_table->default_event;
+    const struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
+    wolfsentry_time_t last_hit_time = WOLFSENTRY_ATOMIC_LOAD_RELAXED(route->meta.last_hit_time);
+
+    if ((config->config.route_idle_time_for_purge > 0) &&
+        (last_hit_time != 0) &&
+        (last_hit_time + config->config.route_idle_time_for_purge > route->meta.purge_after))
+    {
+        return last_hit_time + config->config.route_idle_time_for_purge;
+    }
+    return route->meta.purge_after;
+}
+
+static inline void wolfsentry_route_purge_wheel_cancel(struct wolfsentry_route_table *route_table, struct wolfsentry_route *route) {
+    if (route->purge_bucket == NULL)
+        return;
+    wolfsentry_route_purge_wheel_unfile(route);
+    --route_table->purge_wheel.len;
+}
+
+static void wolfsentry_route_purge_wheel_process_slot(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_list_header *slot,
+    wolfsentry_time_t now)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &route_table->purge_wheel;
+    struct wolfsentry_list_header pending = *slot;
+
+    WOLFSENTRY_LIST_HEADER_RESET(*slot);
+    while (pending.head) {
+        struct wolfsentry_list_ent_header *link = pending.head;
+        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(link);
+        wolfsentry_list_ent_delete(&pending, link);
+        if (route->meta.purge_after <= now)
+            route->meta.purge_after = wolfsentry_route_purge_deadline(wolfsentry, route_table, route);
+        if (route->meta.purge_after <= now) {
+            route->purge_bucket = &wheel->due;
+            wolfsentry_list_ent_append(&wheel->due, link);
+        } else
+            wolfsentry_route_purge_wheel_file(wheel, route);
+    }
+}
+
+static void wolfsentry_route_purge_wheel_advance(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *route_table,
+    wolfsentry_time_t now)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &route_table->purge_wheel;
+    uint64_t now_tick = wolfsentry_route_purge_wheel_tick(now);
+    uint64_t prev_tick;
+    int level;
+
+    if (now_tick <= wheel->cur_tick) {
+        /* the level 0 slot for cur_tick is the only one that can have come due. */
+        if (now < wheel->cur_slot_earliest)
+            return;
+        now_tick = wheel->cur_tick;
+    }
+    prev_tick = wheel->cur_tick;
+    wheel->cur_tick = now_tick;
+    wheel->cur_slot_earliest = MAX_SINT_OF(wheel->cur_slot_earliest);
+    if (wheel->len == 0)
+        return;
+
+    for (level = WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS - 1; level >= 0; --level) {
+        unsigned int shift = (unsigned int)level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS;
+        /* above level 0, a slot is processed when its period is entered.  at
+         * level 0, the slot for prev_tick is revisited, because it holds
+         * routes due later in that tick.
+         */
+        uint64_t first = (prev_tick >> shift) + (level > 0 ? 1 : 0);
+        uint64_t last = now_tick >> shift;
+        uint64_t period;
+        if (first > last)
+            continue;
+        if (last - first >= WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1) {
+            first = 0;
+            last = WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1;
+        }
+        for (period = first; period <= last; ++period)
+            wolfsentry_route_purge_wheel_process_slot(wolfsentry, route_table, &wheel->slots[level][period & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)], now);
+    }
+}
+
+/* the route with the earliest purge_after, for eviction when the table is at
+ * max_purgeable_routes.  the first occupied slot of each level, in time order
+ * from cur_tick, holds that level's earliest routes.  above level 0, the slot
+ * for cur_tick's own period was emptied when the period was entered, and only
+ * holds routes a full rotation ahead, so it comes last in that order.
+ */
+static struct wolfsentry_route *wolfsentry_route_purge_wheel_earliest(struct wolfsentry_route_purge_wheel *wheel) {
+    struct wolfsentry_route *earliest = NULL;
+    unsigned int level, i;
+
+    if (wheel->due.head)
+        return WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(wheel->due.head);
+
+    for (level = 0; level < WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS; ++level) {
+        uint64_t period = wheel->cur_tick >> (level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS);
+        unsigned int first = (level > 0) ? 1U : 0U;
+        for (i = first; i < first + WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS; ++i) {
+            struct wolfsentry_list_header *slot = &wheel->slots[level][(period + i) & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)];
+            struct wolfsentry_list_ent_header *link;
+            if (slot->head == NULL)
+                continue;
+            for (link = slot->head; link; link = link->next) {
+                struct wolfsentry_route *route = WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(link);
+                if ((earliest == NULL) || (route->meta.purge_after < earliest->meta.purge_after))
+                    earliest = route;
+            }
+            break;
+        }
+    }
+    return earliest;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_stale_purge_one_opportunistically(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    wolfsentry_action_res_t *action_results);
+
+static wolfsentry_errcode_t wolfsentry_route_stale_purge_one_unconditionally(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    wolfsentry_action_res_t *action_results);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_check_flags_sensical(wolfsentry_route_flags_t flags) {
+    if (((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
+         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) &&
+         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* validates and normalizes route_to_insert ahead of its insertion, without
+ * touching the route table.
+ */
+static wolfsentry_errcode_t wolfsentry_route_insert_prepare(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route *route_to_insert,
+    const wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_eventconfig_internal *config = (route_to_insert->parent_event && route_to_insert->parent_event->config) ? route_to_insert->parent_event->config : &wolfsentry->config;
+
+    WOLFSENTRY_CONTEXT_ARGS_THREAD_NOT_USED;
+
+    if (config->config.route_flags_to_clear_on_insert != 0)
+        WOLFSENTRY_CLEAR_BITS(route_to_insert->flags, config->config.route_flags_to_clear_on_insert);
+
+    if (config->config.route_flags_to_add_on_insert != 0)
+        WOLFSENTRY_SET_BITS(route_to_insert->flags, config->config.route_flags_to_add_on_insert);
+
+    ret = wolfsentry_route_check_flags_sensical(route_to_insert->flags);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    if (WOLFSENTRY_CHECK_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE))
+        WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+
+    if ((ret = WOLFSENTRY_GET_TIME_CACHED(&route_to_insert->meta.insert_time)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if ((route_to_insert->meta.purge_after != 0) && (route_to_insert->meta.purge_after <= route_to_insert->meta.insert_time))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    /* fields marked as wildcards must be zeroed before insertion to meet
+     * assumptions of table lookup logic.
+     */
+    if ((route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) && (route_to_insert->remote.addr_len != 0))
+        memset(WOLFSENTRY_ROUTE_REMOTE_ADDR(route_to_insert), 0, WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(route_to_insert));
+    if ((route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD) && (route_to_insert->local.addr_len != 0))
+        memset(WOLFSENTRY_ROUTE_LOCAL_ADDR(route_to_insert), 0, WOLFSENTRY_ROUTE_LOCAL_ADDR_BYTES(route_to_insert));
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD)
+        route_to_insert->sa_family = 0;
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)
+        route_to_insert->sa_proto = 0;
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)
+        route_to_insert->remote.sa_port = 0;
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD)
+        route_to_insert->remote.interface = 0;
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)
+        route_to_insert->local.sa_port = 0;
+    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD)
+        route_to_insert->local.interface = 0;
+
+    if (*action_results & WOLFSENTRY_ACTION_RES_DEROGATORY)
+        ++route_to_insert->meta.derogatory_count;
+    if (*action_results & WOLFSENTRY_ACTION_RES_COMMENDABLE)
+        ++route_to_insert->meta.commendable_count;
+    if ((*action_results & WOLFSENTRY_ACTION_RES_CONNECT) && (! (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS)))
+        ++route_to_insert->meta.connection_count;
+
+    if ((config->config.route_idle_time_for_purge > 0) && (route_to_insert->meta.purge_after == 0))
+        route_to_insert->meta.purge_after = route_to_insert->meta.insert_time + config->config.route_idle_time_for_purge;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* backs a route out of route_table after its insert actions fail. */
+static void wolfsentry_route_insert_unwind(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route)
+{
+    wolfsentry_route_flags_t flags_before, flags_after;
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header));
+    wolfsentry_route_table_index_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+    wolfsentry_route_purge_wheel_cancel(route_table, route);
+    wolfsentry_route_update_flags_1(route, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_IN_TABLE, &flags_before, &flags_after);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* runs the insert actions for a route newly linked into route_table. */
+static wolfsentry_errcode_t wolfsentry_route_insert_finish(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route *target_route,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route_to_insert,
+    struct wolfsentry_event *trigger_event,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+
+    if (route_to_insert->parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(route_to_insert->parent_event, WOLFSENTRY_ACTION_TYPE_INSERT)) {
+        ret = wolfsentry_action_list_dispatch(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            caller_arg,
+            route_to_insert->parent_event,
+            trigger_event,
+            WOLFSENTRY_ACTION_TYPE_INSERT,
+            target_route,
+            route_table,
+            route_to_insert,
+            action_results);
+        if (ret < 0)
+            wolfsentry_route_insert_unwind(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route_to_insert);
+    } else {
+        if (route_to_insert->parent_event) {
+            if (! WOLFSENTRY_CHECK_BITS(route_to_insert->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT))
+                WOLFSENTRY_SET_BITS(route_to_insert->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT);
+        }
+        ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    }
+
+    {
+        wolfsentry_priority_t effective_priority = route_to_insert->parent_event ? route_to_insert->parent_event->priority : 0;
+        if (effective_priority < route_table->highest_priority_route_in_table)
+            route_table->highest_priority_route_in_table = effective_priority;
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_insert_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route *target_route,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route_to_insert,
+    struct wolfsentry_event *trigger_event,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+
+    ret = wolfsentry_route_insert_prepare(WOLFSENTRY_CONTEXT_ARGS_OUT, route_to_insert, action_results);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    if (route_to_insert->meta.purge_after) {
+        wolfsentry_hitcount_t max_purgeable_routes;
+
+        if ((ret = wolfsentry_route_table_max_purgeable_routes_get(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, &max_purgeable_routes)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+
+        if ((max_purgeable_routes > 0) &&
+            (route_table->purge_wheel.len >= max_purgeable_routes))
+        {
+            ret = wolfsentry_route_stale_purge_one_unconditionally(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, NULL /* action_results */);
+            WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        }
+    }
+
+    if ((ret = wolfsentry_id_allocate(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    WOLFSENTRY_SET_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+    if ((ret = wolfsentry_table_ent_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header, &route_table->header, 1 /* unique_p */)) < 0) {
+        WOLFSENTRY_CLEAR_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header));
+        route_to_insert->header.id = WOLFSENTRY_ENT_ID_NONE;
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+    if ((ret = wolfsentry_route_table_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route_to_insert)) < 0) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header));
+        WOLFSENTRY_CLEAR_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+        route_to_insert->header.id = WOLFSENTRY_ENT_ID_NONE;
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+
+    WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_INSERTED); /* signals to _dispatch_0() that counts were assigned to the newly inserted route. */
+
+    if (route_to_insert->meta.purge_after) {
+        wolfsentry_route_purge_wheel_advance(wolfsentry, route_table, route_to_insert->meta.insert_time);
+        wolfsentry_route_purge_wheel_schedule(route_table, route_to_insert);
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_insert_finish(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, target_route, route_table, route_to_insert, trigger_event, action_results));
+}
+
+static wolfsentry_errcode_t wolfsentry_route_insert_2(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *parent_event,
+    wolfsentry_ent_id_t *id,
+    struct wolfsentry_route **route,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_route *new;
+    wolfsentry_errcode_t ret;
+
+    if ((remote->sa_family != local->sa_family) ||
+        (remote->sa_proto != local->sa_proto))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if ((ret = wolfsentry_route_new(WOLFSENTRY_CONTEXT_ARGS_OUT, parent_event, remote, local, flags, &new)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if ((ret = wolfsentry_route_insert_1(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, NULL /* target_route */, route_table, new, parent_event, action_results)) < 0)
+        goto out;
+
+    if (id)
+        *id = new->header.id;
+
+    if (route && (wolfsentry_object_checkout(new) >= 0))
+        *route = new;
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (ret < 0)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, new, NULL /* action_results */));
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_insert_by_exports_2(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route_exports *route_exports,
+    struct wolfsentry_event *parent_event,
+    wolfsentry_ent_id_t *id,
+    struct wolfsentry_route **route,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_route *new;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = wolfsentry_route_new_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, parent_event, route_exports, &new)) < 0)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if ((ret = wolfsentry_route_insert_1(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, NULL /* target_route */, route_table, new, parent_event, action_results)) < 0)
+        goto out;
+
+    if (id)
+        *id = new->header.id;
+
+    if (route) {
+        if (wolfsentry_object_checkout(new) >= 0)
+            *route = new;
+        else
+            *route = NULL;
+    }
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (ret < 0)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, new, NULL /* action_results */));
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_into_table(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    wolfsentry_ent_id_t *id,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_event *event = NULL;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &event)) < 0)
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    }
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    ret = wolfsentry_route_insert_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, remote, local, flags, event, id, NULL /* route */, action_results);
+    if (event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_by_exports_into_table(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route_exports *route_exports,
+    wolfsentry_ent_id_t *id,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_event *event = NULL;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (route_exports->parent_event_label) {
+        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route_exports->parent_event_label, route_exports->parent_event_label_len, &event)) < 0)
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    }
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    ret = wolfsentry_route_insert_by_exports_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, route_exports, event, id, NULL /* route */, action_results);
+    if (event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    wolfsentry_ent_id_t *id,
+    wolfsentry_action_res_t *action_results)
+{
+    WOLFSENTRY_ERROR_RERETURN(
+        wolfsentry_route_insert_into_table(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            wolfsentry->routes,
+            caller_arg,
+            remote,
+            local,
+            flags,
+            event_label,
+            event_label_len,
+            id,
+            action_results));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_into_table_and_check_out(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    struct wolfsentry_route **route,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_event *event = NULL;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &event)) < 0)
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    }
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    ret = wolfsentry_route_insert_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, remote, local, flags, event, NULL /* id */, route, action_results);
+    if (event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_and_check_out(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    struct wolfsentry_route **route,
+    wolfsentry_action_res_t *action_results)
+{
+    WOLFSENTRY_ERROR_RERETURN(
+        wolfsentry_route_insert_into_table_and_check_out(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            wolfsentry->routes,
+            caller_arg,
+            remote,
+            local,
+            flags,
+            event_label,
+            event_label_len,
+            route,
+            action_results));
+}
+
+/* bulk insertion.  the batch is built and validated in full before the table
+ * is touched, then sorted, and its position in the table found either by a
+ * single merge walk of the table's ordered list (when the batch is large
+ * relative to the table) or by a descent per route.  the routes are then
+ * linked at their known positions, and only after all are linked are routes
+ * evicted to make room on the purge wheel, and the insert actions run, in the
+ * caller's order.
+ */
+
+struct wolfsentry_route_bulk_slot {
+    struct wolfsentry_route *route;
+    struct wolfsentry_table_ent_header *succ;
+};
+
+/* the table:batch size ratio below which the merge walk is used. */
+#define WOLFSENTRY_ROUTE_BULK_MERGE_RATIO 32U
+
+static void wolfsentry_route_bulk_sift_down(struct wolfsentry_route_bulk_slot *slots, size_t root, size_t n) {
+    for (;;) {
+        size_t child = (root * 2U) + 1U;
+        struct wolfsentry_route_bulk_slot tmp;
+        if (child >= n)
+            return;
+        if ((child + 1U < n) &&
+            (wolfsentry_route_key_cmp(&slots[child].route->header, &slots[child + 1U].route->header) < 0))
+        {
+            ++child;
+        }
+        if (wolfsentry_route_key_cmp(&slots[root].route->header, &slots[child].route->header) >= 0)
+            return;
+        tmp = slots[root];
+        slots[root] = slots[child];
+        slots[child] = tmp;
+        root = child;
+    }
+}
+
+/* heapsort, to sort in place without a libc dependency. */
+static void wolfsentry_route_bulk_sort(struct wolfsentry_route_bulk_slot *slots, size_t n) {
+    size_t i;
+    struct wolfsentry_route_bulk_slot tmp;
+
+    if (n < 2U)
+        return;
+    for (i = n / 2U; i-- > 0; )
+        wolfsentry_route_bulk_sift_down(slots, i, n);
+    for (i = n - 1U; i > 0; --i) {
+        tmp = slots[0];
+        slots[0] = slots[i];
+        slots[i] = tmp;
+        wolfsentry_route_bulk_sift_down(slots, 0, i);
+    }
+}
+
+/* finds the successor in route_table of each route in the sorted batch. */
+static wolfsentry_errcode_t wolfsentry_route_bulk_place(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_bulk_slot *sorted,
+    size_t n_routes)
+{
+    size_t i;
+
+    if (route_table->header.n_ents / n_routes < WOLFSENTRY_ROUTE_BULK_MERGE_RATIO) {
+        struct wolfsentry_table_ent_header *cur = route_table->header.head;
+        int c = 1;
+        for (i = 0; i < n_routes; ++i) {
+            while (cur && ((c = wolfsentry_route_key_cmp(cur, &sorted[i].route->header)) < 0))
+                cur = cur->next;
+            if (cur && (c == 0))
+                WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+            sorted[i].succ = cur;
+        }
+    } else {
+        for (i = 0; i < n_routes; ++i)
+            WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_table_ent_find_successor(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_table->header, &sorted[i].route->header, &sorted[i].succ));
+    }
+
     WOLFSENTRY_RETURN_OK;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_insert_1(
+static int wolfsentry_route_bulk_same_label(const char *a, int a_len, const char *b, int b_len) {
+    if ((a == NULL) || (b == NULL))
+        return a == b;
+    if (a_len < 0)
+        a_len = (int)strlen(a);
+    if (b_len < 0)
+        b_len = (int)strlen(b);
+    return (a_len == b_len) && (memcmp(a, b, (size_t)a_len) == 0);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_bulk_insert_by_exports_1(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_route *target_route,
     struct wolfsentry_route_table *route_table,
-    struct wolfsentry_route *route_to_insert,
-    struct wolfsentry_event *trigger_event,
+    const struct wolfsentry_route_exports *route_exports,
+    size_t n_routes,
+    wolfsentry_ent_id_t *ids,
     wolfsentry_action_res_t *action_results)
 {
+    struct wolfsentry_route_bulk_slot *sorted;
+    struct wolfsentry_route **routes;
+    struct wolfsentry_event *event = NULL;
+    const char *event_label = NULL;
+    int event_label_len = 0;
+    size_t i, n_built = 0, n_linked = 0, n_purgeable = 0;
+    wolfsentry_hitcount_t max_purgeable_routes = 0;
     wolfsentry_errcode_t ret;
-    struct wolfsentry_eventconfig_internal *config = (route_to_insert->parent_event && route_to_insert->parent_event->config) ? route_to_insert->parent_event->config : &wolfsentry->config;
 
-    if (config->config.route_flags_to_clear_on_insert != 0)
-        WOLFSENTRY_CLEAR_BITS(route_to_insert->flags, config->config.route_flags_to_clear_on_insert);
+    if (n_routes > (size_t)MAX_SINT_OF(ret) / (sizeof *sorted + sizeof *routes))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    if (config->config.route_flags_to_add_on_insert != 0)
-        WOLFSENTRY_SET_BITS(route_to_insert->flags, config->config.route_flags_to_add_on_insert);
+    sorted = (struct wolfsentry_route_bulk_slot *)WOLFSENTRY_MALLOC(n_routes * (sizeof *sorted + sizeof *routes));
+    if (sorted == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    routes = (struct wolfsentry_route **)(sorted + n_routes);
 
-    ret = wolfsentry_route_check_flags_sensical(route_to_insert->flags);
-    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    for (i = 0; i < n_routes; ++i) {
+        const struct wolfsentry_route_exports *exports = &route_exports[i];
 
-    if (WOLFSENTRY_CHECK_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE))
-        WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+        if ((i == 0) || (! wolfsentry_route_bulk_same_label(exports->parent_event_label, exports->parent_event_label_len, event_label, event_label_len))) {
+            if (event != NULL) {
+                WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+                event = NULL;
+            }
+            if (exports->parent_event_label) {
+                if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, exports->parent_event_label, exports->parent_event_label_len, &event)) < 0)
+                    goto out;
+            }
+            event_label = exports->parent_event_label;
+            event_label_len = exports->parent_event_label_len;
+        }
 
-    if ((ret = WOLFSENTRY_GET_TIME(&route_to_insert->meta.insert_time)) < 0)
-        WOLFSENTRY_ERROR_RERETURN(ret);
+        if ((ret = wolfsentry_route_new_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, event, exports, &routes[i])) < 0)
+            goto out;
+        ++n_built;
+        if ((ret = wolfsentry_route_insert_prepare(WOLFSENTRY_CONTEXT_ARGS_OUT, routes[i], action_results)) < 0)
+            goto out;
+        if (routes[i]->meta.purge_after)
+            ++n_purgeable;
+        sorted[i].route = routes[i];
+    }
 
-    if ((route_to_insert->meta.purge_after != 0) && (route_to_insert->meta.purge_after <= route_to_insert->meta.insert_time))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    wolfsentry_route_bulk_sort(sorted, n_routes);
+    for (i = 1; i < n_routes; ++i) {
+        if (wolfsentry_route_key_cmp(&sorted[i - 1].route->header, &sorted[i].route->header) == 0) {
+            ret = WOLFSENTRY_ERROR_ENCODE(ITEM_ALREADY_PRESENT);
+            goto out;
+        }
+    }
 
-    /* fields marked as wildcards must be zeroed before insertion to meet
-     * assumptions of table lookup logic.
-     */
-    if ((route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) && (route_to_insert->remote.addr_len != 0))
-        memset(WOLFSENTRY_ROUTE_REMOTE_ADDR(route_to_insert), 0, WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(route_to_insert));
-    if ((route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD) && (route_to_insert->local.addr_len != 0))
-        memset(WOLFSENTRY_ROUTE_LOCAL_ADDR(route_to_insert), 0, WOLFSENTRY_ROUTE_LOCAL_ADDR_BYTES(route_to_insert));
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD)
-        route_to_insert->sa_family = 0;
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)
-        route_to_insert->sa_proto = 0;
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)
-        route_to_insert->remote.sa_port = 0;
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD)
-        route_to_insert->remote.interface = 0;
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)
-        route_to_insert->local.sa_port = 0;
-    if (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD)
-        route_to_insert->local.interface = 0;
+    if (n_purgeable > 0) {
+        if ((ret = wolfsentry_route_table_max_purgeable_routes_get(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, &max_purgeable_routes)) < 0)
+            goto out;
+        if ((max_purgeable_routes > 0) && (n_purgeable > max_purgeable_routes)) {
+            ret = WOLFSENTRY_ERROR_ENCODE(OVERFLOW_AVERTED);
+            goto out;
+        }
+    }
 
-    if (*action_results & WOLFSENTRY_ACTION_RES_DEROGATORY)
-        ++route_to_insert->meta.derogatory_count;
-    if (*action_results & WOLFSENTRY_ACTION_RES_COMMENDABLE)
-        ++route_to_insert->meta.commendable_count;
-    if ((*action_results & WOLFSENTRY_ACTION_RES_CONNECT) && (! (route_to_insert->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS)))
-        ++route_to_insert->meta.connection_count;
+    if ((ret = wolfsentry_route_bulk_place(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, sorted, n_routes)) < 0)
+        goto out;
 
-    if ((config->config.route_idle_time_for_purge > 0) && (route_to_insert->meta.purge_after == 0))
-        route_to_insert->meta.purge_after = route_to_insert->meta.insert_time + config->config.route_idle_time_for_purge;
+    /* the batch is linked before any route is evicted to make room for it, so
+     * that a batch that fails to link leaves the table as it was.  the batch
+     * isn't scheduled on the purge wheel until after the evictions, so that
+     * it can't evict its own routes.
+     */
+    for (n_linked = 0; n_linked < n_routes; ++n_linked) {
+        struct wolfsentry_route *route = sorted[n_linked].route;
 
-    if (route_to_insert->meta.purge_after) {
-        wolfsentry_hitcount_t max_purgeable_routes;
+        if ((ret = wolfsentry_id_allocate(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header)) < 0)
+            break;
+        WOLFSENTRY_SET_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+        if ((ret = wolfsentry_table_ent_insert_before(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header, &route_table->header, sorted[n_linked].succ)) < 0) {
+            WOLFSENTRY_CLEAR_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header));
+            route->header.id = WOLFSENTRY_ENT_ID_NONE;
+            break;
+        }
+        if ((ret = wolfsentry_route_table_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route)) < 0) {
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header));
+            WOLFSENTRY_CLEAR_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+            route->header.id = WOLFSENTRY_ENT_ID_NONE;
+            break;
+        }
+    }
 
-        if ((ret = wolfsentry_route_table_max_purgeable_routes_get(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, &max_purgeable_routes)) < 0)
-            WOLFSENTRY_ERROR_RERETURN(ret);
+    /* make room for the purgeable routes as single inserts would, by evicting
+     * the routes soonest due.  if an eviction fails, the batch is backed out,
+     * but routes already evicted, as with a single insert, stay evicted.
+     */
+    if ((n_linked == n_routes) && (n_purgeable > 0) && (max_purgeable_routes > 0)) {
+        while (route_table->purge_wheel.len + n_purgeable > max_purgeable_routes) {
+            if ((ret = wolfsentry_route_stale_purge_one_unconditionally(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, NULL /* action_results */)) < 0)
+                break;
+        }
+    }
 
-        if ((max_purgeable_routes > 0) &&
-            (route_table->purge_list.len >= max_purgeable_routes))
-        {
-            ret = wolfsentry_route_stale_purge_one_unconditionally(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, NULL /* action_results */);
-            WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    if ((n_linked < n_routes) || (ret < 0)) {
+        /* back out the whole batch. */
+        while (n_linked > 0) {
+            struct wolfsentry_route *route = sorted[--n_linked].route;
+            wolfsentry_route_insert_unwind(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+            route->header.id = WOLFSENTRY_ENT_ID_NONE;
         }
+        goto out;
     }
 
-    if ((ret = wolfsentry_id_allocate(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header)) < 0)
-        WOLFSENTRY_ERROR_RERETURN(ret);
-    WOLFSENTRY_SET_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
-    if ((ret = wolfsentry_table_ent_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header, &route_table->header, 1 /* unique_p */)) < 0) {
-        WOLFSENTRY_CLEAR_BITS(route_to_insert->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header));
-        route_to_insert->header.id = WOLFSENTRY_ENT_ID_NONE;
-        WOLFSENTRY_ERROR_RERETURN(ret);
+    for (i = 0; i < n_routes; ++i) {
+        struct wolfsentry_route *route = sorted[i].route;
+        if (route->meta.purge_after) {
+            wolfsentry_route_purge_wheel_advance(wolfsentry, route_table, route->meta.insert_time);
+            wolfsentry_route_purge_wheel_schedule(route_table, route);
+        }
     }
 
-    WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_INSERTED); /* signals to _dispatch_0() that counts were assigned to the newly inserted route. */
+    WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_INSERTED);
 
-    if (route_to_insert->meta.purge_after)
-        wolfsentry_route_purge_list_insert(route_table, route_to_insert);
+    /* routes whose insert actions fail are backed out individually, leaving
+     * the rest of the batch in place, and the first such error is returned.
+     */
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    for (i = 0; i < n_routes; ++i) {
+        wolfsentry_errcode_t action_ret = wolfsentry_route_insert_finish(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, NULL /* target_route */, route_table, routes[i], routes[i]->parent_event, action_results);
+        if ((action_ret < 0) && (ret >= 0))
+            ret = action_ret;
+    }
 
-    if (route_to_insert->parent_event && (wolfsentry_list_ent_get_len(&route_to_insert->parent_event->insert_action_list.header) > 0)) {
-        ret = wolfsentry_action_list_dispatch(
+  out:
+
+    for (i = 0; i < n_built; ++i) {
+        if (WOLFSENTRY_CHECK_BITS(routes[i]->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE)) {
+            if (ids)
+                ids[i] = routes[i]->header.id;
+        } else {
+            if (ids)
+                ids[i] = WOLFSENTRY_ENT_ID_NONE;
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, routes[i], NULL /* action_results */));
+        }
+    }
+    if (ids) {
+        for (; i < n_routes; ++i)
+            ids[i] = WOLFSENTRY_ENT_ID_NONE;
+    }
+
+    if (event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+
+    WOLFSENTRY_FREE(sorted);
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_insert_by_exports_into_table(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route_exports *route_exports,
+    size_t n_routes,
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+
+    if ((route_exports == NULL) && (n_routes > 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    if (n_routes == 0)
+        WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+    ret = wolfsentry_route_bulk_insert_by_exports_1(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, route_exports, n_routes, ids, action_results);
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_insert_by_exports(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route_exports *route_exports,
+    size_t n_routes,
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results)
+{
+    WOLFSENTRY_ERROR_RERETURN(
+        wolfsentry_route_bulk_insert_by_exports_into_table(
             WOLFSENTRY_CONTEXT_ARGS_OUT,
+            wolfsentry->routes,
             caller_arg,
-            route_to_insert->parent_event,
-            trigger_event,
-            WOLFSENTRY_ACTION_TYPE_INSERT,
-            target_route,
-            route_table,
-            route_to_insert,
-            action_results);
-        if (ret < 0) {
-            wolfsentry_route_flags_t flags_before, flags_after;
-            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_to_insert->header));
-            wolfsentry_route_update_flags_1(route_to_insert, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_IN_TABLE, &flags_before, &flags_after);
-        }
-    } else {
-        if (route_to_insert->parent_event) {
-            if (! WOLFSENTRY_CHECK_BITS(route_to_insert->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT))
-                WOLFSENTRY_SET_BITS(route_to_insert->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT);
-        }
-        ret = WOLFSENTRY_ERROR_ENCODE(OK);
+            route_exports,
+            n_routes,
+            ids,
+            action_results));
+}
+
+/* links a fully formed route, holding its own references but not yet in any
+ * table, into route_table with a fresh ID.  the route's metadata is kept as
+ * is.  on failure, the route is freed.
+ */
+static wolfsentry_errcode_t wolfsentry_route_link_restored(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *new,
+    wolfsentry_time_t now)
+{
+    struct wolfsentry_table_ent_header *succ = NULL;
+    wolfsentry_errcode_t ret;
+
+    if ((route_table->header.tail != NULL) && (wolfsentry_route_key_cmp(route_table->header.tail, &new->header) >= 0)) {
+        if ((ret = wolfsentry_table_ent_find_successor(WOLFSENTRY_CONTEXT_ARGS_OUT, &route_table->header, &new->header, &succ)) < 0)
+            goto out;
+    }
+
+    if ((ret = wolfsentry_id_allocate(WOLFSENTRY_CONTEXT_ARGS_OUT, &new->header)) < 0)
+        goto out;
+    WOLFSENTRY_SET_BITS(new->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+    if ((ret = wolfsentry_table_ent_insert_before(WOLFSENTRY_CONTEXT_ARGS_OUT, &new->header, &route_table->header, succ)) < 0) {
+        WOLFSENTRY_CLEAR_BITS(new->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &new->header));
+        goto out;
+    }
+    if ((ret = wolfsentry_route_table_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, new)) < 0) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &new->header));
+        WOLFSENTRY_CLEAR_BITS(new->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+        goto out;
+    }
+    if (new->meta.purge_after) {
+        wolfsentry_route_purge_wheel_advance(wolfsentry, route_table, now);
+        wolfsentry_route_purge_wheel_schedule(route_table, new);
     }
 
     {
-        wolfsentry_priority_t effective_priority = route_to_insert->parent_event ? route_to_insert->parent_event->priority : 0;
+        wolfsentry_priority_t effective_priority = new->parent_event ? new->parent_event->priority : 0;
         if (effective_priority < route_table->highest_priority_route_in_table)
             route_table->highest_priority_route_in_table = effective_priority;
     }
 
+    WOLFSENTRY_RETURN_OK;
+
+  out:
+
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, new, NULL /* action_results */));
     WOLFSENTRY_ERROR_RERETURN(ret);
 }
 
-static wolfsentry_errcode_t wolfsentry_route_insert_2(
+/* rebuilds a route from a wolfsentry_context_save() record and links it into
+ * route_table, with its metadata and hitcount as saved.  routes are saved in
+ * table order, so each normally goes on the tail without a descent.  insert
+ * actions aren't called -- the caller runs them once the whole context is
+ * restored.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_restore(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
     struct wolfsentry_route_table *route_table,
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
     struct wolfsentry_event *parent_event,
-    wolfsentry_ent_id_t *id,
-    struct wolfsentry_route **route,
-    wolfsentry_action_res_t *action_results)
+    const struct wolfsentry_route_snapshot *snap,
+    const byte *data,
+    wolfsentry_time_t now)
 {
+    struct wolfsentry_eventconfig_internal *config = (parent_event && parent_event->config) ? parent_event->config : &wolfsentry->config;
     struct wolfsentry_route *new;
+    size_t new_size;
     wolfsentry_errcode_t ret;
 
-    if ((remote->sa_family != local->sa_family) ||
-        (remote->sa_proto != local->sa_proto))
-        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((snap->data_addr_offset != config->config.route_private_data_size) ||
+        (snap->remote.extra_port_count != 0) ||
+        (snap->local.extra_port_count != 0))
+    {
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+    }
+    new_size = (size_t)snap->data_addr_offset + WOLFSENTRY_BITS_TO_BYTES((size_t)snap->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)snap->local.addr_len);
+    if (new_size & 1)
+        ++new_size;
+    if (new_size != snap->data_addr_size)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    if (! (snap->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    ret = wolfsentry_route_check_flags_sensical(snap->flags);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    new_size += offsetof(struct wolfsentry_route, data);
 
-    if ((ret = wolfsentry_route_new(WOLFSENTRY_CONTEXT_ARGS_OUT, parent_event, remote, local, flags, &new)) < 0)
-        WOLFSENTRY_ERROR_RERETURN(ret);
+    if (config->config.route_private_data_alignment == 0)
+        new = (struct wolfsentry_route *)WOLFSENTRY_MALLOC(new_size);
+    else
+        new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
+    if (new == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
 
-    if ((ret = wolfsentry_route_insert_1(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, NULL /* target_route */, route_table, new, parent_event, action_results)) < 0)
-        goto out;
+    memset(new, 0, offsetof(struct wolfsentry_route, data));
+    memcpy(new->data, data, snap->data_addr_size);
+    new->header.refcount = 1;
+    new->header.id = WOLFSENTRY_ENT_ID_NONE;
+    new->flags = snap->flags;
+    WOLFSENTRY_CLEAR_BITS(new->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE | WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED | WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED);
+    new->sa_family = snap->sa_family;
+    new->sa_proto = snap->sa_proto;
+    new->remote = snap->remote;
+    new->local = snap->local;
+    new->data_addr_offset = snap->data_addr_offset;
+    new->data_addr_size = snap->data_addr_size;
+    new->meta.insert_time = snap->insert_time;
+    new->meta.last_hit_time = snap->last_hit_time;
+    new->meta.last_penaltybox_time = snap->last_penaltybox_time;
+    new->meta.purge_after = snap->purge_after;
+    new->meta.connection_count = snap->connection_count;
+    new->meta.derogatory_count = snap->derogatory_count;
+    new->meta.commendable_count = snap->commendable_count;
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    new->hit_shards[0].hitcount = snap->hitcount;
+#else
+    new->header.hitcount = snap->hitcount;
+#endif
 
-    if (id)
-        *id = new->header.id;
+    if (parent_event != NULL) {
+        WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount, ret);
+        if (ret < 0) {
+            wolfsentry_route_free_1(WOLFSENTRY_CONTEXT_ARGS_OUT, config, new);
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+        new->parent_event = parent_event;
+    }
 
-    if (route && (wolfsentry_object_checkout(new) >= 0))
-        *route = new;
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_link_restored(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, new, now));
+}
 
-    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+static void wolfsentry_route_increment_hitcount(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    if (! (route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS)) {
+        wolfsentry_hitcount_t post_hitcount;
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+        WOLFSENTRY_ATOMIC_INCREMENT_UNSIGNED_SAFELY_BY_ONE(route->hit_shards[WOLFSENTRY_COUNTER_SHARD_INDEX(thread)].hitcount, post_hitcount);
+#else
+        WOLFSENTRY_ATOMIC_INCREMENT_UNSIGNED_SAFELY_BY_ONE(route->header.hitcount, post_hitcount);
+#endif
+        if (post_hitcount == 0) {
+            wolfsentry_route_flags_t flags_before, flags_after;
+            WOLFSENTRY_WARN_ON_FAILURE(
+                wolfsentry_route_update_flags(
+                    WOLFSENTRY_CONTEXT_ARGS_OUT,
+                    route,
+                    WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS,
+                    WOLFSENTRY_ROUTE_FLAG_NONE,
+                    &flags_before,
+                    &flags_after,
+                    action_results));
+        }
+    }
+    WOLFSENTRY_RETURN_VOID;
+}
 
-  out:
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_route_get_hitcount(const struct wolfsentry_route *route) {
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    return wolfsentry_counter_shards_sum(route->hit_shards);
+#else
+    return WOLFSENTRY_ATOMIC_LOAD(route->header.hitcount);
+#endif
+}
 
-    if (ret < 0)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, new, NULL /* action_results */));
+/* admit a connection on route only if the count stays within
+ * max_connection_count.  the reservation is committed by the same atomic step
+ * that checks the limit, so concurrent dispatches never see (or reject on) a
+ * transient overshoot.  released by wolfsentry_route_connection_release().
+ */
+static int wolfsentry_route_connection_reserve(struct wolfsentry_route *route, uint32_t max_connection_count) {
+    uint16_t pre = WOLFSENTRY_ATOMIC_LOAD(route->meta.connection_count);
+    for (;;) {
+        uint16_t post;
+        int committed;
+        if ((pre >= max_connection_count) || (pre == MAX_UINT_OF(pre)))
+            return 0;
+        post = (uint16_t)(pre + 1U);
+#ifdef WOLFSENTRY_THREADSAFE
+        committed = WOLFSENTRY_ATOMIC_TEST_AND_SET(route->meta.connection_count, pre, post);
+#else
+        route->meta.connection_count = post;
+        committed = 1;
+#endif
+        if (committed)
+            return 1;
+    }
+}
 
-    WOLFSENTRY_ERROR_RERETURN(ret);
+static void wolfsentry_route_connection_release(struct wolfsentry_route *route) {
+    uint16_t post;
+    WOLFSENTRY_ATOMIC_DECREMENT_UNSIGNED_SAFELY_BY_ONE(route->meta.connection_count, post);
+    (void)post;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_insert_by_exports_2(
+struct wolfsentry_route_lookup_state {
+    const struct wolfsentry_route_table *table;
+    struct wolfsentry_route *target_route;
+    wolfsentry_action_res_t *action_results;
+    struct wolfsentry_route *best;
+    wolfsentry_route_flags_t best_inexact_matches;
+    int best_priority;
+    int prefer_later_p; /* break exact ties in favor of the route later in table order. */
+#ifdef WOLFSENTRY_INSTRUMENT
+    unsigned int n_considered;
+#endif
+};
+
+static void wolfsentry_route_lookup_consider(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    struct wolfsentry_route_table *route_table,
-    const struct wolfsentry_route_exports *route_exports,
-    struct wolfsentry_event *parent_event,
-    wolfsentry_ent_id_t *id,
-    struct wolfsentry_route **route,
-    wolfsentry_action_res_t *action_results)
+    struct wolfsentry_route_lookup_state *state,
+    struct wolfsentry_route *i)
 {
-    struct wolfsentry_route *new;
-    wolfsentry_errcode_t ret;
-
-    if ((ret = wolfsentry_route_new_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, parent_event, route_exports, &new)) < 0)
-        WOLFSENTRY_ERROR_RERETURN(ret);
+    wolfsentry_route_flags_t inexact_matches;
+    int cmp;
+    int effective_priority;
 
-    if ((ret = wolfsentry_route_insert_1(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, NULL /* target_route */, route_table, new, parent_event, action_results)) < 0)
-        goto out;
+#ifndef DEBUG_ROUTE_LOOKUP
+    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+#endif
 
-    if (id)
-        *id = new->header.id;
+#ifdef WOLFSENTRY_INSTRUMENT
+    ++state->n_considered;
+#endif
 
-    if (route) {
-        if (wolfsentry_object_checkout(new) >= 0)
-            *route = new;
-        else
-            *route = NULL;
+    if (WOLFSENTRY_CHECK_BITS(i->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))
+        WOLFSENTRY_RETURN_VOID;
+    /* ignore routes that don't cover the direction of the target. */
+    if (! (i->flags & WOLFSENTRY_MASKIN_BITS(state->target_route->flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN|WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
+        WOLFSENTRY_RETURN_VOID;
+    /* ignore routes that don't meet actions_results constraints. */
+    if (state->action_results && i->parent_event && i->parent_event->config &&
+        (((*state->action_results & i->parent_event->config->config.action_res_filter_bits_set) != i->parent_event->config->config.action_res_filter_bits_set) ||
+         ((~(*state->action_results) & i->parent_event->config->config.action_res_filter_bits_unset) != i->parent_event->config->config.action_res_filter_bits_unset)))
+    {
+        WOLFSENTRY_RETURN_VOID;
+    }
+    /* if *action_results has _EXCLUDE_REJECT_ROUTES set on entry to
+     * wolfsentry_route_lookup_0(), it was set via
+     * wolfsentry_route_event_dispatch_with_inited_result() for a
+     * bind/listen query that should succeed if any routes can succeed.
+     * this requires ignoring routes with _PENALTYBOXED/_PORT_RESET set.
+     */
+    if (state->action_results &&
+        WOLFSENTRY_CHECK_BITS(*state->action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES) &&
+        WOLFSENTRY_MASKIN_BITS(i->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_PORT_RESET))
+    {
+        WOLFSENTRY_RETURN_VOID;
     }
 
-    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    cmp = wolfsentry_route_key_cmp_1(i, state->target_route, 1 /* match_wildcards_p */, &inexact_matches);
 
-  out:
+#ifdef DEBUG_ROUTE_LOOKUP
+    fprintf(stderr,"i: ");
+    if (wolfsentry_route_render(WOLFSENTRY_CONTEXT_ARGS_OUT, i, stderr) < 0) {}
+    fprintf(stderr,"\n  res: %d\n",cmp);
+    fputs("  inexact_matches: ", stderr);
+    if (wolfsentry_route_render_flags(inexact_matches, stderr) < 0) {}
+    fputc('\n', stderr);
+#endif
 
-    if (ret < 0)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, new, NULL /* action_results */));
+    if (cmp != 0)
+        WOLFSENTRY_RETURN_VOID;
 
-    WOLFSENTRY_ERROR_RERETURN(ret);
+    /* preference is a match with the highest-priority event, with null
+     * events having highest priority, and ties broken using
+     * compare_match_exactness().
+     */
+    effective_priority = i->parent_event ? i->parent_event->priority : 0;
+    if (state->best != NULL) {
+        if (effective_priority > state->best_priority)
+            WOLFSENTRY_RETURN_VOID;
+        if (effective_priority == state->best_priority) {
+            cmp = compare_match_exactness(state->target_route, i, inexact_matches, state->best, state->best_inexact_matches);
+            if ((cmp > 0) ||
+                ((cmp == 0) &&
+                 ((! state->prefer_later_p) ||
+                  (state->table->header.cmp_fn(&i->header, &state->best->header) < 0))))
+            {
+                WOLFSENTRY_RETURN_VOID;
+            }
+        }
+    }
+
+    state->best = i;
+    state->best_inexact_matches = inexact_matches;
+    state->best_priority = effective_priority;
+
+    WOLFSENTRY_RETURN_VOID;
 }
 
+/* the LPM index can be used for targets with a definite sa_family, remote and
+ * local address, and direction.
+ */
+static inline int wolfsentry_route_lpm_lookup_eligible(const struct wolfsentry_route *target_route) {
+    wolfsentry_route_flags_t direction = target_route->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
+    if (target_route->flags & (WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD))
+        return 0;
+    if ((direction != WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN) && (direction != WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT))
+        return 0;
+    if ((target_route->remote.addr_len > WOLFSENTRY_MAX_ADDR_BITS) || (target_route->local.addr_len > WOLFSENTRY_MAX_ADDR_BITS))
+        return 0;
+    return 1;
+}
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_into_table(
+static void wolfsentry_route_lpm_lookup_node(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *route_table,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
-    wolfsentry_ent_id_t *id,
-    wolfsentry_action_res_t *action_results)
+    struct wolfsentry_route_lookup_state *state,
+    const struct wolfsentry_route_lpm_node *node,
+    int d)
 {
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_event *event = NULL;
+    const struct wolfsentry_list_ent_header *link;
+    for (link = node->routes.head; link; link = link->next)
+        wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, state, WOLFSENTRY_ROUTE_LPM_LINK_TO_ROUTE(link, d));
+    WOLFSENTRY_RETURN_VOID;
+}
 
-    WOLFSENTRY_MUTEX_OR_RETURN();
+/* visit each node whose prefix is a prefix of addr, and the whole subtree
+ * under the first node whose prefix is at least as long as addr.
+ */
+static void wolfsentry_route_lpm_lookup_trie(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_lookup_state *state,
+    const struct wolfsentry_route_lpm_node *node,
+    const byte *addr,
+    int addr_len,
+    int d)
+{
+    const struct wolfsentry_route_lpm_node *top;
 
-    if (event_label) {
-        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &event)) < 0)
-            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    while (node) {
+        int min_len = (node->prefix_len < addr_len) ? node->prefix_len : addr_len;
+        if (addr_prefix_match_size(node->prefix, node->prefix_len, addr, addr_len) < min_len)
+            WOLFSENTRY_RETURN_VOID;
+        if (node->prefix_len >= addr_len)
+            break;
+        wolfsentry_route_lpm_lookup_node(WOLFSENTRY_CONTEXT_ARGS_OUT, state, node, d);
+        node = node->child[wolfsentry_route_lpm_addr_bit(addr, node->prefix_len)];
+    }
+    if (node == NULL)
+        WOLFSENTRY_RETURN_VOID;
+
+    top = node;
+    for (;;) {
+        wolfsentry_route_lpm_lookup_node(WOLFSENTRY_CONTEXT_ARGS_OUT, state, node, d);
+        if (node->child[0])
+            node = node->child[0];
+        else if (node->child[1])
+            node = node->child[1];
+        else {
+            for (;;) {
+                if (node == top)
+                    WOLFSENTRY_RETURN_VOID;
+                if ((node == node->parent->child[0]) && node->parent->child[1]) {
+                    node = node->parent->child[1];
+                    break;
+                }
+                node = node->parent;
+            }
+        }
     }
-    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    ret = wolfsentry_route_insert_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, remote, local, flags, event, id, NULL /* route */, action_results);
-    if (event != NULL)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
-    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_by_exports_into_table(
+static void wolfsentry_route_lpm_lookup(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *route_table,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_route_exports *route_exports,
-    wolfsentry_ent_id_t *id,
-    wolfsentry_action_res_t *action_results)
+    struct wolfsentry_route_lookup_state *state)
 {
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_event *event = NULL;
+    const struct wolfsentry_route *target_route = state->target_route;
+    wolfsentry_route_flags_t direction = target_route->flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
+    int d = (direction == WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
+    const struct wolfsentry_route_lpm_index *index;
+    const struct wolfsentry_list_ent_header *link;
+
+    for (index = state->table->lpm_indexes; index; index = index->next) {
+        if ((index->sa_family != target_route->sa_family) || (index->direction != direction))
+            continue;
+        wolfsentry_route_lpm_lookup_trie(WOLFSENTRY_CONTEXT_ARGS_OUT, state, index->remote_root, WOLFSENTRY_ROUTE_REMOTE_ADDR(target_route), target_route->remote.addr_len, d);
+        wolfsentry_route_lpm_lookup_trie(WOLFSENTRY_CONTEXT_ARGS_OUT, state, index->local_root, WOLFSENTRY_ROUTE_LOCAL_ADDR(target_route), target_route->local.addr_len, d);
+        break;
+    }
 
-    WOLFSENTRY_MUTEX_OR_RETURN();
+    for (link = state->table->lpm_unindexed.head; link; link = link->next)
+        wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, state, WOLFSENTRY_ROUTE_LPM_LINK_TO_ROUTE(link, 0));
 
-    if (route_exports->parent_event_label) {
-        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route_exports->parent_event_label, route_exports->parent_event_label_len, &event)) < 0)
-            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
-    }
-    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    ret = wolfsentry_route_insert_by_exports_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, route_exports, event, id, NULL /* route */, action_results);
-    if (event != NULL)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
-    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    WOLFSENTRY_RETURN_VOID;
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert(
-    WOLFSENTRY_CONTEXT_ARGS_IN,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
-    wolfsentry_ent_id_t *id,
-    wolfsentry_action_res_t *action_results)
+/* the tuple classifier can be used for targets with no wildcards. */
+static inline int wolfsentry_route_tuple_lookup_eligible(
+    const struct wolfsentry_route_table *table,
+    const struct wolfsentry_route *target_route)
 {
-    WOLFSENTRY_ERROR_RERETURN(
-        wolfsentry_route_insert_into_table(
-            WOLFSENTRY_CONTEXT_ARGS_OUT,
-            wolfsentry->routes,
-            caller_arg,
-            remote,
-            local,
-            flags,
-            event_label,
-            event_label_len,
-            id,
-            action_results));
+    return table->tuple_classifier_enabled && (! (target_route->flags & WOLFSENTRY_ROUTE_WILDCARD_FLAGS));
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_into_table_and_check_out(
+static void wolfsentry_route_tuple_lookup(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route_table *route_table,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
-    struct wolfsentry_route **route,
-    wolfsentry_action_res_t *action_results)
+    struct wolfsentry_route_lookup_state *state)
 {
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_event *event = NULL;
+    const struct wolfsentry_route *target_route = state->target_route;
+    const struct wolfsentry_route_tuple *tuple;
+    struct wolfsentry_route *i;
 
-    WOLFSENTRY_MUTEX_OR_RETURN();
+    for (tuple = state->table->tuples; tuple; tuple = tuple->next) {
+        /* a target address shorter than the tuple's prefix can match any route
+         * in the tuple whose prefix it begins, so the whole tuple is checked.
+         */
+        if ((target_route->remote.addr_len < tuple->remote_prefix_len) ||
+            (target_route->local.addr_len < tuple->local_prefix_len))
+        {
+            uint32_t b;
+            for (b = 0; b < tuple->n_buckets; ++b) {
+                for (i = tuple->buckets[b]; i; i = i->tuple_next)
+                    wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, state, i);
+            }
+        } else {
+            uint32_t hash = wolfsentry_route_tuple_hash(target_route, tuple);
+            for (i = tuple->buckets[hash & (tuple->n_buckets - 1U)]; i; i = i->tuple_next) {
+                if (i->tuple_hash == hash)
+                    wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, state, i);
+            }
+        }
+    }
 
-    if (event_label) {
-        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &event)) < 0)
-            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* read-only route images.  wolfsentry_route_table_image_build() compiles the
+ * persistent routes of a table into a position-independent image -- offsets
+ * throughout, no pointers -- that wolfsentry_route_table_image_attach() then
+ * searches in place, so that any number of processes can map a single copy of
+ * it.  the routes are grouped by address family and remote prefix length, and
+ * sorted by remote address within each group, so that a lookup binary-searches
+ * each group for the routes whose remote prefix covers the target.  parent
+ * events are recorded by label, and resolved in the attaching context.
+ */
+
+#define WOLFSENTRY_ROUTE_IMAGE_MAGIC 0x57535249U /* "WSRI" */
+#define WOLFSENTRY_ROUTE_IMAGE_FORMAT_VERSION 1U
+#define WOLFSENTRY_ROUTE_IMAGE_ALIGNMENT 8U
+#define WOLFSENTRY_ROUTE_IMAGE_ALIGN(x) (((x) + (WOLFSENTRY_ROUTE_IMAGE_ALIGNMENT - 1U)) / WOLFSENTRY_ROUTE_IMAGE_ALIGNMENT * WOLFSENTRY_ROUTE_IMAGE_ALIGNMENT)
+#define WOLFSENTRY_ROUTE_IMAGE_NO_EVENT (~(uint32_t)0)
+
+struct wolfsentry_route_image_header {
+    uint32_t magic;
+    uint32_t format_version;
+    struct wolfsentry_build_settings build_settings;
+    uint32_t header_size;
+    uint32_t event_record_size;
+    uint32_t group_record_size;
+    uint32_t route_record_size;
+    uint32_t checksum; /* FNV-1a of everything after the header. */
+    uint32_t total_len;
+    uint32_t n_events;
+    uint32_t n_groups;
+    uint32_t n_routes;
+    uint32_t events_offset;
+    uint32_t groups_offset;
+    uint32_t routes_offset;
+    uint32_t pool_offset; /* the event labels and route addresses. */
+    uint32_t pool_len;
+};
+
+struct wolfsentry_route_image_event {
+    uint32_t label_offset; /* in the pool. */
+    uint32_t label_len;
+};
+
+/* the routes with one sa_family (or a wildcard family) and remote prefix length. */
+struct wolfsentry_route_image_group {
+    uint32_t first;
+    uint32_t count;
+    wolfsentry_addr_family_t sa_family; /* zero for a wildcard family. */
+    wolfsentry_addr_bits_t remote_prefix_len; /* zero for a wildcard remote address. */
+    uint16_t family_wildcard;
+    uint16_t reserved;
+};
+
+struct wolfsentry_route_image_route {
+    uint32_t flags;
+    uint32_t event_index; /* WOLFSENTRY_ROUTE_IMAGE_NO_EVENT for a null parent event. */
+    uint32_t addr_offset; /* in the pool, the remote address followed by the local address. */
+    wolfsentry_addr_family_t sa_family;
+    wolfsentry_proto_t sa_proto;
+    struct wolfsentry_route_endpoint remote, local;
+};
+
+/* an image as attached to a route table. */
+struct wolfsentry_route_image {
+    const byte *base;
+    size_t len;
+    const struct wolfsentry_route_image_group *groups;
+    const struct wolfsentry_route_image_route *routes;
+    const byte *pool;
+    uint32_t n_groups;
+    uint32_t n_routes;
+    uint32_t n_events;
+    wolfsentry_priority_t highest_priority;
+    struct wolfsentry_event *events[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE]; /* the resolved parent events, each holding a reference. */
+};
+
+/* an image route expanded into a stand-in rule route for dispatch.  it's
+ * marked _IN_TABLE, but has no ID or private data, and doesn't outlive the
+ * dispatch, so any state the dispatch leaves on it is discarded.
+ */
+struct wolfsentry_route_image_slot {
+    const struct wolfsentry_route_image_route *record;
+    struct wolfsentry_route route;
+    byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+};
+
+static int wolfsentry_route_image_family_wildcard(const struct wolfsentry_route *route) {
+    return (route->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) != 0;
+}
+
+/* compares the leading bits of two big endian addresses. */
+static int wolfsentry_route_image_prefix_cmp(const byte *left, const byte *right, int bits) {
+    for (; bits > 0; bits -= BITS_PER_BYTE, ++left, ++right) {
+        unsigned int mask = (bits >= BITS_PER_BYTE) ? 0xffU : ((0xffU << (BITS_PER_BYTE - bits)) & 0xffU);
+        if ((*left & mask) != (*right & mask))
+            return (int)(*left & mask) - (int)(*right & mask);
     }
-    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    ret = wolfsentry_route_insert_2(WOLFSENTRY_CONTEXT_ARGS_OUT, caller_arg, route_table, remote, local, flags, event, NULL /* id */, route, action_results);
-    if (event != NULL)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
-    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    return 0;
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_and_check_out(
-    WOLFSENTRY_CONTEXT_ARGS_IN,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
-    struct wolfsentry_route **route,
-    wolfsentry_action_res_t *action_results)
+/* builds the stand-in route that wolfsentry_deferred_actions_drain() passes to
+ * a deferred handler.  like the image stand-ins, it has no parent event or
+ * private data, and doesn't outlive the call.  it carries the rule route's ID,
+ * but isn't _IN_TABLE.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_init_deferred(
+    const struct wolfsentry_deferred_action *record,
+    struct wolfsentry_route *route,
+    size_t data_addr_size)
 {
-    WOLFSENTRY_ERROR_RERETURN(
-        wolfsentry_route_insert_into_table_and_check_out(
-            WOLFSENTRY_CONTEXT_ARGS_OUT,
-            wolfsentry->routes,
-            caller_arg,
-            remote,
-            local,
+    wolfsentry_route_flags_t flags = record->rule_route_flags;
+    WOLFSENTRY_CLEAR_BITS(flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE);
+    WOLFSENTRY_RERETURN_IF_ERROR(
+        wolfsentry_route_init(
+            NULL /* parent_event */,
+            (const struct wolfsentry_sockaddr *)&record->remote,
+            (const struct wolfsentry_sockaddr *)&record->local,
             flags,
-            event_label,
-            event_label_len,
-            route,
-            action_results));
+            0 /* data_addr_offset */,
+            data_addr_size,
+            route));
+    route->header.id = record->rule_route_id;
+    WOLFSENTRY_RETURN_OK;
 }
 
-static void wolfsentry_route_increment_hitcount(
+static void wolfsentry_route_image_expand(
+    const struct wolfsentry_route_image *image,
+    const struct wolfsentry_route_image_route *record,
+    struct wolfsentry_route_image_slot *slot)
+{
+    struct wolfsentry_route *route = &slot->route;
+
+    memset(route, 0, offsetof(struct wolfsentry_route, data));
+    slot->record = record;
+    route->header.id = WOLFSENTRY_ENT_ID_NONE;
+    route->parent_event = (record->event_index == WOLFSENTRY_ROUTE_IMAGE_NO_EVENT) ? NULL : image->events[record->event_index];
+    route->flags = (wolfsentry_route_flags_t)(record->flags | WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
+    route->sa_family = record->sa_family;
+    route->sa_proto = record->sa_proto;
+    route->remote = record->remote;
+    route->local = record->local;
+    route->data_addr_size = (uint16_t)sizeof slot->buf;
+    memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(route), image->pool + record->addr_offset,
+           WOLFSENTRY_BITS_TO_BYTES((size_t)record->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)record->local.addr_len));
+}
+
+/* considers each image route that can match the target, keeping the best in
+ * *best_slot.
+ */
+static void wolfsentry_route_image_lookup(
     WOLFSENTRY_CONTEXT_ARGS_IN,
-    struct wolfsentry_route *route,
-    wolfsentry_action_res_t *action_results)
+    struct wolfsentry_route_lookup_state *state,
+    struct wolfsentry_route_image_slot *best_slot)
 {
-    if (! (route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS)) {
-        wolfsentry_hitcount_t post_hitcount;
-        WOLFSENTRY_ATOMIC_INCREMENT_UNSIGNED_SAFELY_BY_ONE(route->header.hitcount, post_hitcount);
-        if (post_hitcount == 0) {
-            wolfsentry_route_flags_t flags_before, flags_after;
-            WOLFSENTRY_WARN_ON_FAILURE(
-                wolfsentry_route_update_flags(
-                    WOLFSENTRY_CONTEXT_ARGS_OUT,
-                    route,
-                    WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS,
-                    WOLFSENTRY_ROUTE_FLAG_NONE,
-                    &flags_before,
-                    &flags_after,
-                    action_results));
+    const struct wolfsentry_route_image *image = state->table->image;
+    const struct wolfsentry_route *target_route = state->target_route;
+    const byte *target_remote_addr = WOLFSENTRY_ROUTE_REMOTE_ADDR(target_route);
+    wolfsentry_route_flags_t target_directions = WOLFSENTRY_MASKIN_BITS(target_route->flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN|WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
+    /* a target with a wildcard family or remote address can match in any group. */
+    int match_any_p = WOLFSENTRY_MASKIN_BITS(target_route->flags, WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD|WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) != 0;
+    struct wolfsentry_route_image_slot candidate;
+    uint32_t g;
+
+    /* as for the indexed table lookups, ties are broken by table order. */
+    state->prefer_later_p = 1;
+
+    for (g = 0; g < image->n_groups; ++g) {
+        const struct wolfsentry_route_image_group *group = &image->groups[g];
+        uint32_t i = group->first, end = group->first + group->count;
+        int prefix_len = 0;
+
+        if (! match_any_p) {
+            if ((! group->family_wildcard) && (group->sa_family != target_route->sa_family))
+                continue;
+            prefix_len = (group->remote_prefix_len < target_route->remote.addr_len) ? (int)group->remote_prefix_len : (int)target_route->remote.addr_len;
+            if (prefix_len > 0) {
+                /* find the first route whose remote prefix doesn't sort before the target's. */
+                uint32_t hi = end;
+                while (i < hi) {
+                    uint32_t mid = i + ((hi - i) >> 1U);
+                    if (wolfsentry_route_image_prefix_cmp(image->pool + image->routes[mid].addr_offset, target_remote_addr, prefix_len) < 0)
+                        i = mid + 1U;
+                    else
+                        hi = mid;
+                }
+            }
+        }
+
+        for (; i < end; ++i) {
+            const struct wolfsentry_route_image_route *record = &image->routes[i];
+            if ((prefix_len > 0) && (wolfsentry_route_image_prefix_cmp(image->pool + record->addr_offset, target_remote_addr, prefix_len) != 0))
+                break;
+            if (! (record->flags & target_directions))
+                continue;
+            wolfsentry_route_image_expand(image, record, &candidate);
+            wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, state, &candidate.route);
+            if (state->best == &candidate.route) {
+                *best_slot = candidate;
+                state->best = &best_slot->route;
+            }
         }
     }
+
     WOLFSENTRY_RETURN_VOID;
 }
 
@@ -1103,20 +3066,25 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
     int exact_p,
     wolfsentry_route_flags_t *inexact_matches,
     struct wolfsentry_route **found_route,
+    struct wolfsentry_route_image_slot *image_slot, /* null to search the table alone. */
     wolfsentry_action_res_t *action_results)
 {
     struct wolfsentry_cursor cursor;
     int cursor_position;
     struct wolfsentry_route *i;
-    int highest_priority_seen = 0;
-    struct wolfsentry_route *highest_priority_match_seen = NULL;
-    wolfsentry_route_flags_t highest_priority_inexact_matches = 0;
+    struct wolfsentry_route_lookup_state state;
     wolfsentry_errcode_t ret;
     int contiguous_search;
     wolfsentry_route_flags_t inexact_matches_buf;
+    const struct wolfsentry_route_image *image = image_slot ? table->image : NULL;
+    wolfsentry_priority_t highest_priority = table->highest_priority_route_in_table;
 #ifdef DEBUG_ROUTE_LOOKUP
     struct wolfsentry_route *i_prev = NULL;
 #endif
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t lookup_start = WOLFSENTRY_INSTRUMENT_NOW();
+    unsigned int n_compared = 0;
+#endif
 
 #ifdef DEBUG_ROUTE_LOOKUP
     fprintf(stderr,"target: ");
@@ -1125,6 +3093,9 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
 
     *found_route = NULL;
 
+    if ((image != NULL) && (image->highest_priority < highest_priority))
+        highest_priority = image->highest_priority;
+
     if ((ret = wolfsentry_table_cursor_init(WOLFSENTRY_CONTEXT_ARGS_OUT, &cursor)) < 0)
         goto out;
 
@@ -1154,7 +3125,7 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
         WOLFSENTRY_SET_BITS(target_route->flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
 
     /* if the target has wildcard holes in it (not strictly prefix-matching),
-     * then seek to the tail and skip straight to reverse iteration.
+     * then skip straight to the secondary search.
      *
      * the test for this depends on the wildcard bits in the flag word being
      * crowded at the bottom of the word, in order (lsb is leftmost search
@@ -1167,11 +3138,11 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
         /* secondary search will be skipped. */
     } else if (((~target_route->flags & WOLFSENTRY_ROUTE_WILDCARD_FLAGS) + 1) & (~target_route->flags & WOLFSENTRY_ROUTE_WILDCARD_FLAGS)) {
         contiguous_search = 0;
-        /* skip primary search for now -- once the table is a red-black tree, it
-         * will be worth constructing a target_route_contiguous_wildcards and
-         * doing both, avoiding the need to traverse the entire table.
+        cursor_position = -1;
+        /* skip the primary search -- the secondary search below uses the LPM
+         * index when it can, and otherwise scans the entire table.
          */
-        goto just_seek_to_tail;
+        goto secondary_search;
     } else
         contiguous_search = 1;
 
@@ -1187,6 +3158,11 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
     fprintf(stderr,"  res: %d\n",cursor_position);
 #endif
 
+#ifdef WOLFSENTRY_INSTRUMENT
+    if (cursor.point != NULL)
+        n_compared = 1;
+#endif
+
     if (exact_p) {
         if (cursor_position == 0) {
             *inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
@@ -1208,93 +3184,72 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
              ((~(*action_results) & parent_event->config->config.action_res_filter_bits_unset) == parent_event->config->config.action_res_filter_bits_unset)))
         {
             int effective_priority = parent_event ? parent_event->priority : 0;
-            if (effective_priority <= table->highest_priority_route_in_table) {
+            if (effective_priority <= highest_priority) {
                 if (inexact_matches != NULL)
                     *inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
-                *found_route = (struct wolfsentry_route *)cursor.point;
-                ret = WOLFSENTRY_ERROR_ENCODE(OK);
-                goto out;
-            }
-        }
-    }
-
-    if (cursor_position == -1) {
-    just_seek_to_tail:
-        wolfsentry_table_cursor_seek_to_tail(&table->header, &cursor);
-    }
-
-    for (i = (struct wolfsentry_route *)wolfsentry_table_cursor_current(&cursor);
-         i;
-         i = (struct wolfsentry_route *)wolfsentry_table_cursor_prev(&cursor))
-    {
-        if (WOLFSENTRY_CHECK_BITS(i->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))
-            continue;
-        /* ignore routes that don't cover the direction of the target. */
-        if (! (i->flags & WOLFSENTRY_MASKIN_BITS(target_route->flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN|WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
-            continue;
-        /* ignore routes that don't meet actions_results constraints. */
-        if (action_results && i->parent_event && i->parent_event->config &&
-            (((*action_results & i->parent_event->config->config.action_res_filter_bits_set) != i->parent_event->config->config.action_res_filter_bits_set) ||
-             ((~(*action_results) & i->parent_event->config->config.action_res_filter_bits_unset) != i->parent_event->config->config.action_res_filter_bits_unset)))
-        {
-            continue;
-        }
-        /* if *action_results has _EXCLUDE_REJECT_ROUTES set on entry to
-         * wolfsentry_route_lookup_0(), it was set via
-         * wolfsentry_route_event_dispatch_with_inited_result() for a
-         * bind/listen query that should succeed if any routes can succeed.
-         * this requires ignoring routes with _PENALTYBOXED/_PORT_RESET set.
-         */
-        if (action_results &&
-            WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES) &&
-            WOLFSENTRY_MASKIN_BITS(i->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_PORT_RESET))
-        {
-            continue;
+                *found_route = (struct wolfsentry_route *)cursor.point;
+                ret = WOLFSENTRY_ERROR_ENCODE(OK);
+                goto out;
+            }
         }
+    }
 
-        cursor_position = wolfsentry_route_key_cmp_1(i, target_route, 1 /* match_wildcards_p */, inexact_matches);
+  secondary_search:
 
-#ifdef DEBUG_ROUTE_LOOKUP
-        fprintf(stderr,"i: ");
-        if (wolfsentry_route_render(WOLFSENTRY_CONTEXT_ARGS_OUT, i, stderr) < 0) {}
-        fprintf(stderr,"\n  res: %d\n",cursor_position);
-        fputs("  inexact_matches: ", stderr);
-        if (wolfsentry_route_render_flags(*inexact_matches, stderr) < 0) {}
-        fputc('\n', stderr);
+    state.table = table;
+    state.target_route = target_route;
+    state.action_results = action_results;
+    state.best = NULL;
+    state.best_inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
+    state.best_priority = 0;
+#ifdef WOLFSENTRY_INSTRUMENT
+    state.n_considered = 0;
 #endif
 
-        if (cursor_position == 0) {
-            /* preference is a match with the highest-priority event, with null
-             * events having highest priority, and ties broken using
-             * compare_match_exactness().
+    if (wolfsentry_route_tuple_lookup_eligible(table, target_route)) {
+        /* the indexes yield the same candidates as a full scan, in no
+         * particular order, so ties are broken by table order explicitly.
+         */
+        state.prefer_later_p = 1;
+        wolfsentry_route_tuple_lookup(WOLFSENTRY_CONTEXT_ARGS_OUT, &state);
+    } else if ((! table->lpm_lookup_disabled) && wolfsentry_route_lpm_lookup_eligible(target_route)) {
+        state.prefer_later_p = 1;
+        wolfsentry_route_lpm_lookup(WOLFSENTRY_CONTEXT_ARGS_OUT, &state);
+    } else {
+        state.prefer_later_p = 0;
+
+        if (cursor_position == -1)
+            wolfsentry_table_cursor_seek_to_tail(&table->header, &cursor);
+
+        for (i = (struct wolfsentry_route *)wolfsentry_table_cursor_current(&cursor);
+             i;
+             i = (struct wolfsentry_route *)wolfsentry_table_cursor_prev(&cursor))
+        {
+            wolfsentry_route_lookup_consider(WOLFSENTRY_CONTEXT_ARGS_OUT, &state, i);
+
+            /* short circuit if we know there can't be a higher priority
+             * match in a later iteration.
              */
-            int effective_priority = i->parent_event ? i->parent_event->priority : 0;
-            if ((highest_priority_match_seen == NULL) ||
-                (effective_priority < highest_priority_seen) ||
-                ((effective_priority == highest_priority_seen) &&
-                 (compare_match_exactness(target_route, i, *inexact_matches, highest_priority_match_seen, highest_priority_inexact_matches) < 0)))
+            if (contiguous_search &&
+                state.best &&
+                ((state.best_inexact_matches & WOLFSENTRY_ROUTE_WILDCARD_FLAGS) == 0) &&
+                (state.best_priority <= highest_priority))
             {
-                highest_priority_match_seen = i;
-                highest_priority_inexact_matches = *inexact_matches;
-                highest_priority_seen = effective_priority;
+                break;
             }
         }
-
-        /* short circuit if we know there can't be a higher priority
-         * match in a later iteration.
-         */
-        if (contiguous_search &&
-            highest_priority_match_seen &&
-            ((highest_priority_inexact_matches & WOLFSENTRY_ROUTE_WILDCARD_FLAGS) == 0) &&
-            (highest_priority_seen <= table->highest_priority_route_in_table))
-        {
-            break;
-        }
     }
 
-    if (highest_priority_match_seen) {
-        *found_route = highest_priority_match_seen;
-        *inexact_matches = highest_priority_inexact_matches;
+    if (image != NULL)
+        wolfsentry_route_image_lookup(WOLFSENTRY_CONTEXT_ARGS_OUT, &state, image_slot);
+
+#ifdef WOLFSENTRY_INSTRUMENT
+    n_compared = state.n_considered;
+#endif
+
+    if (state.best) {
+        *found_route = state.best;
+        *inexact_matches = state.best_inexact_matches;
         ret = WOLFSENTRY_ERROR_ENCODE(OK);
     } else {
         ret = WOLFSENTRY_ERROR_ENCODE(ITEM_NOT_FOUND);
@@ -1302,6 +3257,11 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_0(
 
   out:
 
+#ifdef WOLFSENTRY_INSTRUMENT
+    WOLFSENTRY_INSTRUMENT_RECORD(wolfsentry->instrument, WOLFSENTRY_INSTRUMENT_LOOKUP_TIME, WOLFSENTRY_INSTRUMENT_NOW() - lookup_start);
+    WOLFSENTRY_INSTRUMENT_RECORD(wolfsentry->instrument, WOLFSENTRY_INSTRUMENT_LOOKUP_COMPARES, n_compared);
+#endif
+
     if (action_results && WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES))
         WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES);
 
@@ -1347,7 +3307,76 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_1(
     if ((ret = wolfsentry_route_init(parent_event, remote, local, flags, 0 /* data_addr_offset */, sizeof target.buf, &target.route)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
 
-    ret = wolfsentry_route_lookup_0(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &target.route, exact_p, inexact_matches, found_route, action_results);
+    ret = wolfsentry_route_lookup_0(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &target.route, exact_p, inexact_matches, found_route, NULL /* image_slot */, action_results);
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+/* wolfsentry_route_lookup_0() for dispatch, consulting the flow cache first
+ * when the table has one.  a match in the route image is expanded into
+ * *image_slot.
+ */
+static wolfsentry_errcode_t wolfsentry_route_lookup_cached(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    struct wolfsentry_route *target_route,
+    wolfsentry_route_flags_t *inexact_matches,
+    struct wolfsentry_route **found_route,
+    struct wolfsentry_route_image_slot *image_slot,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_route_flow_cache *cache = table->flow_cache;
+    wolfsentry_route_flags_t inexact_matches_buf;
+    wolfsentry_action_res_t action_results_on_entry;
+    wolfsentry_hitcount_t generation;
+    const struct wolfsentry_route_image_route *image_route;
+    uint32_t hash;
+    wolfsentry_errcode_t ret;
+
+    if ((cache == NULL) || (action_results == NULL) || (! wolfsentry_route_flow_cache_eligible(target_route)))
+        WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_lookup_0(WOLFSENTRY_CONTEXT_ARGS_OUT, table, target_route, 0 /* exact_p */, inexact_matches, found_route, image_slot, action_results));
+
+    if (inexact_matches == NULL)
+        inexact_matches = &inexact_matches_buf;
+
+    /* as in wolfsentry_route_lookup_0(), the event is always a wildcard for
+     * dispatch.
+     */
+    WOLFSENTRY_SET_BITS(target_route->flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
+
+    /* the generation must be captured before the lookup, so that a result
+     * computed concurrently with a flag change is never cached as current.
+     */
+    generation = WOLFSENTRY_ATOMIC_LOAD(table->generation);
+    action_results_on_entry = *action_results;
+    hash = wolfsentry_route_flow_cache_hash(target_route, action_results_on_entry);
+
+    if (wolfsentry_route_flow_cache_get(cache, target_route, action_results_on_entry, hash, generation, found_route, &image_route, inexact_matches)) {
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(cache->hits);
+        if (WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES))
+            WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_EXCLUDE_REJECT_ROUTES);
+        /* the generation changes whenever an image is attached or detached,
+         * so a cached image route is always from the current image.
+         */
+        if (image_route != NULL) {
+            wolfsentry_route_image_expand(table->image, image_route, image_slot);
+            *found_route = &image_slot->route;
+        }
+        if (*found_route == NULL)
+            WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+        wolfsentry_route_increment_hitcount(WOLFSENTRY_CONTEXT_ARGS_OUT, *found_route, action_results);
+        WOLFSENTRY_RETURN_OK;
+    }
+
+    WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(cache->misses);
+
+    ret = wolfsentry_route_lookup_0(WOLFSENTRY_CONTEXT_ARGS_OUT, table, target_route, 0 /* exact_p */, inexact_matches, found_route, image_slot, action_results);
+    if ((ret >= 0) || WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND)) {
+        if ((ret >= 0) && (*found_route == &image_slot->route))
+            wolfsentry_route_flow_cache_put(cache, target_route, action_results_on_entry, hash, generation, NULL /* route */, image_slot->record, *inexact_matches);
+        else
+            wolfsentry_route_flow_cache_put(cache, target_route, action_results_on_entry, hash, generation, (ret >= 0) ? *found_route : NULL, NULL /* image_route */, *inexact_matches);
+    }
+
     WOLFSENTRY_ERROR_RERETURN(ret);
 }
 
@@ -1401,7 +3430,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_max_purgeable_routes_
     int need_purge_now = 0;
 
     if (WOLFSENTRY_ATOMIC_LOAD(table->max_purgeable_routes) > max_purgeable_routes) {
-        if (table->purge_list.len > max_purgeable_routes)
+        if (table->purge_wheel.len > max_purgeable_routes)
             need_purge_now = 1;
     }
 
@@ -1413,6 +3442,561 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_max_purgeable_routes_
         WOLFSENTRY_RETURN_OK;
 }
 
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_tuple_classifier_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    int *enabled)
+{
+    WOLFSENTRY_SHARED_OR_RETURN();
+    *enabled = table->tuple_classifier_enabled;
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_tuple_classifier_set(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    int enabled)
+{
+    struct wolfsentry_table_ent_header *i;
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if ((enabled != 0) == (table->tuple_classifier_enabled != 0))
+        WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+
+    if (! enabled) {
+        wolfsentry_route_tuples_free(WOLFSENTRY_CONTEXT_ARGS_OUT, table);
+        table->tuple_classifier_enabled = 0;
+        WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+    }
+
+    for (i = table->header.head; i; i = i->next) {
+        if ((ret = wolfsentry_route_tuple_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, table, (struct wolfsentry_route *)i)) < 0) {
+            wolfsentry_route_tuples_free(WOLFSENTRY_CONTEXT_ARGS_OUT, table);
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+        }
+    }
+    table->tuple_classifier_enabled = 1;
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_flow_cache_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    size_t *n_entries,
+    wolfsentry_hitcount_t *hits,
+    wolfsentry_hitcount_t *misses)
+{
+    WOLFSENTRY_SHARED_OR_RETURN();
+    if (table->flow_cache == NULL) {
+        if (n_entries)
+            *n_entries = 0;
+        if (hits)
+            *hits = 0;
+        if (misses)
+            *misses = 0;
+    } else {
+        if (n_entries)
+            *n_entries = (size_t)table->flow_cache->n_sets * WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS;
+        if (hits)
+            *hits = WOLFSENTRY_ATOMIC_LOAD(table->flow_cache->hits);
+        if (misses)
+            *misses = WOLFSENTRY_ATOMIC_LOAD(table->flow_cache->misses);
+    }
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_flow_cache_set(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    size_t n_entries)
+{
+    struct wolfsentry_route_flow_cache *cache = NULL;
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (n_entries > 0) {
+        if ((ret = wolfsentry_route_flow_cache_new(WOLFSENTRY_CONTEXT_ARGS_OUT, n_entries, &cache)) < 0)
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    }
+
+    if (table->flow_cache != NULL)
+        WOLFSENTRY_FREE(table->flow_cache);
+    table->flow_cache = cache;
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+/* building and attaching route images. */
+
+struct wolfsentry_route_image_build_slot {
+    const struct wolfsentry_route *route;
+    uint32_t event_index;
+    uint32_t table_order;
+    /* the group key. */
+    int family_wildcard;
+    wolfsentry_addr_family_t sa_family; /* zero for a wildcard family. */
+    int remote_prefix_len;
+};
+
+static int wolfsentry_route_image_build_group_cmp(const struct wolfsentry_route_image_build_slot *left, const struct wolfsentry_route_image_build_slot *right) {
+    if (left->family_wildcard != right->family_wildcard)
+        return left->family_wildcard - right->family_wildcard;
+    if (left->sa_family != right->sa_family)
+        return (left->sa_family < right->sa_family) ? -1 : 1;
+    return left->remote_prefix_len - right->remote_prefix_len;
+}
+
+static int wolfsentry_route_image_build_cmp(const struct wolfsentry_route_image_build_slot *left, const struct wolfsentry_route_image_build_slot *right) {
+    int cmp = wolfsentry_route_image_build_group_cmp(left, right);
+    if (cmp != 0)
+        return cmp;
+    cmp = wolfsentry_route_image_prefix_cmp(WOLFSENTRY_ROUTE_REMOTE_ADDR(left->route), WOLFSENTRY_ROUTE_REMOTE_ADDR(right->route), left->remote_prefix_len);
+    if (cmp != 0)
+        return cmp;
+    return (left->table_order < right->table_order) ? -1 : (left->table_order > right->table_order);
+}
+
+static void wolfsentry_route_image_build_sift_down(struct wolfsentry_route_image_build_slot *slots, size_t root, size_t n) {
+    for (;;) {
+        size_t child = (root * 2U) + 1U;
+        struct wolfsentry_route_image_build_slot tmp;
+        if (child >= n)
+            return;
+        if ((child + 1U < n) && (wolfsentry_route_image_build_cmp(&slots[child], &slots[child + 1U]) < 0))
+            ++child;
+        if (wolfsentry_route_image_build_cmp(&slots[root], &slots[child]) >= 0)
+            return;
+        tmp = slots[root];
+        slots[root] = slots[child];
+        slots[child] = tmp;
+        root = child;
+    }
+}
+
+static void wolfsentry_route_image_build_sort(struct wolfsentry_route_image_build_slot *slots, size_t n) {
+    size_t i;
+    struct wolfsentry_route_image_build_slot tmp;
+
+    if (n < 2U)
+        return;
+    for (i = n / 2U; i-- > 0; )
+        wolfsentry_route_image_build_sift_down(slots, i, n);
+    for (i = n - 1U; i > 0; --i) {
+        tmp = slots[0];
+        slots[0] = slots[i];
+        slots[i] = tmp;
+        wolfsentry_route_image_build_sift_down(slots, 0, i);
+    }
+}
+
+/* expiring routes are dynamic by nature, and are left out of the image. */
+static int wolfsentry_route_image_build_eligible(const struct wolfsentry_route *route) {
+    return (! WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE)) && (route->meta.purge_after == 0);
+}
+
+/* the section offsets and total length of an image with the given counts.
+ * they're summed in uint64_t, which can't wrap for uint32_t counts, so that the
+ * builder and the checker can compare them to the uint32_t header fields
+ * without overflow, even where size_t is 32 bits.
+ */
+struct wolfsentry_route_image_layout {
+    uint64_t events_offset;
+    uint64_t groups_offset;
+    uint64_t routes_offset;
+    uint64_t pool_offset;
+    uint64_t total_len;
+};
+
+static void wolfsentry_route_image_layout(
+    uint64_t n_events,
+    uint64_t n_groups,
+    uint64_t n_routes,
+    uint64_t pool_len,
+    struct wolfsentry_route_image_layout *layout)
+{
+    layout->events_offset = WOLFSENTRY_ROUTE_IMAGE_ALIGN((uint64_t)sizeof(struct wolfsentry_route_image_header));
+    layout->groups_offset = WOLFSENTRY_ROUTE_IMAGE_ALIGN(layout->events_offset + n_events * sizeof(struct wolfsentry_route_image_event));
+    layout->routes_offset = WOLFSENTRY_ROUTE_IMAGE_ALIGN(layout->groups_offset + n_groups * sizeof(struct wolfsentry_route_image_group));
+    layout->pool_offset = WOLFSENTRY_ROUTE_IMAGE_ALIGN(layout->routes_offset + n_routes * sizeof(struct wolfsentry_route_image_route));
+    layout->total_len = WOLFSENTRY_ROUTE_IMAGE_ALIGN(layout->pool_offset + pool_len);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_build(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    byte *buf,
+    size_t *buf_len)
+{
+    struct wolfsentry_route_image_header header;
+    struct wolfsentry_route_image_layout layout;
+    struct wolfsentry_route_image_build_slot *slots = NULL;
+    struct wolfsentry_event **events = NULL;
+    struct wolfsentry_table_ent_header *i;
+    size_t n_routes = 0, n_events = 0, n_groups = 0, pool_len = 0, pool_pos, total_len, r, e;
+    wolfsentry_errcode_t ret;
+
+    if ((table == NULL) || (buf_len == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    for (i = table->header.head; i; i = i->next) {
+        const struct wolfsentry_route *route = (const struct wolfsentry_route *)i;
+        if (! wolfsentry_route_image_build_eligible(route))
+            continue;
+        if ((route->remote.extra_port_count != 0) || (route->local.extra_port_count != 0) ||
+            (route->remote.addr_len > WOLFSENTRY_MAX_ADDR_BITS) || (route->local.addr_len > WOLFSENTRY_MAX_ADDR_BITS))
+        {
+            ret = WOLFSENTRY_ERROR_ENCODE(INCOMPATIBLE_STATE);
+            goto out;
+        }
+        ++n_routes;
+    }
+
+    if (n_routes > 0) {
+        if (n_routes > MAX_UINT_OF(uint32_t) / (sizeof *slots + sizeof *events)) {
+            ret = WOLFSENTRY_ERROR_ENCODE(NUMERIC_ARG_TOO_BIG);
+            goto out;
+        }
+        if ((slots = (struct wolfsentry_route_image_build_slot *)WOLFSENTRY_MALLOC(n_routes * (sizeof *slots + sizeof *events))) == NULL) {
+            ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+            goto out;
+        }
+        events = (struct wolfsentry_event **)(slots + n_routes);
+    }
+
+    /* collect the routes in table order, and their distinct parent events. */
+    for (i = table->header.head, r = 0; i; i = i->next) {
+        const struct wolfsentry_route *route = (const struct wolfsentry_route *)i;
+        if (! wolfsentry_route_image_build_eligible(route))
+            continue;
+        slots[r].route = route;
+        slots[r].table_order = (uint32_t)r;
+        slots[r].family_wildcard = wolfsentry_route_image_family_wildcard(route);
+        slots[r].sa_family = slots[r].family_wildcard ? 0 : route->sa_family;
+        slots[r].remote_prefix_len = wolfsentry_route_lpm_remote_len(route);
+        if (route->parent_event == NULL)
+            slots[r].event_index = WOLFSENTRY_ROUTE_IMAGE_NO_EVENT;
+        else if ((r > 0) && (slots[r - 1].route->parent_event == route->parent_event))
+            slots[r].event_index = slots[r - 1].event_index;
+        else {
+            for (e = 0; e < n_events; ++e) {
+                if (events[e] == route->parent_event)
+                    break;
+            }
+            if (e == n_events) {
+                events[n_events++] = route->parent_event;
+                pool_len += route->parent_event->label_len;
+            }
+            slots[r].event_index = (uint32_t)e;
+        }
+        pool_len += WOLFSENTRY_BITS_TO_BYTES((size_t)route->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)route->local.addr_len);
+        ++r;
+    }
+
+    wolfsentry_route_image_build_sort(slots, n_routes);
+
+    for (r = 0; r < n_routes; ++r) {
+        if ((r == 0) || (wolfsentry_route_image_build_group_cmp(&slots[r - 1], &slots[r]) != 0))
+            ++n_groups;
+    }
+
+    memset(&header, 0, sizeof header);
+    header.magic = WOLFSENTRY_ROUTE_IMAGE_MAGIC;
+    header.format_version = WOLFSENTRY_ROUTE_IMAGE_FORMAT_VERSION;
+    header.build_settings = wolfsentry_get_build_settings();
+    header.header_size = (uint32_t)sizeof(struct wolfsentry_route_image_header);
+    header.event_record_size = (uint32_t)sizeof(struct wolfsentry_route_image_event);
+    header.group_record_size = (uint32_t)sizeof(struct wolfsentry_route_image_group);
+    header.route_record_size = (uint32_t)sizeof(struct wolfsentry_route_image_route);
+    header.n_events = (uint32_t)n_events;
+    header.n_groups = (uint32_t)n_groups;
+    header.n_routes = (uint32_t)n_routes;
+    wolfsentry_route_image_layout(n_events, n_groups, n_routes, pool_len, &layout);
+    /* the offsets all precede the end, so they fit if it does. */
+    if (layout.total_len > MAX_UINT_OF(uint32_t)) {
+        ret = WOLFSENTRY_ERROR_ENCODE(NUMERIC_ARG_TOO_BIG);
+        goto out;
+    }
+    header.events_offset = (uint32_t)layout.events_offset;
+    header.groups_offset = (uint32_t)layout.groups_offset;
+    header.routes_offset = (uint32_t)layout.routes_offset;
+    header.pool_offset = (uint32_t)layout.pool_offset;
+    header.pool_len = (uint32_t)pool_len;
+    total_len = (size_t)layout.total_len;
+    header.total_len = (uint32_t)total_len;
+
+    if ((buf == NULL) || (*buf_len < total_len)) {
+        *buf_len = total_len;
+        ret = WOLFSENTRY_ERROR_ENCODE(BUFFER_TOO_SMALL);
+        goto out;
+    }
+
+    memset(buf, 0, total_len);
+    pool_pos = 0;
+
+    for (e = 0; e < n_events; ++e) {
+        struct wolfsentry_route_image_event *record = (struct wolfsentry_route_image_event *)(buf + header.events_offset) + e;
+        record->label_offset = (uint32_t)pool_pos;
+        record->label_len = events[e]->label_len;
+        memcpy(buf + header.pool_offset + pool_pos, events[e]->label, events[e]->label_len);
+        pool_pos += events[e]->label_len;
+    }
+
+    {
+        struct wolfsentry_route_image_group *group = (struct wolfsentry_route_image_group *)(buf + header.groups_offset) - 1;
+        for (r = 0; r < n_routes; ++r) {
+            const struct wolfsentry_route *route = slots[r].route;
+            struct wolfsentry_route_image_route *record = (struct wolfsentry_route_image_route *)(buf + header.routes_offset) + r;
+            size_t addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)route->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)route->local.addr_len);
+
+            if ((r == 0) || (wolfsentry_route_image_build_group_cmp(&slots[r - 1], &slots[r]) != 0)) {
+                ++group;
+                group->first = (uint32_t)r;
+                group->family_wildcard = (uint16_t)slots[r].family_wildcard;
+                group->sa_family = slots[r].sa_family;
+                group->remote_prefix_len = (wolfsentry_addr_bits_t)slots[r].remote_prefix_len;
+            }
+            ++group->count;
+
+            /* the table's runtime state isn't carried over. */
+            record->flags = (uint32_t)WOLFSENTRY_MASKOUT_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE|WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE|WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED|WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED);
+            record->event_index = slots[r].event_index;
+            record->addr_offset = (uint32_t)pool_pos;
+            record->sa_family = route->sa_family;
+            record->sa_proto = route->sa_proto;
+            record->remote = route->remote;
+            record->local = route->local;
+            memcpy(buf + header.pool_offset + pool_pos, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), addr_bytes);
+            pool_pos += addr_bytes;
+        }
+    }
+
+    header.checksum = wolfsentry_route_tuple_hash_bytes(2166136261U, buf + sizeof header, total_len - sizeof header);
+    memcpy(buf, &header, sizeof header);
+    *buf_len = total_len;
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (slots != NULL)
+        WOLFSENTRY_FREE(slots);
+
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+/* checks an image for consistency with this build, and with itself, so that
+ * lookups can trust its offsets and ordering without further checks.
+ */
+static wolfsentry_errcode_t wolfsentry_route_image_check(
+    const byte *image,
+    size_t image_len)
+{
+    struct wolfsentry_build_settings build_settings = wolfsentry_get_build_settings();
+    const struct wolfsentry_route_image_header *header = (const struct wolfsentry_route_image_header *)image;
+    struct wolfsentry_route_image_layout layout;
+    const struct wolfsentry_route_image_event *events;
+    const struct wolfsentry_route_image_group *groups;
+    const struct wolfsentry_route_image_route *routes;
+    uint32_t g, r, e;
+    wolfsentry_errcode_t ret;
+
+    if ((image == NULL) || (((uintptr_t)image % WOLFSENTRY_ROUTE_IMAGE_ALIGNMENT) != 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (image_len < sizeof *header)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    if (header->magic != WOLFSENTRY_ROUTE_IMAGE_MAGIC)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    if (header->format_version != WOLFSENTRY_ROUTE_IMAGE_FORMAT_VERSION)
+        WOLFSENTRY_ERROR_RETURN(LIB_MISMATCH);
+    ret = wolfsentry_build_settings_compatible(header->build_settings);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    if ((header->build_settings.config & WOLFSENTRY_CONFIG_FLAG_ENDIANNESS_ONE) != (build_settings.config & WOLFSENTRY_CONFIG_FLAG_ENDIANNESS_ONE))
+        WOLFSENTRY_ERROR_RETURN(LIBCONFIG_MISMATCH);
+    if ((header->header_size != sizeof(struct wolfsentry_route_image_header)) ||
+        (header->event_record_size != sizeof(struct wolfsentry_route_image_event)) ||
+        (header->group_record_size != sizeof(struct wolfsentry_route_image_group)) ||
+        (header->route_record_size != sizeof(struct wolfsentry_route_image_route)))
+    {
+        WOLFSENTRY_ERROR_RETURN(LIBCONFIG_MISMATCH);
+    }
+    if (header->total_len != image_len)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    wolfsentry_route_image_layout(header->n_events, header->n_groups, header->n_routes, header->pool_len, &layout);
+    if ((header->events_offset != layout.events_offset) ||
+        (header->groups_offset != layout.groups_offset) ||
+        (header->routes_offset != layout.routes_offset) ||
+        (header->pool_offset != layout.pool_offset) ||
+        (header->total_len != layout.total_len))
+    {
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    }
+    if (header->checksum != wolfsentry_route_tuple_hash_bytes(2166136261U, image + sizeof *header, image_len - sizeof *header))
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+    events = (const struct wolfsentry_route_image_event *)(image + header->events_offset);
+    groups = (const struct wolfsentry_route_image_group *)(image + header->groups_offset);
+    routes = (const struct wolfsentry_route_image_route *)(image + header->routes_offset);
+
+    for (e = 0; e < header->n_events; ++e) {
+        if ((events[e].label_len == 0) || (events[e].label_len > WOLFSENTRY_MAX_LABEL_BYTES) ||
+            (events[e].label_len > header->pool_len) || (events[e].label_offset > header->pool_len - events[e].label_len))
+        {
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+        }
+    }
+
+    for (g = 0, r = 0; g < header->n_groups; ++g) {
+        if ((groups[g].first != r) || (groups[g].count == 0) || (groups[g].count > header->n_routes - r))
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+        for (; r < groups[g].first + groups[g].count; ++r) {
+            const struct wolfsentry_route_image_route *record = &routes[r];
+            size_t addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)record->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)record->local.addr_len);
+            int family_wildcard = (record->flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) != 0;
+            int remote_len = (record->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) ? 0 : (int)record->remote.addr_len;
+
+            if ((record->event_index != WOLFSENTRY_ROUTE_IMAGE_NO_EVENT) && (record->event_index >= header->n_events))
+                WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+            if (record->flags & (WOLFSENTRY_ROUTE_FLAG_IN_TABLE|WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE|WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED|WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED))
+                WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+            if ((record->remote.extra_port_count != 0) || (record->local.extra_port_count != 0) ||
+                (record->remote.addr_len > WOLFSENTRY_MAX_ADDR_BITS) || (record->local.addr_len > WOLFSENTRY_MAX_ADDR_BITS) ||
+                (record->addr_offset > header->pool_len) || (addr_bytes > header->pool_len - record->addr_offset))
+            {
+                WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+            }
+            if ((family_wildcard != (int)groups[g].family_wildcard) ||
+                ((! family_wildcard) && (record->sa_family != groups[g].sa_family)) ||
+                (remote_len != (int)groups[g].remote_prefix_len))
+            {
+                WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+            }
+            /* lookups binary-search each group by remote address. */
+            if ((r > groups[g].first) &&
+                (wolfsentry_route_image_prefix_cmp(image + header->pool_offset + routes[r - 1].addr_offset,
+                                                   image + header->pool_offset + record->addr_offset,
+                                                   remote_len) > 0))
+            {
+                WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+            }
+        }
+    }
+    if (r != header->n_routes)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_route_image_unbind(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_image **image)
+{
+    uint32_t e;
+
+    for (e = 0; e < (*image)->n_events; ++e) {
+        if ((*image)->events[e] != NULL)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, (*image)->events[e], NULL /* action_results */));
+    }
+    WOLFSENTRY_FREE(*image);
+    *image = NULL;
+
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* binds a checked image to the context, resolving its parent events. */
+static wolfsentry_errcode_t wolfsentry_route_image_bind(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const byte *base,
+    size_t len,
+    struct wolfsentry_route_image **image)
+{
+    const struct wolfsentry_route_image_header *header = (const struct wolfsentry_route_image_header *)base;
+    const struct wolfsentry_route_image_event *events = (const struct wolfsentry_route_image_event *)(base + header->events_offset);
+    size_t image_size = offsetof(struct wolfsentry_route_image, events) + ((size_t)header->n_events * sizeof(struct wolfsentry_event *));
+    uint32_t e, r;
+    wolfsentry_errcode_t ret;
+
+    if ((*image = (struct wolfsentry_route_image *)WOLFSENTRY_MALLOC(image_size)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*image, 0, image_size);
+    (*image)->base = base;
+    (*image)->len = len;
+    (*image)->groups = (const struct wolfsentry_route_image_group *)(base + header->groups_offset);
+    (*image)->routes = (const struct wolfsentry_route_image_route *)(base + header->routes_offset);
+    (*image)->pool = base + header->pool_offset;
+    (*image)->n_groups = header->n_groups;
+    (*image)->n_routes = header->n_routes;
+    (*image)->n_events = header->n_events;
+
+    for (e = 0; e < header->n_events; ++e) {
+        if ((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, (const char *)(*image)->pool + events[e].label_offset, (int)events[e].label_len, &(*image)->events[e])) < 0) {
+            (*image)->events[e] = NULL;
+            wolfsentry_route_image_unbind(WOLFSENTRY_CONTEXT_ARGS_OUT, image);
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+    }
+
+    /* as in the table, a null parent event counts as the highest priority. */
+    (*image)->highest_priority = MAX_UINT_OF(wolfsentry_priority_t);
+    for (r = 0; r < header->n_routes; ++r) {
+        uint32_t event_index = (*image)->routes[r].event_index;
+        wolfsentry_priority_t effective_priority = (event_index == WOLFSENTRY_ROUTE_IMAGE_NO_EVENT) ? 0 : (*image)->events[event_index]->priority;
+        if (effective_priority < (*image)->highest_priority)
+            (*image)->highest_priority = effective_priority;
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_attach(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    const byte *image,
+    size_t image_len)
+{
+    struct wolfsentry_route_image *bound, *old;
+    wolfsentry_errcode_t ret;
+
+    if (table == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    ret = wolfsentry_route_image_check(image, image_len);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    ret = wolfsentry_route_image_bind(WOLFSENTRY_CONTEXT_ARGS_OUT, image, image_len, &bound);
+    WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
+
+    old = table->image;
+    table->image = bound;
+    if (old != NULL)
+        wolfsentry_route_image_unbind(WOLFSENTRY_CONTEXT_ARGS_OUT, &old);
+    wolfsentry_route_table_generation_bump(table);
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_detach(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table)
+{
+    if (table == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    if (table->image == NULL)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(ITEM_NOT_FOUND);
+    wolfsentry_route_image_unbind(WOLFSENTRY_CONTEXT_ARGS_OUT, &table->image);
+    wolfsentry_route_table_generation_bump(table);
+
+    WOLFSENTRY_UNLOCK_AND_RETURN_OK;
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_reference(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     const struct wolfsentry_route_table *table,
@@ -1455,15 +4039,16 @@ static inline wolfsentry_errcode_t wolfsentry_route_delete_0(
     if ((ret = wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, &route->header)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
 
-    if (route->meta.purge_after)
-        wolfsentry_list_ent_delete(&route_table->purge_list, &route->purge_links);
+    wolfsentry_route_table_index_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route);
+
+    wolfsentry_route_purge_wheel_cancel(route_table, route);
 
     {
         wolfsentry_route_flags_t flags_before, flags_after;
         wolfsentry_route_update_flags_1(route, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_IN_TABLE, &flags_before, &flags_after);
     }
 
-    if (route->parent_event && (wolfsentry_list_ent_get_len(&route->parent_event->delete_action_list.header) > 0)) {
+    if (route->parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(route->parent_event, WOLFSENTRY_ACTION_TYPE_DELETE)) {
         ret = wolfsentry_action_list_dispatch(
             WOLFSENTRY_CONTEXT_ARGS_OUT,
             caller_arg,
@@ -1508,7 +4093,7 @@ static inline wolfsentry_errcode_t wolfsentry_route_delete_0(
     WOLFSENTRY_RETURN_OK;
 }
 
-static inline wolfsentry_errcode_t wolfsentry_route_delete_1(
+static wolfsentry_errcode_t wolfsentry_route_delete_1(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *route_table,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
@@ -1631,6 +4216,27 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_delete_by_id(
     WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+#define WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(counters, which) WOLFSENTRY_ATOMIC_INCREMENT((counters).which[WOLFSENTRY_COUNTER_SHARD_INDEX(thread)].hitcount, 1)
+#else
+#define WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(counters, which) WOLFSENTRY_ATOMIC_INCREMENT((counters).which, 1)
+#endif
+
+static void wolfsentry_route_table_count_dispatch(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    wolfsentry_action_res_t action_results)
+{
+    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+    WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(route_table->dispatch_counters, n_dispatches);
+    if (action_results & WOLFSENTRY_ACTION_RES_REJECT)
+        WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(route_table->dispatch_counters, n_rejects);
+    else if (action_results & WOLFSENTRY_ACTION_RES_ACCEPT)
+        WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(route_table->dispatch_counters, n_accepts);
+    if (action_results & WOLFSENTRY_ACTION_RES_FALLTHROUGH)
+        WOLFSENTRY_DISPATCH_COUNTER_INCREMENT(route_table->dispatch_counters, n_fallthroughs);
+}
+
 static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_event *trigger_event,
@@ -1638,7 +4244,8 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     struct wolfsentry_route *target_route,
     struct wolfsentry_route_table *route_table,
     struct wolfsentry_route *rule_route,
-    wolfsentry_action_res_t *action_results
+    wolfsentry_action_res_t *action_results,
+    const wolfsentry_time_t *now /* if null, the time is fetched here. */
     )
 {
     struct wolfsentry_event *parent_event;
@@ -1656,32 +4263,32 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
 
     current_rule_route_flags = WOLFSENTRY_ATOMIC_LOAD(rule_route->flags);
 
-    WOLFSENTRY_WARN_ON_FAILURE(WOLFSENTRY_GET_TIME(&rule_route->meta.last_hit_time));
-
-    if (rule_route->meta.purge_after) {
-        wolfsentry_time_t purge_margin, new_purge_after;
-        /* use the purge_margin to reduce mutex burden. */
-        WOLFSENTRY_FROM_EPOCH_TIME(WOLFSENTRY_ROUTE_PURGE_MARGIN_SECONDS, 0 /* epoch_nsecs */, &purge_margin);
-        new_purge_after = rule_route->meta.last_hit_time + config->config.route_idle_time_for_purge + purge_margin;
-        if (new_purge_after - rule_route->meta.purge_after >= purge_margin) {
-            rule_route->meta.purge_after = new_purge_after;
-            if (route_table->purge_list.tail != &rule_route->purge_links) {
-#ifdef WOLFSENTRY_THREADSAFE
-                if ((wolfsentry_lock_have_mutex(&wolfsentry->lock, thread, WOLFSENTRY_LOCK_FLAG_NONE) >= 0) ||
-                    (wolfsentry_lock_shared2mutex(&wolfsentry->lock, thread, WOLFSENTRY_LOCK_FLAG_NONE) >= 0))
+    if (trigger_event != NULL) {
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+        WOLFSENTRY_ATOMIC_INCREMENT(trigger_event->hit_shards[WOLFSENTRY_COUNTER_SHARD_INDEX(thread)].hitcount, 1);
+#else
+        WOLFSENTRY_ATOMIC_INCREMENT(trigger_event->header.hitcount, 1);
 #endif
-                {
-                    wolfsentry_list_ent_delete(&route_table->purge_list, &rule_route->purge_links);
-                    wolfsentry_route_purge_list_insert(route_table, rule_route);
-                }
-            }
-        }
+    }
+
+    /* the hit refreshes the route's purge deadline only lazily -- the purger
+     * rechecks last_hit_time when the route comes due, and refiles it then, so
+     * the dispatch path never needs the mutex.
+     */
+    if (now != NULL)
+        WOLFSENTRY_ATOMIC_STORE_RELAXED(rule_route->meta.last_hit_time, *now);
+    else {
+        wolfsentry_time_t hit_time;
+        if ((ret = WOLFSENTRY_GET_TIME_CACHED(&hit_time)) < 0)
+            WOLFSENTRY_WARN_ON_FAILURE(ret);
+        else
+            WOLFSENTRY_ATOMIC_STORE_RELAXED(rule_route->meta.last_hit_time, hit_time);
     }
 
     /* opportunistic garbage collection. */
     (void)wolfsentry_route_stale_purge_one_opportunistically(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, NULL /* action_results */);
 
-    if (trigger_event && (wolfsentry_list_ent_get_len(&trigger_event->post_action_list.header) > 0)) {
+    if (trigger_event && WOLFSENTRY_EVENT_HAS_ACTIONS(trigger_event, WOLFSENTRY_ACTION_TYPE_POST)) {
         /* for dynamic blocking, e.g. of a port scanner, one of the plugins in
          * trigger_event->action_list must call wolfsentry_route_set_wildcard(),
          * in addition to setting _ACTION_RES_INSERT.
@@ -1715,7 +4322,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
         parent_event = route_table->default_event;
     }
 
-    if (parent_event && (wolfsentry_list_ent_get_len(&parent_event->match_action_list.header) > 0)) {
+    if (parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(parent_event, WOLFSENTRY_ACTION_TYPE_MATCH)) {
         WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_action_list_dispatch(
                                        WOLFSENTRY_CONTEXT_ARGS_OUT,
                                        caller_arg,
@@ -1737,19 +4344,13 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     if (! WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_INSERTED)) {
         if (! (current_rule_route_flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS)) {
             if (*action_results & WOLFSENTRY_ACTION_RES_CONNECT) {
-                if (rule_route->meta.connection_count >= config->config.max_connection_count) {
-                    *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
-                    ret = WOLFSENTRY_ERROR_ENCODE(OK);
-                    goto done;
-                }
-                if (WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(rule_route->meta.connection_count) > config->config.max_connection_count) {
-                    WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(rule_route->meta.connection_count);
+                if (! wolfsentry_route_connection_reserve(rule_route, config->config.max_connection_count)) {
                     *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
                     ret = WOLFSENTRY_ERROR_ENCODE(OK);
                     goto done;
                 }
             } else if (*action_results & WOLFSENTRY_ACTION_RES_DISCONNECT)
-                WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(rule_route->meta.connection_count);
+                wolfsentry_route_connection_release(rule_route);
         }
 
         if (*action_results & WOLFSENTRY_ACTION_RES_DEROGATORY) {
@@ -1783,13 +4384,14 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     if (((current_rule_route_flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)) &&
         ((config->config.penaltybox_duration > 0) && (rule_route->meta.last_penaltybox_time != 0)))
     {
-        wolfsentry_time_t now;
-        ret = WOLFSENTRY_GET_TIME(&now);
-        if (ret < 0) {
+        wolfsentry_time_t now_buf;
+        if (now != NULL)
+            now_buf = *now;
+        else if ((ret = WOLFSENTRY_GET_TIME_CACHED(&now_buf)) < 0) {
             *action_results |= WOLFSENTRY_ACTION_RES_ERROR | WOLFSENTRY_ACTION_RES_REJECT;
             goto done;
         }
-        if (WOLFSENTRY_DIFF_TIME(now, rule_route->meta.last_penaltybox_time) > config->config.penaltybox_duration) {
+        if (WOLFSENTRY_DIFF_TIME(now_buf, rule_route->meta.last_penaltybox_time) > config->config.penaltybox_duration) {
             wolfsentry_route_flags_t flags_before;
             WOLFSENTRY_WARN_ON_FAILURE(
                 wolfsentry_route_update_flags(
@@ -1856,7 +4458,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     }
 
     if (WOLFSENTRY_CHECK_BITS(*action_results, WOLFSENTRY_ACTION_RES_UPDATE) &&
-        parent_event && (wolfsentry_list_ent_get_len(&parent_event->update_action_list.header) > 0))
+        parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(parent_event, WOLFSENTRY_ACTION_TYPE_UPDATE))
     {
         WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP);
         WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_action_list_dispatch(
@@ -1872,7 +4474,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
         /* no need to refresh current_rule_route_flags */
     }
 
-    if (parent_event && (wolfsentry_list_ent_get_len(&parent_event->decision_action_list.header) > 0)) {
+    if (parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(parent_event, WOLFSENTRY_ACTION_TYPE_DECISION)) {
         WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP);
         WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_action_list_dispatch(
                                        WOLFSENTRY_CONTEXT_ARGS_OUT,
@@ -1887,45 +4489,56 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
         /* no need to refresh current_rule_route_flags */
     }
 
+    wolfsentry_route_table_count_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, *action_results);
+
     WOLFSENTRY_ERROR_RERETURN(ret);
 }
 
-static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
+/* caller holds the lock, and a reference to trigger_event if it's non-null. */
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_2(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *route_table,
     const struct wolfsentry_sockaddr *remote,
     const struct wolfsentry_sockaddr *local,
     wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
+    struct wolfsentry_event *trigger_event,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
     wolfsentry_ent_id_t *id,
     wolfsentry_route_flags_t *inexact_matches,
-    wolfsentry_action_res_t *action_results
+    wolfsentry_action_res_t *action_results,
+    const wolfsentry_time_t *now
     )
 {
+    /* the target route, and the stand-in rule route on a miss or a match in
+     * the route image, are built on the stack, so that dispatch only allocates
+     * when a route is inserted.
+     */
+    struct {
+        struct wolfsentry_route route;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    } target, fallthrough;
+    struct wolfsentry_route_image_slot image_match;
     struct wolfsentry_route *target_route = NULL;
     struct wolfsentry_route *rule_route = NULL;
-    struct wolfsentry_event *trigger_event = NULL;
     wolfsentry_errcode_t ret;
-
-    WOLFSENTRY_SHARED_OR_RETURN();
-
-    if (event_label) {
-        if (((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &trigger_event)) < 0)
-            && (! (flags & WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD)))
-        {
-            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
-        }
-    }
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t dispatch_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
 
     if (id)
         *id = WOLFSENTRY_ENT_ID_NONE;
 
-    if ((ret = wolfsentry_route_new(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event, remote, local, flags, &target_route)) < 0)
-        goto just_free_resources;
+    if (WOLFSENTRY_BITS_TO_BYTES((size_t)remote->addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)local->addr_len) <= sizeof target.buf) {
+        if ((ret = wolfsentry_route_init(trigger_event, remote, local, flags, 0 /* data_addr_offset */, sizeof target.buf, &target.route)) < 0)
+            goto just_free_resources;
+        target_route = &target.route;
+    } else {
+        /* addresses too long for the stack buffer -- fall back to the heap. */
+        if ((ret = wolfsentry_route_new(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event, remote, local, flags, &target_route)) < 0)
+            goto just_free_resources;
+    }
 
-    if ((ret = wolfsentry_route_lookup_0(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, target_route, 0 /* exact_p */, inexact_matches, &rule_route, action_results)) >= 0) {
+    if ((ret = wolfsentry_route_lookup_cached(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, target_route, inexact_matches, &rule_route, &image_match, action_results)) >= 0) {
         /* continue */
     }
     else if (trigger_event || route_table->default_event) {
@@ -1939,44 +4552,94 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
 
     if (rule_route == NULL) {
         *action_results |= WOLFSENTRY_ACTION_RES_FALLTHROUGH;
-        if ((ret = wolfsentry_route_clone(
-                 WOLFSENTRY_CONTEXT_ARGS_OUT,
-                 &target_route->header,
-                 wolfsentry,
-                 (struct wolfsentry_table_ent_header **)&rule_route,
-                 WOLFSENTRY_CLONE_FLAG_NONE)) < 0)
-            goto just_free_resources;
-        if ((rule_route->parent_event == NULL) && (route_table->default_event != NULL)) {
-            rule_route->parent_event = route_table->default_event;
-            WOLFSENTRY_REFCOUNT_INCREMENT(rule_route->parent_event->header.refcount, ret);
-            WOLFSENTRY_UNLOCK_AND_RERETURN_IF_ERROR(ret);
+        if (target_route == &target.route) {
+            /* the stand-in never outlives this call, and its parent event is
+             * held either by our trigger_event reference or by the route
+             * table, so no refcounting is needed.
+             */
+            fallthrough = target;
+            rule_route = &fallthrough.route;
+            if (rule_route->parent_event == NULL)
+                rule_route->parent_event = route_table->default_event;
+        } else {
+            if ((ret = wolfsentry_route_clone(
+                     WOLFSENTRY_CONTEXT_ARGS_OUT,
+                     &target_route->header,
+                     wolfsentry,
+                     (struct wolfsentry_table_ent_header **)&rule_route,
+                     WOLFSENTRY_CLONE_FLAG_NONE)) < 0)
+                goto just_free_resources;
+            if ((rule_route->parent_event == NULL) && (route_table->default_event != NULL)) {
+                rule_route->parent_event = route_table->default_event;
+                WOLFSENTRY_REFCOUNT_INCREMENT(rule_route->parent_event->header.refcount, ret);
+                if (ret < 0)
+                    goto just_free_resources;
+            }
         }
     }
 
-    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, target_route, route_table, rule_route, action_results);
+    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, target_route, route_table, rule_route, action_results, now);
 
     if (id && WOLFSENTRY_CHECK_BITS(rule_route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE))
         *id = rule_route->header.id;
 
   just_free_resources:
 
-    if ((rule_route != NULL) && (! WOLFSENTRY_CHECK_BITS(rule_route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE)))
+    if ((rule_route != NULL) && (rule_route != &fallthrough.route) && (rule_route != &image_match.route) && (! WOLFSENTRY_CHECK_BITS(rule_route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE)))
         WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, rule_route, NULL /* action_results */));
 
-    if (target_route != NULL)
+    if ((target_route != NULL) && (target_route != &target.route))
         WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(WOLFSENTRY_CONTEXT_ARGS_OUT, target_route, NULL /* action_results */));
 
-    if (trigger_event != NULL)
-        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event, NULL /* action_results */));
+#ifdef WOLFSENTRY_INSTRUMENT
+    WOLFSENTRY_INSTRUMENT_RECORD(wolfsentry->instrument, WOLFSENTRY_INSTRUMENT_DISPATCH_TIME, WOLFSENTRY_INSTRUMENT_NOW() - dispatch_start);
+#endif
 
     if (rule_route == NULL) {
         if (inexact_matches)
             *inexact_matches = WOLFSENTRY_ROUTE_WILDCARD_FLAGS | WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD;
         if (action_results)
             *action_results = route_table->default_policy;
-        WOLFSENTRY_SUCCESS_UNLOCK_AND_RETURN(USED_FALLBACK);
+        wolfsentry_route_table_count_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, route_table->default_policy | WOLFSENTRY_ACTION_RES_FALLTHROUGH);
+        WOLFSENTRY_SUCCESS_RETURN(USED_FALLBACK);
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results,
+    const wolfsentry_time_t *now /* if null, the time is fetched as needed. */
+    )
+{
+    struct wolfsentry_event *trigger_event = NULL;
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    if (event_label) {
+        if (((ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &trigger_event)) < 0)
+            && (! (flags & WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD)))
+        {
+            WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+        }
     }
 
+    ret = wolfsentry_route_event_dispatch_2(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, remote, local, flags, trigger_event, caller_arg, id, inexact_matches, action_results, now);
+
+    if (trigger_event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event, NULL /* action_results */));
+
     WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
@@ -1995,7 +4658,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_table(
     )
 {
     WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results));
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results, NULL /* now */));
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch(
@@ -2012,7 +4675,25 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch(
     )
 {
     WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results));
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results, NULL /* now */));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_at_time(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    wolfsentry_time_t now,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results, &now));
 }
 
 static wolfsentry_errcode_t check_user_inited_result(wolfsentry_action_res_t action_results) {
@@ -2043,7 +4724,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_table_w
 {
     wolfsentry_errcode_t ret = check_user_inited_result(*action_results);
     WOLFSENTRY_RERETURN_IF_ERROR(ret);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results));
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route_table, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results, NULL /* now */));
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_inited_result(
@@ -2061,7 +4742,141 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_inited_
 {
     wolfsentry_errcode_t ret = check_user_inited_result(*action_results);
     WOLFSENTRY_RERETURN_IF_ERROR(ret);
-    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results));
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_1(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results, NULL /* now */));
+}
+
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_event_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    /* a handle for an event since deleted, or from before a context exchange,
+     * is treated just like an unknown label.
+     */
+    if (trigger_event && (trigger_event->header.parent_table != &wolfsentry->events->header)) {
+        if (! (flags & WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD))
+            WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(ITEM_NOT_FOUND);
+        trigger_event = NULL;
+    }
+
+    ret = wolfsentry_route_event_dispatch_2(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, remote, local, flags, trigger_event, caller_arg, id, inexact_matches, action_results, NULL /* now */);
+
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_event(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_with_event_1(WOLFSENTRY_CONTEXT_ARGS_OUT, remote, local, flags, trigger_event, caller_arg, id, inexact_matches, action_results));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_event_with_inited_result(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    wolfsentry_errcode_t ret = check_user_inited_result(*action_results);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_with_event_1(WOLFSENTRY_CONTEXT_ARGS_OUT, remote, local, flags, trigger_event, caller_arg, id, inexact_matches, action_results));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_batch(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    size_t n_items,
+    const struct wolfsentry_sockaddr * const *remotes,
+    const struct wolfsentry_sockaddr * const *locals,
+    const wolfsentry_route_flags_t *flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results,
+    wolfsentry_errcode_t *item_results
+    )
+{
+    struct wolfsentry_event *trigger_event = NULL;
+    wolfsentry_errcode_t event_ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    wolfsentry_time_t now;
+    const wolfsentry_time_t *nowp = &now;
+    size_t i;
+
+    if ((remotes == NULL) || (locals == NULL) || (flags == NULL) || (action_results == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    /* the event and the time are resolved once for the whole batch. */
+    if (event_label)
+        event_ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_label, event_label_len, &trigger_event);
+    if (WOLFSENTRY_GET_TIME_CACHED(&now) < 0)
+        nowp = NULL;
+
+    for (i = 0; i < n_items; ++i) {
+        wolfsentry_errcode_t item_ret;
+
+        if (i + 1 < n_items) {
+            WOLFSENTRY_PREFETCH(remotes[i + 1]);
+            WOLFSENTRY_PREFETCH(locals[i + 1]);
+        }
+
+        WOLFSENTRY_CLEAR_ALL_BITS(action_results[i]);
+
+        if ((event_ret < 0) && (! (flags[i] & WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD)))
+            item_ret = event_ret;
+        else
+            item_ret = wolfsentry_route_event_dispatch_2(
+                WOLFSENTRY_CONTEXT_ARGS_OUT,
+                wolfsentry->routes,
+                remotes[i],
+                locals[i],
+                flags[i],
+                trigger_event,
+                caller_arg,
+                ids ? &ids[i] : NULL,
+                inexact_matches ? &inexact_matches[i] : NULL,
+                &action_results[i],
+                nowp);
+
+        if (item_results)
+            item_results[i] = item_ret;
+        if ((item_ret < 0) && (ret >= 0))
+            ret = item_ret;
+    }
+
+    if (trigger_event != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event, NULL /* action_results */));
+
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
 }
 
 static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_1(
@@ -2077,6 +4892,9 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_1(
     struct wolfsentry_event *trigger_event = NULL;
     struct wolfsentry_route *route;
     struct wolfsentry_route_table *route_table;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t dispatch_start;
+#endif
 
     WOLFSENTRY_SHARED_OR_RETURN();
 
@@ -2098,7 +4916,14 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_1(
 
     route_table = (struct wolfsentry_route_table *)route->header.parent_table;
 
-    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, NULL /* target_route */, (struct wolfsentry_route_table *)route->header.parent_table, route, action_results);
+    /* the caller identified the route outright, so it is its own target. */
+#ifdef WOLFSENTRY_INSTRUMENT
+    dispatch_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, route /* target_route */, route_table, route, action_results, NULL /* now */);
+#ifdef WOLFSENTRY_INSTRUMENT
+    WOLFSENTRY_INSTRUMENT_RECORD(wolfsentry->instrument, WOLFSENTRY_INSTRUMENT_DISPATCH_TIME, WOLFSENTRY_INSTRUMENT_NOW() - dispatch_start);
+#endif
 
   out:
     if (trigger_event)
@@ -2145,6 +4970,9 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_route_1(
     wolfsentry_errcode_t ret;
     struct wolfsentry_event *trigger_event = NULL;
     struct wolfsentry_route_table *route_table;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t dispatch_start;
+#endif
 
     WOLFSENTRY_SHARED_OR_RETURN();
 
@@ -2160,7 +4988,14 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_route_1(
 
     route_table = (struct wolfsentry_route_table *)route->header.parent_table;
 
-    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, NULL /* target_route */, (struct wolfsentry_route_table *)route->header.parent_table, route, action_results);
+    /* the caller identified the route outright, so it is its own target. */
+#ifdef WOLFSENTRY_INSTRUMENT
+    dispatch_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+    ret = wolfsentry_route_event_dispatch_0(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_event ? trigger_event : route_table->default_event, caller_arg, route /* target_route */, route_table, route, action_results, NULL /* now */);
+#ifdef WOLFSENTRY_INSTRUMENT
+    WOLFSENTRY_INSTRUMENT_RECORD(wolfsentry->instrument, WOLFSENTRY_INSTRUMENT_DISPATCH_TIME, WOLFSENTRY_INSTRUMENT_NOW() - dispatch_start);
+#endif
 
   out:
     if (trigger_event)
@@ -2195,20 +5030,6 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_route_wit
     WOLFSENTRY_ERROR_RERETURN(wolfsentry_route_event_dispatch_by_route_1(WOLFSENTRY_CONTEXT_ARGS_OUT, route, event_label, event_label_len, caller_arg, action_results));
 }
 
-/* purge_list: least stale at the head, most stale at the tail. */
-
-WOLFSENTRY_LOCAL_VOID wolfsentry_route_purge_list_insert(struct wolfsentry_route_table *route_table, struct wolfsentry_route *route_to_insert) {
-    struct wolfsentry_list_ent_header *point_ent;
-
-    for (wolfsentry_list_ent_get_first(&route_table->purge_list, &point_ent); point_ent; point_ent = point_ent->next) {
-        struct wolfsentry_route *point_route = WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(point_ent);
-        if (point_route->meta.purge_after < route_to_insert->meta.purge_after)
-            break;
-    }
-    wolfsentry_list_ent_insert_before(&route_table->purge_list, point_ent, &route_to_insert->purge_links);
-    WOLFSENTRY_RETURN_VOID;
-}
-
 static wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *table,
@@ -2225,7 +5046,7 @@ static wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
 #endif
 
     if (mode != 3) {
-        if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        if ((ret = WOLFSENTRY_GET_TIME_CACHED(&now)) < 0)
             WOLFSENTRY_ERROR_RERETURN(ret);
     }
 
@@ -2254,10 +5075,34 @@ static wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
         have_mutex = 1;
 #endif
 
-    while (table->purge_list.tail) {
-        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(table->purge_list.tail);
-        if ((mode != 3) && (route->meta.purge_after > now))
-            break;
+    if (mode != 3)
+        wolfsentry_route_purge_wheel_advance(wolfsentry, table, now);
+
+    for (;;) {
+        struct wolfsentry_route *route;
+        wolfsentry_time_t deadline;
+        if (mode == 3) {
+            if ((route = wolfsentry_route_purge_wheel_earliest(&table->purge_wheel)) == NULL)
+                break;
+            deadline = wolfsentry_route_purge_deadline(wolfsentry, table, route);
+            if (deadline > route->meta.purge_after) {
+                /* hit since it was filed -- refile it and look again. */
+                route->meta.purge_after = deadline;
+                wolfsentry_route_purge_wheel_reschedule(table, route);
+                continue;
+            }
+        } else {
+            if (table->purge_wheel.due.head == NULL)
+                break;
+            route = WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(table->purge_wheel.due.head);
+            deadline = wolfsentry_route_purge_deadline(wolfsentry, table, route);
+            if (deadline > now) {
+                /* hit since it was found due. */
+                route->meta.purge_after = deadline;
+                wolfsentry_route_purge_wheel_reschedule(table, route);
+                continue;
+            }
+        }
 #ifdef WOLFSENTRY_THREADSAFE
         if (! have_mutex) {
             if (mode == 2)
@@ -2281,6 +5126,7 @@ static wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
             WOLFSENTRY_ERROR_RERETURN(ret);
         }
         WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP);
+        WOLFSENTRY_ATOMIC_INCREMENT(table->n_purges, 1);
         ++n;
         if (mode >= 1)
              break;
@@ -2403,7 +5249,7 @@ static wolfsentry_errcode_t wolfsentry_route_call_insert_action(
     struct wolfsentry_table_ent_header *route,
     wolfsentry_action_res_t *action_results)
 {
-    if (((struct wolfsentry_route *)route)->parent_event && (wolfsentry_list_ent_get_len(&((struct wolfsentry_route *)route)->parent_event->insert_action_list.header) > 0)) {
+    if (((struct wolfsentry_route *)route)->parent_event && WOLFSENTRY_EVENT_HAS_ACTIONS(((struct wolfsentry_route *)route)->parent_event, WOLFSENTRY_ACTION_TYPE_INSERT)) {
         wolfsentry_errcode_t ret = wolfsentry_action_list_dispatch(
             WOLFSENTRY_CONTEXT_GET_ELEMENTS(*(struct insert_action_args *)args),
             NULL /* caller_arg */,
@@ -2448,7 +5294,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_private_data(
 {
     struct wolfsentry_eventconfig_internal *config = (route->parent_event && route->parent_event->config) ? route->parent_event->config : &wolfsentry->config;
     WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
-    if (config->config.route_private_data_size == 0)
+    /* routes built on the stack for dispatch have no private data area. */
+    if ((config->config.route_private_data_size == 0) || (route->data_addr_offset == 0))
         WOLFSENTRY_ERROR_RETURN(DATA_MISSING);
     *private_data = (byte *)route->data + config->route_private_data_padding;
     if (private_data_size)
@@ -2472,6 +5319,13 @@ static void wolfsentry_route_update_flags_1(
     wolfsentry_route_flags_t *flags_after)
 {
     WOLFSENTRY_ATOMIC_UPDATE_FLAGS(route->flags, flags_to_set, flags_to_clear, flags_before, flags_after);
+    /* flags that route lookup filters on invalidate cached lookup results. */
+    if ((*flags_after & WOLFSENTRY_ROUTE_FLAG_IN_TABLE) &&
+        (route->header.parent_table != NULL) &&
+        ((*flags_before ^ *flags_after) & (WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE|WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_PORT_RESET)))
+    {
+        wolfsentry_route_table_generation_bump((struct wolfsentry_route_table *)route->header.parent_table);
+    }
     WOLFSENTRY_RETURN_VOID;
 }
 
@@ -2501,7 +5355,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_update_flags(
             *action_results |= WOLFSENTRY_ACTION_RES_UPDATE;
     }
     if ((*flags_after & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (! (*flags_before & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)))
-        WOLFSENTRY_WARN_ON_FAILURE(WOLFSENTRY_GET_TIME(&route->meta.last_penaltybox_time));
+        WOLFSENTRY_WARN_ON_FAILURE(WOLFSENTRY_GET_TIME_CACHED(&route->meta.last_penaltybox_time));
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -2643,7 +5497,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_metadata(
     metadata->connection_count = WOLFSENTRY_ATOMIC_LOAD(route->meta.connection_count);
     metadata->derogatory_count = WOLFSENTRY_ATOMIC_LOAD(route->meta.derogatory_count);
     metadata->commendable_count = WOLFSENTRY_ATOMIC_LOAD(route->meta.commendable_count);
-    metadata->hit_count = WOLFSENTRY_ATOMIC_LOAD(route->header.hitcount);
+    metadata->hit_count = wolfsentry_route_get_hitcount(route);
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -2759,7 +5613,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_export(
         route_exports->local_extra_ports = NULL;
     if ((ret = wolfsentry_route_get_metadata(route, &route_exports->meta)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
-    if (config->config.route_private_data_size == 0) {
+    if ((config->config.route_private_data_size == 0) || (route->data_addr_offset == 0)) {
         route_exports->private_data = NULL;
         route_exports->private_data_size = 0;
     } else {
@@ -3627,6 +6481,15 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_init(
     route_table->header.free_fn = wolfsentry_route_drop_reference_generic;
     route_table->header.ent_type = WOLFSENTRY_OBJECT_TYPE_ROUTE;
     route_table->highest_priority_route_in_table = MAX_UINT_OF(wolfsentry_priority_t);
+    memset(&route_table->purge_wheel, 0, sizeof route_table->purge_wheel);
+    route_table->lpm_indexes = NULL;
+    WOLFSENTRY_LIST_HEADER_RESET(route_table->lpm_unindexed);
+    route_table->lpm_lookup_disabled = 0;
+    route_table->tuples = NULL;
+    route_table->tuple_classifier_enabled = 0;
+    route_table->generation = 1;
+    route_table->flow_cache = NULL;
+    route_table->image = NULL;
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -3646,8 +6509,24 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_clone_header(
 
     ((struct wolfsentry_route_table *)dest_table)->max_purgeable_routes =
         ((struct wolfsentry_route_table *)src_table)->max_purgeable_routes;
+    ((struct wolfsentry_route_table *)dest_table)->purge_wheel.cur_tick =
+        ((struct wolfsentry_route_table *)src_table)->purge_wheel.cur_tick;
     ((struct wolfsentry_route_table *)dest_table)->default_policy =
         ((struct wolfsentry_route_table *)src_table)->default_policy;
+    ((struct wolfsentry_route_table *)dest_table)->tuple_classifier_enabled =
+        ((struct wolfsentry_route_table *)src_table)->tuple_classifier_enabled;
+
+    if (((struct wolfsentry_route_table *)dest_table)->flow_cache != NULL) {
+        WOLFSENTRY_FREE_1(dest_context->hpi.allocator, ((struct wolfsentry_route_table *)dest_table)->flow_cache);
+        ((struct wolfsentry_route_table *)dest_table)->flow_cache = NULL;
+    }
+    if (((struct wolfsentry_route_table *)src_table)->flow_cache != NULL) {
+        if ((ret = wolfsentry_route_flow_cache_new(
+                 WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context),
+                 (size_t)((struct wolfsentry_route_table *)src_table)->flow_cache->n_sets * WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS,
+                 &((struct wolfsentry_route_table *)dest_table)->flow_cache)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+    }
 
     if (((struct wolfsentry_route_table *)src_table)->default_event != NULL) {
         struct wolfsentry_event *default_event;
@@ -3686,6 +6565,26 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_clone_header(
     ((struct wolfsentry_route_table *)dest_table)->highest_priority_route_in_table =
         ((struct wolfsentry_route_table *)src_table)->highest_priority_route_in_table;
 
+    if (((struct wolfsentry_route_table *)dest_table)->image != NULL) {
+        wolfsentry_route_image_unbind(dest_context,
+#ifdef WOLFSENTRY_THREADSAFE
+                                      NULL /* thread_context */,
+#endif
+                                      &((struct wolfsentry_route_table *)dest_table)->image);
+    }
+    if (((struct wolfsentry_route_table *)src_table)->image != NULL) {
+        /* the image itself is shared -- it's only rebound to the dest context's events. */
+        if ((ret = wolfsentry_route_image_bind(
+                 dest_context,
+#ifdef WOLFSENTRY_THREADSAFE
+                 NULL /* thread_context */,
+#endif
+                 ((struct wolfsentry_route_table *)src_table)->image->base,
+                 ((struct wolfsentry_route_table *)src_table)->image->len,
+                 &((struct wolfsentry_route_table *)dest_table)->image)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -3702,6 +6601,14 @@ WOLFSENTRY_LOCAL_VOID wolfsentry_route_table_free(
         (*route_table)->default_event = NULL;
     }
 
+    if ((*route_table)->image != NULL)
+        wolfsentry_route_image_unbind(WOLFSENTRY_CONTEXT_ARGS_OUT, &(*route_table)->image);
+
+    wolfsentry_route_lpm_free(WOLFSENTRY_CONTEXT_ARGS_OUT, *route_table);
+    wolfsentry_route_tuples_free(WOLFSENTRY_CONTEXT_ARGS_OUT, *route_table);
+    if ((*route_table)->flow_cache != NULL)
+        WOLFSENTRY_FREE((*route_table)->flow_cache);
+
     WOLFSENTRY_FREE(*route_table);
     *route_table = NULL;
 }
@@ -3746,3 +6653,46 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_copy_metadata(
 
     WOLFSENTRY_RETURN_OK;
 }
+
+/* copies the dynamic routes of from_table -- those with a purge_after -- into
+ * to_table in dest_context, with fresh IDs and their metadata intact.  routes
+ * whose key is already in to_table, or whose parent event dest_context lacks,
+ * are skipped.  insert actions aren't called again.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_migrate_dynamic(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *from_table,
+    struct wolfsentry_context *dest_context,
+    struct wolfsentry_route_table *to_table)
+{
+    struct wolfsentry_table_ent_header *i;
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+
+    WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
+    WOLFSENTRY_HAVE_MUTEX_OR_RETURN_EX(dest_context);
+
+    ret = WOLFSENTRY_GET_TIME_1(dest_context->hpi.timecbs, &now);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    for (i = from_table->header.head; i; i = i->next) {
+        struct wolfsentry_route *new;
+        if ((((struct wolfsentry_route *)i)->meta.purge_after == 0) ||
+            WOLFSENTRY_CHECK_BITS(((struct wolfsentry_route *)i)->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))
+        {
+            continue;
+        }
+        ret = wolfsentry_route_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, i, dest_context, (struct wolfsentry_table_ent_header **)&new, WOLFSENTRY_CLONE_FLAG_NONE);
+        if (WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND))
+            continue;
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        new->header.id = WOLFSENTRY_ENT_ID_NONE;
+        WOLFSENTRY_CLEAR_BITS(new->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE);
+        ret = wolfsentry_route_link_restored(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), to_table, new, now);
+        if (WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT))
+            continue;
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
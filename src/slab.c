@@ -0,0 +1,413 @@
+/*
+ * slab.c
+ *
+ * Copyright (C) 2021-2023 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_SLAB_C
+
+#ifdef WOLFSENTRY_SLAB_ALLOCATOR
+
+/* each block, slab or oversize, is preceded by a header of one granule,
+ * recording its size class, and for oversize blocks, the requested size.
+ * granules are 16 bytes, so payloads keep the 16 byte alignment of the chunks
+ * returned by the backing allocator.  size classes are spaced one granule
+ * apart, up to WOLFSENTRY_SLAB_MAX_BLOCK_SIZE including the header.
+ */
+
+#ifndef WOLFSENTRY_SLAB_GRANULARITY
+#define WOLFSENTRY_SLAB_GRANULARITY 16
+#endif
+
+#ifndef WOLFSENTRY_SLAB_MAX_BLOCK_SIZE
+#define WOLFSENTRY_SLAB_MAX_BLOCK_SIZE 512
+#endif
+
+#ifndef WOLFSENTRY_SLAB_CHUNK_SIZE
+#define WOLFSENTRY_SLAB_CHUNK_SIZE 16384
+#endif
+
+#define WOLFSENTRY_SLAB_N_CLASSES (WOLFSENTRY_SLAB_MAX_BLOCK_SIZE / WOLFSENTRY_SLAB_GRANULARITY)
+#define WOLFSENTRY_SLAB_CLASS_OVERSIZE 0xffffffffU
+#define WOLFSENTRY_SLAB_CLASS_BLOCK_SIZE(i) (((size_t)(i) + 1U) * WOLFSENTRY_SLAB_GRANULARITY)
+
+#if (WOLFSENTRY_SLAB_MAX_BLOCK_SIZE % WOLFSENTRY_SLAB_GRANULARITY) != 0
+#error WOLFSENTRY_SLAB_MAX_BLOCK_SIZE must be a multiple of WOLFSENTRY_SLAB_GRANULARITY.
+#endif
+
+#if WOLFSENTRY_SLAB_CHUNK_SIZE < (WOLFSENTRY_SLAB_MAX_BLOCK_SIZE * 2)
+#error WOLFSENTRY_SLAB_CHUNK_SIZE must hold at least one block of the largest size class.
+#endif
+
+union wolfsentry_slab_header {
+    struct {
+        uint32_t size_class;
+        size_t size; /* oversize blocks only */
+    } h;
+    byte granule[WOLFSENTRY_SLAB_GRANULARITY];
+};
+
+wolfsentry_static_assert(sizeof(union wolfsentry_slab_header) == WOLFSENTRY_SLAB_GRANULARITY)
+
+struct wolfsentry_slab_free_block {
+    struct wolfsentry_slab_free_block *next;
+};
+
+union wolfsentry_slab_chunk {
+    union wolfsentry_slab_chunk *next;
+    byte granule[WOLFSENTRY_SLAB_GRANULARITY];
+};
+
+struct wolfsentry_slab_class {
+    struct wolfsentry_slab_free_block *free_list;
+    union wolfsentry_slab_chunk *chunks;
+    uint64_t n_allocs;
+    uint64_t n_frees;
+    uint64_t n_chunks;
+#ifdef WOLFSENTRY_THREADSAFE
+    uint32_t lock;
+#endif
+};
+
+struct wolfsentry_slab {
+    struct wolfsentry_allocator backing;
+    struct wolfsentry_slab_class classes[WOLFSENTRY_SLAB_N_CLASSES];
+    uint64_t n_oversize_allocs;
+    uint64_t n_oversize_frees;
+    size_t oversize_bytes_in_use;
+};
+
+/* the per-class critical sections are a few pointer operations, or a single
+ * chunk allocation from the backing allocator, so a spinlock is used.
+ */
+#ifdef WOLFSENTRY_THREADSAFE
+static inline void wolfsentry_slab_class_lock(struct wolfsentry_slab_class *c) {
+    int locked;
+    do {
+        uint32_t expected = 0;
+        locked = WOLFSENTRY_ATOMIC_TEST_AND_SET(c->lock, expected, 1U);
+    } while (! locked);
+}
+static inline void wolfsentry_slab_class_unlock(struct wolfsentry_slab_class *c) {
+    WOLFSENTRY_ATOMIC_STORE(c->lock, 0U);
+}
+#else
+#define wolfsentry_slab_class_lock(c) ((void)(c))
+#define wolfsentry_slab_class_unlock(c) ((void)(c))
+#endif
+
+static inline uint32_t wolfsentry_slab_size_class(size_t size) {
+    if (size > WOLFSENTRY_SLAB_MAX_BLOCK_SIZE - sizeof(union wolfsentry_slab_header))
+        return WOLFSENTRY_SLAB_CLASS_OVERSIZE;
+    return (uint32_t)((size + sizeof(union wolfsentry_slab_header) + WOLFSENTRY_SLAB_GRANULARITY - 1U) / WOLFSENTRY_SLAB_GRANULARITY) - 1U;
+}
+
+static inline size_t wolfsentry_slab_usable_size(const union wolfsentry_slab_header *hdr) {
+    if (hdr->h.size_class == WOLFSENTRY_SLAB_CLASS_OVERSIZE)
+        return hdr->h.size;
+    else
+        return WOLFSENTRY_SLAB_CLASS_BLOCK_SIZE(hdr->h.size_class) - sizeof *hdr;
+}
+
+/* carve a fresh chunk into blocks of class i, and push them onto its free
+ * list.  called with the class locked.
+ */
+static int wolfsentry_slab_class_grow(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_slab *slab),
+    uint32_t i)
+{
+    struct wolfsentry_slab_class *c = &slab->classes[i];
+    size_t block_size = WOLFSENTRY_SLAB_CLASS_BLOCK_SIZE(i);
+    union wolfsentry_slab_chunk *chunk = (union wolfsentry_slab_chunk *)WOLFSENTRY_MALLOC_1(slab->backing, WOLFSENTRY_SLAB_CHUNK_SIZE);
+    byte *block;
+    byte *end;
+
+    if (chunk == NULL)
+        return 0;
+    chunk->next = c->chunks;
+    c->chunks = chunk;
+    ++c->n_chunks;
+
+    end = (byte *)chunk + WOLFSENTRY_SLAB_CHUNK_SIZE - block_size;
+    for (block = (byte *)(chunk + 1); block <= end; block += block_size) {
+        struct wolfsentry_slab_free_block *fb = (struct wolfsentry_slab_free_block *)(block + sizeof(union wolfsentry_slab_header));
+        fb->next = c->free_list;
+        c->free_list = fb;
+    }
+
+    return 1;
+}
+
+static void *wolfsentry_slab_malloc(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(void *context),
+    size_t size)
+{
+    struct wolfsentry_slab *slab = (struct wolfsentry_slab *)context;
+    uint32_t i = wolfsentry_slab_size_class(size);
+    union wolfsentry_slab_header *hdr;
+
+    if (i == WOLFSENTRY_SLAB_CLASS_OVERSIZE) {
+        if (size > (size_t)MAX_UINT_OF(size) - sizeof *hdr)
+            WOLFSENTRY_RETURN_VALUE(NULL);
+        hdr = (union wolfsentry_slab_header *)WOLFSENTRY_MALLOC_1(slab->backing, size + sizeof *hdr);
+        if (hdr == NULL)
+            WOLFSENTRY_RETURN_VALUE(NULL);
+        hdr->h.size_class = WOLFSENTRY_SLAB_CLASS_OVERSIZE;
+        hdr->h.size = size;
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(slab->n_oversize_allocs);
+        WOLFSENTRY_ATOMIC_INCREMENT(slab->oversize_bytes_in_use, size + sizeof *hdr);
+        WOLFSENTRY_RETURN_VALUE(hdr + 1);
+    } else {
+        struct wolfsentry_slab_class *c = &slab->classes[i];
+        struct wolfsentry_slab_free_block *fb;
+
+        wolfsentry_slab_class_lock(c);
+        if ((c->free_list == NULL) &&
+            (! wolfsentry_slab_class_grow(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(slab), i)))
+        {
+            wolfsentry_slab_class_unlock(c);
+            WOLFSENTRY_RETURN_VALUE(NULL);
+        }
+        fb = c->free_list;
+        c->free_list = fb->next;
+        ++c->n_allocs;
+        wolfsentry_slab_class_unlock(c);
+
+        hdr = (union wolfsentry_slab_header *)fb - 1;
+        hdr->h.size_class = i;
+        WOLFSENTRY_RETURN_VALUE(fb);
+    }
+}
+
+static void wolfsentry_slab_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(void *context),
+    void *ptr)
+{
+    struct wolfsentry_slab *slab = (struct wolfsentry_slab *)context;
+    union wolfsentry_slab_header *hdr;
+
+    if (ptr == NULL)
+        WOLFSENTRY_RETURN_VOID;
+
+    hdr = (union wolfsentry_slab_header *)ptr - 1;
+    if (hdr->h.size_class == WOLFSENTRY_SLAB_CLASS_OVERSIZE) {
+        WOLFSENTRY_ATOMIC_DECREMENT(slab->oversize_bytes_in_use, hdr->h.size + sizeof *hdr);
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(slab->n_oversize_frees);
+        WOLFSENTRY_FREE_1(slab->backing, hdr);
+    } else {
+        struct wolfsentry_slab_class *c = &slab->classes[hdr->h.size_class];
+        struct wolfsentry_slab_free_block *fb = (struct wolfsentry_slab_free_block *)ptr;
+
+        wolfsentry_slab_class_lock(c);
+        fb->next = c->free_list;
+        c->free_list = fb;
+        ++c->n_frees;
+        wolfsentry_slab_class_unlock(c);
+    }
+
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static void *wolfsentry_slab_realloc(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(void *context),
+    void *ptr,
+    size_t size)
+{
+    struct wolfsentry_slab *slab = (struct wolfsentry_slab *)context;
+    union wolfsentry_slab_header *hdr;
+    uint32_t i;
+    size_t old_size;
+    void *new_ptr;
+
+    if (ptr == NULL)
+        WOLFSENTRY_RETURN_VALUE(wolfsentry_slab_malloc(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(context), size));
+    if (size == 0) {
+        wolfsentry_slab_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(context), ptr);
+        WOLFSENTRY_RETURN_VALUE(NULL);
+    }
+
+    hdr = (union wolfsentry_slab_header *)ptr - 1;
+    i = wolfsentry_slab_size_class(size);
+
+    if (hdr->h.size_class != WOLFSENTRY_SLAB_CLASS_OVERSIZE) {
+        /* shrinking, or growing within the slack of the block's class, is done in place. */
+        if (i <= hdr->h.size_class)
+            WOLFSENTRY_RETURN_VALUE(ptr);
+    } else if (i == WOLFSENTRY_SLAB_CLASS_OVERSIZE) {
+        /* oversize to oversize is delegated wholesale to the backing allocator. */
+        size_t old_total = hdr->h.size + sizeof *hdr;
+        union wolfsentry_slab_header *new_hdr;
+        if (size > (size_t)MAX_UINT_OF(size) - sizeof *hdr)
+            WOLFSENTRY_RETURN_VALUE(NULL);
+        new_hdr = (union wolfsentry_slab_header *)slab->backing.realloc(slab->backing.context,
+#ifdef WOLFSENTRY_THREADSAFE
+                                                                        thread,
+#endif
+                                                                        hdr, size + sizeof *hdr);
+        if (new_hdr == NULL)
+            WOLFSENTRY_RETURN_VALUE(NULL);
+        new_hdr->h.size = size;
+        WOLFSENTRY_ATOMIC_DECREMENT(slab->oversize_bytes_in_use, old_total);
+        WOLFSENTRY_ATOMIC_INCREMENT(slab->oversize_bytes_in_use, size + sizeof *hdr);
+        WOLFSENTRY_RETURN_VALUE(new_hdr + 1);
+    }
+
+    new_ptr = wolfsentry_slab_malloc(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(context), size);
+    if (new_ptr == NULL)
+        WOLFSENTRY_RETURN_VALUE(NULL);
+    old_size = wolfsentry_slab_usable_size(hdr);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    wolfsentry_slab_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(context), ptr);
+    WOLFSENTRY_RETURN_VALUE(new_ptr);
+}
+
+/* aligned allocations are rare (the allocator itself uses none), and are
+ * passed straight through.
+ */
+static void *wolfsentry_slab_memalign(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(void *context),
+    size_t alignment,
+    size_t size)
+{
+    struct wolfsentry_slab *slab = (struct wolfsentry_slab *)context;
+    WOLFSENTRY_RETURN_VALUE(WOLFSENTRY_MEMALIGN_1(slab->backing, alignment, size));
+}
+
+static void wolfsentry_slab_free_aligned(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(void *context),
+    void *ptr)
+{
+    struct wolfsentry_slab *slab = (struct wolfsentry_slab *)context;
+    WOLFSENTRY_FREE_ALIGNED_1(slab->backing, ptr);
+    WOLFSENTRY_RETURN_VOID;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_init(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(const struct wolfsentry_allocator *backing),
+    struct wolfsentry_allocator *slab_allocator)
+{
+    struct wolfsentry_slab *slab;
+
+    if (slab_allocator == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (backing == NULL) {
+#ifdef WOLFSENTRY_MALLOC_BUILTINS
+        backing = wolfsentry_get_default_allocator();
+#else
+        WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+#endif
+    }
+
+    if ((backing->malloc == NULL) ||
+        (backing->free == NULL) ||
+        (backing->realloc == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if ((backing->memalign == NULL) ^
+        (backing->free_aligned == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    slab = (struct wolfsentry_slab *)WOLFSENTRY_MALLOC_1(*backing, sizeof *slab);
+    if (slab == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(slab, 0, sizeof *slab);
+    slab->backing = *backing;
+
+    memset(slab_allocator, 0, sizeof *slab_allocator);
+    slab_allocator->context = slab;
+    slab_allocator->malloc = wolfsentry_slab_malloc;
+    slab_allocator->free = wolfsentry_slab_free;
+    slab_allocator->realloc = wolfsentry_slab_realloc;
+    if (backing->memalign != NULL) {
+        slab_allocator->memalign = wolfsentry_slab_memalign;
+        slab_allocator->free_aligned = wolfsentry_slab_free_aligned;
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_get_stats(
+    const struct wolfsentry_allocator *slab_allocator,
+    struct wolfsentry_slab_stats *stats)
+{
+    struct wolfsentry_slab *slab;
+    uint32_t i;
+
+    if ((slab_allocator == NULL) ||
+        (slab_allocator->malloc != wolfsentry_slab_malloc) ||
+        (stats == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    slab = (struct wolfsentry_slab *)slab_allocator->context;
+
+    memset(stats, 0, sizeof *stats);
+    for (i = 0; i < WOLFSENTRY_SLAB_N_CLASSES; ++i) {
+        struct wolfsentry_slab_class *c = &slab->classes[i];
+        wolfsentry_slab_class_lock(c);
+        stats->n_slab_allocs += c->n_allocs;
+        stats->n_slab_frees += c->n_frees;
+        stats->n_chunks += c->n_chunks;
+        stats->bytes_in_use += (size_t)(c->n_allocs - c->n_frees) * WOLFSENTRY_SLAB_CLASS_BLOCK_SIZE(i);
+        wolfsentry_slab_class_unlock(c);
+    }
+    stats->bytes_reserved = (size_t)stats->n_chunks * WOLFSENTRY_SLAB_CHUNK_SIZE;
+    stats->n_oversize_allocs = WOLFSENTRY_ATOMIC_LOAD(slab->n_oversize_allocs);
+    stats->n_oversize_frees = WOLFSENTRY_ATOMIC_LOAD(slab->n_oversize_frees);
+    stats->bytes_in_use += WOLFSENTRY_ATOMIC_LOAD(slab->oversize_bytes_in_use);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* returns BUSY, leaving the slab intact, if any blocks are still allocated. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_shutdown(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_allocator *slab_allocator))
+{
+    struct wolfsentry_slab *slab;
+    struct wolfsentry_allocator backing;
+    uint32_t i;
+
+    if ((slab_allocator == NULL) ||
+        (slab_allocator->malloc != wolfsentry_slab_malloc))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    slab = (struct wolfsentry_slab *)slab_allocator->context;
+
+    if (WOLFSENTRY_ATOMIC_LOAD(slab->n_oversize_allocs) != WOLFSENTRY_ATOMIC_LOAD(slab->n_oversize_frees))
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+    for (i = 0; i < WOLFSENTRY_SLAB_N_CLASSES; ++i) {
+        if (slab->classes[i].n_allocs != slab->classes[i].n_frees)
+            WOLFSENTRY_ERROR_RETURN(BUSY);
+    }
+
+    backing = slab->backing;
+    for (i = 0; i < WOLFSENTRY_SLAB_N_CLASSES; ++i) {
+        union wolfsentry_slab_chunk *chunk, *next;
+        for (chunk = slab->classes[i].chunks; chunk; chunk = next) {
+            next = chunk->next;
+            WOLFSENTRY_FREE_1(backing, chunk);
+        }
+    }
+    WOLFSENTRY_FREE_1(backing, slab);
+    memset(slab_allocator, 0, sizeof *slab_allocator);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#endif /* WOLFSENTRY_SLAB_ALLOCATOR */
@@ -0,0 +1,850 @@
+/*
+ * snapshot.c
+ *
+ * Copyright (C) 2021-2023 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+#ifdef WOLFSENTRY_HAVE_JSON_DOM
+#include <wolfsentry/wolfsentry_json.h>
+#include <wolfsentry/centijson_dom.h>
+#endif
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_SNAPSHOT_C
+
+/* a snapshot is a header, then the context settings, then the events, routes,
+ * and user values, each a fixed-size record in native layout followed by its
+ * variable-length data, padded to 8 bytes.  the records are only meaningful to
+ * a library of the same version and build configuration, which the header
+ * carries and wolfsentry_context_load() checks, along with the record sizes and
+ * a checksum.  events and routes refer to events by their index in the saved
+ * events, and actions are referred to by label.
+ */
+
+#define WOLFSENTRY_SNAPSHOT_MAGIC 0x57534e50U /* "WSNP" */
+#define WOLFSENTRY_SNAPSHOT_FORMAT_VERSION 1U
+#define WOLFSENTRY_SNAPSHOT_ALIGNMENT 8U
+#define WOLFSENTRY_SNAPSHOT_ACTION_LISTS 6U /* WOLFSENTRY_ACTION_TYPE_POST through WOLFSENTRY_ACTION_TYPE_DECISION. */
+
+struct wolfsentry_snapshot_header {
+    uint32_t magic;
+    uint32_t format_version;
+    struct wolfsentry_build_settings build_settings;
+    uint32_t header_size;
+    uint32_t settings_size;
+    uint32_t event_record_size;
+    uint32_t route_record_size;
+    uint32_t user_value_record_size;
+    uint32_t checksum; /* FNV-1a of everything after the header. */
+    uint64_t total_len;
+    uint32_t n_events;
+    uint32_t n_routes;
+    uint32_t n_user_values;
+    uint32_t reserved;
+};
+
+struct wolfsentry_snapshot_settings {
+    struct wolfsentry_eventconfig config;
+    wolfsentry_hitcount_t max_purgeable_routes;
+    uint64_t flow_cache_entries;
+    wolfsentry_action_res_t default_policy;
+    uint32_t default_event_index;
+    uint32_t tuple_classifier_enabled;
+};
+
+/* followed by the label, then for each action list in turn, each action as a
+ * length byte and label.
+ */
+struct wolfsentry_snapshot_event {
+    struct wolfsentry_eventconfig config; /* zero unless has_config. */
+    wolfsentry_priority_t priority;
+    wolfsentry_event_flags_t flags;
+    uint32_t aux_event_index;
+    uint16_t n_actions[WOLFSENTRY_SNAPSHOT_ACTION_LISTS];
+    byte has_config;
+    byte label_len;
+};
+
+/* followed by the key, then value_len bytes of string, bytes, or JSON text. */
+struct wolfsentry_snapshot_user_value {
+    uint64_t value; /* the bits of the uint, sint, or float. */
+    uint64_t value_len;
+    uint32_t v_type; /* including WOLFSENTRY_KV_FLAG_READONLY. */
+    uint32_t key_len;
+};
+
+struct wolfsentry_snapshot_writer {
+    byte *buf; /* null when only sizing. */
+    size_t buf_size;
+    size_t len;
+};
+
+static void wolfsentry_snapshot_put(struct wolfsentry_snapshot_writer *w, const void *src, size_t len) {
+    if ((w->buf != NULL) && (len <= w->buf_size) && (w->len <= w->buf_size - len))
+        memcpy(w->buf + w->len, src, len);
+    w->len += len;
+}
+
+#ifdef WOLFSENTRY_HAVE_JSON_DOM
+static void wolfsentry_snapshot_patch(struct wolfsentry_snapshot_writer *w, size_t offset, const void *src, size_t len) {
+    if ((w->buf != NULL) && (len <= w->buf_size) && (offset <= w->buf_size - len))
+        memcpy(w->buf + offset, src, len);
+}
+#endif
+
+static void wolfsentry_snapshot_put_pad(struct wolfsentry_snapshot_writer *w) {
+    static const byte zeros[WOLFSENTRY_SNAPSHOT_ALIGNMENT] = { 0 };
+    size_t slop = w->len % WOLFSENTRY_SNAPSHOT_ALIGNMENT;
+    if (slop > 0)
+        wolfsentry_snapshot_put(w, zeros, WOLFSENTRY_SNAPSHOT_ALIGNMENT - slop);
+}
+
+struct wolfsentry_snapshot_reader {
+    const byte *buf;
+    size_t len;
+    size_t pos;
+};
+
+static wolfsentry_errcode_t wolfsentry_snapshot_get_ptr(struct wolfsentry_snapshot_reader *r, size_t len, const byte **p) {
+    if (len > r->len - r->pos)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    *p = r->buf + r->pos;
+    r->pos += len;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_get(struct wolfsentry_snapshot_reader *r, void *dest, size_t len) {
+    const byte *p;
+    wolfsentry_errcode_t ret = wolfsentry_snapshot_get_ptr(r, len, &p);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    memcpy(dest, p, len);
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_get_pad(struct wolfsentry_snapshot_reader *r) {
+    const byte *p;
+    size_t slop = r->pos % WOLFSENTRY_SNAPSHOT_ALIGNMENT;
+    if (slop == 0)
+        WOLFSENTRY_RETURN_OK;
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_snapshot_get_ptr(r, WOLFSENTRY_SNAPSHOT_ALIGNMENT - slop, &p));
+}
+
+static uint32_t wolfsentry_snapshot_checksum(const byte *p, size_t len) {
+    uint32_t h = 2166136261U;
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* copies field by field, so that the padding in dest stays zeroed. */
+static void wolfsentry_snapshot_eventconfig_copy(struct wolfsentry_eventconfig *dest, const struct wolfsentry_eventconfig *src) {
+    memset(dest, 0, sizeof *dest);
+    dest->route_private_data_size = src->route_private_data_size;
+    dest->route_private_data_alignment = src->route_private_data_alignment;
+    dest->max_connection_count = src->max_connection_count;
+    dest->derogatory_threshold_for_penaltybox = src->derogatory_threshold_for_penaltybox;
+    dest->penaltybox_duration = src->penaltybox_duration;
+    dest->route_idle_time_for_purge = src->route_idle_time_for_purge;
+    dest->flags = src->flags;
+    dest->route_flags_to_add_on_insert = src->route_flags_to_add_on_insert;
+    dest->route_flags_to_clear_on_insert = src->route_flags_to_clear_on_insert;
+    dest->action_res_filter_bits_set = src->action_res_filter_bits_set;
+    dest->action_res_filter_bits_unset = src->action_res_filter_bits_unset;
+    dest->action_res_bits_to_add = src->action_res_bits_to_add;
+    dest->action_res_bits_to_clear = src->action_res_bits_to_clear;
+}
+
+static uint32_t wolfsentry_snapshot_event_index(struct wolfsentry_context *wolfsentry, const struct wolfsentry_event *event) {
+    struct wolfsentry_table_ent_header *i;
+    uint32_t index = 0;
+    if (event == NULL)
+        return WOLFSENTRY_SNAPSHOT_INDEX_NONE;
+    for (i = wolfsentry->events->header.head; i; i = i->next, ++index) {
+        if (i == &event->header)
+            return index;
+    }
+    return WOLFSENTRY_SNAPSHOT_INDEX_NONE;
+}
+
+static struct wolfsentry_action_list *wolfsentry_snapshot_action_list(struct wolfsentry_event *event, unsigned int which) {
+    switch (which) {
+    case 0:
+        return &event->post_action_list;
+    case 1:
+        return &event->insert_action_list;
+    case 2:
+        return &event->match_action_list;
+    case 3:
+        return &event->update_action_list;
+    case 4:
+        return &event->delete_action_list;
+    default:
+        return &event->decision_action_list;
+    }
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_save_settings(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_snapshot_writer *w)
+{
+    struct wolfsentry_snapshot_settings settings;
+    struct wolfsentry_eventconfig config;
+    wolfsentry_errcode_t ret;
+
+    ret = wolfsentry_eventconfig_get_1(&wolfsentry->config, &config);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    memset(&settings, 0, sizeof settings);
+    wolfsentry_snapshot_eventconfig_copy(&settings.config, &config);
+    /* action inhibition is transient state, not configuration. */
+    WOLFSENTRY_CLEAR_BITS(settings.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS);
+    settings.max_purgeable_routes = wolfsentry->routes->max_purgeable_routes;
+    if (wolfsentry->routes->flow_cache)
+        settings.flow_cache_entries = (uint64_t)wolfsentry->routes->flow_cache->n_sets * WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS;
+    settings.default_policy = wolfsentry->routes->default_policy;
+    settings.default_event_index = wolfsentry_snapshot_event_index(wolfsentry, wolfsentry->routes->default_event);
+    settings.tuple_classifier_enabled = (uint32_t)wolfsentry->routes->tuple_classifier_enabled;
+    wolfsentry_snapshot_put(w, &settings, sizeof settings);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_save_events(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_snapshot_writer *w)
+{
+    struct wolfsentry_table_ent_header *i;
+    struct wolfsentry_snapshot_event rec;
+    wolfsentry_errcode_t ret;
+
+    for (i = wolfsentry->events->header.head; i; i = i->next) {
+        struct wolfsentry_event *event = (struct wolfsentry_event *)i;
+        unsigned int which;
+
+        memset(&rec, 0, sizeof rec);
+        if (event->config) {
+            struct wolfsentry_eventconfig config;
+            ret = wolfsentry_eventconfig_get_1(event->config, &config);
+            WOLFSENTRY_RERETURN_IF_ERROR(ret);
+            wolfsentry_snapshot_eventconfig_copy(&rec.config, &config);
+            rec.has_config = 1;
+        }
+        rec.priority = event->priority;
+        rec.flags = event->flags;
+        rec.aux_event_index = wolfsentry_snapshot_event_index(wolfsentry, event->aux_event);
+        for (which = 0; which < WOLFSENTRY_SNAPSHOT_ACTION_LISTS; ++which) {
+            struct wolfsentry_action_list *action_list = wolfsentry_snapshot_action_list(event, which);
+            if (action_list->header.len > MAX_UINT_OF(rec.n_actions[which]))
+                WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+            rec.n_actions[which] = (uint16_t)action_list->header.len;
+        }
+        rec.label_len = event->label_len;
+        wolfsentry_snapshot_put(w, &rec, sizeof rec);
+        wolfsentry_snapshot_put(w, event->label, event->label_len);
+
+        for (which = 0; which < WOLFSENTRY_SNAPSHOT_ACTION_LISTS; ++which) {
+            struct wolfsentry_list_ent_header *j;
+            for (j = wolfsentry_snapshot_action_list(event, which)->header.head; j; j = j->next) {
+                const struct wolfsentry_action *action = ((struct wolfsentry_action_list_ent *)j)->action;
+                wolfsentry_snapshot_put(w, &action->label_len, sizeof action->label_len);
+                wolfsentry_snapshot_put(w, action->label, action->label_len);
+            }
+        }
+        wolfsentry_snapshot_put_pad(w);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_save_routes(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_snapshot_writer *w)
+{
+    struct wolfsentry_table_ent_header *i;
+    struct wolfsentry_route_snapshot rec;
+    const struct wolfsentry_event *last_parent = NULL;
+    uint32_t last_parent_index = WOLFSENTRY_SNAPSHOT_INDEX_NONE;
+
+    for (i = wolfsentry->routes->header.head; i; i = i->next) {
+        const struct wolfsentry_route *route = (const struct wolfsentry_route *)i;
+
+        if (route->parent_event != last_parent) {
+            last_parent = route->parent_event;
+            last_parent_index = wolfsentry_snapshot_event_index(wolfsentry, last_parent);
+        }
+
+        memset(&rec, 0, sizeof rec);
+        rec.insert_time = route->meta.insert_time;
+        rec.last_hit_time = route->meta.last_hit_time;
+        rec.last_penaltybox_time = route->meta.last_penaltybox_time;
+        rec.purge_after = route->meta.purge_after;
+        rec.hitcount = wolfsentry_route_get_hitcount(route);
+        rec.flags = route->flags;
+        WOLFSENTRY_CLEAR_BITS(rec.flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE | WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED | WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED);
+        rec.parent_event_index = last_parent_index;
+        rec.remote = route->remote;
+        rec.local = route->local;
+        rec.sa_family = route->sa_family;
+        rec.sa_proto = route->sa_proto;
+        rec.data_addr_offset = route->data_addr_offset;
+        rec.data_addr_size = route->data_addr_size;
+        rec.connection_count = route->meta.connection_count;
+        rec.derogatory_count = route->meta.derogatory_count;
+        rec.commendable_count = route->meta.commendable_count;
+        wolfsentry_snapshot_put(w, &rec, sizeof rec);
+        wolfsentry_snapshot_put(w, route->data, route->data_addr_size);
+        wolfsentry_snapshot_put_pad(w);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#ifdef WOLFSENTRY_HAVE_JSON_DOM
+static int wolfsentry_snapshot_json_writer(const unsigned char *str, size_t size, void *w) {
+    wolfsentry_snapshot_put((struct wolfsentry_snapshot_writer *)w, str, size);
+    return 0;
+}
+#endif
+
+static wolfsentry_errcode_t wolfsentry_snapshot_save_user_values(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_snapshot_writer *w)
+{
+    struct wolfsentry_table_ent_header *i;
+    struct wolfsentry_snapshot_user_value rec;
+
+    WOLFSENTRY_CONTEXT_ARGS_THREAD_NOT_USED;
+
+    for (i = wolfsentry->user_values->header.head; i; i = i->next) {
+        const struct wolfsentry_kv_pair *kv = &((const struct wolfsentry_kv_pair_internal *)i)->kv;
+        size_t rec_offset = w->len;
+
+        memset(&rec, 0, sizeof rec);
+        rec.v_type = (uint32_t)kv->v_type;
+        rec.key_len = (uint32_t)kv->key_len;
+        switch (WOLFSENTRY_KV_TYPE(kv)) {
+        case WOLFSENTRY_KV_UINT:
+            rec.value = WOLFSENTRY_KV_V_UINT(kv);
+            break;
+        case WOLFSENTRY_KV_SINT:
+            rec.value = (uint64_t)WOLFSENTRY_KV_V_SINT(kv);
+            break;
+        case WOLFSENTRY_KV_FLOAT:
+            memcpy(&rec.value, &WOLFSENTRY_KV_V_FLOAT(kv), sizeof rec.value);
+            break;
+        case WOLFSENTRY_KV_STRING:
+            rec.value_len = WOLFSENTRY_KV_V_STRING_LEN(kv);
+            break;
+        case WOLFSENTRY_KV_BYTES:
+            rec.value_len = WOLFSENTRY_KV_V_BYTES_LEN(kv);
+            break;
+        default:
+            break;
+        }
+        wolfsentry_snapshot_put(w, &rec, sizeof rec);
+        wolfsentry_snapshot_put(w, WOLFSENTRY_KV_KEY(kv), (size_t)kv->key_len);
+
+        switch (WOLFSENTRY_KV_TYPE(kv)) {
+        case WOLFSENTRY_KV_STRING:
+            wolfsentry_snapshot_put(w, WOLFSENTRY_KV_V_STRING(kv), WOLFSENTRY_KV_V_STRING_LEN(kv));
+            break;
+        case WOLFSENTRY_KV_BYTES:
+            wolfsentry_snapshot_put(w, WOLFSENTRY_KV_V_BYTES(kv), WOLFSENTRY_KV_V_BYTES_LEN(kv));
+            break;
+#ifdef WOLFSENTRY_HAVE_JSON_DOM
+        case WOLFSENTRY_KV_JSON: {
+            size_t value_offset = w->len;
+            int ret = json_dom_dump(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(wolfsentry_get_allocator(wolfsentry)),
+                                    WOLFSENTRY_KV_V_JSON(kv),
+                                    wolfsentry_snapshot_json_writer,
+                                    w,
+                                    0 /* tab_width */,
+                                    JSON_DOM_DUMP_MINIMIZE | JSON_DOM_DUMP_PREFERDICTORDER);
+            if (ret < 0)
+                WOLFSENTRY_ERROR_RERETURN(wolfsentry_centijson_errcode_translate(ret));
+            /* the length of the dump is only known now. */
+            rec.value_len = w->len - value_offset;
+            wolfsentry_snapshot_patch(w, rec_offset, &rec, sizeof rec);
+            break;
+        }
+#endif
+        default:
+            break;
+        }
+        (void)rec_offset;
+        wolfsentry_snapshot_put_pad(w);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_save(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    byte *buf,
+    size_t *buf_len)
+{
+    struct wolfsentry_snapshot_header header;
+    struct wolfsentry_snapshot_writer w;
+    wolfsentry_errcode_t ret;
+
+    if (buf_len == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    w.buf = buf;
+    w.buf_size = buf ? *buf_len : 0;
+    w.len = 0;
+
+    WOLFSENTRY_SHARED_OR_RETURN();
+
+    memset(&header, 0, sizeof header);
+    header.magic = WOLFSENTRY_SNAPSHOT_MAGIC;
+    header.format_version = WOLFSENTRY_SNAPSHOT_FORMAT_VERSION;
+    header.build_settings = wolfsentry_get_build_settings();
+    header.header_size = (uint32_t)sizeof(struct wolfsentry_snapshot_header);
+    header.settings_size = (uint32_t)sizeof(struct wolfsentry_snapshot_settings);
+    header.event_record_size = (uint32_t)sizeof(struct wolfsentry_snapshot_event);
+    header.route_record_size = (uint32_t)sizeof(struct wolfsentry_route_snapshot);
+    header.user_value_record_size = (uint32_t)sizeof(struct wolfsentry_snapshot_user_value);
+    header.n_events = (uint32_t)wolfsentry->events->header.n_ents;
+    header.n_routes = (uint32_t)wolfsentry->routes->header.n_ents;
+    header.n_user_values = (uint32_t)wolfsentry->user_values->header.n_ents;
+    wolfsentry_snapshot_put(&w, &header, sizeof header);
+
+    if ((ret = wolfsentry_snapshot_save_settings(wolfsentry, &w)) < 0)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    if ((ret = wolfsentry_snapshot_save_events(wolfsentry, &w)) < 0)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    if ((ret = wolfsentry_snapshot_save_routes(wolfsentry, &w)) < 0)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+    if ((ret = wolfsentry_snapshot_save_user_values(WOLFSENTRY_CONTEXT_ARGS_OUT, &w)) < 0)
+        WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+
+    WOLFSENTRY_UNLOCK_FOR_RETURN();
+
+    if ((buf == NULL) || (w.len > w.buf_size)) {
+        *buf_len = w.len;
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    }
+
+    header.total_len = w.len;
+    header.checksum = wolfsentry_snapshot_checksum(buf + sizeof header, w.len - sizeof header);
+    memcpy(buf, &header, sizeof header);
+    *buf_len = w.len;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_check_header(
+    const byte *buf,
+    size_t buf_len,
+    struct wolfsentry_snapshot_header *header)
+{
+    struct wolfsentry_build_settings build_settings = wolfsentry_get_build_settings();
+    wolfsentry_errcode_t ret;
+
+    if (buf_len < sizeof *header)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    memcpy(header, buf, sizeof *header);
+    if (header->magic != WOLFSENTRY_SNAPSHOT_MAGIC)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    if (header->format_version != WOLFSENTRY_SNAPSHOT_FORMAT_VERSION)
+        WOLFSENTRY_ERROR_RETURN(LIB_MISMATCH);
+    ret = wolfsentry_build_settings_compatible(header->build_settings);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    if ((header->build_settings.config & WOLFSENTRY_CONFIG_FLAG_ENDIANNESS_ONE) != (build_settings.config & WOLFSENTRY_CONFIG_FLAG_ENDIANNESS_ONE))
+        WOLFSENTRY_ERROR_RETURN(LIBCONFIG_MISMATCH);
+    if ((header->header_size != sizeof(struct wolfsentry_snapshot_header)) ||
+        (header->settings_size != sizeof(struct wolfsentry_snapshot_settings)) ||
+        (header->event_record_size != sizeof(struct wolfsentry_snapshot_event)) ||
+        (header->route_record_size != sizeof(struct wolfsentry_route_snapshot)) ||
+        (header->user_value_record_size != sizeof(struct wolfsentry_snapshot_user_value)))
+    {
+        WOLFSENTRY_ERROR_RETURN(LIBCONFIG_MISMATCH);
+    }
+    if (header->total_len != buf_len)
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+    if (header->checksum != wolfsentry_snapshot_checksum(buf + sizeof *header, buf_len - sizeof *header))
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_load_settings(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_snapshot_reader *r,
+    uint32_t *default_event_index)
+{
+    struct wolfsentry_snapshot_settings settings;
+    struct wolfsentry_eventconfig_internal config;
+    wolfsentry_errcode_t ret;
+
+    ret = wolfsentry_snapshot_get(r, &settings, sizeof settings);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    /* the private data layout is fixed when the context is created. */
+    ret = wolfsentry_eventconfig_load(&settings.config, &config);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    if ((config.config.route_private_data_size != wolfsentry->config.config.route_private_data_size) ||
+        (config.config.route_private_data_alignment != wolfsentry->config.config.route_private_data_alignment))
+    {
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+    }
+    /* keep actions inhibited until the caller is ready for them. */
+    WOLFSENTRY_SET_BITS(config.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS);
+    wolfsentry->config = config;
+
+    if (settings.flow_cache_entries > MAX_UINT_OF(size_t))
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+    ret = wolfsentry_route_table_default_policy_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, settings.default_policy);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    ret = wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, settings.max_purgeable_routes);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    ret = wolfsentry_route_table_tuple_classifier_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, settings.tuple_classifier_enabled != 0);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    ret = wolfsentry_route_table_flow_cache_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, (size_t)settings.flow_cache_entries);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    *default_event_index = settings.default_event_index;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* events are few, so they go through the regular insert paths.  a reference to
+ * each is kept in events[], for the fixups that follow.
+ */
+static wolfsentry_errcode_t wolfsentry_snapshot_load_events(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_snapshot_reader *r,
+    uint32_t n_events,
+    struct wolfsentry_event **events,
+    uint32_t *aux_event_indexes)
+{
+    struct wolfsentry_snapshot_event rec;
+    const byte *label;
+    uint32_t i;
+    wolfsentry_errcode_t ret;
+
+    for (i = 0; i < n_events; ++i) {
+        unsigned int which;
+        uint16_t j;
+
+        ret = wolfsentry_snapshot_get(r, &rec, sizeof rec);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        ret = wolfsentry_snapshot_get_ptr(r, rec.label_len, &label);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        if ((rec.label_len == 0) || ((rec.aux_event_index != WOLFSENTRY_SNAPSHOT_INDEX_NONE) && (rec.aux_event_index >= n_events)))
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+        ret = wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, (const char *)label, rec.label_len, rec.priority, rec.has_config ? &rec.config : NULL, rec.flags, NULL /* id */);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        ret = wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, (const char *)label, rec.label_len, &events[i]);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        /* restores the flags wolfsentry_event_insert() leaves to the library. */
+        events[i]->flags = rec.flags;
+        aux_event_indexes[i] = rec.aux_event_index;
+
+        for (which = 0; which < WOLFSENTRY_SNAPSHOT_ACTION_LISTS; ++which) {
+            for (j = 0; j < rec.n_actions[which]; ++j) {
+                byte action_label_len;
+                const byte *action_label;
+                ret = wolfsentry_snapshot_get(r, &action_label_len, sizeof action_label_len);
+                WOLFSENTRY_RERETURN_IF_ERROR(ret);
+                ret = wolfsentry_snapshot_get_ptr(r, action_label_len, &action_label);
+                WOLFSENTRY_RERETURN_IF_ERROR(ret);
+                if (action_label_len == 0)
+                    WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+                ret = wolfsentry_event_action_append(
+                    WOLFSENTRY_CONTEXT_ARGS_OUT,
+                    (const char *)label,
+                    rec.label_len,
+                    (wolfsentry_action_type_t)(WOLFSENTRY_ACTION_TYPE_POST + which),
+                    (const char *)action_label,
+                    action_label_len);
+                WOLFSENTRY_RERETURN_IF_ERROR(ret);
+            }
+        }
+
+        ret = wolfsentry_snapshot_get_pad(r);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    for (i = 0; i < n_events; ++i) {
+        if (aux_event_indexes[i] == WOLFSENTRY_SNAPSHOT_INDEX_NONE)
+            continue;
+        ret = wolfsentry_event_set_aux_event(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            events[i]->label,
+            events[i]->label_len,
+            events[aux_event_indexes[i]]->label,
+            events[aux_event_indexes[i]]->label_len);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* routes are the bulk of a snapshot, and are restored from their records
+ * directly, in saved order, with no parsing or sorting.
+ */
+static wolfsentry_errcode_t wolfsentry_snapshot_load_routes(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_snapshot_reader *r,
+    uint32_t n_routes,
+    struct wolfsentry_event **events,
+    uint32_t n_events)
+{
+    struct wolfsentry_route_snapshot rec;
+    const byte *data;
+    wolfsentry_time_t now;
+    uint32_t i;
+    wolfsentry_errcode_t ret;
+
+    ret = WOLFSENTRY_GET_TIME_CACHED(&now);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    for (i = 0; i < n_routes; ++i) {
+        ret = wolfsentry_snapshot_get(r, &rec, sizeof rec);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        ret = wolfsentry_snapshot_get_ptr(r, rec.data_addr_size, &data);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        if ((rec.parent_event_index != WOLFSENTRY_SNAPSHOT_INDEX_NONE) && (rec.parent_event_index >= n_events))
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+        ret = wolfsentry_route_restore(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            wolfsentry->routes,
+            (rec.parent_event_index == WOLFSENTRY_SNAPSHOT_INDEX_NONE) ? NULL : events[rec.parent_event_index],
+            &rec,
+            data,
+            now);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        ret = wolfsentry_snapshot_get_pad(r);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_load_user_values(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_snapshot_reader *r,
+    uint32_t n_user_values)
+{
+    struct wolfsentry_snapshot_user_value rec;
+    struct wolfsentry_kv_pair_internal *kv;
+    const byte *key, *value;
+    uint32_t i;
+    wolfsentry_errcode_t ret;
+
+    for (i = 0; i < n_user_values; ++i) {
+        int data_len;
+
+        ret = wolfsentry_snapshot_get(r, &rec, sizeof rec);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        if ((rec.key_len == 0) || (rec.key_len > WOLFSENTRY_MAX_LABEL_BYTES) || (rec.value_len > WOLFSENTRY_KV_MAX_VALUE_BYTES))
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+        if ((rec.v_type & ~(uint32_t)WOLFSENTRY_KV_FLAG_MASK) > (uint32_t)WOLFSENTRY_KV_JSON)
+            WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+        ret = wolfsentry_snapshot_get_ptr(r, rec.key_len, &key);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        ret = wolfsentry_snapshot_get_ptr(r, (size_t)rec.value_len, &value);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+        switch (rec.v_type & ~(uint32_t)WOLFSENTRY_KV_FLAG_MASK) {
+        case WOLFSENTRY_KV_STRING:
+            data_len = (int)rec.value_len + 1;
+            break;
+        case WOLFSENTRY_KV_BYTES:
+            data_len = (int)rec.value_len;
+            break;
+        default:
+            data_len = 0;
+            break;
+        }
+
+        ret = wolfsentry_kv_new(WOLFSENTRY_CONTEXT_ARGS_OUT, (const char *)key, (int)rec.key_len, data_len, &kv);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+        switch (rec.v_type & ~(uint32_t)WOLFSENTRY_KV_FLAG_MASK) {
+        case WOLFSENTRY_KV_UINT:
+            WOLFSENTRY_KV_V_UINT(&kv->kv) = rec.value;
+            break;
+        case WOLFSENTRY_KV_SINT:
+            WOLFSENTRY_KV_V_SINT(&kv->kv) = (int64_t)rec.value;
+            break;
+        case WOLFSENTRY_KV_FLOAT:
+            memcpy(&WOLFSENTRY_KV_V_FLOAT(&kv->kv), &rec.value, sizeof rec.value);
+            break;
+        case WOLFSENTRY_KV_STRING:
+            WOLFSENTRY_KV_V_STRING_LEN(&kv->kv) = (size_t)rec.value_len;
+            memcpy(WOLFSENTRY_KV_V_STRING(&kv->kv), value, (size_t)rec.value_len);
+            WOLFSENTRY_KV_V_STRING(&kv->kv)[rec.value_len] = 0;
+            break;
+        case WOLFSENTRY_KV_BYTES:
+            WOLFSENTRY_KV_V_BYTES_LEN(&kv->kv) = (size_t)rec.value_len;
+            memcpy(WOLFSENTRY_KV_V_BYTES(&kv->kv), value, (size_t)rec.value_len);
+            break;
+        case WOLFSENTRY_KV_JSON: {
+#ifdef WOLFSENTRY_HAVE_JSON_DOM
+            int json_ret = json_dom_parse(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(wolfsentry_get_allocator(wolfsentry)),
+                                          value,
+                                          (size_t)rec.value_len,
+                                          NULL /* config */,
+                                          JSON_DOM_MAINTAINDICTORDER,
+                                          &kv->kv.a.v_json,
+                                          NULL /* p_pos */);
+            if (json_ret < 0) {
+                WOLFSENTRY_FREE(kv);
+                WOLFSENTRY_ERROR_RERETURN(wolfsentry_centijson_errcode_translate(json_ret));
+            }
+            break;
+#else
+            WOLFSENTRY_FREE(kv);
+            WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+#endif
+        }
+        default:
+            break;
+        }
+        kv->kv.v_type = (wolfsentry_kv_type_t)rec.v_type;
+
+        ret = wolfsentry_kv_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->user_values, kv);
+        if (ret < 0) {
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_kv_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, kv, NULL /* action_results */));
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+
+        ret = wolfsentry_snapshot_get_pad(r);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the snapshot is loaded into a clone of the context as at creation, keeping
+ * its actions and address families, which is then exchanged in, as for a JSON
+ * load with WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_load(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const byte *buf,
+    size_t buf_len)
+{
+    struct wolfsentry_snapshot_header header;
+    struct wolfsentry_snapshot_reader r;
+    struct wolfsentry_context *clone = NULL;
+    struct wolfsentry_event **events = NULL;
+    uint32_t *aux_event_indexes;
+    uint32_t default_event_index = WOLFSENTRY_SNAPSHOT_INDEX_NONE;
+    uint32_t i;
+    int actions_were_inhibited;
+    wolfsentry_errcode_t ret;
+
+    if (buf == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    ret = wolfsentry_snapshot_check_header(buf, buf_len, &header);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    /* every event takes at least a record, so a count past that is bogus. */
+    if (header.n_events > buf_len / sizeof(struct wolfsentry_snapshot_event))
+        WOLFSENTRY_ERROR_RETURN(BAD_VALUE);
+
+    r.buf = buf;
+    r.len = buf_len;
+    r.pos = sizeof header;
+
+    WOLFSENTRY_MUTEX_OR_RETURN();
+
+    actions_were_inhibited = WOLFSENTRY_CHECK_BITS(wolfsentry->config.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS);
+
+    if (header.n_events > 0) {
+        events = (struct wolfsentry_event **)WOLFSENTRY_MALLOC(header.n_events * (sizeof *events + sizeof *aux_event_indexes));
+        if (events == NULL)
+            WOLFSENTRY_ERROR_UNLOCK_AND_RETURN(SYS_RESOURCE_FAILED);
+        memset(events, 0, header.n_events * sizeof *events);
+        aux_event_indexes = (uint32_t *)(events + header.n_events);
+    } else
+        aux_event_indexes = NULL;
+
+    if ((ret = wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &clone, WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION)) < 0)
+        goto out;
+    if ((ret = wolfsentry_context_inhibit_actions(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone))) < 0)
+        goto out;
+    clone->user_values->validator = wolfsentry->user_values->validator;
+
+    if ((ret = wolfsentry_snapshot_load_settings(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), &r, &default_event_index)) < 0)
+        goto out;
+    if ((ret = wolfsentry_snapshot_load_events(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), &r, header.n_events, events, aux_event_indexes)) < 0)
+        goto out;
+    if (default_event_index != WOLFSENTRY_SNAPSHOT_INDEX_NONE) {
+        if (default_event_index >= header.n_events) {
+            ret = WOLFSENTRY_ERROR_ENCODE(BAD_VALUE);
+            goto out;
+        }
+        if ((ret = wolfsentry_route_table_set_default_event(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), clone->routes, events[default_event_index]->label, events[default_event_index]->label_len)) < 0)
+            goto out;
+    }
+    if ((ret = wolfsentry_snapshot_load_routes(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), &r, header.n_routes, events, header.n_events)) < 0)
+        goto out;
+    if ((ret = wolfsentry_snapshot_load_user_values(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), &r, header.n_user_values)) < 0)
+        goto out;
+    if (r.pos != r.len) {
+        ret = WOLFSENTRY_ERROR_ENCODE(BAD_VALUE);
+        goto out;
+    }
+
+    for (i = 0; i < header.n_events; ++i) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), events[i], NULL /* action_results */));
+        events[i] = NULL;
+    }
+
+    if ((ret = wolfsentry_context_exchange(WOLFSENTRY_CONTEXT_ARGS_OUT, clone)) < 0)
+        goto out;
+
+    /* the new state is live from here on, so what follows is cleanup, and a
+     * failure in it is warned about rather than returned.  the old routes are
+     * flushed with their delete actions, then the new ones get their insert
+     * actions, unless the caller had actions inhibited, in which case they stay
+     * that way.
+     */
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_flush(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone)));
+    if (! actions_were_inhibited) {
+        wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_enable_actions(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_bulk_insert_actions(WOLFSENTRY_CONTEXT_ARGS_OUT, &action_results));
+    }
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (events != NULL) {
+        for (i = 0; i < header.n_events; ++i) {
+            if (events[i] != NULL)
+                WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(clone), events[i], NULL /* action_results */));
+        }
+        WOLFSENTRY_FREE(events);
+    }
+    if (clone != NULL)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&clone)));
+
+    WOLFSENTRY_ERROR_UNLOCK_AND_RERETURN(ret);
+}
@@ -24,43 +24,464 @@
 
 #define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_WOLFSENTRY_INTERNAL_C
 
+/* the tables are intrusive red-black trees, keyed by the table cmp_fn, with
+ * the ents additionally threaded in order through prev/next, so that cursor
+ * iteration and the head/tail seeks are O(1).
+ */
+
+#define WOLFSENTRY_TABLE_ENT_BLACK 0U
+#define WOLFSENTRY_TABLE_ENT_RED 1U
+
+#define WOLFSENTRY_TABLE_ENT_IS_RED(ent) (((ent) != NULL) && ((ent)->rb_color == WOLFSENTRY_TABLE_ENT_RED))
+
+static inline void wolfsentry_table_rotate_left(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *x) {
+    struct wolfsentry_table_ent_header *y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL)
+        table->root = y;
+    else if (x == x->parent->left)
+        x->parent->left = y;
+    else
+        x->parent->right = y;
+    y->left = x;
+    x->parent = y;
+}
+
+static inline void wolfsentry_table_rotate_right(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *x) {
+    struct wolfsentry_table_ent_header *y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL)
+        table->root = y;
+    else if (x == x->parent->right)
+        x->parent->right = y;
+    else
+        x->parent->left = y;
+    y->right = x;
+    x->parent = y;
+}
+
+/* link ent into the tree as a child of parent (or as the root if parent is
+ * null), and into the threaded list between pred and succ, then rebalance.
+ */
+static void wolfsentry_table_ent_link(
+    struct wolfsentry_table_header *table,
+    struct wolfsentry_table_ent_header *parent,
+    int left_p,
+    struct wolfsentry_table_ent_header *pred,
+    struct wolfsentry_table_ent_header *succ,
+    struct wolfsentry_table_ent_header *ent)
+{
+    struct wolfsentry_table_ent_header *p, *g, *u;
+
+    ent->parent = parent;
+    ent->left = ent->right = NULL;
+    ent->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+    if (parent == NULL)
+        table->root = ent;
+    else if (left_p)
+        parent->left = ent;
+    else
+        parent->right = ent;
+
+    ent->prev = pred;
+    ent->next = succ;
+    if (pred)
+        pred->next = ent;
+    else
+        table->head = ent;
+    if (succ)
+        succ->prev = ent;
+    else
+        table->tail = ent;
+
+    while (WOLFSENTRY_TABLE_ENT_IS_RED(p = ent->parent)) {
+        /* a red parent is never the root, so g is always non-null here. */
+        g = p->parent;
+        if (p == g->left) {
+            u = g->right;
+            if (WOLFSENTRY_TABLE_ENT_IS_RED(u)) {
+                p->rb_color = u->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                g->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                ent = g;
+                continue;
+            }
+            if (ent == p->right) {
+                wolfsentry_table_rotate_left(table, p);
+                ent = p;
+                p = ent->parent;
+            }
+            p->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+            g->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+            wolfsentry_table_rotate_right(table, g);
+        } else {
+            u = g->left;
+            if (WOLFSENTRY_TABLE_ENT_IS_RED(u)) {
+                p->rb_color = u->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                g->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                ent = g;
+                continue;
+            }
+            if (ent == p->left) {
+                wolfsentry_table_rotate_right(table, p);
+                ent = p;
+                p = ent->parent;
+            }
+            p->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+            g->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+            wolfsentry_table_rotate_left(table, g);
+        }
+    }
+    table->root->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+}
+
+/* appends ent after the current tail -- caller must assure that ent sorts
+ * after every ent already in the table.
+ */
+static void wolfsentry_table_ent_append(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *ent) {
+    wolfsentry_table_ent_link(table, table->tail, 0 /* left_p */, table->tail, NULL /* succ */, ent);
+}
+
+static inline void wolfsentry_table_transplant(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *u, struct wolfsentry_table_ent_header *v) {
+    if (u->parent == NULL)
+        table->root = v;
+    else if (u == u->parent->left)
+        u->parent->left = v;
+    else
+        u->parent->right = v;
+    if (v)
+        v->parent = u->parent;
+}
+
+static void wolfsentry_table_ent_unlink(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *ent) {
+    struct wolfsentry_table_ent_header *x, *x_parent, *w;
+    uint32_t removed_color = ent->rb_color;
+
+    if (ent->left == NULL) {
+        x = ent->right;
+        x_parent = ent->parent;
+        wolfsentry_table_transplant(table, ent, ent->right);
+    } else if (ent->right == NULL) {
+        x = ent->left;
+        x_parent = ent->parent;
+        wolfsentry_table_transplant(table, ent, ent->left);
+    } else {
+        /* the in-order successor is the leftmost ent of the right subtree. */
+        struct wolfsentry_table_ent_header *y = ent->next;
+        removed_color = y->rb_color;
+        x = y->right;
+        if (y->parent == ent)
+            x_parent = y;
+        else {
+            x_parent = y->parent;
+            wolfsentry_table_transplant(table, y, y->right);
+            y->right = ent->right;
+            y->right->parent = y;
+        }
+        wolfsentry_table_transplant(table, ent, y);
+        y->left = ent->left;
+        y->left->parent = y;
+        y->rb_color = ent->rb_color;
+    }
+
+    if (removed_color == WOLFSENTRY_TABLE_ENT_BLACK) {
+        while ((x != table->root) && (! WOLFSENTRY_TABLE_ENT_IS_RED(x))) {
+            if (x == x_parent->left) {
+                w = x_parent->right;
+                if (WOLFSENTRY_TABLE_ENT_IS_RED(w)) {
+                    w->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    x_parent->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                    wolfsentry_table_rotate_left(table, x_parent);
+                    w = x_parent->right;
+                }
+                if ((! WOLFSENTRY_TABLE_ENT_IS_RED(w->left)) && (! WOLFSENTRY_TABLE_ENT_IS_RED(w->right))) {
+                    w->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                    x = x_parent;
+                    x_parent = x->parent;
+                } else {
+                    if (! WOLFSENTRY_TABLE_ENT_IS_RED(w->right)) {
+                        w->left->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                        w->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                        wolfsentry_table_rotate_right(table, w);
+                        w = x_parent->right;
+                    }
+                    w->rb_color = x_parent->rb_color;
+                    x_parent->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    w->right->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    wolfsentry_table_rotate_left(table, x_parent);
+                    x = table->root;
+                }
+            } else {
+                w = x_parent->left;
+                if (WOLFSENTRY_TABLE_ENT_IS_RED(w)) {
+                    w->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    x_parent->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                    wolfsentry_table_rotate_right(table, x_parent);
+                    w = x_parent->left;
+                }
+                if ((! WOLFSENTRY_TABLE_ENT_IS_RED(w->right)) && (! WOLFSENTRY_TABLE_ENT_IS_RED(w->left))) {
+                    w->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                    x = x_parent;
+                    x_parent = x->parent;
+                } else {
+                    if (! WOLFSENTRY_TABLE_ENT_IS_RED(w->left)) {
+                        w->right->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                        w->rb_color = WOLFSENTRY_TABLE_ENT_RED;
+                        wolfsentry_table_rotate_left(table, w);
+                        w = x_parent->left;
+                    }
+                    w->rb_color = x_parent->rb_color;
+                    x_parent->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    w->left->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+                    wolfsentry_table_rotate_right(table, x_parent);
+                    x = table->root;
+                }
+            }
+        }
+        if (x)
+            x->rb_color = WOLFSENTRY_TABLE_ENT_BLACK;
+    }
+
+    if (ent->prev)
+        ent->prev->next = ent->next;
+    else
+        table->head = ent->next;
+    if (ent->next)
+        ent->next->prev = ent->prev;
+    else
+        table->tail = ent->prev;
+
+    ent->parent = ent->left = ent->right = NULL;
+    ent->prev = ent->next = NULL;
+}
+
+/* Fibonacci hashing of key down to one of 1 << n_slots_log2 slots. */
+static inline size_t wolfsentry_hash_to_slot(uint64_t key, unsigned int n_slots_log2) {
+    return (size_t)((key * WOLFSENTRY_FIBONACCI_HASH_MULTIPLIER) >> (64U - n_slots_log2));
+}
+
+/* the label index of a label-keyed table uses the same linear probing and
+ * backward-shift deletion as the ID index, on an FNV-1a hash of the label.  it
+ * parallels the red-black tree, which still provides the ordered iteration.
+ */
+
+#define WOLFSENTRY_LABEL_INDEX_MIN_SLOTS_LOG2 4U
+
+static uint32_t wolfsentry_label_hash(const char *label, unsigned int label_len) {
+    uint32_t h = 2166136261U;
+    while (label_len-- > 0) {
+        h ^= (byte)*label++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static size_t wolfsentry_label_index_home(const struct wolfsentry_table_header *table, const struct wolfsentry_table_ent_header *ent) {
+    const char *label;
+    unsigned int label_len;
+    table->label_fn(ent, &label, &label_len);
+    return wolfsentry_hash_to_slot(wolfsentry_label_hash(label, label_len), table->label_index.n_slots_log2);
+}
+
+/* returns the slot holding label, or failing that, the empty slot where it would go. */
+static size_t wolfsentry_label_index_find(const struct wolfsentry_table_header *table, const char *label, unsigned int label_len) {
+    const struct wolfsentry_label_index *index = &table->label_index;
+    size_t mask = ((size_t)1 << index->n_slots_log2) - 1U;
+    size_t i = wolfsentry_hash_to_slot(wolfsentry_label_hash(label, label_len), index->n_slots_log2);
+    while (index->slots[i] != NULL) {
+        const char *i_label;
+        unsigned int i_label_len;
+        table->label_fn(index->slots[i], &i_label, &i_label_len);
+        if ((i_label_len == label_len) && (memcmp(i_label, label, label_len) == 0))
+            break;
+        i = (i + 1U) & mask;
+    }
+    return i;
+}
+
+static wolfsentry_errcode_t wolfsentry_label_index_insert(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *ent) {
+    struct wolfsentry_label_index *index = &table->label_index;
+    const char *label;
+    unsigned int label_len;
+
+    if ((index->slots == NULL) ||
+        (index->n_ents >= ((size_t)1 << (index->n_slots_log2 - 1U))))
+    {
+        struct wolfsentry_table_ent_header **old_slots = index->slots;
+        size_t old_n_slots = old_slots ? (size_t)1 << index->n_slots_log2 : 0;
+        unsigned int new_n_slots_log2 = old_slots ? index->n_slots_log2 + 1U : WOLFSENTRY_LABEL_INDEX_MIN_SLOTS_LOG2;
+        size_t i;
+
+        if ((index->slots = (struct wolfsentry_table_ent_header **)WOLFSENTRY_MALLOC(sizeof *index->slots << new_n_slots_log2)) == NULL) {
+            index->slots = old_slots;
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        }
+        memset(index->slots, 0, sizeof *index->slots << new_n_slots_log2);
+        index->n_slots_log2 = new_n_slots_log2;
+        for (i = 0; i < old_n_slots; ++i) {
+            if (old_slots[i]) {
+                table->label_fn(old_slots[i], &label, &label_len);
+                index->slots[wolfsentry_label_index_find(table, label, label_len)] = old_slots[i];
+            }
+        }
+        if (old_slots)
+            WOLFSENTRY_FREE(old_slots);
+    }
+
+    table->label_fn(ent, &label, &label_len);
+    index->slots[wolfsentry_label_index_find(table, label, label_len)] = ent;
+    ++index->n_ents;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_label_index_delete(struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *ent) {
+    struct wolfsentry_label_index *index = &table->label_index;
+    const char *label;
+    unsigned int label_len;
+    size_t mask, hole, i;
+
+    if (index->slots == NULL)
+        return;
+    table->label_fn(ent, &label, &label_len);
+    hole = wolfsentry_label_index_find(table, label, label_len);
+    if (index->slots[hole] != ent)
+        return;
+
+    index->slots[hole] = NULL;
+    mask = ((size_t)1 << index->n_slots_log2) - 1U;
+    for (i = (hole + 1U) & mask; index->slots[i] != NULL; i = (i + 1U) & mask) {
+        size_t home = wolfsentry_label_index_home(table, index->slots[i]);
+        if ((hole <= i) ? ((home <= hole) || (home > i)) : ((home <= hole) && (home > i))) {
+            index->slots[hole] = index->slots[i];
+            index->slots[i] = NULL;
+            hole = i;
+        }
+    }
+    --index->n_ents;
+}
+
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_IN, const struct wolfsentry_table_header *table, const char *label, unsigned int label_len, struct wolfsentry_table_ent_header **ent) {
+    size_t slot;
+
+    WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
+
+    if (table->label_fn == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (table->label_index.slots == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    slot = wolfsentry_label_index_find(table, label, label_len);
+    if (table->label_index.slots[slot] == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    *ent = table->label_index.slots[slot];
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* returns the exact match for ent, or null. */
+static struct wolfsentry_table_ent_header *wolfsentry_table_ent_find(const struct wolfsentry_table_header *table, const struct wolfsentry_table_ent_header *ent) {
+    struct wolfsentry_table_ent_header *i = table->root;
+    while (i) {
+        int c = table->cmp_fn(i, ent);
+        if (c == 0)
+            return i;
+        else if (c > 0)
+            i = i->left;
+        else
+            i = i->right;
+    }
+    return NULL;
+}
+
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_header *table, int unique_p) {
-    struct wolfsentry_table_ent_header *i = table->head;
-    int cmpret;
+    struct wolfsentry_table_ent_header *i = table->root, *parent = NULL, *pred = NULL, *succ = NULL;
+    int cmpret = 0;
 
     WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
 
     if (ent->id == WOLFSENTRY_ENT_ID_NONE)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
+    /* non-unique ents are inserted ahead of any equal ents already present. */
     while (i) {
-        if ((cmpret = table->cmp_fn(i, ent)) >= 0)
-            break;
-        i = i->next;
-    }
-    if (i) {
+        parent = i;
+        cmpret = table->cmp_fn(i, ent);
         if ((cmpret == 0) && unique_p) {
             if (ent->id != WOLFSENTRY_ENT_ID_NONE)
                 WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_OUT, ent));
             WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
         }
-        ent->prev = i->prev;
-        ent->next = i;
-        if (i->prev) {
-            i->prev->next = ent;
+        if (cmpret >= 0) {
+            succ = i;
+            i = i->left;
         } else {
-            table->head = ent;
+            pred = i;
+            i = i->right;
         }
-        i->prev = ent;
-    } else if (table->tail) {
-        table->tail->next = ent;
-        ent->prev = table->tail;
-        ent->next = NULL;
-        table->tail = ent;
-    } else {
-        table->head = table->tail = ent;
-        ent->prev = ent->next = NULL;
     }
+
+    if (table->label_fn)
+        WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_label_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, table, ent));
+
+    wolfsentry_table_ent_link(table, parent, cmpret >= 0, pred, succ, ent);
+
+    ++table->n_ents;
+    ++table->n_inserts;
+    ent->parent_table = table;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* finds the ent that ent would be inserted ahead of, or null if it would go at
+ * the tail, failing with ITEM_ALREADY_PRESENT if an equal ent is present.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_find_successor(WOLFSENTRY_CONTEXT_ARGS_IN, const struct wolfsentry_table_header *table, const struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_ent_header **succ) {
+    struct wolfsentry_table_ent_header *i = table->root;
+
+    WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
+
+    *succ = NULL;
+    while (i) {
+        int c = table->cmp_fn(i, ent);
+        if (c == 0)
+            WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+        else if (c > 0) {
+            *succ = i;
+            i = i->left;
+        } else
+            i = i->right;
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* inserts ent immediately ahead of succ, or at the tail if succ is null, for
+ * callers that have already established ent's position and uniqueness.  the
+ * in-order neighbors of any gap are an ancestor and a descendant of one
+ * another, and the descendant has a null child on the side of the gap.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert_before(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *succ) {
+    struct wolfsentry_table_ent_header *pred;
+
+    WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
+
+    if (ent->id == WOLFSENTRY_ENT_ID_NONE)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((succ != NULL) && (succ->parent_table != table))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (table->label_fn)
+        WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_label_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, table, ent));
+
+    pred = succ ? succ->prev : table->tail;
+    if ((succ != NULL) && (succ->left == NULL))
+        wolfsentry_table_ent_link(table, succ, 1 /* left_p */, pred, succ, ent);
+    else
+        wolfsentry_table_ent_link(table, pred, 0 /* left_p */, pred, succ, ent);
+
     ++table->n_ents;
     ++table->n_inserts;
     ent->parent_table = table;
@@ -107,7 +528,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_clone(
 {
     wolfsentry_errcode_t ret;
     wolfsentry_table_ent_clone_fn_t clone_fn = NULL;
-    struct wolfsentry_table_ent_header *prev = NULL, *new = NULL, *i;
+    struct wolfsentry_table_ent_header *new = NULL, *i;
 
     WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
 #ifdef WOLFSENTRY_THREADSAFE
@@ -173,25 +594,30 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_clone(
         if ((ret = clone_fn(WOLFSENTRY_CONTEXT_ARGS_OUT, i, dest_context, &new, flags)) < 0)
             goto out;
         new->parent_table = dest_table;
-        new->prev = prev;
-        if (prev)
-            prev->next = new;
-        else
-            dest_table->head = new;
-        prev = new;
+        wolfsentry_table_ent_append(dest_table, new);
+        if (dest_table->label_fn &&
+            ((ret = wolfsentry_label_index_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), dest_table, new)) < 0))
+        {
+            goto out;
+        }
         if ((ret = wolfsentry_table_ent_insert_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), new)) < 0)
             goto out;
 
         if ((src_table->ent_type == WOLFSENTRY_OBJECT_TYPE_ROUTE) &&
             ((struct wolfsentry_route *)new)->meta.purge_after)
         {
-            wolfsentry_route_purge_list_insert((struct wolfsentry_route_table *)dest_table, (struct wolfsentry_route *)new);
+            wolfsentry_route_purge_wheel_schedule((struct wolfsentry_route_table *)dest_table, (struct wolfsentry_route *)new);
         }
     }
-    dest_table->tail = new;
 
     dest_table->n_ents = src_table->n_ents;
 
+    /* routes are indexed in a single pass once they're all in place. */
+    if (src_table->ent_type == WOLFSENTRY_OBJECT_TYPE_ROUTE) {
+        if ((ret = wolfsentry_route_table_clone_indexes(WOLFSENTRY_CONTEXT_ARGS_OUT, (const struct wolfsentry_route_table *)src_table, dest_context, (struct wolfsentry_route_table *)dest_table)) < 0)
+            goto out;
+    }
+
     /* event cloning is tricky because events refer to other events by pointer, so a second pass through the table is needed. */
     if (src_table->ent_type == WOLFSENTRY_OBJECT_TYPE_EVENT) {
         if ((ret = wolfsentry_table_clone_map(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->events->header, dest_context, &dest_context->events->header, wolfsentry_event_clone_resolve, flags)) < 0)
@@ -217,7 +643,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_coupled_table_clone(
 {
     wolfsentry_errcode_t ret;
     wolfsentry_coupled_table_ent_clone_fn_t clone_fn = NULL;
-    struct wolfsentry_table_ent_header *prev = NULL, *new1 = NULL, *new2 = NULL, *i;
+    struct wolfsentry_table_ent_header *new1 = NULL, *new2 = NULL, *i;
 
     WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
 #ifdef WOLFSENTRY_THREADSAFE
@@ -269,11 +695,7 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_coupled_table_clone(
             goto out;
         new1->parent_table = dest_table1;
         new2->parent_table = dest_table2;
-        if (prev)
-            prev->next = new1;
-        else
-            dest_table1->head = new1;
-        prev = new1;
+        wolfsentry_table_ent_append(dest_table1, new1);
         if ((ret = wolfsentry_table_ent_insert_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), new1)) < 0)
             goto out;
         if ((ret = wolfsentry_table_ent_insert_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), new2)) < 0)
@@ -281,7 +703,6 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_coupled_table_clone(
         if ((ret = wolfsentry_table_ent_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(dest_context), new2, dest_table2, 1 /* unique_p */)) < 0)
             goto out;
     }
-    dest_table1->tail = new1;
 
     dest_table1->n_ents = src_table1->n_ents;
 
@@ -296,13 +717,70 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_coupled_table_clone(
 }
 #endif /* WOLFSENTRY_PROTOCOL_NAMES */
 
-static inline int wolfsentry_ent_id_cmp(struct wolfsentry_table_ent_header *left, wolfsentry_ent_id_t right_id) {
-    if (left->id < right_id)
-        return -1;
-    else if (left->id > right_id)
-        return 1;
-    else
-        return 0;
+/* the ID index is open-addressed with linear probing, on a Fibonacci hash of
+ * the ID, which spreads the dense IDs from the builtin counter evenly across the
+ * slots, while still coping with arbitrary IDs from a user mk_id_cb.
+ */
+
+#define WOLFSENTRY_ENT_ID_INDEX_MIN_SLOTS_LOG2 6U
+
+#define wolfsentry_ent_id_hash(id, n_slots_log2) wolfsentry_hash_to_slot((uint64_t)(id), n_slots_log2)
+
+/* returns the slot holding id, or failing that, the empty slot where it would go. */
+static size_t wolfsentry_ent_id_index_find(const struct wolfsentry_ent_id_index *index, wolfsentry_ent_id_t id) {
+    size_t mask = ((size_t)1 << index->n_slots_log2) - 1U;
+    size_t i = wolfsentry_ent_id_hash(id, index->n_slots_log2);
+    while ((index->slots[i] != NULL) && (index->slots[i]->id != id))
+        i = (i + 1U) & mask;
+    return i;
+}
+
+static wolfsentry_errcode_t wolfsentry_ent_id_index_resize(WOLFSENTRY_CONTEXT_ARGS_IN, unsigned int new_n_slots_log2) {
+    struct wolfsentry_ent_id_index *index = &wolfsentry->ents_by_id;
+    struct wolfsentry_table_ent_header **old_slots = index->slots;
+    size_t old_n_slots = old_slots ? (size_t)1 << index->n_slots_log2 : 0;
+    size_t new_n_slots = (size_t)1 << new_n_slots_log2;
+    size_t i;
+
+    if ((index->slots = (struct wolfsentry_table_ent_header **)WOLFSENTRY_MALLOC(sizeof *index->slots * new_n_slots)) == NULL) {
+        index->slots = old_slots;
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    }
+    memset(index->slots, 0, sizeof *index->slots * new_n_slots);
+    index->n_slots_log2 = new_n_slots_log2;
+
+    for (i = 0; i < old_n_slots; ++i) {
+        if (old_slots[i])
+            index->slots[wolfsentry_ent_id_index_find(index, old_slots[i]->id)] = old_slots[i];
+    }
+    if (old_slots)
+        WOLFSENTRY_FREE(old_slots);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_LOCAL void wolfsentry_ent_id_index_free(WOLFSENTRY_CONTEXT_ARGS_IN) {
+    if (wolfsentry->ents_by_id.slots)
+        WOLFSENTRY_FREE(wolfsentry->ents_by_id.slots);
+    memset(&wolfsentry->ents_by_id, 0, sizeof wolfsentry->ents_by_id);
+}
+
+/* sizes the ID index for n_more insertions in one step, so that a bulk copy
+ * doesn't rehash it repeatedly as it grows.
+ */
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_ent_id_index_reserve(WOLFSENTRY_CONTEXT_ARGS_IN, size_t n_more) {
+    struct wolfsentry_ent_id_index *index = &wolfsentry->ents_by_id;
+    size_t n_ents = index->n_ents + n_more;
+    unsigned int n_slots_log2 = index->slots ? index->n_slots_log2 : WOLFSENTRY_ENT_ID_INDEX_MIN_SLOTS_LOG2;
+
+    WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
+
+    /* wolfsentry_table_ent_insert_by_id() keeps the index at most half full. */
+    while (n_ents > ((size_t)1 << (n_slots_log2 - 1U)))
+        ++n_slots_log2;
+    if ((index->slots != NULL) && (n_slots_log2 == index->n_slots_log2))
+        WOLFSENTRY_RETURN_OK;
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_ent_id_index_resize(WOLFSENTRY_CONTEXT_ARGS_OUT, n_slots_log2));
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_id_allocate(
@@ -346,79 +824,86 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_label_is_builtin(const char *la
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert_by_id(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent) {
-    struct wolfsentry_table_ent_header *i = wolfsentry->ents_by_id.head;
-    int cmpret;
+    struct wolfsentry_ent_id_index *index = &wolfsentry->ents_by_id;
+    size_t slot = 0;
 
     WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
 
     if (ent->id == WOLFSENTRY_ENT_ID_NONE)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    while (i) {
-        if ((cmpret = wolfsentry_ent_id_cmp(i, ent->id)) >= 0)
-            break;
-        i = i->next_by_id;
-    }
-    if (i) {
-        if (cmpret == 0)
+    if (index->slots) {
+        slot = wolfsentry_ent_id_index_find(index, ent->id);
+        if (index->slots[slot])
             WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
-        ent->prev_by_id = i->prev_by_id;
-        ent->next_by_id = i;
-        if (i->prev_by_id) {
-            i->prev_by_id->next_by_id = ent;
-        } else {
-            wolfsentry->ents_by_id.head = ent;
-        }
-        i->prev_by_id = ent;
-    } else if (wolfsentry->ents_by_id.tail) {
-        wolfsentry->ents_by_id.tail->next_by_id = ent;
-        ent->prev_by_id = wolfsentry->ents_by_id.tail;
-        ent->next_by_id = NULL;
-        wolfsentry->ents_by_id.tail = ent;
-    } else {
-        wolfsentry->ents_by_id.head = wolfsentry->ents_by_id.tail = ent;
-        ent->prev_by_id = ent->next_by_id = NULL;
     }
-    ++wolfsentry->ents_by_id.n_ents;
-    ++wolfsentry->ents_by_id.n_inserts;
+
+    if ((index->slots == NULL) ||
+        (index->n_ents >= ((size_t)1 << (index->n_slots_log2 - 1U))))
+    {
+        wolfsentry_errcode_t ret = wolfsentry_ent_id_index_resize(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            index->slots ? index->n_slots_log2 + 1U : WOLFSENTRY_ENT_ID_INDEX_MIN_SLOTS_LOG2);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        slot = wolfsentry_ent_id_index_find(index, ent->id);
+    }
+
+    index->slots[slot] = ent;
+    ++index->n_ents;
+    ++index->n_inserts;
     WOLFSENTRY_RETURN_OK;
 }
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_table_ent_get_by_id(WOLFSENTRY_CONTEXT_ARGS_IN, wolfsentry_ent_id_t id, struct wolfsentry_table_ent_header **ent) {
-    struct wolfsentry_table_ent_header *i;
+    size_t slot;
 
     WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
 
     if (id == WOLFSENTRY_ENT_ID_NONE)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    for (i = wolfsentry->ents_by_id.head; i; i = i->next_by_id) {
-        int c = wolfsentry_ent_id_cmp(i, id);
-        if (c >= 0) {
-            if (c == 0) {
-                *ent = i;
-                WOLFSENTRY_RETURN_OK;
-            }
-            WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
-        }
-    }
-    WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    if (wolfsentry->ents_by_id.slots == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    slot = wolfsentry_ent_id_index_find(&wolfsentry->ents_by_id, id);
+    if (wolfsentry->ents_by_id.slots[slot] == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    *ent = wolfsentry->ents_by_id.slots[slot];
+    WOLFSENTRY_RETURN_OK;
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent) {
+    struct wolfsentry_ent_id_index *index = &wolfsentry->ents_by_id;
+    size_t mask, hole, i;
+
     WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
 
-    if (ent->prev_by_id)
-        ent->prev_by_id->next_by_id = ent->next_by_id;
-    else
-        wolfsentry->ents_by_id.head = ent->next_by_id;
-    if (ent->next_by_id)
-        ent->next_by_id->prev_by_id = ent->prev_by_id;
-    else
-        wolfsentry->ents_by_id.tail = ent->prev_by_id;
-    ent->prev_by_id = ent->next_by_id = NULL;
-    --wolfsentry->ents_by_id.n_ents;
-    ++wolfsentry->ents_by_id.n_deletes;
+    if ((index->slots == NULL) || (ent->id == WOLFSENTRY_ENT_ID_NONE))
+        WOLFSENTRY_RETURN_OK;
+
+    /* an ent that isn't in the index (e.g. one that lost a unique insert to
+     * another ent with the same ID) must be left alone.
+     */
+    hole = wolfsentry_ent_id_index_find(index, ent->id);
+    if (index->slots[hole] != ent)
+        WOLFSENTRY_RETURN_OK;
+
+    /* backward-shift deletion -- each ent in the probe run after the hole moves
+     * into it, unless its home slot lies cyclically in (hole, i], so that no
+     * tombstones are needed.
+     */
+    index->slots[hole] = NULL;
+    mask = ((size_t)1 << index->n_slots_log2) - 1U;
+    for (i = (hole + 1U) & mask; index->slots[i] != NULL; i = (i + 1U) & mask) {
+        size_t home = wolfsentry_ent_id_hash(index->slots[i]->id, index->n_slots_log2);
+        if ((hole <= i) ? ((home <= hole) || (home > i)) : ((home <= hole) && (home > i))) {
+            index->slots[hole] = index->slots[i];
+            index->slots[i] = NULL;
+            hole = i;
+        }
+    }
+
+    --index->n_ents;
+    ++index->n_deletes;
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -441,22 +926,21 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_by_id(WOLFSENT
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header **ent) {
-    struct wolfsentry_table_ent_header *i = table->head;
+    struct wolfsentry_table_ent_header *i;
 
     WOLFSENTRY_HAVE_A_LOCK_OR_RETURN();
 
-    while (i) {
-        int c = table->cmp_fn(i, *ent);
-        if (c >= 0) {
-            if (c == 0) {
-                *ent = i;
-                WOLFSENTRY_RETURN_OK;
-            }
-            WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
-        }
-        i = i->next;
+    if (table->label_fn) {
+        const char *label;
+        unsigned int label_len;
+        table->label_fn(*ent, &label, &label_len);
+        WOLFSENTRY_ERROR_RERETURN(wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_OUT, table, label, label_len, ent));
     }
-    WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+
+    if ((i = wolfsentry_table_ent_find(table, *ent)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    *ent = i;
+    WOLFSENTRY_RETURN_OK;
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent) {
@@ -465,15 +949,9 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_1(WOLFSENTRY_C
     if (ent->parent_table == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    if (ent->prev)
-        ent->prev->next = ent->next;
-    else
-        ent->parent_table->head = ent->next;
-    if (ent->next)
-        ent->next->prev = ent->prev;
-    else
-        ent->parent_table->tail = ent->prev;
-    ent->prev = ent->next = NULL;
+    wolfsentry_table_ent_unlink(ent->parent_table, ent);
+    if (ent->parent_table->label_fn)
+        wolfsentry_label_index_delete(ent->parent_table, ent);
     --ent->parent_table->n_ents;
     ++ent->parent_table->n_deletes;
     ent->parent_table = NULL;
@@ -494,20 +972,10 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete(WOLFSENTRY_CON
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
     }
 
-    i = (*ent)->parent_table->head;
-    (void)wolfsentry;
-    while (i) {
-        int c = (*ent)->parent_table->cmp_fn(i, *ent);
-        if (c >= 0) {
-            if (c == 0) {
-                *ent = i;
-                WOLFSENTRY_ERROR_RERETURN(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, i));
-            }
-            WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
-        }
-        i = i->next;
-    }
-    WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    if ((i = wolfsentry_table_ent_find((*ent)->parent_table, *ent)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    *ent = i;
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_OUT, i));
 }
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_drop_reference(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, wolfsentry_action_res_t *action_results) {
@@ -537,6 +1005,10 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_free_ents(WOLFSENTRY_CONT
     WOLFSENTRY_HAVE_MUTEX_OR_RETURN();
 
     WOLFSENTRY_TABLE_HEADER_RESET(*table);
+    if (table->label_index.slots) {
+        WOLFSENTRY_FREE(table->label_index.slots);
+        memset(&table->label_index, 0, sizeof table->label_index);
+    }
     /* coupled objects are freed as a pair, e.g. ents in
      * wolfsentry_addr_family_byname_table are freed when the corresponding
      * wolfsentry_addr_family_bynumber_table ents are freed.
@@ -567,15 +1039,25 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_cursor_init(WOLFSENTRY_CO
  * immediately after where the search ent would be.
  */
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_cursor_seek(const struct wolfsentry_table_header *table, const struct wolfsentry_table_ent_header *ent, struct wolfsentry_cursor *cursor, int *cursor_position) {
-    struct wolfsentry_table_ent_header *i = table->head;
+    struct wolfsentry_table_ent_header *i = table->root, *lower_bound = NULL;
+    int lower_bound_cmp = -1;
+
+    /* find the first ent that sorts at or after the search ent. */
     while (i) {
         int c = table->cmp_fn(i, ent);
         if (c >= 0) {
-            cursor->point = i;
-            *cursor_position = c;
-            WOLFSENTRY_RETURN_OK;
-        }
-        i = i->next;
+            lower_bound = i;
+            lower_bound_cmp = c;
+            if (c == 0)
+                break;
+            i = i->left;
+        } else
+            i = i->right;
+    }
+    if (lower_bound) {
+        cursor->point = lower_bound;
+        *cursor_position = lower_bound_cmp;
+        WOLFSENTRY_RETURN_OK;
     }
     cursor->point = table->tail;
     *cursor_position = -1;
@@ -590,7 +1072,9 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_filter(
     wolfsentry_dropper_function_t dropper,
     void *dropper_context)
 {
-    /* with linked lists, this is easy, but it will be a lot trickier with red-black trees. */
+    /* the in-order threading is left intact for ents that follow a deleted ent,
+     * so saving i_next before each deletion keeps iteration safe.
+     */
     wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
     struct wolfsentry_table_ent_header *i, *i_next;
 
@@ -619,7 +1103,6 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_map(
     void *map_context,
     wolfsentry_action_res_t *action_results)
 {
-    /* with linked lists, this is easy, but it will be a lot trickier with red-black trees. */
     wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
     struct wolfsentry_table_ent_header *i, *i_next;
 
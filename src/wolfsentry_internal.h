@@ -34,6 +34,11 @@ typedef uint32_t wolfsentry_refcount_t;
 
 #include "wolfsentry_ll.h"
 
+/* 2^64 divided by the golden ratio, the Fibonacci hashing multiplier, composed
+ * from 32 bit halves for C89, which has no long long literals.
+ */
+#define WOLFSENTRY_FIBONACCI_HASH_MULTIPLIER (((uint64_t)0x9e3779b9U << 32U) | (uint64_t)0x7f4a7c15U)
+
 #ifdef WOLFSENTRY_THREADSAFE
 
 #define WOLFSENTRY_THREAD_ID_SENT ~0UL /* lock handoff not yet implemented. */
@@ -46,6 +51,43 @@ enum wolfsentry_rwlock_state {
     WOLFSENTRY_LOCK_MAX = 0x7fffffff /* force enum to be 32 bits, for intrinsic atomicity. */
 };
 
+#ifndef WOLFSENTRY_LOCK_READER_SLOTS
+#define WOLFSENTRY_LOCK_READER_SLOTS 64 /* must be a power of 2. */
+#endif
+
+#ifndef WOLFSENTRY_CACHE_LINE_SIZE
+#define WOLFSENTRY_CACHE_LINE_SIZE 64
+#endif
+
+/* reader indicator for WOLFSENTRY_LOCK_FLAG_READ_BIAS locks -- each slot is
+ * the count of fast-path shared holds by threads hashing to it, padded to a
+ * cache line so that readers on different cores don't contend.
+ */
+struct wolfsentry_rwlock_reader_slot {
+    volatile int count;
+    byte pad[WOLFSENTRY_CACHE_LINE_SIZE - sizeof(int)];
+};
+
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+#if (WOLFSENTRY_COUNTER_SHARDS < 2) || (WOLFSENTRY_COUNTER_SHARDS & (WOLFSENTRY_COUNTER_SHARDS - 1))
+#error WOLFSENTRY_COUNTER_SHARDS must be a power of 2 greater than 1.
+#endif
+
+/* hit counter slot for WOLFSENTRY_COUNTER_SHARDS builds -- each thread context
+ * counts into the slot picked by its counter_shard, and readers fold the slots.
+ * padded so that slots of the same counter never share a cache line.
+ */
+struct wolfsentry_counter_shard {
+    wolfsentry_hitcount_t hitcount;
+    byte pad[WOLFSENTRY_CACHE_LINE_SIZE - sizeof(wolfsentry_hitcount_t)];
+};
+
+#define WOLFSENTRY_COUNTER_SHARD_INDEX(thread) ((thread) ? ((thread)->counter_shard & (WOLFSENTRY_COUNTER_SHARDS - 1U)) : 0U)
+
+/* folds the WOLFSENTRY_COUNTER_SHARDS slots of a counter, saturating. */
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_counter_shards_sum(const struct wolfsentry_counter_shard *shards);
+#endif
+
 struct wolfsentry_rwlock {
     const struct wolfsentry_host_platform_interface *hpi;
     sem_t sem;
@@ -64,6 +106,13 @@ struct wolfsentry_rwlock {
     volatile enum wolfsentry_rwlock_state state;
     volatile int promoted_at_count;
     wolfsentry_lock_flags_t flags;
+    volatile int read_bias; /* nonzero while shared lockers may use reader_slots instead of sem. */
+    struct wolfsentry_rwlock_reader_slot *reader_slots; /* null unless WOLFSENTRY_LOCK_FLAG_READ_BIAS. */
+    void *reader_slots_buf; /* unaligned allocation backing reader_slots. */
+    wolfsentry_hitcount_t wait_count; /* lockers that had to block, counted with sem held. */
+#ifdef WOLFSENTRY_INSTRUMENT
+    struct wolfsentry_instrument *instrument; /* null except for the context lock. */
+#endif
 };
 
 struct wolfsentry_thread_context {
@@ -82,6 +131,10 @@ struct wolfsentry_thread_context {
     int recursion_of_tracked_lock; /* recursion count for outermost_shared_lock/current_shared_lock -- 1 if locked only once. */
     int shared_count; /* total count of shared locks held */
     int mutex_and_reservation_count;
+    int tracked_shared_lock_biased; /* tracked_shared_lock is held via its reader slot rather than its holder count. */
+#if defined(WOLFSENTRY_COUNTER_SHARDS) || defined(WOLFSENTRY_INSTRUMENT)
+    unsigned int counter_shard; /* slot used for sharded hit counters and histograms, assigned round-robin at init. */
+#endif
 };
 
 #define WOLFSENTRY_THREAD_GET_ID (thread ? thread->id : WOLFSENTRY_THREAD_GET_ID_HANDLER())
@@ -136,8 +189,12 @@ static_assert(__alignof__(struct wolfsentry_thread_context_public) >= __alignof_
     } while (0)
 #define WOLFSENTRY_HAVE_A_LOCK_OR_RETURN() WOLFSENTRY_HAVE_A_LOCK_OR_RETURN_EX(wolfsentry)
 
+WOLFSENTRY_LOCAL_VOID wolfsentry_thread_yield(void);
+
 #else /* !WOLFSENTRY_THREADSAFE */
 
+#undef WOLFSENTRY_COUNTER_SHARDS /* nothing to shard without concurrency. */
+
 #define WOLFSENTRY_THREAD_ASSERT_INITED(thread) do {} while (0)
 #define WOLFSENTRY_THREAD_ASSERT_NULL_OR_INITED(thread) do {} while (0)
 
@@ -150,6 +207,49 @@ static_assert(__alignof__(struct wolfsentry_thread_context_public) >= __alignof_
 
 #endif /* WOLFSENTRY_THREADSAFE */
 
+#ifdef WOLFSENTRY_INSTRUMENT
+
+#ifdef WOLFSENTRY_THREADSAFE
+#ifndef WOLFSENTRY_INSTRUMENT_SHARDS
+#define WOLFSENTRY_INSTRUMENT_SHARDS 4
+#endif
+#if (WOLFSENTRY_INSTRUMENT_SHARDS < 1) || (WOLFSENTRY_INSTRUMENT_SHARDS & (WOLFSENTRY_INSTRUMENT_SHARDS - 1))
+#error WOLFSENTRY_INSTRUMENT_SHARDS must be a power of 2.
+#endif
+#define WOLFSENTRY_INSTRUMENT_SHARD_INDEX(thread) ((thread) ? ((thread)->counter_shard & (WOLFSENTRY_INSTRUMENT_SHARDS - 1U)) : 0U)
+#else
+#undef WOLFSENTRY_INSTRUMENT_SHARDS
+#define WOLFSENTRY_INSTRUMENT_SHARDS 1
+#define WOLFSENTRY_INSTRUMENT_SHARD_INDEX(thread) 0U
+#endif
+
+/* monotonic nanoseconds for instrumentation, overridable by the user. */
+#ifndef WOLFSENTRY_INSTRUMENT_NOW
+#if defined(WOLFSENTRY_CLOCK_BUILTINS) && !defined(FREERTOS)
+#define WOLFSENTRY_INSTRUMENT_BUILTIN_NOW
+WOLFSENTRY_LOCAL uint64_t wolfsentry_instrument_now(void);
+#define WOLFSENTRY_INSTRUMENT_NOW() wolfsentry_instrument_now()
+#else
+#error WOLFSENTRY_INSTRUMENT requires WOLFSENTRY_CLOCK_BUILTINS or a user-supplied WOLFSENTRY_INSTRUMENT_NOW().
+#endif
+#endif
+
+/* the context histograms, one set per shard, each shard written by the
+ * threads whose counter_shard maps to it.  folded on readout.
+ */
+struct wolfsentry_instrument {
+    struct {
+        struct wolfsentry_histogram hists[WOLFSENTRY_INSTRUMENT_HISTOGRAM_COUNT];
+    } shards[WOLFSENTRY_INSTRUMENT_SHARDS];
+};
+
+WOLFSENTRY_LOCAL void wolfsentry_histogram_record(struct wolfsentry_histogram *histogram, uint64_t value);
+
+#define WOLFSENTRY_INSTRUMENT_RECORD(instrument, which, value) \
+    wolfsentry_histogram_record(&(instrument)->shards[WOLFSENTRY_INSTRUMENT_SHARD_INDEX(thread)].hists[which], value)
+
+#endif /* WOLFSENTRY_INSTRUMENT */
+
 #define WOLFSENTRY_REFCOUNT_INCREMENT(x, ret)                           \
     do {                                                                \
         wolfsentry_refcount_t _out;                                     \
@@ -179,17 +279,19 @@ struct wolfsentry_table_ent_header
 #endif
 {
     struct wolfsentry_table_header *parent_table;
-    struct wolfsentry_table_ent_header *prev, *next; /* these will be replaced by red-black table elements later. */
-    struct wolfsentry_table_ent_header *prev_by_id, *next_by_id; /* these will be replaced by red-black table elements later. */
+    struct wolfsentry_table_ent_header *parent, *left, *right; /* red-black tree links. */
+    struct wolfsentry_table_ent_header *prev, *next; /* in-order threading of the tree, for O(1) cursor iteration. */
     wolfsentry_hitcount_t hitcount;
     wolfsentry_ent_id_t id;
-    uint32_t padding1;
+    uint32_t rb_color;
     wolfsentry_refcount_t refcount;
 };
 
 #define WOLFSENTRY_TABLE_ENT_HEADER_RESET(ent) do {                           \
         (ent).parent_table = NULL;                                            \
-        (ent).prev = (ent).next = (ent).prev_by_id = (ent).next_by_id = NULL; \
+        (ent).parent = (ent).left = (ent).right = NULL;                       \
+        (ent).prev = (ent).next = NULL;                                       \
+        (ent).rb_color = 0;                                                   \
         (ent).refcount = 1; }                                                 \
     while (0)
 
@@ -197,6 +299,7 @@ struct wolfsentry_context;
 
 typedef int (*wolfsentry_ent_cmp_fn_t)(const struct wolfsentry_table_ent_header *left, const struct wolfsentry_table_ent_header *right);
 typedef wolfsentry_errcode_t (*wolfsentry_ent_free_fn_t)(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, wolfsentry_action_res_t *action_results);
+typedef void (*wolfsentry_ent_label_fn_t)(const struct wolfsentry_table_ent_header *ent, const char **label, unsigned int *label_len);
 
 typedef wolfsentry_errcode_t (*wolfsentry_filter_function_t)(void *context, struct wolfsentry_table_ent_header *object, wolfsentry_action_res_t *action_results);
 typedef wolfsentry_errcode_t (*wolfsentry_dropper_function_t)(void *context, struct wolfsentry_table_ent_header *object, wolfsentry_action_res_t *action_results);
@@ -233,10 +336,20 @@ typedef wolfsentry_errcode_t (*wolfsentry_table_ent_clone_map_fn_t)(
     struct wolfsentry_table_ent_header *new_ent,
     wolfsentry_clone_flags_t flags);
 
+/* open-addressed hash index of the ents in a label-keyed table, kept at most half full. */
+struct wolfsentry_label_index {
+    struct wolfsentry_table_ent_header **slots;
+    unsigned int n_slots_log2;
+    wolfsentry_hitcount_t n_ents;
+};
+
 struct wolfsentry_table_header {
-    struct wolfsentry_table_ent_header *head, *tail; /* these will be replaced by red-black table elements later. */
+    struct wolfsentry_table_ent_header *root; /* red-black tree ordered by cmp_fn. */
+    struct wolfsentry_table_ent_header *head, *tail; /* leftmost and rightmost ents, for O(1) seek_to_head/seek_to_tail. */
     wolfsentry_ent_cmp_fn_t cmp_fn;
     wolfsentry_ent_free_fn_t free_fn;
+    wolfsentry_ent_label_fn_t label_fn; /* set for label-keyed tables, whose exact lookups then go through label_index. */
+    struct wolfsentry_label_index label_index;
     wolfsentry_hitcount_t n_ents;
     wolfsentry_hitcount_t n_inserts;
     wolfsentry_hitcount_t n_deletes;
@@ -244,12 +357,22 @@ struct wolfsentry_table_header {
 };
 
 #define WOLFSENTRY_TABLE_HEADER_RESET(table) do { \
+        (table).root = NULL;                      \
         (table).head = (table).tail = NULL;       \
         (table).n_ents = 0;                       \
         (table).n_inserts = 0;                    \
         (table).n_deletes = 0;                    \
     } while (0)
 
+/* open-addressed hash index of every ent with an ID, kept at most half full. */
+struct wolfsentry_ent_id_index {
+    struct wolfsentry_table_ent_header **slots;
+    unsigned int n_slots_log2;
+    wolfsentry_hitcount_t n_ents;
+    wolfsentry_hitcount_t n_inserts;
+    wolfsentry_hitcount_t n_deletes;
+};
+
 struct wolfsentry_cursor {
     struct wolfsentry_table_ent_header *point;
 };
@@ -259,6 +382,12 @@ struct wolfsentry_action {
     wolfsentry_action_callback_t handler;
     void *handler_arg;
     wolfsentry_action_flags_t flags, flags_at_creation;
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    struct wolfsentry_counter_shard hit_shards[WOLFSENTRY_COUNTER_SHARDS]; /* header.hitcount is unused. */
+#endif
+#ifdef WOLFSENTRY_INSTRUMENT
+    struct wolfsentry_histogram handler_time;
+#endif
     byte label_len;
     char label[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE];
 };
@@ -272,8 +401,23 @@ struct wolfsentry_action_list_ent {
     struct wolfsentry_action *action;
 };
 
+struct wolfsentry_action_vector_ent {
+    wolfsentry_action_callback_t handler;
+    void *handler_arg;
+    struct wolfsentry_action *action;
+};
+
 struct wolfsentry_action_list {
     struct wolfsentry_list_header header;
+    /* the actions on the list, in order, flattened for
+     * wolfsentry_action_list_dispatch().  recompiled under the mutex whenever
+     * the list changes.  disabled actions are kept, and skipped at dispatch,
+     * so that action flag changes need no recompilation.  vector_cap is kept
+     * at least header.len, so recompilation never allocates.
+     */
+    struct wolfsentry_action_vector_ent *vector;
+    unsigned int vector_len;
+    unsigned int vector_cap;
 };
 
 struct wolfsentry_eventconfig_internal {
@@ -302,12 +446,20 @@ struct wolfsentry_event {
 
     struct wolfsentry_event *aux_event; /* plugins that insert new routes can use this as parent, and autoinserted routes via WOLFSENTRY_ACTION_RES_INSERT use this. */
 
+    byte action_type_mask; /* bit (1U << action_type) is set for each nonempty action list. */
+
     wolfsentry_priority_t priority;
 
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    struct wolfsentry_counter_shard hit_shards[WOLFSENTRY_COUNTER_SHARDS]; /* header.hitcount is unused. */
+#endif
+
     byte label_len;
     char label[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE];
 };
 
+#define WOLFSENTRY_EVENT_HAS_ACTIONS(event, action_type) (((event)->action_type_mask & (1U << (action_type))) != 0)
+
 struct wolfsentry_event_table {
     struct wolfsentry_table_header header;
 };
@@ -317,6 +469,19 @@ struct wolfsentry_route {
 
     struct wolfsentry_list_ent_header purge_links;
 #define WOLFSENTRY_ROUTE_PURGE_HEADER_TO_TABLE_ENT_HEADER(purge_link) container_of(purge_link, struct wolfsentry_route, purge_links)
+    struct wolfsentry_list_header *purge_bucket; /* the purge wheel slot (or due list) holding purge_links, or null. */
+
+    /* membership in the address indexes for _DIRECTION_IN and _DIRECTION_OUT
+     * respectively, or for unindexable routes, lpm_links[0] is on the
+     * route table lpm_unindexed list.
+     */
+    struct wolfsentry_list_ent_header lpm_links[2];
+    struct wolfsentry_route_lpm_node *lpm_nodes[2];
+
+    /* membership in the tuple classifier, when it's enabled on the table. */
+    struct wolfsentry_route_tuple *tuple;
+    struct wolfsentry_route *tuple_next;
+    uint32_t tuple_hash;
 
     struct wolfsentry_event *parent_event; /* applicable config is parent_event->config or if null, wolfsentry->config */
 
@@ -333,14 +498,15 @@ struct wolfsentry_route {
         wolfsentry_time_t last_hit_time;
         wolfsentry_time_t last_penaltybox_time;
         wolfsentry_time_t purge_after;
-#ifndef WOLFSENTRY_ROUTE_PURGE_MARGIN_SECONDS
-#define WOLFSENTRY_ROUTE_PURGE_MARGIN_SECONDS 60
-#endif
         uint16_t connection_count;
         uint16_t derogatory_count;
         uint16_t commendable_count;
     } meta;
 
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    struct wolfsentry_counter_shard hit_shards[WOLFSENTRY_COUNTER_SHARDS]; /* header.hitcount is unused. */
+#endif
+
     uint16_t data[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE]; /* first the caller's private data area (if any),
                    * then the remote addr in big endian padded up to
                    * nearest byte, then local addr, then
@@ -360,13 +526,163 @@ struct wolfsentry_route {
 #define WOLFSENTRY_ROUTE_LOCAL_EXTRA_PORTS(r) (WOLFSENTRY_ROUTE_REMOTE_EXTRA_PORTS(r) + (r)->remote.extra_port_count)
 #define WOLFSENTRY_ROUTE_BUF_SIZE(r) (WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(r) + WOLFSENTRY_ROUTE_LOCAL_ADDR_BYTES(r) + ((WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(r) + WOLFSENTRY_ROUTE_LOCAL_ADDR_BYTES(r)) & 1) + (WOLFSENTRY_ROUTE_REMOTE_PORT_COUNT(r) * sizeof(wolfsentry_port_t)) + (WOLFSENTRY_ROUTE_LOCAL_PORT_COUNT(r) * sizeof(wolfsentry_port_t)))
 
+/* a route as saved by wolfsentry_context_save(), followed in the snapshot by
+ * data_addr_size bytes of route data (the private data area, then the
+ * addresses).  saved records are zeroed before filling, so that the padding is
+ * deterministic.
+ */
+struct wolfsentry_route_snapshot {
+    wolfsentry_time_t insert_time;
+    wolfsentry_time_t last_hit_time;
+    wolfsentry_time_t last_penaltybox_time;
+    wolfsentry_time_t purge_after;
+    wolfsentry_hitcount_t hitcount;
+    wolfsentry_route_flags_t flags;
+    uint32_t parent_event_index; /* index into the saved events, or WOLFSENTRY_SNAPSHOT_INDEX_NONE. */
+    struct wolfsentry_route_endpoint remote, local;
+    wolfsentry_addr_family_t sa_family;
+    wolfsentry_proto_t sa_proto;
+    uint16_t data_addr_offset;
+    uint16_t data_addr_size;
+    uint16_t connection_count;
+    uint16_t derogatory_count;
+    uint16_t commendable_count;
+};
+
+#define WOLFSENTRY_SNAPSHOT_INDEX_NONE (~(uint32_t)0)
+
 #define WOLFSENTRY_ROUTE_REMOTE_PORT_GET(r, i) ((i) ? WOLFSENTRY_ROUTE_REMOTE_EXTRA_PORTS(r)[(i)-1] : (r)->remote.sa_port)
 #define WOLFSENTRY_ROUTE_LOCAL_PORT_GET(r, i) ((i) ? WOLFSENTRY_ROUTE_LOCAL_EXTRA_PORTS(r)[(i)-1] : (r)->local.sa_port)
 
+/* node in a path-compressed binary trie of address prefixes, most significant
+ * bit first, holding the routes whose indexed address is exactly this prefix.
+ */
+struct wolfsentry_route_lpm_node {
+    struct wolfsentry_route_lpm_node *parent, *child[2];
+    struct wolfsentry_list_header routes;
+    wolfsentry_addr_bits_t prefix_len;
+    byte prefix[WOLFSENTRY_MAX_ADDR_BYTES];
+};
+
+/* each route is indexed by whichever of its remote and local addresses has
+ * the longer prefix, so that every route matching a target is found along the
+ * target's path through one or the other trie.
+ */
+struct wolfsentry_route_lpm_index {
+    struct wolfsentry_route_lpm_index *next;
+    wolfsentry_addr_family_t sa_family;
+    wolfsentry_route_flags_t direction;
+    struct wolfsentry_route_lpm_node *remote_root, *local_root;
+};
+
+/* the routes sharing a wildcard mask and pair of address prefix lengths, hashed
+ * on the fields the mask leaves significant.
+ */
+struct wolfsentry_route_tuple {
+    struct wolfsentry_route_tuple *next;
+    wolfsentry_route_flags_t wildcard_flags;
+    wolfsentry_addr_bits_t remote_prefix_len, local_prefix_len;
+    wolfsentry_hitcount_t n_routes;
+    uint32_t n_buckets; /* always a power of two. */
+    struct wolfsentry_route **buckets;
+};
+
+/* hashed hierarchical timing wheel for route purge_after.  level 0 slots are
+ * one tick wide, and each higher level's slots are
+ * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS times wider than those below.  ticks are
+ * wolfsentry_time_t shifted right by WOLFSENTRY_ROUTE_PURGE_WHEEL_TICK_SHIFT,
+ * about a second with the builtin microsecond clock.  routes further out than
+ * the wheel spans are filed in the top level and refiled as it turns.
+ */
+#ifndef WOLFSENTRY_ROUTE_PURGE_WHEEL_TICK_SHIFT
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_TICK_SHIFT 20
+#endif
+#ifndef WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS 6
+#endif
+#ifndef WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS 4
+#endif
+#if WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS >= 64
+#error WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS must be less than 64.
+#endif
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS (1U << WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)
+
+struct wolfsentry_route_purge_wheel {
+    struct wolfsentry_list_header slots[WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS][WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS];
+    struct wolfsentry_list_header due; /* routes found expired by the last advance, awaiting deletion. */
+    uint64_t cur_tick; /* all slots for earlier ticks have been processed. */
+    wolfsentry_time_t cur_slot_earliest; /* lower bound on the purge_after of routes in the level 0 slot for cur_tick. */
+    wolfsentry_hitcount_t len; /* routes in the slots and the due list. */
+};
+
+#define WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS 4
+
+struct wolfsentry_route_image_route;
+struct wolfsentry_route_image;
+
+/* a cached result of wolfsentry_route_lookup_0(), keyed on the lookup target
+ * and the action_results on entry, valid while the table generation matches.
+ */
+struct wolfsentry_route_flow_cache_ent {
+    wolfsentry_hitcount_t generation; /* zero for an empty slot. */
+    struct wolfsentry_route *route; /* null for a cached miss, or a match in the route image. */
+    const struct wolfsentry_route_image_route *image_route; /* non-null for a match in the route image. */
+    uint32_t hash;
+    wolfsentry_route_flags_t flags;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t parent_event_id; /* of the trigger event, which can change the result.  WOLFSENTRY_ENT_ID_NONE for none. */
+    wolfsentry_addr_family_t sa_family;
+    wolfsentry_proto_t sa_proto;
+    wolfsentry_port_t remote_port, local_port;
+    wolfsentry_addr_bits_t remote_addr_len, local_addr_len;
+    byte remote_interface, local_interface;
+    byte remote_addr[WOLFSENTRY_MAX_ADDR_BYTES];
+    byte local_addr[WOLFSENTRY_MAX_ADDR_BYTES];
+};
+
+struct wolfsentry_route_flow_cache_set {
+    uint32_t lock; /* claimed with a try-lock, so that concurrent dispatchers never wait. */
+    uint32_t next_victim;
+    struct wolfsentry_route_flow_cache_ent ways[WOLFSENTRY_ROUTE_FLOW_CACHE_WAYS];
+};
+
+struct wolfsentry_route_flow_cache {
+    wolfsentry_hitcount_t hits, misses;
+    uint32_t n_sets; /* always a power of two. */
+    struct wolfsentry_route_flow_cache_set sets[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE];
+};
+
+/* outcomes of the dispatches to a route table, for wolfsentry_metrics_snapshot(). */
+struct wolfsentry_dispatch_counters {
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+    struct wolfsentry_counter_shard n_dispatches[WOLFSENTRY_COUNTER_SHARDS];
+    struct wolfsentry_counter_shard n_accepts[WOLFSENTRY_COUNTER_SHARDS];
+    struct wolfsentry_counter_shard n_rejects[WOLFSENTRY_COUNTER_SHARDS];
+    struct wolfsentry_counter_shard n_fallthroughs[WOLFSENTRY_COUNTER_SHARDS];
+#else
+    wolfsentry_hitcount_t n_dispatches;
+    wolfsentry_hitcount_t n_accepts;
+    wolfsentry_hitcount_t n_rejects;
+    wolfsentry_hitcount_t n_fallthroughs;
+#endif
+};
+
 struct wolfsentry_route_table {
     struct wolfsentry_table_header header;
-    struct wolfsentry_list_header purge_list;
+    struct wolfsentry_route_purge_wheel purge_wheel;
+    struct wolfsentry_route_lpm_index *lpm_indexes; /* one per sa_family and direction. */
+    struct wolfsentry_list_header lpm_unindexed; /* routes with a wildcard sa_family, or addresses too long to index. */
+    int lpm_lookup_disabled; /* lookups scan the table rather than the LPM index, which is still maintained.  used to verify the index. */
+    struct wolfsentry_route_tuple *tuples; /* null unless tuple_classifier_enabled. */
+    int tuple_classifier_enabled;
+    wolfsentry_hitcount_t generation; /* advanced by every change that can alter a lookup result. */
+    struct wolfsentry_route_flow_cache *flow_cache; /* null unless enabled. */
+    struct wolfsentry_route_image *image; /* null unless a read-only route image is attached. */
     wolfsentry_hitcount_t max_purgeable_routes;
+    wolfsentry_hitcount_t n_purges; /* routes deleted by the stale purge. */
+    struct wolfsentry_dispatch_counters dispatch_counters;
     struct wolfsentry_event *default_event; /* used as the parent_event by wolfsentry_route_dispatch() for a static route match with a null parent_event. */
     struct wolfsentry_route *fallthrough_route; /* used as the rule_route when no rule_route is matched or inserted. */
     wolfsentry_action_res_t default_policy;
@@ -415,6 +731,36 @@ struct wolfsentry_addr_family_byname_table {
 };
 #endif
 
+/* the deferred action ring.  a bounded MPSC queue: dispatchers, holding the
+ * context lock shared, claim slots by advancing tail, and publish each record
+ * by advancing its slot seq.  the drainer, holding drainer_lock, consumes from
+ * head without the context lock.
+ */
+struct wolfsentry_deferred_action_slot {
+    uint32_t seq;
+    struct wolfsentry_deferred_action record;
+};
+
+/* under WOLFSENTRY_DEFERRED_OVERFLOW_YIELD_THEN_RUN_INLINE, the number of
+ * times a dispatcher yields waiting for room in a full ring before it runs the
+ * action inline.
+ */
+#ifndef WOLFSENTRY_DEFERRED_OVERFLOW_MAX_YIELDS
+#define WOLFSENTRY_DEFERRED_OVERFLOW_MAX_YIELDS 100
+#endif
+
+struct wolfsentry_deferred_action_ring {
+    uint32_t mask;
+    wolfsentry_deferred_overflow_policy_t overflow_policy;
+    uint32_t tail;
+    uint32_t head;
+#ifdef WOLFSENTRY_THREADSAFE
+    uint32_t drainer_lock;
+#endif
+    struct wolfsentry_deferred_action_stats stats;
+    struct wolfsentry_deferred_action_slot slots[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE];
+};
+
 struct wolfsentry_context {
     struct wolfsentry_host_platform_interface hpi;
 #ifdef WOLFSENTRY_THREADSAFE
@@ -434,7 +780,27 @@ struct wolfsentry_context {
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
     struct wolfsentry_addr_family_byname_table *addr_families_byname;
 #endif
-    struct wolfsentry_table_header ents_by_id;
+    struct wolfsentry_ent_id_index ents_by_id;
+    wolfsentry_time_t cached_time; /* zero unless the time cache is in use -- see wolfsentry_time_cache_set(). */
+    struct wolfsentry_deferred_action_ring *deferred_actions; /* null unless set up by wolfsentry_deferred_actions_init(). */
+#ifdef WOLFSENTRY_INSTRUMENT
+    struct wolfsentry_instrument *instrument; /* allocated with the context, and stays with it across wolfsentry_context_exchange(). */
+#endif
+};
+
+/* readers register in readers[epoch & 1] before loading current, and
+ * wolfsentry_context_publish() advances epoch after storing a new current, so
+ * once readers[] for the epoch before a publish drains, nothing can still be
+ * using the generation it replaced.  epoch and readers[] are only ever
+ * accessed by sequentially consistent read-modify-write operations.
+ */
+struct wolfsentry_context_publisher {
+    struct wolfsentry_context *current;
+    struct wolfsentry_context *retiring; /* the generation last replaced, until its readers drain. */
+    uint32_t retiring_epoch;
+    uint32_t epoch;
+    int readers[2];
+    int publishing;
 };
 
 #ifdef WOLFSENTRY_THREADSAFE
@@ -477,6 +843,16 @@ struct wolfsentry_context {
 #define WOLFSENTRY_INTERVAL_TO_SECONDS(howlong, howlong_secs, howlong_nsecs) WOLFSENTRY_INTERVAL_TO_SECONDS_1(wolfsentry->hpi.timecbs, howlong, howlong_secs, howlong_nsecs)
 #define WOLFSENTRY_INTERVAL_FROM_SECONDS(howlong_secs, howlong_nsecs, howlong) WOLFSENTRY_INTERVAL_FROM_SECONDS_1(wolfsentry->hpi.timecbs, howlong_secs, howlong_nsecs, howlong)
 
+/* for the dispatch, insert, and purge paths, which tolerate a coarse clock. */
+#define WOLFSENTRY_GET_TIME_CACHED(time_p)                                  \
+    ((*(time_p) = WOLFSENTRY_ATOMIC_LOAD_RELAXED(wolfsentry->cached_time)) != 0 ? \
+     WOLFSENTRY_ERROR_ENCODE(OK) :                                          \
+     WOLFSENTRY_GET_TIME(time_p))
+
+#ifdef WOLFSENTRY_MALLOC_BUILTINS
+WOLFSENTRY_LOCAL const struct wolfsentry_allocator *wolfsentry_get_default_allocator(void);
+#endif
+
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_id_allocate(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent);
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_label_is_builtin(const char *label, int label_len);
@@ -519,6 +895,11 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_copy_metadata(
     struct wolfsentry_route_table *from_table,
     struct wolfsentry_context *dest_context,
     struct wolfsentry_route_table *to_table);
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_migrate_dynamic(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *from_table,
+    struct wolfsentry_context *dest_context,
+    struct wolfsentry_route_table *to_table);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_kv_table_init(
     struct wolfsentry_kv_table *kv_table);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_kv_table_clone_header(
@@ -551,11 +932,16 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_addr_family_table_clone_headers
 #endif
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_header *table, int unique_p);
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_find_successor(WOLFSENTRY_CONTEXT_ARGS_IN, const struct wolfsentry_table_header *table, const struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_ent_header **succ);
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert_before(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header *succ);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_get(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_header *table, struct wolfsentry_table_ent_header **ent);
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_get_by_label(WOLFSENTRY_CONTEXT_ARGS_IN, const struct wolfsentry_table_header *table, const char *label, unsigned int label_len, struct wolfsentry_table_ent_header **ent);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header **ent);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_drop_reference(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent, wolfsentry_action_res_t *action_results);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_1(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent);
 
+WOLFSENTRY_LOCAL void wolfsentry_ent_id_index_free(WOLFSENTRY_CONTEXT_ARGS_IN);
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_ent_id_index_reserve(WOLFSENTRY_CONTEXT_ARGS_IN, size_t n_more);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_insert_by_id(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_by_id_1(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_ent_header *ent);
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_ent_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_IN, wolfsentry_ent_id_t id, struct wolfsentry_table_ent_header **ent);
@@ -628,9 +1014,31 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_clone(
     struct wolfsentry_table_ent_header **new_ent,
     wolfsentry_clone_flags_t flags);
 
-WOLFSENTRY_LOCAL_VOID wolfsentry_route_purge_list_insert(
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_init_deferred(
+    const struct wolfsentry_deferred_action *record,
+    struct wolfsentry_route *route,
+    size_t data_addr_size);
+
+WOLFSENTRY_LOCAL_VOID wolfsentry_route_purge_wheel_schedule(
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route);
+
+WOLFSENTRY_LOCAL_VOID wolfsentry_route_table_generation_bump(
+    struct wolfsentry_route_table *route_table);
+
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_table_clone_indexes(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_route_table *src_table,
+    struct wolfsentry_context *dest_context,
+    struct wolfsentry_route_table *dest_table);
+
+WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_route_restore(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *route_table,
-    struct wolfsentry_route *route_to_insert);
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_route_snapshot *snap,
+    const byte *data,
+    wolfsentry_time_t now);
 
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_table_free_ents(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_table_header *table);
 
@@ -720,6 +1128,24 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_delete_all(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_action_list *action_list);
 
+WOLFSENTRY_LOCAL void wolfsentry_action_list_compile(
+    struct wolfsentry_action_list *action_list);
+
+WOLFSENTRY_LOCAL void wolfsentry_deferred_actions_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN);
+
+WOLFSENTRY_LOCAL void wolfsentry_event_update_action_type_mask(
+    struct wolfsentry_event *event);
+
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_route_get_hitcount(
+    const struct wolfsentry_route *route);
+
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_action_get_hitcount(
+    const struct wolfsentry_action *action);
+
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_event_get_hitcount(
+    const struct wolfsentry_event *event);
+
 WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_action_list_dispatch(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     void *caller_arg,
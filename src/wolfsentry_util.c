@@ -20,6 +20,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
  */
 
+#if defined(WOLFSENTRY_USE_FUTEX_SEMAPHORES) && !defined(WOLFSENTRY_SINGLETHREADED) && !defined(_DEFAULT_SOURCE)
+/* kludge to make the glibc syscall() prototype visible with -std=c99.  this
+ * has to precede the first system header.
+ */
+#define _DEFAULT_SOURCE
+#endif
+
 #define DEFINE_WOLFSENTRY_BUILD_SETTINGS
 #include "wolfsentry_internal.h"
 
@@ -69,6 +76,14 @@ WOLFSENTRY_API const char *wolfsentry_errcode_source_string(wolfsentry_errcode_t
         return "lwip/packet_filter_glue.c";
     case WOLFSENTRY_SOURCE_ID_ACTION_BUILTINS_C:
         return "action_builtins.c";
+    case WOLFSENTRY_SOURCE_ID_SLAB_C:
+        return "slab.c";
+    case WOLFSENTRY_SOURCE_ID_METRICS_C:
+        return "metrics.c";
+    case WOLFSENTRY_SOURCE_ID_INSTRUMENT_C:
+        return "instrument.c";
+    case WOLFSENTRY_SOURCE_ID_SNAPSHOT_C:
+        return "snapshot.c";
 
     case WOLFSENTRY_SOURCE_ID_USER_BASE:
         break;
@@ -644,7 +659,7 @@ static void *wolfsentry_builtin_malloc(
     WOLFSENTRY_CONTEXT_ARGS_THREAD_NOT_USED;
 #ifdef WOLFSENTRY_MALLOC_DEBUG
     {
-        ret = malloc(size);
+        void *ret = malloc(size);
         if (ret != NULL)
             WOLFSENTRY_ATOMIC_INCREMENT(n_mallocs, 1);
         WOLFSENTRY_RETURN_VALUE(ret);
@@ -676,9 +691,9 @@ static void *wolfsentry_builtin_realloc(
 #ifdef WOLFSENTRY_MALLOC_DEBUG
     {
         void *ret = realloc(ptr, size);
-        if ((ptr == null) && (ret != NULL))
+        if ((ptr == NULL) && (ret != NULL))
             WOLFSENTRY_ATOMIC_INCREMENT(n_mallocs, 1);
-        else if ((ptr != null) && (ret == NULL))
+        else if ((ptr != NULL) && (ret == NULL))
             WOLFSENTRY_ATOMIC_DECREMENT(n_mallocs, 1);
         return ret;
     }
@@ -774,6 +789,10 @@ static const struct wolfsentry_allocator default_allocator = {
 #endif
 };
 
+WOLFSENTRY_LOCAL const struct wolfsentry_allocator *wolfsentry_get_default_allocator(void) {
+    return &default_allocator;
+}
+
 #endif /* WOLFSENTRY_MALLOC_BUILTINS */
 
 #if defined(FREERTOS) && (defined(WOLFSENTRY_THREADSAFE) || defined(WOLFSENTRY_CLOCK_BUILTINS))
@@ -797,6 +816,9 @@ static void freertos_now(struct timespec *now) {
 #ifdef WOLFSENTRY_THREADSAFE
 
 static wolfsentry_thread_id_t fallback_thread_id_counter = WOLFSENTRY_THREAD_NO_ID;
+#if defined(WOLFSENTRY_COUNTER_SHARDS) || defined(WOLFSENTRY_INSTRUMENT)
+static unsigned int counter_shard_counter = 0;
+#endif
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_init_thread_context(struct wolfsentry_thread_context *thread_context, wolfsentry_thread_flags_t init_thread_flags, void *user_context) {
     memset(thread_context, 0, sizeof *thread_context);
@@ -804,6 +826,9 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_init_thread_context(struct wolfse
     thread_context->deadline.tv_sec = WOLFSENTRY_DEADLINE_NEVER;
     thread_context->deadline.tv_nsec = WOLFSENTRY_DEADLINE_NEVER;
     thread_context->current_thread_flags = init_thread_flags;
+#if defined(WOLFSENTRY_COUNTER_SHARDS) || defined(WOLFSENTRY_INSTRUMENT)
+    thread_context->counter_shard = WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(counter_shard_counter);
+#endif
     thread_context->id = WOLFSENTRY_THREAD_GET_ID_HANDLER();
     if (thread_context->id == WOLFSENTRY_THREAD_NO_ID) {
         thread_context->id = WOLFSENTRY_ATOMIC_DECREMENT(fallback_thread_id_counter, 1);
@@ -993,11 +1018,126 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_set_thread_readwrite(struct wolfs
 
 #ifdef WOLFSENTRY_USE_NATIVE_POSIX_THREADS
     #include <errno.h>
+    #include <sched.h>
 #endif
 
 #ifdef WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
 
-#ifdef __MACH__
+#ifdef WOLFSENTRY_USE_FUTEX_SEMAPHORES
+
+/* Linux futex semaphores.  an uncontended wait is a single compare-and-swap on
+ * the count, and an uncontended post is a single atomic increment plus a load
+ * of the waiter count -- the kernel is only entered when a waiter actually has
+ * to sleep, or has to be woken.  waiters spin briefly before sleeping, because
+ * lock->sem is held only across a few dozen instructions of bookkeeping.
+ */
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef WOLFSENTRY_FUTEX_SEM_SPINS
+#define WOLFSENTRY_FUTEX_SEM_SPINS 100
+#endif
+
+static int futex_sem_init(sem_t *sem, int pshared, unsigned int value)
+{
+    sem->count = value;
+    sem->waiters = 0;
+    sem->futex_private = pshared ? 0 : FUTEX_PRIVATE_FLAG;
+    WOLFSENTRY_RETURN_VALUE(0);
+}
+#define sem_init futex_sem_init
+
+static int futex_sem_trydecrement(sem_t *sem)
+{
+    uint32_t count = WOLFSENTRY_ATOMIC_LOAD(sem->count);
+    int decremented;
+    while (count > 0) {
+        decremented = WOLFSENTRY_ATOMIC_TEST_AND_SET(sem->count, count, count - 1);
+        if (decremented)
+            return 1;
+    }
+    return 0;
+}
+
+static int futex_sem_post(sem_t *sem)
+{
+    (void)WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(sem->count);
+    /* the sequentially consistent increment above pairs with the one on
+     * sem->waiters in futex_sem_timedwait(), so that either the waiter sees
+     * the new count, or we see the waiter.
+     */
+    if (WOLFSENTRY_ATOMIC_LOAD(sem->waiters) > 0) {
+        if (syscall(SYS_futex, &sem->count, FUTEX_WAKE | sem->futex_private, 1, NULL, NULL, 0) < 0)
+            WOLFSENTRY_RETURN_VALUE(-1);
+    }
+    WOLFSENTRY_RETURN_VALUE(0);
+}
+#define sem_post futex_sem_post
+
+static int futex_sem_timedwait(sem_t *sem, const struct timespec *abs_timeout)
+{
+    int i;
+    long ret;
+
+    for (i = 0; i < WOLFSENTRY_FUTEX_SEM_SPINS; ++i) {
+        if (futex_sem_trydecrement(sem))
+            WOLFSENTRY_RETURN_VALUE(0);
+    }
+
+    if ((abs_timeout != NULL) &&
+        ((abs_timeout->tv_nsec < 0) || (abs_timeout->tv_nsec >= 1000000000L)))
+    {
+        errno = EINVAL;
+        WOLFSENTRY_RETURN_VALUE(-1);
+    }
+
+    (void)WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(sem->waiters);
+    for (;;) {
+        if (futex_sem_trydecrement(sem)) {
+            ret = 0;
+            break;
+        }
+        /* FUTEX_WAIT_BITSET takes an absolute timeout, like sem_timedwait(). */
+        ret = syscall(SYS_futex, &sem->count,
+                      FUTEX_WAIT_BITSET | sem->futex_private | (abs_timeout ? FUTEX_CLOCK_REALTIME : 0),
+                      0 /* expected count */, abs_timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+        if ((ret < 0) && (errno != EAGAIN))
+            break; /* ETIMEDOUT, EINTR, or a hard error, all passed to the caller in errno. */
+    }
+    (void)WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(sem->waiters);
+
+    WOLFSENTRY_RETURN_VALUE(ret < 0 ? -1 : 0);
+}
+#define sem_timedwait futex_sem_timedwait
+
+static int futex_sem_wait(sem_t *sem)
+{
+    WOLFSENTRY_RETURN_VALUE(futex_sem_timedwait(sem, NULL));
+}
+#define sem_wait futex_sem_wait
+
+static int futex_sem_trywait(sem_t *sem)
+{
+    if (futex_sem_trydecrement(sem))
+        WOLFSENTRY_RETURN_VALUE(0);
+    errno = EAGAIN;
+    WOLFSENTRY_RETURN_VALUE(-1);
+}
+#define sem_trywait futex_sem_trywait
+
+static int futex_sem_destroy(sem_t *sem)
+{
+    if (WOLFSENTRY_ATOMIC_LOAD(sem->waiters) > 0) {
+        errno = EBUSY;
+        WOLFSENTRY_RETURN_VALUE(-1);
+    }
+    WOLFSENTRY_RETURN_VALUE(0);
+}
+#define sem_destroy futex_sem_destroy
+
+#elif defined(__MACH__)
 
 /* Apple style dispatch semaphores -- this uses the only unnamed semaphore
  * facility available in Darwin since POSIX sem_* deprecation.  see
@@ -1447,6 +1587,169 @@ static int freertos_sem_destroy( sem_t * sem )
 
 static const struct timespec timespec_deadline_now = {WOLFSENTRY_DEADLINE_NOW, WOLFSENTRY_DEADLINE_NOW};
 
+/* reader bias (WOLFSENTRY_LOCK_FLAG_READ_BIAS):
+ *
+ * while lock->read_bias is set, a thread taking a fresh shared lock just
+ * increments the reader slot its thread ID hashes to, then rechecks
+ * lock->read_bias.  it never touches lock->sem or any other shared line, so
+ * concurrent readers on different cores don't contend.
+ *
+ * every transition to WOLFSENTRY_LOCK_EXCLUSIVE is followed, before the
+ * acquiring call returns, by revocation of the bias and a wait for all the
+ * reader slots to drain.  that wait is a grace period -- when it completes,
+ * no reader can still be looking at anything the writer is about to change,
+ * so writers can free or mutate in place exactly as with the regular lock.
+ *
+ * the bias is restored when the lock leaves the exclusive state with no
+ * writers waiting.  a biased holder that needs to promote, or to take another
+ * lock, is first converted to a regular shared holder.
+ */
+
+#if (WOLFSENTRY_LOCK_READER_SLOTS & (WOLFSENTRY_LOCK_READER_SLOTS - 1)) != 0
+#error WOLFSENTRY_LOCK_READER_SLOTS must be a power of 2.
+#endif
+
+#ifndef WOLFSENTRY_LOCK_DRAIN_YIELD
+    #ifdef FREERTOS
+        #define WOLFSENTRY_LOCK_DRAIN_YIELD() taskYIELD()
+    #elif defined(WOLFSENTRY_USE_NATIVE_POSIX_THREADS)
+        #define WOLFSENTRY_LOCK_DRAIN_YIELD() (void)sched_yield()
+    #else
+        #define WOLFSENTRY_LOCK_DRAIN_YIELD() do {} while (0)
+    #endif
+#endif
+
+WOLFSENTRY_LOCAL_VOID wolfsentry_thread_yield(void) {
+    WOLFSENTRY_LOCK_DRAIN_YIELD();
+    WOLFSENTRY_RETURN_VOID;
+}
+
+static inline volatile int *wolfsentry_lock_reader_slot(struct wolfsentry_rwlock *lock, const struct wolfsentry_thread_context *thread) {
+    uint64_t hash = (uint64_t)(uintptr_t)thread->id * WOLFSENTRY_FIBONACCI_HASH_MULTIPLIER;
+    return &lock->reader_slots[(hash >> 32) & (WOLFSENTRY_LOCK_READER_SLOTS - 1)].count;
+}
+
+static int wolfsentry_lock_readers_biased(const struct wolfsentry_rwlock *lock) {
+    int i;
+    if (lock->reader_slots == NULL)
+        return 0;
+    for (i = 0; i < WOLFSENTRY_LOCK_READER_SLOTS; ++i) {
+        if (WOLFSENTRY_ATOMIC_LOAD(lock->reader_slots[i].count) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* returns nonzero if the shared lock was obtained via the reader slots. */
+static int wolfsentry_lock_shared_biased(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread) {
+    volatile int *slot;
+
+    if (! WOLFSENTRY_ATOMIC_LOAD(lock->read_bias))
+        return 0;
+
+    slot = wolfsentry_lock_reader_slot(lock, thread);
+    (void)WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(*slot);
+    /* recheck after the (sequentially consistent) increment, pairing with
+     * the revocation in wolfsentry_lock_drain_readers().
+     */
+    if (! WOLFSENTRY_ATOMIC_LOAD(lock->read_bias)) {
+        (void)WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(*slot);
+        return 0;
+    }
+
+    ++thread->shared_count;
+    thread->tracked_shared_lock = lock;
+    thread->recursion_of_tracked_lock = 1;
+    thread->tracked_shared_lock_biased = 1;
+    return 1;
+}
+
+/* convert the caller's biased hold on lock to a regular shared hold, so that
+ * it is visible to promotion and reservation logic.  fails with
+ * DEADLOCK_AVERTED if a writer has already revoked the bias and is waiting
+ * for the caller to drain.
+ */
+static wolfsentry_errcode_t wolfsentry_lock_unbias(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread) {
+    int ret;
+
+    for (;;) {
+        ret = sem_wait(&lock->sem);
+        if (ret == 0)
+            break;
+        else {
+            if (errno != EINTR)
+                WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+        }
+    }
+
+    if (lock->state == WOLFSENTRY_LOCK_EXCLUSIVE) {
+        if (sem_post(&lock->sem) < 0)
+            WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+        WOLFSENTRY_ERROR_RETURN(DEADLOCK_AVERTED);
+    }
+
+    if (lock->state == WOLFSENTRY_LOCK_UNLOCKED)
+        WOLFSENTRY_ATOMIC_STORE(lock->state, WOLFSENTRY_LOCK_SHARED);
+    lock->holder_count.read += thread->recursion_of_tracked_lock;
+
+    if (sem_post(&lock->sem) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+
+    thread->tracked_shared_lock_biased = 0;
+    (void)WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(*wolfsentry_lock_reader_slot(lock, thread));
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* called with lock->sem held, wherever the lock may leave the exclusive state. */
+static inline void wolfsentry_lock_restore_read_bias(struct wolfsentry_rwlock *lock) {
+    if ((lock->reader_slots != NULL) &&
+        (lock->state != WOLFSENTRY_LOCK_EXCLUSIVE) &&
+        (lock->write_waiter_count == 0))
+    {
+        WOLFSENTRY_ATOMIC_STORE(lock->read_bias, 1);
+    }
+}
+
+/* called by a caller that has just obtained the lock exclusively, without
+ * lock->sem held.  on failure, the caller still holds the lock exclusively,
+ * and must unwind its acquisition.
+ */
+static wolfsentry_errcode_t wolfsentry_lock_drain_readers(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout) {
+    int read_bias = 1;
+    wolfsentry_time_t deadline = 0, now;
+    unsigned int spins;
+    wolfsentry_errcode_t ret;
+
+    (void)WOLFSENTRY_ATOMIC_TEST_AND_SET(lock->read_bias, read_bias, 0);
+
+    if ((abs_timeout == NULL) &&
+        thread &&
+        (thread->current_thread_flags & WOLFSENTRY_THREAD_FLAG_DEADLINE))
+    {
+        abs_timeout = &thread->deadline;
+    }
+
+    if ((abs_timeout != NULL) && (abs_timeout != &timespec_deadline_now)) {
+        if ((ret = WOLFSENTRY_FROM_EPOCH_TIME_1(lock->hpi->timecbs, abs_timeout->tv_sec, abs_timeout->tv_nsec, &deadline)) < 0)
+            WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+
+    for (spins = 0; wolfsentry_lock_readers_biased(lock); ++spins) {
+        if (abs_timeout == &timespec_deadline_now)
+            WOLFSENTRY_ERROR_RETURN(BUSY);
+        if ((abs_timeout != NULL) && ((spins & 0xf) == 0)) {
+            if ((ret = WOLFSENTRY_GET_TIME_1(lock->hpi->timecbs, &now)) < 0)
+                WOLFSENTRY_ERROR_RERETURN(ret);
+            if (WOLFSENTRY_DIFF_TIME_1(lock->hpi->timecbs, now, deadline) >= 0)
+                WOLFSENTRY_ERROR_RETURN(TIMED_OUT);
+        }
+        WOLFSENTRY_LOCK_DRAIN_YIELD();
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_init(struct wolfsentry_host_platform_interface *hpi, struct wolfsentry_thread_context *thread, struct wolfsentry_rwlock *lock, wolfsentry_lock_flags_t flags) {
     wolfsentry_errcode_t ret;
 
@@ -1465,10 +1768,27 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_init(struct wolfsentry_host_
     lock->read2write_reservation_holder = WOLFSENTRY_THREAD_NO_ID;
     lock->hpi = hpi;
 
-    if (sem_init(&lock->sem, flags & WOLFSENTRY_LOCK_FLAG_PSHARED, 0 /* value */) < 0)
-        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    if (sem_post(&lock->sem) < 0)
-        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+    if (flags & WOLFSENTRY_LOCK_FLAG_READ_BIAS) {
+        /* the reader slots are private to the process, so can't be used with
+         * a lock shared between processes.
+         */
+        if ((hpi == NULL) || (flags & WOLFSENTRY_LOCK_FLAG_PSHARED))
+            WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+        if ((lock->reader_slots_buf = WOLFSENTRY_MALLOC_1(hpi->allocator, (sizeof *lock->reader_slots * WOLFSENTRY_LOCK_READER_SLOTS) + WOLFSENTRY_CACHE_LINE_SIZE)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        lock->reader_slots = (struct wolfsentry_rwlock_reader_slot *)(((uintptr_t)lock->reader_slots_buf + WOLFSENTRY_CACHE_LINE_SIZE - 1) & ~(uintptr_t)(WOLFSENTRY_CACHE_LINE_SIZE - 1));
+        memset(lock->reader_slots, 0, sizeof *lock->reader_slots * WOLFSENTRY_LOCK_READER_SLOTS);
+        lock->read_bias = 1;
+    }
+
+    if (sem_init(&lock->sem, flags & WOLFSENTRY_LOCK_FLAG_PSHARED, 0 /* value */) < 0) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        goto free_reader_slots;
+    }
+    if (sem_post(&lock->sem) < 0) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_OP_FATAL);
+        goto free_reader_slots;
+    }
     if (sem_init(&lock->sem_read_waiters, flags & WOLFSENTRY_LOCK_FLAG_PSHARED, 0 /* value */) < 0) {
         ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
         goto free_sem;
@@ -1495,6 +1815,12 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_init(struct wolfsentry_host_
   free_sem:
     if (sem_init(&lock->sem, flags & WOLFSENTRY_LOCK_FLAG_PSHARED, 1 /* value */) < 0)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+  free_reader_slots:
+    if (lock->reader_slots_buf != NULL) {
+        WOLFSENTRY_FREE_1(hpi->allocator, lock->reader_slots_buf);
+        lock->reader_slots_buf = NULL;
+        lock->reader_slots = NULL;
+    }
 
   out:
 
@@ -1540,7 +1866,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_destroy(struct wolfsentry_rw
         else
             WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
     }
-    if (lock->state != WOLFSENTRY_LOCK_UNLOCKED) {
+    if ((lock->state != WOLFSENTRY_LOCK_UNLOCKED) || wolfsentry_lock_readers_biased(lock)) {
         WOLFSENTRY_WARN("attempt to destroy used lock {%u,%d,%d,%d,%d,%d,%d}\n", (unsigned int)lock->state, lock->holder_count.read, lock->read_waiter_count, lock->write_waiter_count, lock->read2write_waiter_read_count, lock->read2write_reservation_holder != WOLFSENTRY_THREAD_NO_ID, lock->promoted_at_count);
         if (sem_post(&lock->sem) < 0)
             WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
@@ -1582,6 +1908,12 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_destroy(struct wolfsentry_rw
     if (sem_destroy(&lock->sem_read2write_waiters) < 0)
         WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
 
+    if (lock->reader_slots_buf != NULL) {
+        WOLFSENTRY_FREE_1(lock->hpi->allocator, lock->reader_slots_buf);
+        lock->reader_slots_buf = NULL;
+        lock->reader_slots = NULL;
+    }
+
     lock->state = WOLFSENTRY_LOCK_UNINITED;
 
     WOLFSENTRY_RETURN_OK;
@@ -1608,6 +1940,9 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_free(struct wolfsentry_rwloc
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
     int ret;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t wait_start = 0;
+#endif
 
     WOLFSENTRY_LOCK_ASSERT_INITED(lock);
 
@@ -1626,6 +1961,22 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared_abstimed(struct wolfs
     if ((flags & WOLFSENTRY_LOCK_FLAG_NONRECURSIVE_SHARED) && (thread->tracked_shared_lock == lock))
         WOLFSENTRY_ERROR_RETURN(ALREADY);
 
+    if (thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock)) {
+        if (! (flags & (WOLFSENTRY_LOCK_FLAG_GET_RESERVATION_TOO | WOLFSENTRY_LOCK_FLAG_TRY_RESERVATION_TOO))) {
+            ++thread->shared_count;
+            ++thread->recursion_of_tracked_lock;
+            WOLFSENTRY_RETURN_OK;
+        }
+        ret = wolfsentry_lock_unbias(lock, thread);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    } else if ((lock->reader_slots != NULL) &&
+               (thread->tracked_shared_lock == NULL) &&
+               (! (flags & (WOLFSENTRY_LOCK_FLAG_GET_RESERVATION_TOO | WOLFSENTRY_LOCK_FLAG_TRY_RESERVATION_TOO))))
+    {
+        if (wolfsentry_lock_shared_biased(lock, thread))
+            WOLFSENTRY_RETURN_OK;
+    }
+
     if ((abs_timeout == NULL) &&
         (thread->current_thread_flags & WOLFSENTRY_THREAD_FLAG_DEADLINE))
     {
@@ -1684,10 +2035,16 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared_abstimed(struct wolfs
         }
 
         ++lock->read_waiter_count;
+        ++lock->wait_count;
 
         if (sem_post(&lock->sem) < 0)
             WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
 
+#ifdef WOLFSENTRY_INSTRUMENT
+        if (lock->instrument != NULL)
+            wait_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+
         if (abs_timeout == NULL) {
             for (;;) {
                 ret = sem_wait(&lock->sem_read_waiters);
@@ -1700,6 +2057,10 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared_abstimed(struct wolfs
             }
         } else
             ret = sem_timedwait(&lock->sem_read_waiters, abs_timeout);
+#ifdef WOLFSENTRY_INSTRUMENT
+        if ((ret == 0) && (lock->instrument != NULL))
+            WOLFSENTRY_INSTRUMENT_RECORD(lock->instrument, WOLFSENTRY_INSTRUMENT_LOCK_WAIT_SHARED, WOLFSENTRY_INSTRUMENT_NOW() - wait_start);
+#endif
         if (ret < 0) {
             if (errno == ETIMEDOUT)
                 ret = WOLFSENTRY_ERROR_ENCODE(TIMED_OUT);
@@ -1860,8 +2221,11 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared(struct wolfsentry_rwl
     return wolfsentry_lock_shared_abstimed(lock, thread, NULL, flags);
 }
 
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+static wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed_1(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
     wolfsentry_errcode_t ret;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t wait_start = 0;
+#endif
 
     if (lock == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
@@ -1969,10 +2333,16 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed(struct wolfse
         }
 
         ++lock->write_waiter_count;
+        ++lock->wait_count;
 
         if (sem_post(&lock->sem) < 0)
             WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
 
+#ifdef WOLFSENTRY_INSTRUMENT
+        if (lock->instrument != NULL)
+            wait_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+
         if (abs_timeout == NULL) {
             for (;;) {
                 ret = sem_wait(&lock->sem_write_waiters);
@@ -1985,6 +2355,10 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed(struct wolfse
             }
         } else
             ret = sem_timedwait(&lock->sem_write_waiters, abs_timeout);
+#ifdef WOLFSENTRY_INSTRUMENT
+        if ((ret == 0) && (lock->instrument != NULL))
+            WOLFSENTRY_INSTRUMENT_RECORD(lock->instrument, WOLFSENTRY_INSTRUMENT_LOCK_WAIT_MUTEX, WOLFSENTRY_INSTRUMENT_NOW() - wait_start);
+#endif
         if (ret < 0) {
             if (errno == ETIMEDOUT)
                 ret = WOLFSENTRY_ERROR_ENCODE(TIMED_OUT);
@@ -2051,6 +2425,34 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed(struct wolfse
         WOLFSENTRY_RETURN_OK;
 }
 
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+    wolfsentry_errcode_t ret;
+    int already_held;
+
+    if (lock == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (lock->reader_slots == NULL)
+        WOLFSENTRY_ERROR_RERETURN(wolfsentry_lock_mutex_abstimed_1(lock, thread, abs_timeout, flags));
+
+    if (thread && thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock)) {
+        ret = wolfsentry_lock_unbias(lock, thread);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    already_held = (WOLFSENTRY_ATOMIC_LOAD(lock->write_lock_holder) == WOLFSENTRY_THREAD_GET_ID);
+    ret = wolfsentry_lock_mutex_abstimed_1(lock, thread, abs_timeout, flags);
+    if ((ret < 0) || already_held)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if ((ret = wolfsentry_lock_drain_readers(lock, thread, abs_timeout)) < 0) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_lock_unlock(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_ERROR_RERETURN(ret);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex_timed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, wolfsentry_time_t max_wait, wolfsentry_lock_flags_t flags) {
     wolfsentry_time_t now;
     struct timespec abs_timeout;
@@ -2158,6 +2560,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_mutex2shared(struct wolfsent
         }
     }
 
+    wolfsentry_lock_restore_read_bias(lock);
+
     if (sem_post(&lock->sem) < 0)
         WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
 
@@ -2180,6 +2584,11 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_reserve(struct
     if (thread->current_thread_flags & WOLFSENTRY_THREAD_FLAG_READONLY)
         WOLFSENTRY_ERROR_RETURN(NOT_PERMITTED);
 
+    if (thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock)) {
+        wolfsentry_errcode_t ret = wolfsentry_lock_unbias(lock, thread);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
     if (WOLFSENTRY_ATOMIC_LOAD(lock->state) == WOLFSENTRY_LOCK_EXCLUSIVE) {
         if (WOLFSENTRY_ATOMIC_LOAD(lock->write_lock_holder) == WOLFSENTRY_THREAD_GET_ID)
             WOLFSENTRY_ERROR_RETURN(ALREADY);
@@ -2225,8 +2634,11 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_reserve(struct
 }
 
 /* if this returns BUSY or TIMED_OUT, the caller still owns a reservation, and must either retry the redemption, or abandon the reservation. */
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+static wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed_1(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
     wolfsentry_errcode_t ret;
+#ifdef WOLFSENTRY_INSTRUMENT
+    uint64_t wait_start = 0;
+#endif
 
     (void)flags;
 
@@ -2327,6 +2739,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed
 
     --lock->holder_count.read; /* reenable posts to sem_read2write_waiters by unlockers. */
     ++lock->write_waiter_count; /* and force shared lockers to wait. */
+    ++lock->wait_count;
     if (thread->tracked_shared_lock == lock)
         lock->read2write_waiter_read_count = thread->recursion_of_tracked_lock;
     else
@@ -2335,6 +2748,11 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed
     if (sem_post(&lock->sem) < 0)
         WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
 
+#ifdef WOLFSENTRY_INSTRUMENT
+    if (lock->instrument != NULL)
+        wait_start = WOLFSENTRY_INSTRUMENT_NOW();
+#endif
+
     if (abs_timeout == NULL) {
         for (;;) {
             ret = sem_wait(&lock->sem_read2write_waiters);
@@ -2347,6 +2765,10 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed
         }
     } else
         ret = sem_timedwait(&lock->sem_read2write_waiters, abs_timeout);
+#ifdef WOLFSENTRY_INSTRUMENT
+    if ((ret == 0) && (lock->instrument != NULL))
+        WOLFSENTRY_INSTRUMENT_RECORD(lock->instrument, WOLFSENTRY_INSTRUMENT_LOCK_WAIT_UPGRADE, WOLFSENTRY_INSTRUMENT_NOW() - wait_start);
+#endif
     if (ret < 0) {
         if (errno == ETIMEDOUT)
             ret = WOLFSENTRY_ERROR_ENCODE(TIMED_OUT);
@@ -2405,6 +2827,27 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed
     WOLFSENTRY_RETURN_OK;
 }
 
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+    wolfsentry_errcode_t ret, drain_ret;
+
+    WOLFSENTRY_LOCK_ASSERT_INITED(lock);
+
+    if (lock->reader_slots == NULL)
+        WOLFSENTRY_ERROR_RERETURN(wolfsentry_lock_shared2mutex_redeem_abstimed_1(lock, thread, abs_timeout, flags));
+
+    ret = wolfsentry_lock_shared2mutex_redeem_abstimed_1(lock, thread, abs_timeout, flags);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    if ((drain_ret = wolfsentry_lock_drain_readers(lock, thread, abs_timeout)) < 0) {
+        /* put the reservation back, per the contract above. */
+        ret = wolfsentry_lock_mutex2shared(lock, thread, WOLFSENTRY_LOCK_FLAG_GET_RESERVATION_TOO);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        WOLFSENTRY_ERROR_RERETURN(drain_ret);
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_redeem_timed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, wolfsentry_time_t max_wait, wolfsentry_lock_flags_t flags) {
     wolfsentry_time_t now;
     struct timespec abs_timeout;
@@ -2476,7 +2919,7 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_abandon(struct
  * deadlock, then reattempt its transaction with a fresh lock (ideally
  * with a _lock_mutex() at the open).
  */
-WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+static wolfsentry_errcode_t wolfsentry_lock_shared2mutex_abstimed_1(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
     wolfsentry_errcode_t ret;
 
     if (lock == NULL)
@@ -2670,6 +3113,38 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_abstimed(struct
     WOLFSENTRY_RETURN_OK;
 }
 
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_abstimed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, const struct timespec *abs_timeout, wolfsentry_lock_flags_t flags) {
+    wolfsentry_errcode_t ret, drain_ret;
+    int already_held;
+
+    if (lock == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (lock->reader_slots == NULL)
+        WOLFSENTRY_ERROR_RERETURN(wolfsentry_lock_shared2mutex_abstimed_1(lock, thread, abs_timeout, flags));
+
+    WOLFSENTRY_THREAD_ASSERT_INITED(thread);
+
+    if (thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock)) {
+        ret = wolfsentry_lock_unbias(lock, thread);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    }
+
+    already_held = (WOLFSENTRY_ATOMIC_LOAD(lock->write_lock_holder) == WOLFSENTRY_THREAD_GET_ID);
+    ret = wolfsentry_lock_shared2mutex_abstimed_1(lock, thread, abs_timeout, flags);
+    if ((ret < 0) || already_held)
+        WOLFSENTRY_ERROR_RERETURN(ret);
+
+    if ((drain_ret = wolfsentry_lock_drain_readers(lock, thread, abs_timeout)) < 0) {
+        /* leave the caller holding the shared lock it came in with. */
+        ret = wolfsentry_lock_mutex2shared(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE);
+        WOLFSENTRY_RERETURN_IF_ERROR(ret);
+        WOLFSENTRY_ERROR_RERETURN(drain_ret);
+    }
+
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_shared2mutex_timed(struct wolfsentry_rwlock *lock, struct wolfsentry_thread_context *thread, wolfsentry_time_t max_wait, wolfsentry_lock_flags_t flags) {
     wolfsentry_time_t now;
     struct timespec abs_timeout;
@@ -2705,6 +3180,16 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_unlock(struct wolfsentry_rwl
 
     WOLFSENTRY_THREAD_ASSERT_NULL_OR_INITED(thread);
 
+    if (thread && thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock)) {
+        --thread->shared_count;
+        if (--thread->recursion_of_tracked_lock == 0) {
+            thread->tracked_shared_lock = NULL;
+            thread->tracked_shared_lock_biased = 0;
+            (void)WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(*wolfsentry_lock_reader_slot(lock, thread));
+        }
+        WOLFSENTRY_RETURN_OK;
+    }
+
     /* unlocking a recursive mutex, like recursively locking one, can be done lock-free. */
     if ((WOLFSENTRY_ATOMIC_LOAD(lock->write_lock_holder) == WOLFSENTRY_THREAD_GET_ID) &&
         (lock->holder_count.write > 1))
@@ -2868,6 +3353,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_unlock(struct wolfsentry_rwl
 
   out:
 
+    wolfsentry_lock_restore_read_bias(lock);
+
     if (sem_post(&lock->sem) < 0)
         WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
     WOLFSENTRY_ERROR_RERETURN(ret);
@@ -2883,6 +3370,9 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_lock_have_shared(struct wolfsentr
 
     (void)flags;
 
+    if (thread->tracked_shared_lock_biased && (thread->tracked_shared_lock == lock))
+        WOLFSENTRY_SUCCESS_RETURN(HAVE_READ_LOCK);
+
     lock_state = WOLFSENTRY_ATOMIC_LOAD(lock->state);
 
     if (lock_state != WOLFSENTRY_LOCK_SHARED) {
@@ -3194,6 +3684,20 @@ WOLFSENTRY_API_VOID wolfsentry_free_aligned(WOLFSENTRY_CONTEXT_ARGS_IN, void *pt
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_get_time(struct wolfsentry_context *wolfsentry, wolfsentry_time_t *time_p) {
     WOLFSENTRY_RETURN_VALUE(wolfsentry->hpi.timecbs.get_time(wolfsentry->hpi.timecbs.context, time_p));
 }
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_time_cache_refresh(struct wolfsentry_context *wolfsentry) {
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret = WOLFSENTRY_GET_TIME(&now);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    WOLFSENTRY_ATOMIC_STORE_RELAXED(wolfsentry->cached_time, now);
+    WOLFSENTRY_RETURN_OK;
+}
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_time_cache_set(struct wolfsentry_context *wolfsentry, wolfsentry_time_t now) {
+    WOLFSENTRY_ATOMIC_STORE_RELAXED(wolfsentry->cached_time, now);
+    WOLFSENTRY_RETURN_OK;
+}
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_get_time_cached(struct wolfsentry_context *wolfsentry, wolfsentry_time_t *time_p) {
+    WOLFSENTRY_ERROR_RERETURN(WOLFSENTRY_GET_TIME_CACHED(time_p));
+}
 WOLFSENTRY_API wolfsentry_time_t wolfsentry_diff_time(struct wolfsentry_context *wolfsentry, wolfsentry_time_t later, wolfsentry_time_t earlier) {
     WOLFSENTRY_RETURN_VALUE(wolfsentry->hpi.timecbs.diff_time(later, earlier));
 }
@@ -3322,6 +3826,8 @@ WOLFSENTRY_LOCAL wolfsentry_errcode_t wolfsentry_eventconfig_get_1(
     if (exported == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
     *exported = internal->config;
+    /* export the size as supplied, without the alignment padding. */
+    exported->route_private_data_size -= internal->route_private_data_padding;
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -3374,6 +3880,11 @@ static wolfsentry_errcode_t wolfsentry_context_free_1(
     if ((*wolfsentry)->addr_families_byname != NULL)
         WOLFSENTRY_FREE_1((*wolfsentry)->hpi.allocator, (*wolfsentry)->addr_families_byname);
 #endif
+#ifdef WOLFSENTRY_INSTRUMENT
+    if ((*wolfsentry)->instrument != NULL)
+        WOLFSENTRY_FREE_1((*wolfsentry)->hpi.allocator, (*wolfsentry)->instrument);
+#endif
+    wolfsentry_ent_id_index_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*wolfsentry));
 
 #ifdef WOLFSENTRY_THREADSAFE
     ret = wolfsentry_lock_unlock(&(*wolfsentry)->lock, thread, WOLFSENTRY_LOCK_FLAG_NONE);
@@ -3401,6 +3912,9 @@ static wolfsentry_errcode_t wolfsentry_context_init_1(
 #ifdef WOLFSENTRY_THREADSAFE
     if ((ret = wolfsentry_lock_init(&wolfsentry->hpi, thread, &wolfsentry->lock, lock_flags)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
+#ifdef WOLFSENTRY_INSTRUMENT
+    wolfsentry->lock.instrument = wolfsentry->instrument;
+#endif
 #endif
 
     if ((ret = wolfsentry_event_table_init(wolfsentry->events)) < 0)
@@ -3444,6 +3958,9 @@ static wolfsentry_errcode_t wolfsentry_context_alloc_1(
         (((*wolfsentry)->addr_families_bynumber = (struct wolfsentry_addr_family_bynumber_table *)WOLFSENTRY_MALLOC_1(hpi->allocator, sizeof *(*wolfsentry)->addr_families_bynumber)) == NULL)
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
         || (((*wolfsentry)->addr_families_byname = (struct wolfsentry_addr_family_byname_table *)WOLFSENTRY_MALLOC_1(hpi->allocator, sizeof *(*wolfsentry)->addr_families_byname)) == NULL)
+#endif
+#ifdef WOLFSENTRY_INSTRUMENT
+        || (((*wolfsentry)->instrument = (struct wolfsentry_instrument *)WOLFSENTRY_MALLOC_1(hpi->allocator, sizeof *(*wolfsentry)->instrument)) == NULL)
 #endif
         )
     {
@@ -3456,6 +3973,9 @@ static wolfsentry_errcode_t wolfsentry_context_alloc_1(
     memset((*wolfsentry)->routes, 0, sizeof *(*wolfsentry)->routes);
     memset((*wolfsentry)->user_values, 0, sizeof *(*wolfsentry)->user_values);
     memset((*wolfsentry)->addr_families_bynumber, 0, sizeof *(*wolfsentry)->addr_families_bynumber);
+#ifdef WOLFSENTRY_INSTRUMENT
+    memset((*wolfsentry)->instrument, 0, sizeof *(*wolfsentry)->instrument);
+#endif
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
     memset((*wolfsentry)->addr_families_byname, 0, sizeof *(*wolfsentry)->addr_families_byname);
     if ((ret = wolfsentry_addr_family_table_pair(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*wolfsentry), (*wolfsentry)->addr_families_bynumber, (*wolfsentry)->addr_families_byname)) < 0) {
@@ -3550,6 +4070,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_init_ex(
 #ifdef WOLFSENTRY_THREADSAFE
     if (flags & WOLFSENTRY_INIT_FLAG_LOCK_SHARED_ERROR_CHECKING)
         lock_flags |= WOLFSENTRY_LOCK_FLAG_SHARED_ERROR_CHECKING;
+    if (flags & WOLFSENTRY_INIT_FLAG_LOCK_READ_BIAS)
+        lock_flags |= WOLFSENTRY_LOCK_FLAG_READ_BIAS;
     if ((ret = wolfsentry_context_alloc_1(&hpi, thread, wolfsentry, lock_flags)) < 0)
         WOLFSENTRY_ERROR_RERETURN(ret);
 #else
@@ -3624,6 +4146,8 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_free(WOLFSENTRY_CONTEXT_A
 
     WOLFSENTRY_HAVE_MUTEX_OR_RETURN_EX(*wolfsentry);
 
+    wolfsentry_deferred_actions_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*wolfsentry));
+
     ret = wolfsentry_route_flush_table(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*wolfsentry), (*wolfsentry)->routes, &action_results);
     WOLFSENTRY_RERETURN_IF_ERROR(ret);
     ret = wolfsentry_action_flush_all(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*wolfsentry));
@@ -3715,9 +4239,16 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_clone(
     else {
         (*clone)->config = wolfsentry->config;
         (*clone)->config_at_creation = wolfsentry->config_at_creation;
-    }
 
-    WOLFSENTRY_TABLE_HEADER_RESET((*clone)->ents_by_id);
+        /* size the clone's ID index for everything it's about to receive. */
+        if ((ret = wolfsentry_ent_id_index_reserve(
+                 WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*clone),
+                 wolfsentry->ents_by_id.n_ents -
+                 (WOLFSENTRY_CHECK_BITS(flags, WOLFSENTRY_CLONE_FLAG_NO_ROUTES) ? wolfsentry->routes->header.n_ents : 0))) < 0)
+        {
+            goto out;
+        }
+    }
 
     if ((ret = wolfsentry_table_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &wolfsentry->actions->header, *clone, &(*clone)->actions->header, flags)) < 0)
         goto out;
@@ -3835,6 +4366,224 @@ out:
     WOLFSENTRY_ERROR_RERETURN(ret);
 }
 
+/* a generation fresh from wolfsentry_context_clone() still has the mutex the
+ * clone left held on it, which would shut out readers on other threads, so the
+ * publisher releases it on taking the generation over.
+ */
+static void wolfsentry_context_publisher_adopt(WOLFSENTRY_CONTEXT_ARGS_IN) {
+#ifdef WOLFSENTRY_THREADSAFE
+    if (wolfsentry_lock_have_mutex(&wolfsentry->lock, thread, WOLFSENTRY_LOCK_FLAG_NONE) >= 0)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+#else
+    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+#endif
+    WOLFSENTRY_RETURN_VOID;
+}
+
+/* wolfsentry_context_free() consumes a mutex on the context, which the
+ * publisher takes afresh, as the generation has been shared since adoption.
+ */
+static wolfsentry_errcode_t wolfsentry_context_publisher_free_generation(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context **generation))
+{
+    wolfsentry_errcode_t ret = WOLFSENTRY_MUTEX_EX(*generation);
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_context_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(generation)));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_new(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_context_publisher **publisher)
+{
+    if (publisher == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((*publisher = (struct wolfsentry_context_publisher *)WOLFSENTRY_MALLOC(sizeof **publisher)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*publisher, 0, sizeof **publisher);
+    wolfsentry_context_publisher_adopt(WOLFSENTRY_CONTEXT_ARGS_OUT);
+    (*publisher)->current = wolfsentry;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* caller must hold publisher->publishing. */
+static wolfsentry_errcode_t wolfsentry_context_publisher_reclaim_1(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher *publisher))
+{
+    if (publisher->retiring == NULL)
+        WOLFSENTRY_RETURN_OK;
+    if (WOLFSENTRY_ATOMIC_INCREMENT(publisher->readers[publisher->retiring_epoch & 1U], 0) != 0)
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_context_publisher_free_generation(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&publisher->retiring)));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher **publisher))
+{
+    struct wolfsentry_context *current;
+    wolfsentry_errcode_t ret;
+
+    if ((publisher == NULL) || (*publisher == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((WOLFSENTRY_ATOMIC_INCREMENT((*publisher)->readers[0], 0) != 0) ||
+        (WOLFSENTRY_ATOMIC_INCREMENT((*publisher)->readers[1], 0) != 0))
+    {
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+    }
+    ret = wolfsentry_context_publisher_reclaim_1(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(*publisher));
+    WOLFSENTRY_RERETURN_IF_ERROR(ret);
+
+    current = (*publisher)->current;
+    WOLFSENTRY_FREE_1(current->hpi.allocator, *publisher);
+    *publisher = NULL;
+
+    WOLFSENTRY_ERROR_RERETURN(wolfsentry_context_publisher_free_generation(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&current)));
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_acquire(
+    struct wolfsentry_context_publisher *publisher,
+    struct wolfsentry_context **wolfsentry,
+    unsigned int *ticket)
+{
+    uint32_t epoch;
+
+    if ((publisher == NULL) || (wolfsentry == NULL) || (ticket == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    for (;;) {
+        epoch = WOLFSENTRY_ATOMIC_INCREMENT(publisher->epoch, 0U);
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(publisher->readers[epoch & 1U]);
+        if (WOLFSENTRY_ATOMIC_INCREMENT(publisher->epoch, 0U) == epoch)
+            break;
+        /* a publish intervened -- register again in the new epoch. */
+        WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->readers[epoch & 1U]);
+    }
+
+    *wolfsentry = WOLFSENTRY_ATOMIC_LOAD(publisher->current);
+    *ticket = epoch & 1U;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_release(
+    struct wolfsentry_context_publisher *publisher,
+    unsigned int ticket)
+{
+    if ((publisher == NULL) || (ticket > 1U))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->readers[ticket]) < 0) {
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(publisher->readers[ticket]);
+        WOLFSENTRY_ERROR_RETURN(INTERNAL_CHECK_FATAL);
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_reclaim(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher *publisher))
+{
+    wolfsentry_errcode_t ret;
+
+    if (publisher == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(publisher->publishing) != 1) {
+        WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->publishing);
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+    }
+    ret = wolfsentry_context_publisher_reclaim_1(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher));
+    WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->publishing);
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publish(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher *publisher),
+    struct wolfsentry_context *new_generation,
+    wolfsentry_publish_flags_t flags)
+{
+    struct wolfsentry_context *old;
+    wolfsentry_errcode_t ret;
+
+    if ((publisher == NULL) || (new_generation == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(publisher->publishing) != 1) {
+        WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->publishing);
+        WOLFSENTRY_ERROR_RETURN(BUSY);
+    }
+
+    /* only publishers change current, and they're serialized by publishing. */
+    old = publisher->current;
+    if ((new_generation == old) ||
+        memcmp(&old->hpi, &new_generation->hpi, sizeof old->hpi))
+    {
+        ret = WOLFSENTRY_ERROR_ENCODE(INVALID_ARG);
+        goto out;
+    }
+
+    /* a publish waits for the grace period of the one before it, so that all
+     * readers of the generation being replaced are in a single epoch.
+     */
+    if ((ret = wolfsentry_context_publisher_reclaim_1(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher))) < 0)
+        goto out;
+
+    if (WOLFSENTRY_CHECK_BITS(flags, WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES)) {
+        /* the shared lock on the outgoing generation holds off its dynamic
+         * route insertions until the new generation is in place.
+         */
+#ifdef WOLFSENTRY_THREADSAFE
+        if ((ret = wolfsentry_context_lock_shared(old, thread)) < 0)
+            goto out;
+        if ((ret = wolfsentry_context_lock_mutex(new_generation, thread)) < 0) {
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(old, thread));
+            goto out;
+        }
+#endif
+        ret = wolfsentry_route_migrate_dynamic(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(old), old->routes, new_generation, new_generation->routes);
+#ifdef WOLFSENTRY_THREADSAFE
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(new_generation, thread));
+#endif
+        if (ret < 0) {
+#ifdef WOLFSENTRY_THREADSAFE
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(old, thread));
+#endif
+            goto out;
+        }
+    }
+
+    wolfsentry_context_publisher_adopt(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(new_generation));
+    WOLFSENTRY_ATOMIC_STORE(publisher->current, new_generation);
+    publisher->retiring = old;
+    publisher->retiring_epoch = WOLFSENTRY_ATOMIC_INCREMENT(publisher->epoch, 1U) - 1U;
+
+#ifdef WOLFSENTRY_THREADSAFE
+    if (WOLFSENTRY_CHECK_BITS(flags, WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES))
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(old, thread));
+#endif
+
+    /* free the outgoing generation now if it's idle, else leave it for
+     * wolfsentry_context_publisher_reclaim().
+     */
+    ret = wolfsentry_context_publisher_reclaim_1(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher));
+    if (WOLFSENTRY_ERROR_CODE_IS(ret, BUSY))
+        ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(publisher->publishing);
+    WOLFSENTRY_ERROR_RERETURN(ret);
+}
+
+#ifdef WOLFSENTRY_COUNTER_SHARDS
+WOLFSENTRY_LOCAL wolfsentry_hitcount_t wolfsentry_counter_shards_sum(const struct wolfsentry_counter_shard *shards) {
+    wolfsentry_hitcount_t sum = 0;
+    unsigned int i;
+    for (i = 0; i < WOLFSENTRY_COUNTER_SHARDS; ++i) {
+        wolfsentry_hitcount_t shard_hits = WOLFSENTRY_ATOMIC_LOAD(shards[i].hitcount);
+        if (MAX_UINT_OF(sum) - sum < shard_hits)
+            return MAX_UINT_OF(sum);
+        sum = (wolfsentry_hitcount_t)(sum + shard_hits);
+    }
+    return sum;
+}
+#endif
+
 WOLFSENTRY_API wolfsentry_hitcount_t wolfsentry_table_n_inserts(struct wolfsentry_table_header *table) {
     WOLFSENTRY_RETURN_VALUE(table->n_inserts);
 }
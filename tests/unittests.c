@@ -678,7 +678,15 @@ static void *rd2wr_reserved_routine(struct rwlock_args *args) {
 #define MAX_WAIT 100000
 #define WAIT_FOR_PHASE(x, atleast) do { int cur_phase; WOLFSENTRY_EXIT_ON_FAILURE_PTHREAD(pthread_mutex_lock(&(x).thread_phase_lock)); cur_phase = (x).thread_phase; WOLFSENTRY_EXIT_ON_FAILURE_PTHREAD(pthread_mutex_unlock(&(x).thread_phase_lock)); if (cur_phase >= (atleast)) break; usleep(1000); } while(1)
 
-static int test_rw_locks (void) {
+#ifdef WOLFSENTRY_LOCK_SHARED_ERROR_CHECKING
+#define test_rw_locks_WOLFSENTRY_INIT_FLAGS WOLFSENTRY_INIT_FLAG_LOCK_SHARED_ERROR_CHECKING
+#define test_rw_locks_WOLFSENTRY_LOCK_FLAGS WOLFSENTRY_LOCK_FLAG_SHARED_ERROR_CHECKING
+#else
+#define test_rw_locks_WOLFSENTRY_INIT_FLAGS WOLFSENTRY_INIT_FLAG_NONE
+#define test_rw_locks_WOLFSENTRY_LOCK_FLAGS WOLFSENTRY_LOCK_FLAG_NONE
+#endif
+
+static int test_rw_locks_1(wolfsentry_init_flags_t init_flags, wolfsentry_lock_flags_t rwlock_flags) {
     struct wolfsentry_context *wolfsentry;
     struct wolfsentry_rwlock *lock;
 #ifdef WOLFSENTRY_HAVE_DESIGNATED_INITIALIZERS
@@ -697,23 +705,15 @@ static int test_rw_locks (void) {
 
     (void)alarm(1);
 
-#ifdef WOLFSENTRY_LOCK_SHARED_ERROR_CHECKING
-#define test_rw_locks_WOLFSENTRY_INIT_FLAGS WOLFSENTRY_INIT_FLAG_LOCK_SHARED_ERROR_CHECKING
-#define test_rw_locks_WOLFSENTRY_LOCK_FLAGS WOLFSENTRY_LOCK_FLAG_SHARED_ERROR_CHECKING
-#else
-#define test_rw_locks_WOLFSENTRY_INIT_FLAGS WOLFSENTRY_INIT_FLAG_NONE
-#define test_rw_locks_WOLFSENTRY_LOCK_FLAGS WOLFSENTRY_LOCK_FLAG_NONE
-#endif
-
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init_ex(wolfsentry_build_settings,
                                                   WOLFSENTRY_TEST_HPI,
                                                   thread,
                                                   &config,
                                                   &wolfsentry,
-                                                  test_rw_locks_WOLFSENTRY_INIT_FLAGS
+                                                  init_flags
                                    ));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_alloc(wolfsentry_get_hpi(wolfsentry), thread, &lock,
-                                                     test_rw_locks_WOLFSENTRY_LOCK_FLAGS
+                                                     rwlock_flags
                                    ));
 
     {
@@ -818,6 +818,41 @@ static int test_rw_locks (void) {
         TEST_INVALID_ARGS(wolfsentry_lock_get_flags(lock, thread, NULL));
     }
 
+    if (rwlock_flags & WOLFSENTRY_LOCK_FLAG_READ_BIAS) {
+        struct wolfsentry_thread_context_public writer_thread_buffer =
+            WOLFSENTRY_THREAD_CONTEXT_PUBLIC_INITIALIZER;
+        struct wolfsentry_thread_context *writer_thread =
+            (struct wolfsentry_thread_context *)&writer_thread_buffer;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init_thread_context(writer_thread, WOLFSENTRY_THREAD_FLAG_NONE, NULL));
+
+        /* biased shared locks don't touch the lock state, so writers have to
+         * revoke the bias and wait for them to drain.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_shared(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_shared(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FALSE(lock->state == WOLFSENTRY_LOCK_UNLOCKED);
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_SUCCESS(HAVE_READ_LOCK, wolfsentry_lock_have_shared(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUSY, wolfsentry_lock_mutex_timed(lock, writer_thread, 0, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(TIMED_OUT, wolfsentry_lock_mutex_timed(lock, writer_thread, 1000, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FALSE(lock->read_bias);
+
+        /* promotion first converts the biased hold to a regular one. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_shared2mutex(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_SUCCESS(HAVE_MUTEX, wolfsentry_lock_have_mutex(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FALSE(! lock->read_bias);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FALSE(lock->read_bias);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_shared(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_mutex_timed(lock, writer_thread, 0, WOLFSENTRY_LOCK_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, writer_thread, WOLFSENTRY_LOCK_FLAG_NONE));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_destroy_thread_context(writer_thread, WOLFSENTRY_THREAD_FLAG_NONE));
+    }
+
     memset(&thread1_args, 0, sizeof thread1_args);
     thread1_args.wolfsentry = wolfsentry;
     thread1_args.measured_sequence = measured_sequence;
@@ -888,9 +923,9 @@ usleep(10000);
     // GCOV_EXCL_STOP
     }
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, rwlock_flags));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_init(wolfsentry_get_hpi(wolfsentry), thread, lock,
-                                                    test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+                                                    rwlock_flags));
 
     /* now a scenario with shared2mutex and mutex2shared in the mix: */
 
@@ -972,9 +1007,9 @@ usleep(10000);
 
     /* again, using shared2mutex reservation: */
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, rwlock_flags));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_init(wolfsentry_get_hpi(wolfsentry), thread, lock,
-                                                    test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+                                                    rwlock_flags));
 
     thread1_args.thread_phase = thread2_args.thread_phase = thread3_args.thread_phase = thread4_args.thread_phase = 0;
 
@@ -1060,9 +1095,9 @@ usleep(10000);
 
     /* cursory exercise of compound reservation calls. */
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, thread, rwlock_flags));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_init(wolfsentry_get_hpi(wolfsentry), thread, lock,
-                                                    test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+                                                    rwlock_flags));
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_mutex(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_mutex2shared(lock, thread, WOLFSENTRY_LOCK_FLAG_GET_RESERVATION_TOO));
@@ -1078,9 +1113,9 @@ usleep(10000);
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, thread, WOLFSENTRY_LOCK_FLAG_NONE));
 
     /* cursory exercise of null thread calls. */
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, NULL /* thread */, test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_destroy(lock, NULL /* thread */, rwlock_flags));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_init(wolfsentry_get_hpi(wolfsentry), NULL /* thread */, lock,
-                                                    test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+                                                    rwlock_flags));
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_mutex(lock, NULL /* thread */, WOLFSENTRY_LOCK_FLAG_NONE));
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_lock_unlock(lock, NULL /* thread */, WOLFSENTRY_LOCK_FLAG_NONE));
@@ -1102,6 +1137,14 @@ usleep(10000);
     WOLFSENTRY_RETURN_OK;
 }
 
+static int test_rw_locks (void) {
+    WOLFSENTRY_EXIT_ON_FAILURE(test_rw_locks_1(test_rw_locks_WOLFSENTRY_INIT_FLAGS, test_rw_locks_WOLFSENTRY_LOCK_FLAGS));
+    /* the whole exercise again, with reader-biased locks throughout. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_rw_locks_1(test_rw_locks_WOLFSENTRY_INIT_FLAGS | WOLFSENTRY_INIT_FLAG_LOCK_READ_BIAS,
+                                               test_rw_locks_WOLFSENTRY_LOCK_FLAGS | WOLFSENTRY_LOCK_FLAG_READ_BIAS));
+    WOLFSENTRY_RETURN_OK;
+}
+
 #else
 
 TEST_SKIP(test_rw_locks)
@@ -1117,6 +1160,92 @@ TEST_SKIP(test_rw_locks)
 #define PRIVATE_DATA_ALIGNMENT 16
 #endif
 
+#if defined(WOLFSENTRY_MALLOC_BUILTINS) && defined(WOLFSENTRY_MALLOC_DEBUG)
+
+/* records the number of outstanding allocations from inside dispatch, to
+ * verify that dispatch doesn't allocate a target or stand-in rule route.
+ */
+static wolfsentry_errcode_t n_mallocs_probe_callback(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_action *action,
+    void *handler_context,
+    void *caller_arg,
+    const struct wolfsentry_event *event,
+    wolfsentry_action_type_t action_type,
+    const struct wolfsentry_route *target_route,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *rule_route,
+    wolfsentry_action_res_t *action_results)
+{
+    WOLFSENTRY_CONTEXT_ARGS_NOT_USED;
+    (void)action;
+    (void)handler_context;
+    (void)event;
+    (void)action_type;
+    (void)target_route;
+    (void)route_table;
+    (void)rule_route;
+    (void)action_results;
+
+    *(int *)caller_arg = _wolfsentry_get_n_mallocs();
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#endif /* WOLFSENTRY_MALLOC_BUILTINS && WOLFSENTRY_MALLOC_DEBUG */
+
+/* a stopped clock, installed in place of the get_time callback so that purge
+ * timing is exercised deterministically.  the context points at the time to
+ * report.
+ */
+static wolfsentry_errcode_t test_clock_get_time(void *context, wolfsentry_time_t *now) {
+    *now = *(const wolfsentry_time_t *)context;
+    WOLFSENTRY_RETURN_OK;
+}
+
+#ifdef WOLFSENTRY_THREADSAFE
+
+/* a reader of published generations, dispatching against whichever one is
+ * current until told to stop.
+ */
+struct publisher_reader_args {
+    struct wolfsentry_context_publisher *publisher;
+    const struct wolfsentry_sockaddr *remote, *local;
+    wolfsentry_route_flags_t flags;
+    int *stop;
+    int n_dispatches;
+    int n_generation_changes;
+};
+
+static void *publisher_reader_routine(struct publisher_reader_args *args) {
+    struct wolfsentry_context *acquired, *last_acquired = NULL;
+    unsigned int ticket;
+    wolfsentry_ent_id_t route_id;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_action_res_t action_results;
+    WOLFSENTRY_THREAD_HEADER(WOLFSENTRY_THREAD_FLAG_NONE);
+    WOLFSENTRY_EXIT_ON_FAILURE(WOLFSENTRY_THREAD_GET_ERROR);
+
+    while (! WOLFSENTRY_ATOMIC_LOAD(*args->stop)) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_acquire(args->publisher, &acquired, &ticket));
+        action_results = WOLFSENTRY_ACTION_RES_NONE;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(acquired), args->remote, args->local, args->flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id != acquired->routes->fallthrough_route->header.id);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        if (acquired != last_acquired) {
+            ++args->n_generation_changes;
+            last_acquired = acquired;
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_release(args->publisher, ticket));
+        WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(args->n_dispatches);
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(WOLFSENTRY_THREAD_TAILER(WOLFSENTRY_THREAD_FLAG_NONE));
+    return 0;
+}
+
+#endif /* WOLFSENTRY_THREADSAFE */
+
 static int test_static_routes (void) {
 
     struct wolfsentry_context *wolfsentry;
@@ -1306,6 +1435,61 @@ static int test_static_routes (void) {
     WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
     WOLFSENTRY_EXIT_ON_FALSE(inexact_matches == 0);
 
+    /* hit and connection accounting -- hit_count is folded from the counter
+     * shards in WOLFSENTRY_COUNTER_SHARDS builds, and max_connection_count is
+     * enforced exactly.
+     */
+    {
+        struct wolfsentry_route_metadata_exports metadata;
+        wolfsentry_hitcount_t hits_before;
+        unsigned int i;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_reference(
+                                     WOLFSENTRY_CONTEXT_ARGS_OUT,
+                                     main_routes,
+                                     &remote.sa,
+                                     &local.sa,
+                                     flags,
+                                     0 /* event_label_len */,
+                                     0 /* event_label */,
+                                     1 /* exact_p */,
+                                     &inexact_matches,
+                                     &route_ref));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.connection_count == 0);
+        hits_before = metadata.hit_count;
+        WOLFSENTRY_EXIT_ON_FALSE(hits_before > 0);
+
+        for (i = 0; i <= config.max_connection_count; ++i) {
+            action_results = WOLFSENTRY_ACTION_RES_CONNECT;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_with_inited_result(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                                      &route_id, &inexact_matches, &action_results));
+            if (i < config.max_connection_count)
+                WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+            else
+                WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        }
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.connection_count == config.max_connection_count);
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.hit_count == hits_before + config.max_connection_count + 1U);
+
+        for (i = 0; i <= config.max_connection_count; ++i) {
+            action_results = WOLFSENTRY_ACTION_RES_DISCONNECT;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_with_inited_result(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                                      &route_id, &inexact_matches, &action_results));
+        }
+
+        /* the surplus disconnect must not wrap the count. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.connection_count == 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route_ref, &action_results));
+    }
+
     flags |= WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
     WOLFSENTRY_CLEAR_BITS(flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
 
@@ -1401,6 +1585,224 @@ static int test_static_routes (void) {
 
     }
 
+    /* churn the route table with scrambled inserts and deletes, checking that
+     * the red-black tree and its in-order threading stay consistent.
+     */
+    {
+        wolfsentry_hitcount_t n_ents_at_start = wolfsentry->routes->header.n_ents;
+        struct wolfsentry_table_ent_header *i;
+        wolfsentry_port_t saved_remote_port = remote.sa.sa_port;
+        int n;
+
+        for (n = 0; n < 256; ++n) {
+            remote.sa.sa_port = (wolfsentry_port_t)(((n * 167) % 256) + 1000);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        }
+        WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_at_start + 256);
+
+        for (n = 0, i = wolfsentry->routes->header.head; i; i = i->next, ++n) {
+            if (i->prev)
+                WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.cmp_fn(i->prev, i) < 0);
+            else
+                WOLFSENTRY_EXIT_ON_FALSE(i == wolfsentry->routes->header.head);
+        }
+        WOLFSENTRY_EXIT_ON_FALSE((wolfsentry_hitcount_t)n == wolfsentry->routes->header.n_ents);
+
+        for (n = 0; n < 256; ++n) {
+            remote.sa.sa_port = (wolfsentry_port_t)(((n * 91) % 256) + 1000);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+            WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_at_start);
+
+        remote.sa.sa_port = saved_remote_port;
+    }
+
+    /* nested and sibling CIDR routes must resolve to the longest matching
+     * prefix, with prefix bits taken most significant first.
+     */
+    {
+        static const struct {
+            byte addr[4];
+            wolfsentry_addr_bits_t len;
+        } cidrs[] = {
+            { { 4, 0, 0, 0 }, 8 },
+            { { 4, 128, 0, 0 }, 9 },
+            { { 4, 5, 0, 0 }, 16 },
+            { { 4, 5, 6, 0 }, 24 },
+            { { 4, 5, 7, 0 }, 24 },
+            { { 4, 5, 6, 4 }, 30 },
+            { { 4, 5, 6, 7 }, 32 }
+        };
+        static const struct {
+            byte addr[4];
+            int cidr;
+        } targets[] = {
+            { { 4, 5, 6, 7 }, 6 },
+            { { 4, 5, 6, 5 }, 5 },
+            { { 4, 5, 6, 1 }, 3 },
+            { { 4, 5, 7, 9 }, 4 },
+            { { 4, 5, 8, 9 }, 2 },
+            { { 4, 200, 1, 1 }, 1 },
+            { { 4, 6, 1, 1 }, 0 }
+        };
+        wolfsentry_ent_id_t cidr_ids[length_of_array(cidrs)];
+        struct {
+            struct wolfsentry_sockaddr sa;
+            byte addr_buf[4];
+        } batch_remotes[length_of_array(targets)];
+        const struct wolfsentry_sockaddr *batch_remote_ptrs[length_of_array(targets)];
+        const struct wolfsentry_sockaddr *batch_local_ptrs[length_of_array(targets)];
+        wolfsentry_route_flags_t batch_flags[length_of_array(targets)];
+        wolfsentry_ent_id_t batch_ids[length_of_array(targets)];
+        wolfsentry_action_res_t single_action_results[length_of_array(targets)];
+        wolfsentry_action_res_t batch_action_results[length_of_array(targets)];
+        wolfsentry_errcode_t batch_rets[length_of_array(targets)];
+        byte saved_remote_addr[sizeof remote.addr_buf];
+        size_t n;
+        int pass;
+
+        memcpy(saved_remote_addr, remote.sa.addr, sizeof saved_remote_addr);
+
+        /* first via the LPM index, then via the tuple classifier, then via
+         * the tuple classifier behind the flow cache.
+         */
+        for (pass = 0; pass <= 2; ++pass) {
+            int tuple_classifier_enabled = (pass >= 1);
+            size_t flow_cache_size = (pass == 2) ? 64 : 0;
+            int enabled;
+            size_t n_entries;
+            wolfsentry_hitcount_t hits, misses;
+            int round;
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_tuple_classifier_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, tuple_classifier_enabled));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_tuple_classifier_get(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, &enabled));
+            WOLFSENTRY_EXIT_ON_FALSE(enabled == tuple_classifier_enabled);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, flow_cache_size));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_get(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, &n_entries, &hits, &misses));
+            WOLFSENTRY_EXIT_ON_FALSE(n_entries == flow_cache_size);
+            WOLFSENTRY_EXIT_ON_FALSE((hits == 0) && (misses == 0));
+
+            for (n = 0; n < length_of_array(cidrs); ++n) {
+                memcpy(remote.sa.addr, cidrs[n].addr, sizeof remote.addr_buf);
+                remote.sa.addr_len = cidrs[n].len;
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &cidr_ids[n], &action_results));
+            }
+
+            remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+            for (round = 0; round < 2; ++round) {
+                for (n = 0; n < length_of_array(targets); ++n) {
+                    memcpy(remote.sa.addr, targets[n].addr, sizeof remote.addr_buf);
+                    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                               &route_id, &inexact_matches, &action_results));
+                    WOLFSENTRY_EXIT_ON_FALSE(route_id == cidr_ids[targets[n].cidr]);
+                    single_action_results[n] = action_results;
+                }
+            }
+
+            /* the second round is served entirely from the flow cache. */
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_get(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, NULL /* n_entries */, &hits, &misses));
+            if (flow_cache_size > 0)
+                WOLFSENTRY_EXIT_ON_FALSE((hits == length_of_array(targets)) && (misses == length_of_array(targets)));
+            else
+                WOLFSENTRY_EXIT_ON_FALSE((hits == 0) && (misses == 0));
+
+            /* the same targets again, as a single batch. */
+            for (n = 0; n < length_of_array(targets); ++n) {
+                batch_remotes[n].sa = remote.sa;
+                memcpy(batch_remotes[n].sa.addr, targets[n].addr, sizeof batch_remotes[n].addr_buf);
+                batch_remote_ptrs[n] = &batch_remotes[n].sa;
+                batch_local_ptrs[n] = &local.sa;
+                batch_flags[n] = flags;
+                batch_action_results[n] = WOLFSENTRY_ACTION_RES_STOP;
+            }
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_batch(WOLFSENTRY_CONTEXT_ARGS_OUT, length_of_array(targets), batch_remote_ptrs, batch_local_ptrs, batch_flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                             batch_ids, NULL /* inexact_matches */, batch_action_results, batch_rets));
+            for (n = 0; n < length_of_array(targets); ++n) {
+                WOLFSENTRY_EXIT_ON_FAILURE(batch_rets[n]);
+                WOLFSENTRY_EXIT_ON_FALSE(batch_ids[n] == cidr_ids[targets[n].cidr]);
+                WOLFSENTRY_EXIT_ON_FALSE(batch_action_results[n] == single_action_results[n]);
+            }
+
+            /* with the most specific routes gone, the enclosing prefixes take over. */
+            for (n = length_of_array(cidrs) - 1; n >= 5; --n) {
+                memcpy(remote.sa.addr, cidrs[n].addr, sizeof remote.addr_buf);
+                remote.sa.addr_len = cidrs[n].len;
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+                WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+            }
+            memcpy(remote.sa.addr, targets[0].addr, sizeof remote.addr_buf);
+            remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                       &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(route_id == cidr_ids[3]);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(inexact_matches, WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD));
+
+            for (n = 0; n < 5; ++n) {
+                memcpy(remote.sa.addr, cidrs[n].addr, sizeof remote.addr_buf);
+                remote.sa.addr_len = cidrs[n].len;
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+                WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+            }
+        }
+
+        /* leave the tuple classifier and flow cache enabled, so that the
+         * wildcard matching below is exercised through them.
+         */
+        memcpy(remote.sa.addr, saved_remote_addr, sizeof saved_remote_addr);
+        remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    }
+
+    /* the trigger event affects the result of a lookup among equal-priority
+     * routes, at least in the reported inexact matches, so a result cached for
+     * one trigger must not be served to another.
+     */
+    {
+        static const char *trigger_labels[] = { "flow-cache-trigger-a", "flow-cache-trigger-b" };
+        wolfsentry_ent_id_t trigger_route_ids[length_of_array(trigger_labels)];
+        wolfsentry_ent_id_t uncached_route_ids[length_of_array(trigger_labels)];
+        wolfsentry_route_flags_t uncached_inexact_matches[length_of_array(trigger_labels)];
+        byte saved_remote_addr[sizeof remote.addr_buf];
+        size_t n;
+        int pass, round;
+
+        memcpy(saved_remote_addr, remote.sa.addr, sizeof saved_remote_addr);
+        memcpy(remote.sa.addr, "\5\6\7\10", sizeof remote.addr_buf);
+
+        for (n = 0; n < length_of_array(trigger_labels); ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_labels[n], WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        for (n = 0; n < length_of_array(trigger_labels); ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, trigger_labels[n], WOLFSENTRY_LENGTH_NULL_TERMINATED, &trigger_route_ids[n], &action_results));
+
+        /* first with the flow cache disabled, then enabled. */
+        for (pass = 0; pass <= 1; ++pass) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, pass ? 64 : 0));
+            for (round = 0; round < 2; ++round) {
+                for (n = 0; n < length_of_array(trigger_labels); ++n) {
+                    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, trigger_labels[n], WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */,
+                                                                               &route_id, &inexact_matches, &action_results));
+                    if ((pass == 0) && (round == 0)) {
+                        uncached_route_ids[n] = route_id;
+                        uncached_inexact_matches[n] = inexact_matches;
+                    } else {
+                        WOLFSENTRY_EXIT_ON_FALSE(route_id == uncached_route_ids[n]);
+                        WOLFSENTRY_EXIT_ON_FALSE(inexact_matches == uncached_inexact_matches[n]);
+                    }
+                }
+            }
+            /* the two triggers get distinguishable results. */
+            WOLFSENTRY_EXIT_ON_FALSE((uncached_route_ids[0] != uncached_route_ids[1]) || (uncached_inexact_matches[0] != uncached_inexact_matches[1]));
+        }
+
+        for (n = 0; n < length_of_array(trigger_labels); ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, trigger_route_ids[n], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        for (n = 0; n < length_of_array(trigger_labels); ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, trigger_labels[n], WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* action_results */));
+
+        memcpy(remote.sa.addr, saved_remote_addr, sizeof saved_remote_addr);
+    }
+
 
     remote_wildcard = remote;
     local_wildcard = local;
@@ -1439,6 +1841,32 @@ static int test_static_routes (void) {
 
     WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
 
+    /* enough routes to grow the ID index several times, with deletions
+     * scattered through the probe runs.
+     */
+    {
+        wolfsentry_ent_id_t ids[300];
+        unsigned int i;
+        wolfsentry_errcode_t ret;
+
+        remote_wildcard = remote;
+        for (i = 0; i < length_of_array(ids); ++i) {
+            remote_wildcard.sa.sa_port = (wolfsentry_port_t)(20000U + i);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote_wildcard.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &ids[i], &action_results));
+        }
+        for (i = 0; i < length_of_array(ids); i += 3)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        for (i = 0; i < length_of_array(ids); ++i) {
+            ret = wolfsentry_route_event_dispatch_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, ids[i], NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &action_results);
+            if (i % 3 == 0)
+                WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND));
+            else {
+                WOLFSENTRY_EXIT_ON_FAILURE(ret);
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+            }
+        }
+    }
+
     remote_wildcard = remote;
     local_wildcard = local;
     flags_wildcard = flags;
@@ -1777,55 +2205,885 @@ static int test_static_routes (void) {
         WOLFSENTRY_EXIT_ON_FALSE(new_derogatory_count == 124);
     }
 
-    {
-        int old_commendable_count;
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_reset_commendable_count(
-                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
-                                       route_ref,
-                                       &old_commendable_count));
-        WOLFSENTRY_EXIT_ON_FALSE(old_commendable_count == 0);
+    {
+        int old_commendable_count;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_reset_commendable_count(
+                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
+                                       route_ref,
+                                       &old_commendable_count));
+        WOLFSENTRY_EXIT_ON_FALSE(old_commendable_count == 0);
+    }
+
+    {
+        int new_commendable_count;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_increment_commendable_count(
+                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
+                                       route_ref,
+                                       123,
+                                       &new_commendable_count));
+        WOLFSENTRY_EXIT_ON_FALSE(new_commendable_count == 123);
+    }
+
+    WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+        OVERFLOW_AVERTED,
+        wolfsentry_route_increment_commendable_count(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            route_ref,
+            -124,
+            NULL));
+
+    WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+        OVERFLOW_AVERTED,
+        wolfsentry_route_increment_commendable_count(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            route_ref,
+            65536 - 123,
+            NULL));
+
+    {
+        int new_commendable_count;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_increment_commendable_count(
+                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
+                                       route_ref,
+                                       1,
+                                       &new_commendable_count));
+        WOLFSENTRY_EXIT_ON_FALSE(new_commendable_count == 124);
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(
+                                   WOLFSENTRY_CONTEXT_ARGS_OUT,
+                                   route_ref,
+                                   NULL /* action_results */));
+
+#if defined(WOLFSENTRY_MALLOC_BUILTINS) && defined(WOLFSENTRY_MALLOC_DEBUG)
+    /* dispatch must not allocate, whether it matches a route or misses. */
+    {
+        int n_mallocs_before, n_mallocs_during;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_FLAG_NONE, n_mallocs_probe_callback, NULL /* handler_context */, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_action_append(WOLFSENTRY_CONTEXT_ARGS_OUT, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_TYPE_POST, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED));
+
+        remote.sa.sa_port = 54321;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+
+        n_mallocs_during = -1;
+        n_mallocs_before = _wolfsentry_get_n_mallocs();
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &n_mallocs_during, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == id);
+        WOLFSENTRY_EXIT_ON_FALSE(n_mallocs_during == n_mallocs_before);
+        WOLFSENTRY_EXIT_ON_FALSE(_wolfsentry_get_n_mallocs() == n_mallocs_before);
+
+        remote.sa.sa_port = 54322;
+        n_mallocs_during = -1;
+        n_mallocs_before = _wolfsentry_get_n_mallocs();
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, "n-mallocs-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &n_mallocs_during, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_FALLTHROUGH));
+        WOLFSENTRY_EXIT_ON_FALSE(n_mallocs_during == n_mallocs_before);
+        WOLFSENTRY_EXIT_ON_FALSE(_wolfsentry_get_n_mallocs() == n_mallocs_before);
+
+        remote.sa.sa_port = 54321;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+        WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+    }
+#endif /* WOLFSENTRY_MALLOC_BUILTINS && WOLFSENTRY_MALLOC_DEBUG */
+
+    /* dispatch with an interned event handle, which goes stale when the event
+     * is deleted.
+     */
+    {
+        struct wolfsentry_event *event_handle;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "interned-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, "interned-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &event_handle));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_with_event(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, event_handle, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, "interned-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+            ITEM_NOT_FOUND,
+            wolfsentry_route_event_dispatch_with_event(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, event_handle, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event_handle, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
+    }
+
+    /* purge wheel: eviction at max_purgeable_routes takes the earliest to
+     * expire, a stale purge takes routes due within the current wheel tick,
+     * and a hit lazily extends a route's deadline, on a stopped clock.
+     */
+    {
+        struct wolfsentry_timecbs *timecbs = wolfsentry_get_timecbs(wolfsentry);
+        struct wolfsentry_timecbs saved_timecbs = *timecbs;
+        struct wolfsentry_route_metadata_exports metadata;
+        wolfsentry_time_t clock_start, clock_now;
+        int i;
+#ifdef WOLFSENTRY_HAVE_DESIGNATED_INITIALIZERS
+        struct wolfsentry_eventconfig purge_config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT, .max_connection_count = 10, .route_idle_time_for_purge = 400000 /* builtin wolfsentry_time_t is microseconds. */ };
+#else
+        struct wolfsentry_eventconfig purge_config = { PRIVATE_DATA_SIZE, PRIVATE_DATA_ALIGNMENT, 10, 0, 0, 400000, 0, 0, 0, 0, 0, 0, 0 };
+#endif
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, &purge_config, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 20));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &clock_start));
+        clock_now = clock_start;
+        timecbs->context = &clock_now;
+        timecbs->get_time = test_clock_get_time;
+
+        for (i = 0; i < 30; ++i) {
+            remote.sa.sa_port = (wolfsentry_port_t)(30000 + i);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 20);
+
+        remote.sa.sa_port = 30000;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+            ITEM_NOT_FOUND,
+            wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+        remote.sa.sa_port = 30029;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+        WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 19);
+
+        clock_now = clock_start + 250000;
+
+        remote.sa.sa_port = 30028;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(inexact_matches == 0);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &remote.sa, &local.sa, flags, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* exact_p */, &inexact_matches, &route_ref));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+        /* the hit only records last_hit_time -- purge_after is left as filed
+         * until the purger reaches the route.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.last_hit_time == clock_start + 250000);
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.purge_after == clock_start + 400000);
+
+        clock_now = clock_start + 500000;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 1);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.purge_after == clock_start + 250000 + 400000);
+
+        clock_now = clock_start + 650000 - 1;
+
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ALREADY, wolfsentry_route_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 1);
+
+        clock_now = clock_start + 650000;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 0);
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ALREADY, wolfsentry_route_stale_purge(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route_ref, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
+
+        *timecbs = saved_timecbs;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 0));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, "purge-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+    }
+
+    /* purge wheel eviction order, across levels, and across the wrap of a
+     * level above 0, on a stopped clock parked in the last tick of a level 1
+     * period.
+     */
+    {
+        struct wolfsentry_timecbs *timecbs = wolfsentry_get_timecbs(wolfsentry);
+        struct wolfsentry_timecbs saved_timecbs = *timecbs;
+        wolfsentry_time_t clock_now;
+        const wolfsentry_time_t tick = (wolfsentry_time_t)1 << WOLFSENTRY_ROUTE_PURGE_WHEEL_TICK_SHIFT;
+        const wolfsentry_time_t slots = WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS;
+        static const char *const wheel_event_labels[] = { "wheel-level-0", "wheel-level-1", "wheel-level-2", "wheel-wrap" };
+        wolfsentry_time_t wheel_idle_ticks[length_of_array(wheel_event_labels)];
+#ifdef WOLFSENTRY_HAVE_DESIGNATED_INITIALIZERS
+        struct wolfsentry_eventconfig wheel_config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT, .max_connection_count = 10 };
+#else
+        struct wolfsentry_eventconfig wheel_config = { PRIVATE_DATA_SIZE, PRIVATE_DATA_ALIGNMENT, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+#endif
+        size_t i;
+
+        /* one span each for levels 0, 1 and 2, and a level 1 span that lands a
+         * full rotation ahead, in the slot of the current level 1 period.
+         */
+        wheel_idle_ticks[0] = 2;
+        wheel_idle_ticks[1] = 2 * slots;
+        wheel_idle_ticks[2] = 2 * slots * slots;
+        wheel_idle_ticks[3] = slots * slots - 1;
+        for (i = 0; i < length_of_array(wheel_event_labels); ++i) {
+            wheel_config.route_idle_time_for_purge = wheel_idle_ticks[i] * tick;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, wheel_event_labels[i], WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, &wheel_config, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        }
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &clock_now));
+        clock_now = ((((clock_now / tick) / slots) + 1) * slots + slots - 1) * tick;
+        timecbs->context = &clock_now;
+        timecbs->get_time = test_clock_get_time;
+
+        /* across levels: each eviction takes the lowest level's route. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 3));
+        remote.sa.sa_port = 32002;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-2", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32000;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-0", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32001;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-1", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 3);
+
+        remote.sa.sa_port = 32003;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-2", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32000;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+            ITEM_NOT_FOUND,
+            wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-0", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+
+        remote.sa.sa_port = 32004;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-2", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32001;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+            ITEM_NOT_FOUND,
+            wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-1", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+
+        /* the level 2 routes are all that remain, and all are to be kept. */
+        for (i = 2; i <= 4; ++i) {
+            remote.sa.sa_port = (wolfsentry_port_t)(32000 + i);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-2", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+            WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 0);
+
+        /* across the wrap: the route in the current period's level 1 slot is
+         * a full rotation ahead, so the route filed in a later slot is the one
+         * evicted.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 2));
+        remote.sa.sa_port = 32010;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-wrap", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32011;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-1", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32012;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-wrap", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+        remote.sa.sa_port = 32011;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+            ITEM_NOT_FOUND,
+            wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-1", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+        for (i = 10; i <= 12; i += 2) {
+            remote.sa.sa_port = (wolfsentry_port_t)(32000 + i);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-wrap", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+            WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 0);
+
+        /* bulk insert: a batch too big for the wheel evicts nothing, and a
+         * batch that fits evicts the routes already filed, not its own.
+         */
+        {
+            struct wolfsentry_route_exports wheel_exports[3];
+            wolfsentry_ent_id_t wheel_ids[length_of_array(wheel_exports)];
+            wolfsentry_hitcount_t n_ents_before;
+
+            memset(wheel_exports, 0, sizeof wheel_exports);
+            for (i = 0; i < length_of_array(wheel_exports); ++i) {
+                wheel_exports[i].parent_event_label = "wheel-level-1";
+                wheel_exports[i].parent_event_label_len = WOLFSENTRY_LENGTH_NULL_TERMINATED;
+                wheel_exports[i].flags = flags;
+                wheel_exports[i].sa_family = remote.sa.sa_family;
+                wheel_exports[i].sa_proto = remote.sa.sa_proto;
+                wheel_exports[i].remote.sa_port = (wolfsentry_port_t)(32030 + i);
+                wheel_exports[i].remote.addr_len = remote.sa.addr_len;
+                wheel_exports[i].remote.interface = remote.sa.interface;
+                wheel_exports[i].local.sa_port = local.sa.sa_port;
+                wheel_exports[i].local.addr_len = local.sa.addr_len;
+                wheel_exports[i].local.interface = local.sa.interface;
+                wheel_exports[i].remote_address = remote.sa.addr;
+                wheel_exports[i].local_address = local.sa.addr;
+            }
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 2));
+            for (i = 20; i <= 21; ++i) {
+                remote.sa.sa_port = (wolfsentry_port_t)(32000 + i);
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-0", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+            }
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 2);
+            n_ents_before = main_routes->header.n_ents;
+
+            WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(OVERFLOW_AVERTED, wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, wheel_exports, length_of_array(wheel_exports), wheel_ids, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 2);
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->header.n_ents == n_ents_before);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, wheel_exports, 2, wheel_ids, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 2);
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->header.n_ents == n_ents_before);
+
+            for (i = 20; i <= 21; ++i) {
+                remote.sa.sa_port = (wolfsentry_port_t)(32000 + i);
+                WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
+                    ITEM_NOT_FOUND,
+                    wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-0", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+            }
+            for (i = 30; i <= 31; ++i) {
+                remote.sa.sa_port = (wolfsentry_port_t)(32000 + i);
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "wheel-level-1", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results, &n_deleted));
+                WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+            }
+            WOLFSENTRY_EXIT_ON_FALSE(main_routes->purge_wheel.len == 0);
+        }
+
+        *timecbs = saved_timecbs;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_max_purgeable_routes_set(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, 0));
+        for (i = 0; i < length_of_array(wheel_event_labels); ++i)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, wheel_event_labels[i], WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+    }
+
+    /* the time cache, and a caller-supplied time, stand in for the clock on
+     * the dispatch path.
+     */
+    {
+        struct wolfsentry_route_metadata_exports metadata;
+        wolfsentry_time_t cached_now, real_now;
+
+        remote.sa.sa_port = 30100;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, 1 /* exact_p */, &inexact_matches, &route_ref));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_time_cache_refresh(wolfsentry));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time_cached(wolfsentry, &cached_now));
+        usleep(2000);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == id);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.last_hit_time == cached_now);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_at_time(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, cached_now + 1, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(route_ref, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.last_hit_time == cached_now + 1);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_time_cache_set(wolfsentry, 0));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time_cached(wolfsentry, &real_now));
+        WOLFSENTRY_EXIT_ON_FALSE(real_now > cached_now);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route_ref, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    }
+
+    /* bulk insertion, first by merge walk into a small table, then by
+     * per-route descent into a table much larger than the batch.
+     */
+    {
+#define N_BULK_ROUTES 64
+        struct wolfsentry_route_exports bulk_exports[N_BULK_ROUTES];
+        byte bulk_addrs[N_BULK_ROUTES][4];
+        wolfsentry_ent_id_t bulk_ids[N_BULK_ROUTES], extra_id;
+        wolfsentry_hitcount_t n_ents_before = wolfsentry->routes->header.n_ents;
+        struct wolfsentry_table_ent_header *i_ent;
+        unsigned int i;
+
+        memset(bulk_exports, 0, sizeof bulk_exports);
+        for (i = 0; i < N_BULK_ROUTES; ++i) {
+            /* descending, so that the batch arrives out of order. */
+            bulk_addrs[i][0] = 10;
+            bulk_addrs[i][1] = 99;
+            bulk_addrs[i][2] = 0;
+            bulk_addrs[i][3] = (byte)(N_BULK_ROUTES - 1 - i);
+            bulk_exports[i].flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+                WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+            bulk_exports[i].sa_family = AF_INET;
+            bulk_exports[i].sa_proto = IPPROTO_TCP;
+            bulk_exports[i].remote.addr_len = 32;
+            bulk_exports[i].remote_address = bulk_addrs[i];
+        }
+
+        /* a duplicate within the batch fails the whole batch. */
+        bulk_addrs[1][3] = bulk_addrs[0][3];
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ITEM_ALREADY_PRESENT, wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, bulk_exports, N_BULK_ROUTES, bulk_ids, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before);
+        WOLFSENTRY_EXIT_ON_FALSE(bulk_ids[0] == WOLFSENTRY_ENT_ID_NONE);
+        bulk_addrs[1][3] = (byte)(N_BULK_ROUTES - 2);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, bulk_exports, N_BULK_ROUTES, bulk_ids, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_INSERTED));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before + N_BULK_ROUTES);
+        for (i = 0; i < N_BULK_ROUTES; ++i)
+            WOLFSENTRY_EXIT_ON_TRUE(bulk_ids[i] == WOLFSENTRY_ENT_ID_NONE);
+
+        /* the ordered list and its back links must be intact. */
+        for (i_ent = wolfsentry->routes->header.head; i_ent && i_ent->next; i_ent = i_ent->next)
+            WOLFSENTRY_EXIT_ON_FALSE(i_ent->next->prev == i_ent);
+        WOLFSENTRY_EXIT_ON_FALSE(i_ent == wolfsentry->routes->header.tail);
+
+        /* a duplicate of a route already in the table fails the batch. */
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ITEM_ALREADY_PRESENT, wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &bulk_exports[5], 1, &extra_id, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before + N_BULK_ROUTES);
+
+        bulk_addrs[0][2] = 1;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &bulk_exports[0], 1, &extra_id, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before + N_BULK_ROUTES + 1);
+
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        remote.sa.sa_port = 4321;
+        local.sa.sa_port = 80;
+        remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+        remote.sa.interface = local.sa.interface = 1;
+        memcpy(remote.sa.addr, "\12\143\0\5", sizeof remote.addr_buf);
+        memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+        WOLFSENTRY_CLEAR_ALL_BITS(flags);
+        WOLFSENTRY_SET_BITS(flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == bulk_ids[N_BULK_ROUTES - 1 - 5]);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+        memcpy(remote.sa.addr, "\12\143\1\77", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == extra_id);
+
+        for (i = 0; i < N_BULK_ROUTES; ++i)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, bulk_ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, extra_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before);
+#undef N_BULK_ROUTES
+    }
+
+    /* a read-only route image, searched in place of the routes it was built from. */
+    {
+#define N_IMAGE_ROUTES 16
+        static const char image_event_label[] = "image-event";
+        struct wolfsentry_route_exports image_exports[N_IMAGE_ROUTES], extra_exports[3];
+        byte image_addrs[N_IMAGE_ROUTES][4];
+        static const byte extra_addrs[2][4] = { { 10, 97, 0, 0 }, { 10, 97, 1, 1 } };
+        wolfsentry_ent_id_t image_ids[N_IMAGE_ROUTES], extra_ids[3], override_id;
+        struct wolfsentry_context *ctx_clone;
+        byte *image, *bad_image;
+        uint32_t forged_image[22];
+        size_t image_len = 0, built_len;
+        unsigned int i;
+
+        memset(image_exports, 0, sizeof image_exports);
+        for (i = 0; i < N_IMAGE_ROUTES; ++i) {
+            image_addrs[i][0] = 10;
+            image_addrs[i][1] = 98;
+            image_addrs[i][2] = (byte)i;
+            image_addrs[i][3] = 0;
+            image_exports[i].flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+                WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD |
+                WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+                ((i & 1) ? WOLFSENTRY_ROUTE_FLAG_GREENLISTED : WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+            image_exports[i].sa_family = AF_INET;
+            image_exports[i].sa_proto = IPPROTO_TCP;
+            image_exports[i].remote.addr_len = 24;
+            image_exports[i].remote_address = image_addrs[i];
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, image_exports, N_IMAGE_ROUTES, image_ids, &action_results));
+
+        /* more groups -- a /16 and a /32 under a parent event, and a wildcard
+         * family route on interface 7 only.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, image_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        memset(extra_exports, 0, sizeof extra_exports);
+        for (i = 0; i < 2; ++i) {
+            extra_exports[i] = image_exports[0];
+            extra_exports[i].parent_event_label = image_event_label;
+            extra_exports[i].parent_event_label_len = WOLFSENTRY_LENGTH_NULL_TERMINATED;
+            extra_exports[i].remote_address = extra_addrs[i];
+        }
+        extra_exports[0].remote.addr_len = 16;
+        extra_exports[0].flags = WOLFSENTRY_MASKOUT_BITS(extra_exports[0].flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) | WOLFSENTRY_ROUTE_FLAG_GREENLISTED;
+        extra_exports[1].remote.addr_len = 32;
+        extra_exports[2].flags = WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN |
+            WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+        extra_exports[2].remote.interface = 7;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, extra_exports, length_of_array(extra_exports), extra_ids, &action_results));
+
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUFFER_TOO_SMALL, wolfsentry_route_table_image_build(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, NULL, &image_len));
+        image = (byte *)malloc(image_len);
+        WOLFSENTRY_EXIT_ON_FALSE(image != NULL);
+        built_len = image_len;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_image_build(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, image, &built_len));
+        WOLFSENTRY_EXIT_ON_FALSE(built_len == image_len);
+
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        remote.sa.sa_port = 4321;
+        local.sa.sa_port = 80;
+        remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+        remote.sa.interface = local.sa.interface = 1;
+        memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+        WOLFSENTRY_CLEAR_ALL_BITS(flags);
+        WOLFSENTRY_SET_BITS(flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN);
+
+        memcpy(remote.sa.addr, "\12\142\3\7", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == image_ids[3]);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+
+        for (i = 0; i < N_IMAGE_ROUTES; ++i)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, image_ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        for (i = 0; i < length_of_array(extra_ids); ++i)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, extra_ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+
+        /* a damaged or foreign image is refused. */
+        bad_image = (byte *)malloc(image_len);
+        WOLFSENTRY_EXIT_ON_FALSE(bad_image != NULL);
+        memcpy(bad_image, image, image_len);
+        bad_image[image_len - 1] ^= 0x5a;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, bad_image, image_len));
+        memcpy(bad_image, image, image_len);
+        bad_image[4] ^= 0x5a;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(LIB_MISMATCH, wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, bad_image, image_len));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, image, image_len - 8));
+        free(bad_image);
+
+        /* a label longer than the whole pool is refused, rather than its
+         * bound wrapping.  the forged image has the built image's 72 byte
+         * header, an event record, and a one byte pool, with the header's
+         * uint32_t fields from the checksum on overwritten.
+         */
+        WOLFSENTRY_EXIT_ON_FALSE(((const uint32_t *)image)[4] == 72);
+        memset(forged_image, 0, sizeof forged_image);
+        memcpy(forged_image, image, 8 * sizeof forged_image[0]);
+        forged_image[9] = (uint32_t)sizeof forged_image; /* total_len */
+        forged_image[10] = 1; /* n_events */
+        forged_image[13] = 72; /* events_offset */
+        forged_image[14] = forged_image[15] = forged_image[16] = 80; /* groups, routes, and pool offsets */
+        forged_image[17] = 1; /* pool_len */
+        forged_image[18] = 0x1000; /* label_offset */
+        forged_image[19] = 4; /* label_len */
+        {
+            const byte *p;
+            uint32_t checksum = 2166136261U;
+            for (p = (const byte *)&forged_image[18]; p < (const byte *)&forged_image[length_of_array(forged_image)]; ++p) {
+                checksum ^= *p;
+                checksum *= 16777619U;
+            }
+            forged_image[8] = checksum;
+        }
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, (const byte *)forged_image, sizeof forged_image));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, image, image_len));
+
+        /* the image routes decide as the table routes did, but anonymously,
+         * with and without the flow cache.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+
+        /* the /32 beats the /16 under it, and the wildcard family route
+         * catches only what's left on its interface.
+         */
+        memcpy(remote.sa.addr, "\12\141\5\5", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        memcpy(remote.sa.addr, "\12\141\1\1", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        memcpy(remote.sa.addr, "\12\140\0\1", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == wolfsentry->routes->fallthrough_route->header.id);
+        remote.sa.interface = 7;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        memcpy(remote.sa.addr, "\12\142\3\7", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        remote.sa.interface = 1;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, 64));
+        for (i = 0; i < 2; ++i) {
+            memcpy(remote.sa.addr, "\12\142\4\7", sizeof remote.addr_buf);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+            memcpy(remote.sa.addr, "\12\142\17\7", sizeof remote.addr_buf);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        }
+
+        /* a more specific dynamic route overrides the image. */
+        memcpy(image_addrs[0], "\12\142\4\7", sizeof image_addrs[0]);
+        image_exports[0].remote.addr_len = 32;
+        image_exports[0].flags = WOLFSENTRY_MASKOUT_BITS(image_exports[0].flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) | WOLFSENTRY_ROUTE_FLAG_GREENLISTED;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_by_exports(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &image_exports[0], 1, &override_id, &action_results));
+        memcpy(remote.sa.addr, "\12\142\4\7", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == override_id);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, override_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_flow_cache_set(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, 0));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_image_detach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ITEM_NOT_FOUND, wolfsentry_route_table_image_detach(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes));
+        memcpy(remote.sa.addr, "\12\142\3\7", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == wolfsentry->routes->fallthrough_route->header.id);
+
+        /* parent events are resolved by label in the attaching context, so a
+         * fresh clone can't take the image until it has the event.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &ctx_clone, WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(ITEM_NOT_FOUND, wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), ctx_clone->routes, image, image_len));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), image_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_image_attach(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), ctx_clone->routes, image, image_len));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+        memcpy(remote.sa.addr, "\12\141\1\1", sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        memcpy(remote.sa.addr, "\12\140\0\1", sizeof remote.addr_buf);
+        remote.sa.interface = 7;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == WOLFSENTRY_ENT_ID_NONE);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        remote.sa.interface = 1;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&ctx_clone)));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, image_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+
+        free(image);
+#undef N_IMAGE_ROUTES
+    }
+
+    /* generation publishing: readers keep the generation they acquired across
+     * a publish, which is freed once they release it, and dynamic routes
+     * migrate into the new generation.
+     */
+    {
+        struct wolfsentry_context *gen1, *gen2, *gen3, *acquired1, *acquired2;
+        struct wolfsentry_context_publisher *publisher;
+        struct wolfsentry_route *migrated_route;
+        struct wolfsentry_route_metadata_exports metadata;
+        unsigned int ticket1, ticket2;
+#ifdef WOLFSENTRY_HAVE_DESIGNATED_INITIALIZERS
+        struct wolfsentry_eventconfig publish_config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT, .max_connection_count = 10, .route_idle_time_for_purge = 100000000 };
+#else
+        struct wolfsentry_eventconfig publish_config = { PRIVATE_DATA_SIZE, PRIVATE_DATA_ALIGNMENT, 10, 0, 0, 100000000, 0, 0, 0, 0, 0, 0, 0 };
+#endif
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "publish-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, &publish_config, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &gen1, WOLFSENTRY_CLONE_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &gen2, WOLFSENTRY_CLONE_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &gen3, WOLFSENTRY_CLONE_FLAG_NONE));
+
+        remote.sa.sa_port = 31000;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(gen1), NULL /* caller_arg */, &remote.sa, &local.sa, flags, "publish-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_new(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(gen1), &publisher));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_acquire(publisher, &acquired1, &ticket1));
+        WOLFSENTRY_EXIT_ON_FALSE(acquired1 == gen1);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publish(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher), gen2, WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_acquire(publisher, &acquired2, &ticket2));
+        WOLFSENTRY_EXIT_ON_FALSE(acquired2 == gen2);
+        WOLFSENTRY_EXIT_ON_FALSE(ticket2 != ticket1);
+
+        /* the old generation is still intact for its reader. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(acquired1), &remote.sa, &local.sa, flags, "publish-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == id);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(acquired2), acquired2->routes, &remote.sa, &local.sa, flags, "publish-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* exact_p */, &inexact_matches, &migrated_route));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_metadata(migrated_route, &metadata));
+        WOLFSENTRY_EXIT_ON_FALSE(metadata.purge_after != 0);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(acquired2), migrated_route, NULL /* action_results */));
+
+        /* gen1 is held, so neither its reclamation nor another publish can proceed. */
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUSY, wolfsentry_context_publisher_reclaim(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher)));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUSY, wolfsentry_context_publish(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher), gen3, WOLFSENTRY_PUBLISH_FLAG_NONE));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUSY, wolfsentry_context_publisher_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&publisher)));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_release(publisher, ticket1));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_reclaim(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher)));
+
+        /* gen3 can replace gen2 while gen2 is held, but gen2 is only freed once released. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publish(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher), gen3, WOLFSENTRY_PUBLISH_FLAG_NONE));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUSY, wolfsentry_context_publisher_reclaim(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher)));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_release(publisher, ticket2));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&publisher)));
+        WOLFSENTRY_EXIT_ON_FALSE(publisher == NULL);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, "publish-probe", WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+    }
+
+#ifdef WOLFSENTRY_THREADSAFE
+    /* generation publishing under load: readers loop acquiring the current
+     * generation, dispatching in it, and releasing it, while this thread
+     * publishes fresh clones, alternately migrating dynamic routes.
+     */
+    {
+#define N_PUBLISHER_READERS 4
+#define N_PUBLISHES 50
+        struct wolfsentry_context *gen;
+        struct wolfsentry_context_publisher *publisher;
+        struct publisher_reader_args reader_args[N_PUBLISHER_READERS];
+        pthread_t readers[N_PUBLISHER_READERS];
+        wolfsentry_ent_id_t probe_id;
+        wolfsentry_errcode_t publish_ret;
+        int stop = 0;
+        unsigned int i;
+
+        remote.sa.sa_port = 31001;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags | WOLFSENTRY_ROUTE_FLAG_GREENLISTED, NULL /* event_label */, 0 /* event_label_len */, &probe_id, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &gen, WOLFSENTRY_CLONE_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_publisher_new(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(gen), &publisher));
+
+        memset(reader_args, 0, sizeof reader_args);
+        for (i = 0; i < N_PUBLISHER_READERS; ++i) {
+            reader_args[i].publisher = publisher;
+            reader_args[i].remote = &remote.sa;
+            reader_args[i].local = &local.sa;
+            reader_args[i].flags = flags;
+            reader_args[i].stop = &stop;
+            WOLFSENTRY_EXIT_ON_FAILURE_PTHREAD(pthread_create(&readers[i], 0 /* attr */, (void *(*)(void *))publisher_reader_routine, (void *)&reader_args[i]));
+        }
+
+        /* let every reader get going before the first publish. */
+        for (i = 0; i < N_PUBLISHER_READERS; ++i) {
+            while (WOLFSENTRY_ATOMIC_LOAD(reader_args[i].n_dispatches) == 0)
+                usleep(1000);
+        }
+
+        for (i = 0; i < N_PUBLISHES; ++i) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &gen, WOLFSENTRY_CLONE_FLAG_NONE));
+            /* BUSY until the readers of the generation replaced last time have
+             * all released it.
+             */
+            while (WOLFSENTRY_ERROR_CODE_IS(publish_ret = wolfsentry_context_publish(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(publisher), gen, (i & 1U) ? WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES : WOLFSENTRY_PUBLISH_FLAG_NONE), BUSY))
+                usleep(100);
+            WOLFSENTRY_EXIT_ON_FAILURE(publish_ret);
+            usleep(500);
+        }
+
+        WOLFSENTRY_ATOMIC_STORE(stop, 1);
+        for (i = 0; i < N_PUBLISHER_READERS; ++i) {
+            WOLFSENTRY_EXIT_ON_FAILURE_PTHREAD(pthread_join(readers[i], 0 /* retval */));
+            WOLFSENTRY_EXIT_ON_FALSE(reader_args[i].n_dispatches >= reader_args[i].n_generation_changes);
+            WOLFSENTRY_EXIT_ON_FALSE(reader_args[i].n_generation_changes >= 1);
+        }
+
+        while (WOLFSENTRY_ERROR_CODE_IS(publish_ret = wolfsentry_context_publisher_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&publisher)), BUSY))
+            usleep(100);
+        WOLFSENTRY_EXIT_ON_FAILURE(publish_ret);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, probe_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+#undef N_PUBLISHER_READERS
+#undef N_PUBLISHES
     }
+#endif /* WOLFSENTRY_THREADSAFE */
 
+    /* metrics snapshot, and its OpenMetrics rendering.  a known number of
+     * accepts and rejects is dispatched between two snapshots, under an event
+     * whose label needs escaping.
+     */
     {
-        int new_commendable_count;
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_increment_commendable_count(
-                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
-                                       route_ref,
-                                       123,
-                                       &new_commendable_count));
-        WOLFSENTRY_EXIT_ON_FALSE(new_commendable_count == 123);
-    }
+        static const char escaped_event_label[] = "metrics \"probe\"\\\nevent";
+        struct wolfsentry_metrics *metrics_before, *metrics;
+        char *text;
+        char expected_line[128];
+        size_t text_len = 0, rendered_len;
+        wolfsentry_ent_id_t accept_id, reject_id;
+        unsigned int i;
 
-    WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
-        OVERFLOW_AVERTED,
-        wolfsentry_route_increment_commendable_count(
-            WOLFSENTRY_CONTEXT_ARGS_OUT,
-            route_ref,
-            -124,
-            NULL));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        remote.sa.sa_port = 32100;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags | WOLFSENTRY_ROUTE_FLAG_GREENLISTED, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, &accept_id, &action_results));
+        remote.sa.sa_port = 32101;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, &reject_id, &action_results));
 
-    WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(
-        OVERFLOW_AVERTED,
-        wolfsentry_route_increment_commendable_count(
-            WOLFSENTRY_CONTEXT_ARGS_OUT,
-            route_ref,
-            65536 - 123,
-            NULL));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_metrics_snapshot(WOLFSENTRY_CONTEXT_ARGS_OUT, 0 /* max_top_routes */, &metrics_before));
 
-    {
-        int new_commendable_count;
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_increment_commendable_count(
-                                       WOLFSENTRY_CONTEXT_ARGS_OUT,
-                                       route_ref,
-                                       1,
-                                       &new_commendable_count));
-        WOLFSENTRY_EXIT_ON_FALSE(new_commendable_count == 124);
-    }
+        remote.sa.sa_port = 32100;
+        for (i = 0; i < 3; ++i) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(route_id == accept_id);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_MASKIN_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT|WOLFSENTRY_ACTION_RES_REJECT|WOLFSENTRY_ACTION_RES_FALLTHROUGH) == WOLFSENTRY_ACTION_RES_ACCEPT);
+        }
+        remote.sa.sa_port = 32101;
+        for (i = 0; i < 2; ++i) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(route_id == reject_id);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_MASKIN_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT|WOLFSENTRY_ACTION_RES_REJECT|WOLFSENTRY_ACTION_RES_FALLTHROUGH) == WOLFSENTRY_ACTION_RES_REJECT);
+        }
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(
-                                   WOLFSENTRY_CONTEXT_ARGS_OUT,
-                                   route_ref,
-                                   NULL /* action_results */));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_metrics_snapshot(WOLFSENTRY_CONTEXT_ARGS_OUT, 3 /* max_top_routes */, &metrics));
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_dispatches - metrics_before->n_dispatches == 5);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_accepts - metrics_before->n_accepts == 3);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_rejects - metrics_before->n_rejects == 2);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_fallthroughs == metrics_before->n_fallthroughs);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_route_inserts == metrics_before->n_route_inserts);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_route_deletes == metrics_before->n_route_deletes);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_route_purges > 0);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_routes == wolfsentry->routes->header.n_ents);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_metrics_free(WOLFSENTRY_CONTEXT_ARGS_OUT, metrics_before));
+
+        for (i = 0; i < metrics->n_events; ++i) {
+            if ((metrics->events[i].label_len == sizeof escaped_event_label - 1) &&
+                (memcmp(metrics->events[i].label, escaped_event_label, sizeof escaped_event_label - 1) == 0))
+                break;
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(i < metrics->n_events);
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->events[i].hits == 5);
+
+        WOLFSENTRY_EXIT_ON_FALSE(metrics->n_top_routes == (metrics->n_routes < 3 ? metrics->n_routes : 3));
+        for (i = 1; i < metrics->n_top_routes; ++i)
+            WOLFSENTRY_EXIT_ON_FALSE(metrics->top_routes[i - 1].hits >= metrics->top_routes[i].hits);
+
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUFFER_TOO_SMALL, wolfsentry_metrics_render_openmetrics(metrics, NULL, &text_len));
+        WOLFSENTRY_EXIT_ON_FALSE(text_len > 0);
+        text = (char *)malloc(text_len);
+        WOLFSENTRY_EXIT_ON_FALSE(text != NULL);
+        rendered_len = text_len;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_metrics_render_openmetrics(metrics, text, &rendered_len));
+        WOLFSENTRY_EXIT_ON_FALSE(rendered_len == text_len - 1);
+        WOLFSENTRY_EXIT_ON_FALSE(strncmp(text, "# TYPE wolfsentry_dispatches counter\n# HELP wolfsentry_dispatches Route event dispatches.\n", strlen("# TYPE wolfsentry_dispatches counter\n# HELP wolfsentry_dispatches Route event dispatches.\n")) == 0);
+        snprintf(expected_line, sizeof expected_line, "\nwolfsentry_dispatches_total %lu\n", (unsigned long)metrics->n_dispatches);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, expected_line) != NULL);
+        snprintf(expected_line, sizeof expected_line, "\nwolfsentry_decisions_total{decision=\"accept\"} %lu\n", (unsigned long)metrics->n_accepts);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, expected_line) != NULL);
+        snprintf(expected_line, sizeof expected_line, "\nwolfsentry_decisions_total{decision=\"reject\"} %lu\n", (unsigned long)metrics->n_rejects);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, expected_line) != NULL);
+        snprintf(expected_line, sizeof expected_line, "\nwolfsentry_fallthroughs_total %lu\n", (unsigned long)metrics->n_fallthroughs);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, expected_line) != NULL);
+        snprintf(expected_line, sizeof expected_line, "\nwolfsentry_routes %lu\n", (unsigned long)metrics->n_routes);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, expected_line) != NULL);
+        /* the quote, backslash, and newline in the label are escaped. */
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(text, "\nwolfsentry_event_hits_total{event=\"metrics \\\"probe\\\"\\\\\\nevent\"} 5\n") != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(strcmp(text + rendered_len - strlen("# EOF\n"), "# EOF\n") == 0);
+        free(text);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_metrics_free(WOLFSENTRY_CONTEXT_ARGS_OUT, metrics));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, accept_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, reject_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(WOLFSENTRY_CONTEXT_ARGS_OUT, escaped_event_label, WOLFSENTRY_LENGTH_NULL_TERMINATED, &action_results));
+    }
 
     /* leave the route in the table, to be cleaned up by wolfsentry_shutdown(). */
 
@@ -1833,6 +3091,66 @@ static int test_static_routes (void) {
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&wolfsentry)));
 
+#if defined(WOLFSENTRY_SLAB_ALLOCATOR) && defined(WOLFSENTRY_MALLOC_BUILTINS) && defined(WOLFSENTRY_CLOCK_BUILTINS)
+    /* run route churn on a context allocating from the slab allocator. */
+    {
+        struct wolfsentry_host_platform_interface slab_hpi;
+        struct wolfsentry_slab_stats stats;
+        wolfsentry_ent_id_t slab_ids[64];
+        byte *p;
+        int i;
+
+        memset(&slab_hpi, 0, sizeof slab_hpi);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_slab_allocator_init(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(NULL /* backing */), &slab_hpi.allocator));
+
+        /* small blocks grow in place within their size class, and move when they outgrow it. */
+        p = (byte *)slab_hpi.allocator.malloc(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(slab_hpi.allocator.context), 20);
+        WOLFSENTRY_EXIT_ON_TRUE(p == NULL);
+        memset(p, 0x5a, 20);
+        WOLFSENTRY_EXIT_ON_FALSE(slab_hpi.allocator.realloc(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(slab_hpi.allocator.context), p, 28) == p);
+        p = (byte *)slab_hpi.allocator.realloc(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(slab_hpi.allocator.context), p, 4096);
+        WOLFSENTRY_EXIT_ON_TRUE(p == NULL);
+        WOLFSENTRY_EXIT_ON_FALSE((p[0] == 0x5a) && (p[19] == 0x5a));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_slab_allocator_get_stats(&slab_hpi.allocator, &stats));
+        WOLFSENTRY_EXIT_ON_FALSE((stats.n_slab_allocs == 1) && (stats.n_slab_frees == 1) && (stats.n_oversize_allocs == 1));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_slab_allocator_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&slab_hpi.allocator)), BUSY));
+        slab_hpi.allocator.free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(slab_hpi.allocator.context), p);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(
+            wolfsentry_init_ex(
+                wolfsentry_build_settings,
+                WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&slab_hpi),
+                &config,
+                &wolfsentry,
+                WOLFSENTRY_INIT_FLAG_NONE));
+
+        flags = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
+        for (i = 0; i < (int)length_of_array(slab_ids); ++i) {
+            byte slab_addr[4];
+            memcpy(slab_addr, "\12\0\0\0", sizeof slab_addr);
+            slab_addr[3] = (byte)i;
+            memcpy(remote.sa.addr, slab_addr, sizeof remote.addr_buf);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &slab_ids[i], &action_results));
+        }
+        for (i = 0; i < (int)length_of_array(slab_ids); i += 2)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, slab_ids[i], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_slab_allocator_get_stats(&slab_hpi.allocator, &stats));
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_slab_allocs > stats.n_slab_frees);
+        WOLFSENTRY_EXIT_ON_FALSE((stats.n_chunks > 0) && (stats.bytes_reserved > 0) && (stats.bytes_in_use > 0));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&wolfsentry)));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_slab_allocator_get_stats(&slab_hpi.allocator, &stats));
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_slab_allocs == stats.n_slab_frees);
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_oversize_allocs == stats.n_oversize_frees);
+        WOLFSENTRY_EXIT_ON_FALSE(stats.bytes_in_use == 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_slab_allocator_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&slab_hpi.allocator)));
+        WOLFSENTRY_EXIT_ON_TRUE(slab_hpi.allocator.malloc != NULL);
+    }
+#endif /* WOLFSENTRY_SLAB_ALLOCATOR && WOLFSENTRY_MALLOC_BUILTINS && WOLFSENTRY_CLOCK_BUILTINS */
+
     WOLFSENTRY_EXIT_ON_FAILURE(WOLFSENTRY_THREAD_TAILER(WOLFSENTRY_THREAD_FLAG_NONE));
 
     WOLFSENTRY_RETURN_OK;
@@ -1874,6 +3192,54 @@ static wolfsentry_errcode_t wolfsentry_action_dummy_callback(
     WOLFSENTRY_RETURN_OK;
 }
 
+struct deferred_test_tally {
+    int n_inline;
+    int n_deferred;
+    wolfsentry_port_t last_remote_port;
+};
+
+static wolfsentry_errcode_t deferred_test_callback(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_action *action,
+    void *handler_context,
+    void *caller_arg,
+    const struct wolfsentry_event *event,
+    wolfsentry_action_type_t action_type,
+    const struct wolfsentry_route *target_route,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *rule_route,
+    wolfsentry_action_res_t *action_results)
+{
+    struct deferred_test_tally *tally = (struct deferred_test_tally *)handler_context;
+    const struct wolfsentry_deferred_action *record = (const struct wolfsentry_deferred_action *)caller_arg;
+
+    wolfsentry_route_flags_t rule_flags;
+    struct wolfsentry_route_exports rule_exports;
+
+    (void)action_type;
+    (void)action_results;
+
+    if (route_table != NULL) {
+        ++tally->n_inline;
+        WOLFSENTRY_RETURN_OK;
+    }
+
+    /* drained -- the routes are a stand-in rebuilt from the record. */
+    if ((record == NULL) || (record->action != action) || (event != NULL) || (rule_route == NULL) || (target_route != rule_route))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_route_get_flags(rule_route, &rule_flags));
+    if (WOLFSENTRY_CHECK_BITS(rule_flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE) ||
+        (wolfsentry_get_object_id(rule_route) != record->rule_route_id) ||
+        (wolfsentry_route_parent_event(rule_route) != NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_RERETURN_IF_ERROR(wolfsentry_route_export(WOLFSENTRY_CONTEXT_ARGS_OUT, rule_route, &rule_exports));
+    if ((rule_exports.remote.addr_len != record->remote.addr_len) ||
+        (memcmp(rule_exports.remote_address, record->remote.addr, WOLFSENTRY_BITS_TO_BYTES(record->remote.addr_len)) != 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    ++tally->n_deferred;
+    tally->last_remote_port = rule_exports.remote.sa_port;
+    WOLFSENTRY_RETURN_OK;
+}
 
 static int test_dynamic_rules (void) {
 
@@ -2473,6 +3839,256 @@ static int test_dynamic_rules (void) {
             "del_from_greenlist",
             -1));
 
+    /* the compiled action vector follows the list.  disabled actions stay in
+     * it, and are skipped at dispatch.
+     */
+    {
+        struct wolfsentry_event *event;
+        struct wolfsentry_action *action;
+        wolfsentry_action_flags_t flags_before, flags_after;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, "match_side_effect_demo", -1, &event));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, "check_counts", -1, &action));
+
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector_len == 2);
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector[1].action == action);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_EVENT_HAS_ACTIONS(event, WOLFSENTRY_ACTION_TYPE_MATCH));
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_EVENT_HAS_ACTIONS(event, WOLFSENTRY_ACTION_TYPE_POST));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_update_flags(action, WOLFSENTRY_ACTION_FLAG_DISABLED, WOLFSENTRY_ACTION_FLAG_NONE, &flags_before, &flags_after));
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector_len == 2);
+        WOLFSENTRY_EXIT_ON_FALSE(strcmp(wolfsentry_action_get_label(event->match_action_list.vector[0].action), "add_to_greenlist") == 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(
+            wolfsentry_event_action_delete(
+                WOLFSENTRY_CONTEXT_ARGS_OUT,
+                "match_side_effect_demo",
+                -1,
+                WOLFSENTRY_ACTION_TYPE_MATCH,
+                "add_to_greenlist",
+                -1));
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector_len == 1);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_update_flags(action, WOLFSENTRY_ACTION_FLAG_NONE, WOLFSENTRY_ACTION_FLAG_DISABLED, &flags_before, &flags_after));
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector_len == 1);
+        WOLFSENTRY_EXIT_ON_FALSE(event->match_action_list.vector[0].action == action);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_EVENT_HAS_ACTIONS(event, WOLFSENTRY_ACTION_TYPE_MATCH));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, action, NULL /* action_results */));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, event, NULL /* action_results */));
+    }
+
+    /* deferrable actions run inline until a ring is set up, then are queued
+     * for wolfsentry_deferred_actions_drain(), with overflow dropped.
+     */
+    {
+        static struct deferred_test_tally tally;
+        struct wolfsentry_deferred_action_stats stats;
+        unsigned int n_drained;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_ent_id_t route_id;
+        wolfsentry_route_flags_t flags = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
+        int i;
+        struct {
+            struct wolfsentry_sockaddr sa;
+            byte addr_buf[4];
+        } remote, local;
+
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        remote.sa.sa_port = 12345;
+        local.sa.sa_port = 443;
+        remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+        remote.sa.interface = local.sa.interface = 1;
+        memcpy(remote.sa.addr,"\12\13\14\15",sizeof remote.addr_buf);
+        memcpy(local.sa.addr,"\300\250\1\1",sizeof local.addr_buf);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_demo", -1, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_tally", -1, WOLFSENTRY_ACTION_FLAG_DEFERRABLE, deferred_test_callback, &tally, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_action_append(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_demo", -1, WOLFSENTRY_ACTION_TYPE_MATCH, "deferred_tally", -1));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, flags, "deferred_demo", -1 /* event_label_len */, &id, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 1);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_deferred_actions_drain(WOLFSENTRY_CONTEXT_ARGS_OUT, 0 /* max_records */, &n_drained), ITEM_NOT_FOUND));
+
+        /* an action disabled with wolfsentry_action_update_flags() isn't
+         * called on the next dispatch, and is called again once reenabled.
+         */
+        {
+            struct wolfsentry_action *action;
+            wolfsentry_action_flags_t flags_before, flags_after;
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_tally", -1, &action));
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_update_flags(action, WOLFSENTRY_ACTION_FLAG_DISABLED, WOLFSENTRY_ACTION_FLAG_NONE, &flags_before, &flags_after));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 1);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_update_flags(action, WOLFSENTRY_ACTION_FLAG_NONE, WOLFSENTRY_ACTION_FLAG_DISABLED, &flags_before, &flags_after));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 2);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, action, NULL /* action_results */));
+        }
+
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_deferred_actions_init(WOLFSENTRY_CONTEXT_ARGS_OUT, 3, WOLFSENTRY_DEFERRED_OVERFLOW_DROP), INVALID_ARG));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_init(WOLFSENTRY_CONTEXT_ARGS_OUT, 4, WOLFSENTRY_DEFERRED_OVERFLOW_DROP));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_deferred_actions_init(WOLFSENTRY_CONTEXT_ARGS_OUT, 4, WOLFSENTRY_DEFERRED_OVERFLOW_DROP), ITEM_ALREADY_PRESENT));
+
+        for (i = 0; i < 6; ++i)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 2);
+        WOLFSENTRY_EXIT_ON_FALSE(tally.n_deferred == 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_drain(WOLFSENTRY_CONTEXT_ARGS_OUT, 3 /* max_records */, &n_drained));
+        WOLFSENTRY_EXIT_ON_FALSE(n_drained == 3);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_drain(WOLFSENTRY_CONTEXT_ARGS_OUT, 0 /* max_records */, &n_drained));
+        WOLFSENTRY_EXIT_ON_FALSE(n_drained == 1);
+        WOLFSENTRY_EXIT_ON_FALSE(tally.n_deferred == 4);
+        WOLFSENTRY_EXIT_ON_FALSE(tally.last_remote_port == 12345);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_get_stats(WOLFSENTRY_CONTEXT_ARGS_OUT, &stats));
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_enqueued == 4);
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_drained == 4);
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped == 2);
+        WOLFSENTRY_EXIT_ON_FALSE(stats.n_handler_errors == 0);
+
+        /* builtins can't be made deferrable. */
+        {
+            struct wolfsentry_action *action;
+            wolfsentry_action_flags_t flags_before, flags_after;
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_BUILTIN_LABEL_PREFIX "track-peer-v1", -1, &action));
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_action_update_flags(action, WOLFSENTRY_ACTION_FLAG_DEFERRABLE, WOLFSENTRY_ACTION_FLAG_NONE, &flags_before, &flags_after), NOT_PERMITTED));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_get_flags(action, &flags_after));
+            WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(flags_after, WOLFSENTRY_ACTION_FLAG_DEFERRABLE));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, action, NULL /* action_results */));
+        }
+
+        /* leave a record queued, to be released by wolfsentry_shutdown(). */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+    }
+
+    /* with no drainer running, overflow under _RUN_INLINE, and under
+     * _YIELD_THEN_RUN_INLINE once its bounded wait runs out, calls the handler
+     * inline, and nothing is dropped.  each policy gets its own context, as a ring is set up once.
+     */
+    {
+        static const wolfsentry_deferred_overflow_policy_t policies[] = { WOLFSENTRY_DEFERRED_OVERFLOW_RUN_INLINE, WOLFSENTRY_DEFERRED_OVERFLOW_YIELD_THEN_RUN_INLINE };
+        struct wolfsentry_context *policy_context;
+        static struct deferred_test_tally tally;
+        struct wolfsentry_deferred_action_stats stats;
+        unsigned int n_drained;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_ent_id_t route_id;
+        wolfsentry_route_flags_t flags = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
+        size_t p;
+        int i;
+        struct {
+            struct wolfsentry_sockaddr sa;
+            byte addr_buf[4];
+        } remote, local;
+
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        remote.sa.sa_port = 12345;
+        local.sa.sa_port = 443;
+        remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+        remote.sa.interface = local.sa.interface = 1;
+        memcpy(remote.sa.addr,"\12\13\14\15",sizeof remote.addr_buf);
+        memcpy(local.sa.addr,"\300\250\1\1",sizeof local.addr_buf);
+
+        for (p = 0; p < length_of_array(policies); ++p) {
+            memset(&tally, 0, sizeof tally);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(
+                wolfsentry_init_ex(
+                    wolfsentry_build_settings,
+                    WOLFSENTRY_CONTEXT_ARGS_OUT_EX(WOLFSENTRY_TEST_HPI),
+                    &config,
+                    &policy_context,
+                    WOLFSENTRY_INIT_FLAG_NONE));
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), "deferred_demo", -1, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), "deferred_tally", -1, WOLFSENTRY_ACTION_FLAG_DEFERRABLE, deferred_test_callback, &tally, &id));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_action_append(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), "deferred_demo", -1, WOLFSENTRY_ACTION_TYPE_MATCH, "deferred_tally", -1));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), NULL /* caller_arg */, &remote.sa, &local.sa, flags, "deferred_demo", -1 /* event_label_len */, &id, &action_results));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_init(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), 2, policies[p]));
+
+            for (i = 0; i < 5; ++i)
+                WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 3);
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_deferred == 0);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_drain(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), 0 /* max_records */, &n_drained));
+            WOLFSENTRY_EXIT_ON_FALSE(n_drained == 2);
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_deferred == 2);
+
+            /* with room made, dispatch queues again. */
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */, &route_id, &inexact_matches, &action_results));
+            WOLFSENTRY_EXIT_ON_FALSE(tally.n_inline == 3);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_drain(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), 0 /* max_records */, &n_drained));
+            WOLFSENTRY_EXIT_ON_FALSE(n_drained == 1);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_deferred_actions_get_stats(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(policy_context), &stats));
+            WOLFSENTRY_EXIT_ON_FALSE(stats.n_enqueued == 3);
+            WOLFSENTRY_EXIT_ON_FALSE(stats.n_drained == 3);
+            WOLFSENTRY_EXIT_ON_FALSE(stats.n_run_inline == 3);
+            WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped == 0);
+            WOLFSENTRY_EXIT_ON_FALSE(stats.n_handler_errors == 0);
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&policy_context)));
+        }
+    }
+
+#ifdef WOLFSENTRY_INSTRUMENT
+    /* latency histograms. */
+    {
+        struct wolfsentry_histogram hist;
+        unsigned int i;
+        uint64_t v;
+
+        /* bucket bounds are monotonic, and each value lands in a bucket whose bound covers it. */
+        for (i = 1; i < WOLFSENTRY_HISTOGRAM_BUCKETS; ++i)
+            WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_histogram_bucket_value(i) > wolfsentry_histogram_bucket_value(i - 1));
+        memset(&hist, 0, sizeof hist);
+        for (v = 1; v <= 1000; ++v) {
+            for (i = 0; wolfsentry_histogram_bucket_value(i) < v; ++i) {}
+            ++hist.buckets[i];
+            ++hist.count;
+            hist.sum += v;
+        }
+        hist.max = 1000;
+        v = wolfsentry_histogram_percentile(&hist, 500000);
+        WOLFSENTRY_EXIT_ON_FALSE((v >= 500) && (v <= 500 + (500 >> WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS)));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_histogram_percentile(&hist, 1000000) == 1000);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_INSTRUMENT_DISPATCH_TIME, &hist, 0 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count >= 8);
+        WOLFSENTRY_EXIT_ON_FALSE(hist.sum >= hist.max);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_INSTRUMENT_LOOKUP_TIME, &hist, 0 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count >= 8);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_INSTRUMENT_LOOKUP_COMPARES, &hist, 0 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count >= 8);
+        WOLFSENTRY_EXIT_ON_FALSE(hist.max >= 1);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_instrument_get_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_INSTRUMENT_HISTOGRAM_COUNT, &hist, 0 /* reset_p */), INVALID_ARG));
+
+        /* the inline call and the 4 drained records of deferred_tally. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_action_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_tally", -1, &hist, 1 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count == 5);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_action_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, "deferred_tally", -1, &hist, 0 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_instrument_get_action_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, "no_such_action", -1, &hist, 0 /* reset_p */), ITEM_NOT_FOUND));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_reset(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_instrument_get_histogram(WOLFSENTRY_CONTEXT_ARGS_OUT, WOLFSENTRY_INSTRUMENT_DISPATCH_TIME, &hist, 0 /* reset_p */));
+        WOLFSENTRY_EXIT_ON_FALSE(hist.count == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_histogram_percentile(&hist, 990000) == 0);
+    }
+#endif /* WOLFSENTRY_INSTRUMENT */
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&wolfsentry)));
 
@@ -3202,6 +4818,122 @@ static int test_user_addr_families (void) {
 #define PRIVATE_DATA_SIZE 32
 #define PRIVATE_DATA_ALIGNMENT 16
 
+/* builds a fully specified target from the given addresses, filling the bits
+ * beyond each prefix with fill.
+ */
+static void lpm_target_addr(byte *dest, const byte *src, int prefix_bits, int addr_bits, byte fill) {
+    int i;
+    for (i = 0; i < (int)WOLFSENTRY_BITS_TO_BYTES((unsigned int)addr_bits); ++i) {
+        int bits_from_src = prefix_bits - (i * BITS_PER_BYTE);
+        if (bits_from_src >= BITS_PER_BYTE)
+            dest[i] = src[i];
+        else if (bits_from_src <= 0)
+            dest[i] = fill;
+        else {
+            byte mask = (byte)(0xffU << (BITS_PER_BYTE - bits_from_src));
+            dest[i] = (byte)((src[i] & mask) | (fill & ~mask));
+        }
+    }
+}
+
+/* for targets derived from each route in the table, the LPM-indexed lookup
+ * must find the same route, with the same inexact matches, as the table scan.
+ */
+static int lpm_lookups_match_scan(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_route_table *table) {
+    static const byte fills[] = { 0x00, 0xff, 0x5a };
+    static const wolfsentry_route_flags_t directions[] = { WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT };
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[WOLFSENTRY_MAX_ADDR_BYTES];
+    } remote, local;
+    struct wolfsentry_cursor *cursor;
+    struct wolfsentry_route *route;
+    struct wolfsentry_route_exports route_exports;
+    wolfsentry_errcode_t ret;
+    int n_targets = 0;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_start(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &cursor));
+    for (ret = wolfsentry_route_table_iterate_current(table, cursor, &route);
+         ret >= 0;
+         ret = wolfsentry_route_table_iterate_next(table, cursor, &route))
+    {
+        wolfsentry_addr_family_t family;
+        wolfsentry_addr_bits_t addr_bits;
+        size_t f, d;
+        int swap;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_export(WOLFSENTRY_CONTEXT_ARGS_OUT, route, &route_exports));
+
+        family = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) ? AF_INET : route_exports.sa_family;
+        if (wolfsentry_addr_family_max_addr_bits(WOLFSENTRY_CONTEXT_ARGS_OUT, family, &addr_bits) < 0)
+            addr_bits = (route_exports.remote.addr_len > route_exports.local.addr_len) ? route_exports.remote.addr_len : route_exports.local.addr_len;
+        if ((addr_bits == 0) || (addr_bits > WOLFSENTRY_MAX_ADDR_BITS))
+            continue;
+
+        memset(&remote, 0, sizeof remote);
+        memset(&local, 0, sizeof local);
+        remote.sa.sa_family = local.sa.sa_family = family;
+        remote.sa.sa_proto = local.sa.sa_proto = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) ? IPPROTO_TCP : route_exports.sa_proto;
+        remote.sa.sa_port = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD) ? 12345 : route_exports.remote.sa_port;
+        local.sa.sa_port = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD) ? 443 : route_exports.local.sa_port;
+        remote.sa.interface = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD) ? 1 : route_exports.remote.interface;
+        local.sa.interface = WOLFSENTRY_CHECK_BITS(route_exports.flags, WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD) ? 1 : route_exports.local.interface;
+        remote.sa.addr_len = local.sa.addr_len = addr_bits;
+
+        /* the route's own addresses, then swapped, so that remote-indexed
+         * routes are also probed through the local trie and vice versa.
+         */
+        for (swap = 0; swap <= 1; ++swap) {
+            const byte *remote_src = swap ? route_exports.local_address : route_exports.remote_address;
+            const byte *local_src = swap ? route_exports.remote_address : route_exports.local_address;
+            int remote_prefix = swap ? route_exports.local.addr_len : route_exports.remote.addr_len;
+            int local_prefix = swap ? route_exports.remote.addr_len : route_exports.local.addr_len;
+
+            if (remote_prefix > addr_bits)
+                remote_prefix = addr_bits;
+            if (local_prefix > addr_bits)
+                local_prefix = addr_bits;
+
+            for (f = 0; f < length_of_array(fills); ++f) {
+                lpm_target_addr(remote.sa.addr, remote_src, remote_prefix, addr_bits, fills[f]);
+                lpm_target_addr(local.sa.addr, local_src, local_prefix, addr_bits, fills[f]);
+
+                for (d = 0; d < length_of_array(directions); ++d) {
+                    struct wolfsentry_route *indexed_route = NULL, *scanned_route = NULL;
+                    wolfsentry_route_flags_t indexed_inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE, scanned_inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
+                    wolfsentry_errcode_t indexed_ret, scanned_ret;
+
+                    table->lpm_lookup_disabled = 0;
+                    indexed_ret = wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &remote.sa, &local.sa, directions[d], NULL /* event_label */, 0 /* event_label_len */, 0 /* exact_p */, &indexed_inexact_matches, &indexed_route);
+                    table->lpm_lookup_disabled = 1;
+                    scanned_ret = wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &remote.sa, &local.sa, directions[d], NULL /* event_label */, 0 /* event_label_len */, 0 /* exact_p */, &scanned_inexact_matches, &scanned_route);
+                    table->lpm_lookup_disabled = 0;
+
+                    WOLFSENTRY_EXIT_ON_FALSE((indexed_ret >= 0) == (scanned_ret >= 0));
+                    if (indexed_ret < 0) {
+                        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(indexed_ret, ITEM_NOT_FOUND));
+                        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(scanned_ret, ITEM_NOT_FOUND));
+                    } else {
+                        WOLFSENTRY_EXIT_ON_FALSE(indexed_route == scanned_route);
+                        WOLFSENTRY_EXIT_ON_FALSE(indexed_inexact_matches == scanned_inexact_matches);
+                        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, indexed_route, NULL /* action_results */));
+                        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, scanned_route, NULL /* action_results */));
+                    }
+                    ++n_targets;
+                }
+            }
+        }
+    }
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_end(WOLFSENTRY_CONTEXT_ARGS_OUT, table, &cursor));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+    WOLFSENTRY_EXIT_ON_FALSE(n_targets > 0);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 static int test_json(const char *fname, const char *extra_fname) {
     wolfsentry_errcode_t ret;
     struct wolfsentry_context *wolfsentry;
@@ -3333,6 +5065,63 @@ static int test_json(const char *fname, const char *extra_fname) {
         }
     }
 
+    {
+        /* a duplicate static route is reported at its own position, and the
+         * routes ahead of it in the batch are left inserted.
+         */
+        static const char *dup_route_json =
+            "{ \"wolfsentry-config-version\" : 1, \"static-routes-insert\" : [\n"
+            "{ \"family\" : \"inet\", \"direction-in\" : true, \"remote\" : { \"address\" : \"10.20.30.1\" } },\n"
+            "{ \"family\" : \"inet\", \"direction-in\" : true, \"remote\" : { \"address\" : \"10.20.30.2\" } },\n"
+            "{ \"family\" : \"inet\", \"direction-in\" : true, \"remote\" : { \"address\" : \"10.20.30.1\" } },\n"
+            "{ \"family\" : \"inet\", \"direction-in\" : true, \"remote\" : { \"address\" : \"10.20.30.3\" } }\n"
+            "] }";
+        static const byte dup_route_net[3] = { 10, 20, 30 };
+        char err_buf[512];
+        wolfsentry_ent_id_t dup_route_ids[3];
+        int n_dup_routes = 0, n;
+        struct wolfsentry_cursor *cursor;
+        struct wolfsentry_route *route;
+        struct wolfsentry_route_exports route_exports;
+        wolfsentry_action_res_t action_results;
+        wolfsentry_hitcount_t n_ents_before = wolfsentry->routes->header.n_ents;
+
+        ret = wolfsentry_config_json_oneshot(
+            WOLFSENTRY_CONTEXT_ARGS_OUT,
+            (const unsigned char *)dup_route_json,
+            strlen(dup_route_json),
+            WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH,
+            err_buf,
+            sizeof err_buf);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT));
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(err_buf, "line 4,") != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(strstr(err_buf, "static route #2,") != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before + 2);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_mutex(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_start(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, &cursor));
+        for (ret = wolfsentry_route_table_iterate_current(wolfsentry->routes, cursor, &route);
+             ret >= 0;
+             ret = wolfsentry_route_table_iterate_next(wolfsentry->routes, cursor, &route)) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_export(WOLFSENTRY_CONTEXT_ARGS_OUT, route, &route_exports));
+            if ((route_exports.sa_family == WOLFSENTRY_AF_INET) &&
+                (route_exports.remote.addr_len == 32) &&
+                (memcmp(route_exports.remote_address, dup_route_net, sizeof dup_route_net) == 0))
+            {
+                WOLFSENTRY_EXIT_ON_FALSE(n_dup_routes < (int)length_of_array(dup_route_ids));
+                WOLFSENTRY_EXIT_ON_FALSE((route_exports.remote_address[3] == 1) || (route_exports.remote_address[3] == 2));
+                dup_route_ids[n_dup_routes++] = route->header.id;
+            }
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_end(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, &cursor));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FALSE(n_dup_routes == 2);
+
+        for (n = 0; n < n_dup_routes; ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, dup_route_ids[n], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_ents_before);
+    }
+
     {
         struct wolfsentry_route_table *main_routes, main_routes_copy;
         const char *value = NULL;
@@ -3467,6 +5256,59 @@ static int test_json(const char *fname, const char *extra_fname) {
 
     WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(WOLFSENTRY_CONTEXT_ARGS_OUT, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 1));
 
+    /* the LPM index must agree with the table scan, for the configured routes
+     * and with added local-address, wildcard-family and single-direction
+     * routes.
+     */
+    {
+        static const struct {
+            wolfsentry_route_flags_t flags;
+            byte remote_addr[4], local_addr[4];
+            wolfsentry_addr_bits_t remote_len, local_len;
+        } extra_routes[] = {
+            { WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD,
+              { 0, 0, 0, 0 }, { 10, 0, 0, 0 }, 0, 8 },
+            { WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT | WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD,
+              { 10, 1, 0, 0 }, { 10, 1, 2, 0 }, 16, 24 },
+            { WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD,
+              { 10, 1, 2, 128 }, { 10, 0, 0, 0 }, 25, 8 },
+            { WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT | WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD,
+              { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, 0, 0 }
+        };
+        struct {
+            struct wolfsentry_sockaddr sa;
+            byte addr_buf[4];
+        } remote, local;
+        struct wolfsentry_route_table *main_routes;
+        wolfsentry_ent_id_t extra_route_ids[length_of_array(extra_routes)];
+        wolfsentry_action_res_t action_results;
+        size_t n;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_main_table(WOLFSENTRY_CONTEXT_ARGS_OUT, &main_routes));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(lpm_lookups_match_scan(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes));
+
+        memset(&remote, 0, sizeof remote);
+        memset(&local, 0, sizeof local);
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        local.sa.sa_port = 443;
+        for (n = 0; n < length_of_array(extra_routes); ++n) {
+            memcpy(remote.sa.addr, extra_routes[n].remote_addr, sizeof remote.addr_buf);
+            memcpy(local.sa.addr, extra_routes[n].local_addr, sizeof local.addr_buf);
+            remote.sa.addr_len = extra_routes[n].remote_len;
+            local.sa.addr_len = extra_routes[n].local_len;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, &remote.sa, &local.sa, extra_routes[n].flags, NULL /* event_label */, 0 /* event_label_len */, &extra_route_ids[n], &action_results));
+        }
+
+        WOLFSENTRY_EXIT_ON_FAILURE(lpm_lookups_match_scan(WOLFSENTRY_CONTEXT_ARGS_OUT, main_routes));
+
+        for (n = 0; n < length_of_array(extra_routes); ++n)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL /* caller_arg */, extra_route_ids[n], NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    }
+
     {
         struct wolfsentry_route_table *main_routes, main_routes_copy;
         struct wolfsentry_cursor *cursor;
@@ -3661,9 +5503,134 @@ static int test_json(const char *fname, const char *extra_fname) {
 
     {
         struct wolfsentry_context *ctx_clone;
+        struct wolfsentry_table_ent_header *i;
+        unsigned int n_found = 0;
 
         WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &ctx_clone, WOLFSENTRY_CLONE_FLAG_NONE));
+
+        /* the clone's route indexes are copied from the original's rather
+         * than rebuilt, and must give the same answers, in terms of the
+         * clone's own routes.
+         */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_shared(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        for (i = wolfsentry->routes->header.head; i; i = i->next) {
+            struct wolfsentry_route_exports exports;
+            WOLFSENTRY_SOCKADDR(WOLFSENTRY_MAX_ADDR_BITS) remote, local;
+            wolfsentry_route_flags_t flags, inexact_matches;
+            struct wolfsentry_route *route = NULL, *route2 = NULL;
+            wolfsentry_errcode_t ret2;
+
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_export(WOLFSENTRY_CONTEXT_ARGS_OUT, (const struct wolfsentry_route *)i, &exports));
+            memset(&remote, 0, sizeof remote);
+            memset(&local, 0, sizeof local);
+            remote.sa_family = local.sa_family = exports.sa_family;
+            remote.sa_proto = local.sa_proto = exports.sa_proto;
+            remote.sa_port = exports.remote.sa_port;
+            local.sa_port = exports.local.sa_port;
+            remote.addr_len = exports.remote.addr_len;
+            local.addr_len = exports.local.addr_len;
+            remote.interface = exports.remote.interface;
+            local.interface = exports.local.interface;
+            memcpy(remote.addr, exports.remote_address, WOLFSENTRY_BITS_TO_BYTES(remote.addr_len));
+            memcpy(local.addr, exports.local_address, WOLFSENTRY_BITS_TO_BYTES(local.addr_len));
+            flags = (exports.flags & WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN) ? WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN : WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT;
+
+            ret = wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, (const struct wolfsentry_sockaddr *)&remote, (const struct wolfsentry_sockaddr *)&local, flags, exports.parent_event_label, exports.parent_event_label_len, 0 /* exact_p */, &inexact_matches, &route);
+            ret2 = wolfsentry_route_get_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), ctx_clone->routes, (const struct wolfsentry_sockaddr *)&remote, (const struct wolfsentry_sockaddr *)&local, flags, exports.parent_event_label, exports.parent_event_label_len, 0 /* exact_p */, &inexact_matches, &route2);
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_DECODE_ERROR_CODE(ret) == WOLFSENTRY_ERROR_DECODE_ERROR_CODE(ret2));
+            if (ret < 0)
+                continue;
+            WOLFSENTRY_EXIT_ON_FALSE(route->header.id == route2->header.id);
+            WOLFSENTRY_EXIT_ON_FALSE(route2->header.parent_table == &ctx_clone->routes->header);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT, route, NULL /* action_results */));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_drop_reference(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), route2, NULL /* action_results */));
+            ++n_found;
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(WOLFSENTRY_CONTEXT_ARGS_OUT));
+        WOLFSENTRY_EXIT_ON_FALSE(n_found > 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&ctx_clone)));
+    }
+
+    /* binary snapshot of the JSON-loaded context, restored into a fresh
+     * context and over the live one, with each restoration saving back to the
+     * identical snapshot.
+     */
+    {
+        struct wolfsentry_context *ctx_clone;
+        byte *snapshot, *snapshot2;
+        size_t snapshot_len = 0, snapshot2_len;
+        wolfsentry_hitcount_t n_events = wolfsentry->events->header.n_ents;
+        wolfsentry_hitcount_t n_routes = wolfsentry->routes->header.n_ents;
+        wolfsentry_hitcount_t n_user_values = wolfsentry->user_values->header.n_ents;
+        wolfsentry_action_res_t default_policy, default_policy2;
+
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUFFER_TOO_SMALL, wolfsentry_context_save(WOLFSENTRY_CONTEXT_ARGS_OUT, NULL, &snapshot_len));
+        snapshot = (byte *)malloc(snapshot_len);
+        snapshot2 = (byte *)malloc(snapshot_len);
+        WOLFSENTRY_EXIT_ON_TRUE((snapshot == NULL) || (snapshot2 == NULL));
+        snapshot2_len = snapshot_len - 1;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BUFFER_TOO_SMALL, wolfsentry_context_save(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot, &snapshot2_len));
+        WOLFSENTRY_EXIT_ON_FALSE(snapshot2_len == snapshot_len);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_save(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot, &snapshot_len));
+        WOLFSENTRY_EXIT_ON_FALSE(snapshot_len == snapshot2_len);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_default_policy_get(WOLFSENTRY_CONTEXT_ARGS_OUT, wolfsentry->routes, &default_policy));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_OUT, &ctx_clone, WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), snapshot, snapshot_len));
+        WOLFSENTRY_EXIT_ON_FALSE(ctx_clone->events->header.n_ents == n_events);
+        WOLFSENTRY_EXIT_ON_FALSE(ctx_clone->routes->header.n_ents == n_routes);
+        WOLFSENTRY_EXIT_ON_FALSE(ctx_clone->user_values->header.n_ents == n_user_values);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_default_policy_get(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), ctx_clone->routes, &default_policy2));
+        WOLFSENTRY_EXIT_ON_FALSE(default_policy == default_policy2);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_save(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), snapshot2, &snapshot2_len));
+        WOLFSENTRY_EXIT_ON_FALSE(snapshot2_len == snapshot_len);
+        WOLFSENTRY_EXIT_ON_FALSE(memcmp(snapshot, snapshot2, snapshot_len) == 0);
+
+        /* a load leaves the caller's action inhibition as it found it. */
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(ctx_clone->config.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_inhibit_actions(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone)));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), snapshot, snapshot_len));
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(ctx_clone->config.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS));
+        WOLFSENTRY_EXIT_ON_FALSE(ctx_clone->routes->header.n_ents == n_routes);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_enable_actions(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone)));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(ctx_clone), snapshot, snapshot_len));
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(ctx_clone->config.config.flags, WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS));
+
         WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(WOLFSENTRY_CONTEXT_ARGS_OUT_EX(&ctx_clone)));
+
+        /* damaged, truncated, and foreign snapshots are refused, leaving the
+         * context untouched.  the header starts with the magic number, the
+         * format version, and the build settings, in that order.
+         */
+        snapshot2[snapshot_len - 1] ^= 0x80;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot2, snapshot_len));
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot, snapshot_len - 8));
+        memcpy(snapshot2, snapshot, snapshot_len);
+        snapshot2[0] ^= 0x01;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(BAD_VALUE, wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot2, snapshot_len));
+        memcpy(snapshot2, snapshot, snapshot_len);
+        snapshot2[sizeof(uint32_t)] ^= 0x01;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(LIB_MISMATCH, wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot2, snapshot_len));
+        memcpy(snapshot2, snapshot, snapshot_len);
+        snapshot2[2 * sizeof(uint32_t)] ^= 0x01;
+        WOLFSENTRY_EXIT_UNLESS_EXPECTED_FAILURE(LIB_MISMATCH, wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot2, snapshot_len));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events->header.n_ents == n_events);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_routes);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->user_values->header.n_ents == n_user_values);
+
+        /* the rest of the tests run against the restored context. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_load(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot, snapshot_len));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events->header.n_ents == n_events);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes->header.n_ents == n_routes);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->user_values->header.n_ents == n_user_values);
+        snapshot2_len = snapshot_len;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_save(WOLFSENTRY_CONTEXT_ARGS_OUT, snapshot2, &snapshot2_len));
+        WOLFSENTRY_EXIT_ON_FALSE(snapshot2_len == snapshot_len);
+        WOLFSENTRY_EXIT_ON_FALSE(memcmp(snapshot, snapshot2, snapshot_len) == 0);
+
+        free(snapshot);
+        free(snapshot2);
     }
 
     {
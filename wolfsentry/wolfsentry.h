@@ -52,7 +52,8 @@ struct wolfsentry_thread_context;
 
 typedef enum {
     WOLFSENTRY_INIT_FLAG_NONE = 0,
-    WOLFSENTRY_INIT_FLAG_LOCK_SHARED_ERROR_CHECKING = 1<<0
+    WOLFSENTRY_INIT_FLAG_LOCK_SHARED_ERROR_CHECKING = 1<<0,
+    WOLFSENTRY_INIT_FLAG_LOCK_READ_BIAS = 1<<1
 } wolfsentry_init_flags_t;
 
 #ifdef WOLFSENTRY_THREADSAFE
@@ -211,7 +212,8 @@ typedef enum {
     WOLFSENTRY_LOCK_FLAG_ABANDON_RESERVATION_TOO = 1<<6,
     WOLFSENTRY_LOCK_FLAG_AUTO_DOWNGRADE = 1<<7,
     WOLFSENTRY_LOCK_FLAG_READONLY = 1<<8,
-    WOLFSENTRY_LOCK_FLAG_RETAIN_SEMAPHORE = 1<<9
+    WOLFSENTRY_LOCK_FLAG_RETAIN_SEMAPHORE = 1<<9,
+    WOLFSENTRY_LOCK_FLAG_READ_BIAS = 1<<10 /* shared lockers use per-thread-hashed reader slots while no writer is active.  writers revoke the bias and wait for those readers to drain. */
 } wolfsentry_lock_flags_t;
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_init_thread_context(struct wolfsentry_thread_context *thread_context, wolfsentry_thread_flags_t init_thread_flags, void *user_context);
@@ -321,7 +323,8 @@ typedef enum {
 
 typedef enum {
     WOLFSENTRY_ACTION_FLAG_NONE       = 0U,
-    WOLFSENTRY_ACTION_FLAG_DISABLED   = 1U << 0U
+    WOLFSENTRY_ACTION_FLAG_DISABLED   = 1U << 0U,
+    WOLFSENTRY_ACTION_FLAG_DEFERRABLE = 1U << 1U /* with a deferred action ring, queued by dispatch for wolfsentry_deferred_actions_drain(). */
 } wolfsentry_action_flags_t;
 
 typedef enum {
@@ -448,7 +451,7 @@ struct wolfsentry_route_metadata_exports {
     wolfsentry_time_t insert_time;
     wolfsentry_time_t last_hit_time;
     wolfsentry_time_t last_penaltybox_time;
-    wolfsentry_time_t purge_after;
+    wolfsentry_time_t purge_after; /* advisory -- see wolfsentry_route_get_metadata(). */
     uint16_t connection_count;
     uint16_t derogatory_count;
     uint16_t commendable_count;
@@ -536,6 +539,43 @@ WOLFSENTRY_API_VOID wolfsentry_free_aligned(WOLFSENTRY_CONTEXT_ARGS_IN, void *pt
 WOLFSENTRY_API int _wolfsentry_get_n_mallocs(void);
 #endif
 
+#ifdef WOLFSENTRY_SLAB_ALLOCATOR
+
+/* the slab allocator.  a size-class allocator for the small fixed-size objects
+ * that wolfSentry allocates and frees at high rates (routes, table entries,
+ * lookup scratch), carving them from chunks obtained from a backing allocator.
+ * wolfsentry_slab_allocator_init() fills in a struct wolfsentry_allocator that
+ * can be passed to wolfsentry_init_ex() in the host platform interface.
+ * allocations too large for the size classes, and aligned allocations, are
+ * passed through to the backing allocator.  chunks are only returned to the
+ * backing allocator by wolfsentry_slab_allocator_shutdown(), which must follow
+ * wolfsentry_shutdown() of every context using the slab.
+ */
+
+struct wolfsentry_slab_stats {
+    uint64_t n_slab_allocs;
+    uint64_t n_slab_frees;
+    uint64_t n_oversize_allocs;
+    uint64_t n_oversize_frees;
+    uint64_t n_chunks;
+    size_t bytes_reserved; /* chunk bytes obtained from the backing allocator */
+    size_t bytes_in_use; /* slab block and oversize bytes currently allocated, including headers */
+};
+
+/* backing is the allocator the slab draws its chunks from.  if null, the
+ * builtin allocator is used.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_init(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(const struct wolfsentry_allocator *backing),
+    struct wolfsentry_allocator *slab_allocator);
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_shutdown(
+    WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_allocator *slab_allocator));
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_slab_allocator_get_stats(
+    const struct wolfsentry_allocator *slab_allocator,
+    struct wolfsentry_slab_stats *stats);
+
+#endif /* WOLFSENTRY_SLAB_ALLOCATOR */
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_get_time(struct wolfsentry_context *wolfsentry, wolfsentry_time_t *time_p);
 WOLFSENTRY_API wolfsentry_time_t wolfsentry_diff_time(struct wolfsentry_context *wolfsentry, wolfsentry_time_t later, wolfsentry_time_t earlier);
 WOLFSENTRY_API wolfsentry_time_t wolfsentry_add_time(struct wolfsentry_context *wolfsentry, wolfsentry_time_t start_time, wolfsentry_time_t time_interval);
@@ -544,6 +584,19 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_from_epoch_time(struct wolfsentry
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_interval_to_seconds(struct wolfsentry_context *wolfsentry, wolfsentry_time_t howlong, time_t *howlong_secs, long *howlong_nsecs);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_interval_from_seconds(struct wolfsentry_context *wolfsentry, time_t howlong_secs, long howlong_nsecs, wolfsentry_time_t *howlong);
 
+/* the time cache.  while it holds a nonzero time, route dispatch, insertion,
+ * and purging use it instead of calling the get_time callback.  the
+ * application keeps it current at the resolution it needs -- purge and
+ * penaltybox timing tolerate milliseconds -- by calling
+ * wolfsentry_time_cache_refresh() from a ticker, or once per batch of
+ * dispatches, or by setting a time it already has with
+ * wolfsentry_time_cache_set().  setting zero empties the cache, restoring a
+ * clock read on every use.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_time_cache_refresh(struct wolfsentry_context *wolfsentry);
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_time_cache_set(struct wolfsentry_context *wolfsentry, wolfsentry_time_t now);
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_get_time_cached(struct wolfsentry_context *wolfsentry, wolfsentry_time_t *time_p);
+
 #if defined(WOLFSENTRY_PROTOCOL_NAMES) || !defined(WOLFSENTRY_NO_JSON)
 WOLFSENTRY_API const char *wolfsentry_action_res_assoc_by_flag(wolfsentry_action_res_t res, unsigned int bit);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_res_assoc_by_name(const char *bit_name, size_t bit_name_len, wolfsentry_action_res_t *res);
@@ -658,6 +711,11 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_shutdown(WOLFSENTRY_CONTEXT_ARGS_
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_inhibit_actions(WOLFSENTRY_CONTEXT_ARGS_IN);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_enable_actions(WOLFSENTRY_CONTEXT_ARGS_IN);
 
+/* wolfsentry_context_clone() makes a deep copy -- every action, event, route
+ * and user value is copied, so the cost grows with the size of the context.
+ * there is no copy-on-write mode sharing objects between the original and the
+ * clone.
+ */
 typedef enum {
     WOLFSENTRY_CLONE_FLAG_NONE = 0U,
     WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION = 1U << 0U,
@@ -666,6 +724,45 @@ typedef enum {
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_clone(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_context **clone, wolfsentry_clone_flags_t flags);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_exchange(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_context *wolfsentry2);
 
+/* generation publishing, for reloading without blocking readers.  a publisher
+ * holds the current generation of a context.  readers bracket each use of it
+ * with wolfsentry_context_publisher_acquire() and
+ * wolfsentry_context_publisher_release() -- a few atomic operations, with no
+ * locks -- and use the acquired context with the usual API, releasing it only
+ * after they've unlocked it.  a reload builds the next generation as a
+ * separate context with the same host platform interface, and
+ * wolfsentry_context_publish() swaps it in with a single pointer store.  the
+ * mutex that wolfsentry_context_clone() leaves held on a clone is released
+ * when the publisher takes it over.
+ *
+ * the outgoing generation is freed once every reader that could have acquired
+ * it has released it -- by the publish itself if it's already idle, otherwise
+ * by wolfsentry_context_publisher_reclaim(), which returns BUSY until then.
+ * a publish also returns BUSY while the previous outgoing generation is still
+ * held.
+ *
+ * with WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES, the dynamic routes of
+ * the outgoing generation (those due to be purged) are copied into the new one
+ * just before the swap, with fresh IDs.  routes added to the outgoing
+ * generation after the swap, by readers still holding it, aren't carried over.
+ */
+typedef enum {
+    WOLFSENTRY_PUBLISH_FLAG_NONE = 0U,
+    WOLFSENTRY_PUBLISH_FLAG_MIGRATE_DYNAMIC_ROUTES = 1U << 0U
+} wolfsentry_publish_flags_t;
+
+struct wolfsentry_context_publisher;
+
+/* the publisher takes ownership of the passed context, as its first generation. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_new(WOLFSENTRY_CONTEXT_ARGS_IN, struct wolfsentry_context_publisher **publisher);
+/* frees the publisher and its generations, or returns BUSY if any are held. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_free(WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher **publisher));
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_acquire(struct wolfsentry_context_publisher *publisher, struct wolfsentry_context **wolfsentry, unsigned int *ticket);
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_release(struct wolfsentry_context_publisher *publisher, unsigned int ticket);
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publisher_reclaim(WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher *publisher));
+/* on success, the publisher takes ownership of new_generation. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_publish(WOLFSENTRY_CONTEXT_ARGS_IN_EX(struct wolfsentry_context_publisher *publisher), struct wolfsentry_context *new_generation, wolfsentry_publish_flags_t flags);
+
 #ifdef WOLFSENTRY_THREADSAFE
 
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_lock_mutex(
@@ -804,6 +901,30 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_insert_by_exports_and_check
     struct wolfsentry_route **route,
     wolfsentry_action_res_t *action_results);
 
+/* inserts n_routes routes under a single lock acquisition, sorting the batch
+ * and linking it into the table in one pass.  if any route is invalid or
+ * duplicates another, none are inserted.  insert actions run after all routes
+ * are linked; a route whose insert actions fail is removed, the rest remain,
+ * and the first such error is returned.  ids, if non-null, has n_routes slots,
+ * and receives the ID of each route inserted, or WOLFSENTRY_ENT_ID_NONE.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_insert_by_exports_into_table(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *route_table,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route_exports *route_exports,
+    size_t n_routes,
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_insert_by_exports(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    const struct wolfsentry_route_exports *route_exports,
+    size_t n_routes,
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_delete_from_table(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *route_table,
@@ -1000,6 +1121,74 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_inited_
     wolfsentry_route_flags_t *inexact_matches,
     wolfsentry_action_res_t *action_results);
 
+/* like wolfsentry_route_event_dispatch(), but with the trigger event passed as
+ * a handle, previously obtained with wolfsentry_event_get_reference() and held
+ * by the caller, sparing hot paths the label lookup on every dispatch.  if the
+ * event has since been deleted, or the context exchanged, ITEM_NOT_FOUND is
+ * returned (unless WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD is set), and the
+ * handle must be dropped and resolved again.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_event(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_event_with_inited_result(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
+/* like wolfsentry_route_event_dispatch(), but for callers that already know
+ * the current time, which is used for the route's hit time and penaltybox
+ * expiry in place of a clock read.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_at_time(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    wolfsentry_time_t now,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
+/* dispatch n_items traffic tuples against the main route table under a single
+ * lock acquisition, with the event resolved and the time fetched once for the
+ * whole batch.  each element of action_results is cleared before its dispatch.
+ * ids, inexact_matches, and item_results are optional, and if supplied, have
+ * n_items elements like the other arrays.  the per-item return codes go to
+ * item_results, and the return value is OK unless an item failed, in which
+ * case it's the first failure.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_batch(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    size_t n_items,
+    const struct wolfsentry_sockaddr * const *remotes,
+    const struct wolfsentry_sockaddr * const *locals,
+    const wolfsentry_route_flags_t *flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results,
+    wolfsentry_errcode_t *item_results);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     wolfsentry_ent_id_t id,
@@ -1046,6 +1235,70 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_max_purgeable_routes_
     struct wolfsentry_route_table *table,
     wolfsentry_hitcount_t max_purgeable_routes);
 
+/* the tuple classifier groups routes by wildcard mask and address prefix
+ * lengths into per-tuple hash tables, so that a lookup without wildcards costs
+ * one hash probe per distinct tuple rather than a walk of the table.  it's off
+ * by default.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_tuple_classifier_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    int *enabled);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_tuple_classifier_set(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    int enabled);
+
+/* the flow cache remembers the results of recent dispatch lookups, keyed on
+ * the full traffic tuple and the trigger event, in a set-associative array of
+ * n_entries (rounded up to a power of two).  any change to the table invalidates it wholesale.
+ * n_entries of zero disables it, which is the default.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_flow_cache_get(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    size_t *n_entries,
+    wolfsentry_hitcount_t *hits,
+    wolfsentry_hitcount_t *misses);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_flow_cache_set(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    size_t n_entries);
+
+/* a route image is a read-only, position-independent compilation of the
+ * persistent routes in a table, for sharing one copy of a large static rule
+ * set among processes.  wolfsentry_route_table_image_build() writes the image
+ * into buf, or returns BUFFER_TOO_SMALL with the needed length in *buf_len.
+ * routes with extra ports are refused, and routes that expire are left out.
+ * the caller places the image where it likes (typically a file mapped read-only
+ * into each process, 8-byte aligned), and wolfsentry_route_table_image_attach()
+ * checks it and searches it in place alongside the table, until it's detached
+ * or the table is freed.  the image must stay mapped and unmodified while
+ * attached.  parent events are matched by label in the attaching context.
+ *
+ * image routes are stateless: dispatch sees them like table routes, but they
+ * have no ID (WOLFSENTRY_ENT_ID_NONE is reported for a match), no private data,
+ * and no hit or connection counts, and they aren't visible to
+ * wolfsentry_route_get_reference() or the table iterators.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_build(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    byte *buf,
+    size_t *buf_len);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_attach(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table,
+    const byte *image,
+    size_t image_len);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_image_detach(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_route_table *table);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_stale_purge(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     struct wolfsentry_route_table *table,
@@ -1079,6 +1332,10 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_flags(
     const struct wolfsentry_route *route,
     wolfsentry_route_flags_t *flags);
 
+/* the purge_after reported is the deadline as last filed.  a route hit since
+ * then is retained until last_hit_time plus its route_idle_time_for_purge,
+ * and purge_after catches up when the purger next reaches the route.
+ */
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_metadata(
     const struct wolfsentry_route *route,
     struct wolfsentry_route_metadata_exports *metadata);
@@ -1224,6 +1481,70 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_update_flags(
     wolfsentry_action_flags_t *flags_before,
     wolfsentry_action_flags_t *flags_after);
 
+/* deferred actions.  actions flagged WOLFSENTRY_ACTION_FLAG_DEFERRABLE, on a
+ * context with a deferred action ring, aren't called by dispatch.  instead a
+ * struct wolfsentry_deferred_action is queued, and the handler is later called
+ * by wolfsentry_deferred_actions_drain(), outside the context lock.  this suits
+ * actions that do I/O (logging, notification, metrics) without affecting the
+ * decision.  the ring has multiple producers and a single consumer --
+ * concurrent drain calls return BUSY.
+ *
+ * at drain time, the handler is called with:
+ *   caller_arg: the struct wolfsentry_deferred_action record, not the
+ *     caller_arg passed to dispatch.
+ *   trigger_event and route_table: null.
+ *   trigger_route and rule_route: both point to a stand-in route rebuilt on the
+ *     stack from the record.  it has the record's endpoints, the rule route's
+ *     ID and flags, and no parent event or private data.  it isn't in a table,
+ *     and is valid only for the duration of the call.
+ *   action_results: a copy of the record's action_results, discarded after the
+ *     call.
+ * builtin actions need the live route table, so they can't be made deferrable.
+ */
+
+typedef enum {
+    WOLFSENTRY_DEFERRED_OVERFLOW_DROP = 0, /* drop the record, counting it in n_dropped. */
+    WOLFSENTRY_DEFERRED_OVERFLOW_RUN_INLINE = 1, /* call the handler synchronously, as if not deferrable. */
+    WOLFSENTRY_DEFERRED_OVERFLOW_YIELD_THEN_RUN_INLINE = 2 /* yield up to WOLFSENTRY_DEFERRED_OVERFLOW_MAX_YIELDS times for the drainer to make room, then run inline (at once if single-threaded).  dispatch never blocks indefinitely. */
+} wolfsentry_deferred_overflow_policy_t;
+
+struct wolfsentry_deferred_action {
+    const struct wolfsentry_action *action; /* a reference is held until the record is drained. */
+    wolfsentry_action_type_t action_type;
+    wolfsentry_ent_id_t trigger_event_id;
+    wolfsentry_ent_id_t rule_route_id;
+    wolfsentry_route_flags_t rule_route_flags; /* as of the dispatch. */
+    wolfsentry_action_res_t action_results; /* as of the dispatch. */
+    wolfsentry_time_t when;
+    struct WOLFSENTRY_SOCKADDR_MEMBERS(WOLFSENTRY_MAX_ADDR_BYTES) remote, local; /* from the trigger route, or else the rule route. */
+};
+
+struct wolfsentry_deferred_action_stats {
+    wolfsentry_hitcount_t n_enqueued;
+    wolfsentry_hitcount_t n_drained;
+    wolfsentry_hitcount_t n_dropped;
+    wolfsentry_hitcount_t n_run_inline;
+    wolfsentry_hitcount_t n_handler_errors;
+};
+
+/* capacity must be a power of 2. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_init(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int capacity,
+    wolfsentry_deferred_overflow_policy_t overflow_policy);
+
+/* drains up to max_records records, or all queued records if max_records is
+ * zero.  must be called without the context lock held.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_drain(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int max_records,
+    unsigned int *n_drained);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_deferred_actions_get_stats(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_deferred_action_stats *stats);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_event_insert(
     WOLFSENTRY_CONTEXT_ARGS_IN,
     const char *label,
@@ -1333,6 +1654,173 @@ WOLFSENTRY_API wolfsentry_hitcount_t wolfsentry_table_n_inserts(struct wolfsentr
 
 WOLFSENTRY_API wolfsentry_hitcount_t wolfsentry_table_n_deletes(struct wolfsentry_table_header *table);
 
+/* metrics snapshots.  wolfsentry_metrics_snapshot() copies the context-wide
+ * counters, the hitcounts of every event and action, and the routes with the
+ * most hits, into a single allocation, holding the context lock shared only
+ * for the copy.  the snapshot can then be inspected or rendered at leisure,
+ * and must be released with wolfsentry_metrics_free().
+ */
+
+#ifndef WOLFSENTRY_METRICS_ADDR_TEXT_SIZE
+#define WOLFSENTRY_METRICS_ADDR_TEXT_SIZE 48 /* room for the longest IPv6 presentation. */
+#endif
+
+struct wolfsentry_metrics_ent {
+    wolfsentry_ent_id_t id;
+    wolfsentry_hitcount_t hits;
+    byte label_len;
+    char label[WOLFSENTRY_MAX_LABEL_BYTES + 1];
+};
+
+struct wolfsentry_metrics_route {
+    wolfsentry_ent_id_t id;
+    wolfsentry_hitcount_t hits;
+    wolfsentry_route_flags_t flags;
+    wolfsentry_addr_family_t sa_family;
+    wolfsentry_proto_t sa_proto;
+    wolfsentry_port_t remote_port, local_port;
+    wolfsentry_addr_bits_t remote_prefix_len, local_prefix_len;
+    char remote_addr[WOLFSENTRY_METRICS_ADDR_TEXT_SIZE]; /* empty if the address family has no formatter. */
+    char local_addr[WOLFSENTRY_METRICS_ADDR_TEXT_SIZE];
+};
+
+struct wolfsentry_metrics {
+    wolfsentry_time_t when;
+    wolfsentry_hitcount_t n_dispatches;
+    wolfsentry_hitcount_t n_accepts;
+    wolfsentry_hitcount_t n_rejects;
+    wolfsentry_hitcount_t n_fallthroughs;
+    wolfsentry_hitcount_t n_routes;
+    wolfsentry_hitcount_t n_route_inserts;
+    wolfsentry_hitcount_t n_route_deletes;
+    wolfsentry_hitcount_t n_route_purges;
+    wolfsentry_hitcount_t n_lock_waits; /* always zero in single-threaded builds. */
+    wolfsentry_hitcount_t n_flow_cache_hits;
+    wolfsentry_hitcount_t n_flow_cache_misses;
+    unsigned int n_events;
+    unsigned int n_actions;
+    unsigned int n_top_routes; /* sorted by descending hits. */
+    struct wolfsentry_metrics_ent *events;
+    struct wolfsentry_metrics_ent *actions;
+    struct wolfsentry_metrics_route *top_routes;
+};
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_snapshot(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    unsigned int max_top_routes,
+    struct wolfsentry_metrics **metrics);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_free(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    struct wolfsentry_metrics *metrics);
+
+/* renders the snapshot in the OpenMetrics text exposition format, terminated
+ * by "# EOF" and a NUL.  on entry *buf_len is the size of buf, and on return
+ * it is the length rendered, excluding the NUL.  if buf is too small, returns
+ * BUFFER_TOO_SMALL with *buf_len set to the size needed, including the NUL.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_metrics_render_openmetrics(
+    const struct wolfsentry_metrics *metrics,
+    char *buf,
+    size_t *buf_len);
+
+/* binary snapshots.  wolfsentry_context_save() saves the default eventconfig,
+ * the route table settings, the events with their action lists, the routes
+ * with their metadata and hitcounts, and the user values, in a format that
+ * wolfsentry_context_load() restores far faster than the equivalent JSON
+ * loads, the routes in particular being copied in directly in table order.
+ * a snapshot is only loadable by a library of the same version and build
+ * configuration, with the same route private data layout, and with the
+ * actions it refers to (by label) already in place.
+ *
+ * on entry to wolfsentry_context_save(), *buf_len is the size of buf, and on
+ * return it is the length saved.  if buf is null or too small, returns
+ * BUFFER_TOO_SMALL with *buf_len set to the size needed.
+ *
+ * wolfsentry_context_load() replaces the configuration, events, routes, and
+ * user values of the context wholesale, leaving it untouched on failure.  the
+ * delete actions of the old routes and the insert actions of the new ones are
+ * called.  route IDs are allocated afresh.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_save(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    byte *buf,
+    size_t *buf_len);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_load(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const byte *buf,
+    size_t buf_len);
+
+#ifdef WOLFSENTRY_INSTRUMENT
+
+/* latency instrumentation, built only with WOLFSENTRY_INSTRUMENT.  samples are
+ * kept in log-linear histograms: values below 2^SUB_BUCKET_BITS each have a
+ * bucket of their own, and each power of 2 above that is split into
+ * 2^SUB_BUCKET_BITS linear buckets, bounding the relative error of a bucket to
+ * 1/2^SUB_BUCKET_BITS.  values at or past 2^MAX_VALUE_BITS land in the last
+ * bucket.  times are in nanoseconds.
+ */
+
+#ifndef WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS
+#define WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS 3
+#endif
+#ifndef WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS
+#define WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS 40
+#endif
+#define WOLFSENTRY_HISTOGRAM_BUCKETS ((WOLFSENTRY_HISTOGRAM_MAX_VALUE_BITS - WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS + 1) << WOLFSENTRY_HISTOGRAM_SUB_BUCKET_BITS)
+
+struct wolfsentry_histogram {
+    wolfsentry_hitcount_t count;
+    uint64_t sum;
+    uint64_t max;
+    wolfsentry_hitcount_t buckets[WOLFSENTRY_HISTOGRAM_BUCKETS];
+};
+
+typedef enum {
+    WOLFSENTRY_INSTRUMENT_DISPATCH_TIME = 0, /* wolfsentry_route_event_dispatch*(), from when the context lock is held. */
+    WOLFSENTRY_INSTRUMENT_LOOKUP_TIME, /* route table lookups. */
+    WOLFSENTRY_INSTRUMENT_LOOKUP_COMPARES, /* routes compared per lookup. */
+    WOLFSENTRY_INSTRUMENT_LOCK_WAIT_SHARED, /* blocked time, context lock only. */
+    WOLFSENTRY_INSTRUMENT_LOCK_WAIT_MUTEX,
+    WOLFSENTRY_INSTRUMENT_LOCK_WAIT_UPGRADE,
+    WOLFSENTRY_INSTRUMENT_HISTOGRAM_COUNT
+} wolfsentry_instrument_histogram_t;
+
+/* copies out (folding the per-thread shards) one of the context histograms,
+ * optionally zeroing it.  samples recorded concurrently with a reset may be
+ * lost.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_get_histogram(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    wolfsentry_instrument_histogram_t which,
+    struct wolfsentry_histogram *histogram,
+    int reset_p);
+
+/* same, for the handler time histogram of the action with the given label. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_get_action_histogram(
+    WOLFSENTRY_CONTEXT_ARGS_IN,
+    const char *label,
+    int label_len,
+    struct wolfsentry_histogram *histogram,
+    int reset_p);
+
+/* zeroes all context and action histograms. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_instrument_reset(
+    WOLFSENTRY_CONTEXT_ARGS_IN);
+
+/* the highest value counted in the given bucket. */
+WOLFSENTRY_API uint64_t wolfsentry_histogram_bucket_value(unsigned int bucket);
+
+/* the value at or below which the given share of samples fell, in parts per
+ * million (e.g. 990000 for p99), accurate to the bucket.  zero if empty.
+ */
+WOLFSENTRY_API uint64_t wolfsentry_histogram_percentile(
+    const struct wolfsentry_histogram *histogram,
+    unsigned int parts_per_million);
+
+#endif /* WOLFSENTRY_INSTRUMENT */
+
 #ifdef WOLFSENTRY_HAVE_JSON_DOM
 #include <wolfsentry/centijson_dom.h>
 #endif
@@ -288,6 +288,10 @@ enum wolfsentry_source_id {
     WOLFSENTRY_SOURCE_ID_JSON_JSON_UTIL_C = 9,
     WOLFSENTRY_SOURCE_ID_LWIP_PACKET_FILTER_GLUE_C = 10,
     WOLFSENTRY_SOURCE_ID_ACTION_BUILTINS_C = 11,
+    WOLFSENTRY_SOURCE_ID_SLAB_C     = 12,
+    WOLFSENTRY_SOURCE_ID_METRICS_C  = 13,
+    WOLFSENTRY_SOURCE_ID_INSTRUMENT_C = 14,
+    WOLFSENTRY_SOURCE_ID_SNAPSHOT_C = 15,
 
     WOLFSENTRY_SOURCE_ID_USER_BASE  =  112
 };
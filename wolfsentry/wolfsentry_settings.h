@@ -103,6 +103,15 @@
 
 #define WOLFSENTRY_THREADSAFE
 
+#ifdef WOLFSENTRY_USE_FUTEX_SEMAPHORES
+    #ifndef __linux__
+        #error WOLFSENTRY_USE_FUTEX_SEMAPHORES is only supported on Linux.
+    #endif
+    #ifndef WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
+        #define WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
+    #endif
+#endif
+
 #ifndef WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
     #if defined(__MACH__) || defined(FREERTOS) || defined(_WIN32)
         #define WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
@@ -137,6 +146,10 @@
     #define WOLFSENTRY_MALLOC_BUILTINS
 #endif
 
+#ifndef WOLFSENTRY_NO_SLAB_ALLOCATOR
+    #define WOLFSENTRY_SLAB_ALLOCATOR
+#endif
+
 #ifndef WOLFSENTRY_NO_ERROR_STRINGS
     #define WOLFSENTRY_ERROR_STRINGS
 #endif
@@ -296,6 +309,17 @@ typedef uint16_t wolfsentry_priority_t;
 #include <semaphore.h>
 #endif
 
+#elif defined(WOLFSENTRY_USE_FUTEX_SEMAPHORES)
+
+/* counting semaphores built directly on Linux futexes -- see wolfsentry_util.c. */
+struct wolfsentry_futex_sem {
+    volatile uint32_t count;
+    volatile uint32_t waiters;
+    int futex_private;
+};
+
+#define sem_t struct wolfsentry_futex_sem
+
 #elif defined(__MACH__)
 
 #include <dispatch/dispatch.h>
@@ -57,6 +57,14 @@
 #endif
 #endif
 
+#ifndef WOLFSENTRY_PREFETCH
+#ifdef __GNUC__
+#define WOLFSENTRY_PREFETCH(x) __builtin_prefetch(x)
+#else
+#define WOLFSENTRY_PREFETCH(x) ((void)(x))
+#endif
+#endif
+
 #define streq(vs,fs,vs_len) (((vs_len) == strlen(fs)) && (memcmp(vs,fs,vs_len) == 0))
 #define strcaseeq(vs,fs,vs_len) (((vs_len) == strlen(fs)) && (strncasecmp(vs,fs,vs_len) == 0))
 
@@ -102,6 +110,8 @@
 #define WOLFSENTRY_ATOMIC_POSTDECREMENT(i, x) __atomic_fetch_sub(&(i),x,__ATOMIC_SEQ_CST)
 #define WOLFSENTRY_ATOMIC_STORE(i, x) __atomic_store_n(&(i), x, __ATOMIC_RELEASE)
 #define WOLFSENTRY_ATOMIC_LOAD(i) __atomic_load_n(&(i), __ATOMIC_CONSUME)
+#define WOLFSENTRY_ATOMIC_STORE_RELAXED(i, x) __atomic_store_n(&(i), x, __ATOMIC_RELAXED)
+#define WOLFSENTRY_ATOMIC_LOAD_RELAXED(i) __atomic_load_n(&(i), __ATOMIC_RELAXED)
 
 /* caution, _TEST_AND_SET() alters arg2 (and returns false) on failure. */
 #define WOLFSENTRY_ATOMIC_TEST_AND_SET(i, expected, intended)           \
@@ -150,7 +160,7 @@ do {                                                                    \
 
 #define WOLFSENTRY_ATOMIC_INCREMENT_UNSIGNED_SAFELY(i, x, out)          \
 do {                                                                    \
-    __typeof__(i) _pre_i = (i);                                         \
+    __typeof__(i) _pre_i = WOLFSENTRY_ATOMIC_LOAD_RELAXED(i);           \
     __typeof__(i) _post_i = _pre_i;                                     \
     for (;;) {                                                          \
         if (MAX_UINT_OF(i) - _pre_i < (x)) {                            \
@@ -177,7 +187,7 @@ do {                                                                    \
 
 #define WOLFSENTRY_ATOMIC_DECREMENT_UNSIGNED_SAFELY(i, x, out)          \
 do {                                                                    \
-    __typeof__(i) _pre_i = (i);                                         \
+    __typeof__(i) _pre_i = WOLFSENTRY_ATOMIC_LOAD_RELAXED(i);           \
     __typeof__(i) _post_i = _pre_i;                                     \
     for (;;) {                                                          \
         if (_pre_i < (x)) {                                             \
@@ -212,6 +222,8 @@ do {                                                                    \
 #define WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(i) (--(i))
 #define WOLFSENTRY_ATOMIC_STORE(i, x) ((i)=(x))
 #define WOLFSENTRY_ATOMIC_LOAD(i) (i)
+#define WOLFSENTRY_ATOMIC_STORE_RELAXED(i, x) ((i)=(x))
+#define WOLFSENTRY_ATOMIC_LOAD_RELAXED(i) (i)
 
 #define WOLFSENTRY_ATOMIC_UPDATE_FLAGS(i, set_i, clear_i, pre_i, post_i)\
 do {                                                                    \